@@ -0,0 +1,36 @@
+#pragma once
+
+// Headless measurements of the engine, printed to stdout
+namespace Benchmark
+{
+    // Times the direct sum against the multipole solver on bodyCount random bodies and reports
+    // the relative error of the multipole accelerations for several expansion orders.
+    // The direct reference is only evaluated on sampleCount bodies and its time extrapolated.
+    void GravityAccuracy(int bodyCount, int sampleCount);
+
+    // Throughput of the World spatial queries (ray cast, sphere overlap, k nearest) on bodyCount
+    // random spheres: one at a time, batched on the thread pool, and a linear scan for reference.
+    void SpatialQueries(int bodyCount, int queryCount);
+
+    // Steps worldCount seeded worlds of bodyCount colliding bodies, one after the other and then
+    // as a WorldBatch on the thread pool, and reports steps and body steps per second of each.
+    void WorldBatchThroughput(int worldCount, int bodyCount, int stepCount);
+
+    // Drops particleCount debris particles on a static floor with a few bodies thrown through
+    // them and reports the time per step and particle steps per second. The same debris is then
+    // stepped without the acceleration as particles and as sphere bodies, at most 10000 of them,
+    // for reference.
+    void Particles(int particleCount, int stepCount);
+
+    // Settles a block of side x side x layers boxes, every other layer shifted, and a pile of as
+    // many spheres dropped on a floor, with the impulse and the position based contact solver.
+    // Reports the time per step and, over the second half of the steps, the kinetic energy left,
+    // the fastest body and how far the bodies crept.
+    void Stacking(int side, int layers, int stepCount);
+
+    // Falls bodyCount spheres through air with gravity and quadratic drag, applied once with
+    // AddForce on every body before each step and once as force fields, then with a wind field
+    // over a tenth of the volume added. Reports the time per step of each and the fall speed
+    // reached against the terminal speed.
+    void ForceFields(int bodyCount, int stepCount);
+}
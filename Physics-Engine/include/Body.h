@@ -1,11 +1,14 @@
 #pragma once
 #include <raylib.h>
 #include <raymath.h>
+#include <atomic>
+#include <cstdint>
 #include <vector>
 
 #include "AABB.h"
 
 class World;
+class Snapshot;
 
 // Enumeration for the type of shape
 enum ShapeType
@@ -14,24 +17,92 @@ enum ShapeType
     Box
 };
 
+// Gravity participation of a body (flags, can be combined)
+enum GravityFlags
+{
+    GravityNone = 0,
+    GravitySource = 1 << 0,   // Pulls the receivers
+    GravityReceiver = 1 << 1, // Is pulled by the sources
+    GravitySourceReceiver = GravitySource | GravityReceiver
+};
+
+// Plain description of a body, used for bulk creation and scene files.
+// Fixed size fields only, so an array of them can be written and mapped as is.
+struct BodyDesc
+{
+    int32_t Shape = Sphere;          // ShapeType
+    Vector3 Position = { 0, 0, 0 };
+    Vector3 LinearVelocity = { 0, 0, 0 };
+    Vector3 Size = { 1, 1, 1 };      // Box
+    float Radius = 1.0f;             // Sphere
+    float Density = 1.0f;
+    float Restitution = 0.5f;
+    int32_t IsStatic = 0;
+    int32_t Gravity = GravitySourceReceiver;
+    Color color = WHITE;
+    uint32_t CollisionLayer = 1;           // see Body::CollisionLayer
+    uint32_t CollisionMask = 0xFFFFFFFFu;
+};
+
+// Bodies of a World moved since its last World::UpdateTransforms, each at most once. Bodies push
+// themselves as they move, from whichever thread moves them.
+struct BodyDirtyList
+{
+    std::vector<int> Indices; // one slot per body
+    std::atomic<int> Count{ 0 };
+
+    void Push(int index)
+    {
+        int slot = this->Count.fetch_add(1, std::memory_order_relaxed);
+        if (slot < (int)this->Indices.size()) this->Indices[slot] = index;
+    }
+};
+
 // Class representing a physical body
 class Body
 {
+    friend class Snapshot;
+    friend class World;
+
 private:
     Vector3 _Position; // Position of the body
     Vector3 _LinearVelocity;
+    Quaternion _Orientation; // Orientation of the body
+    Vector3 _AngularVelocity; // Angular velocity in world space (rad/s)
 
     Vector3 force;
+    Vector3 torque;
 
-    std::vector<Vector3> vertices;
-    std::vector<int> Triangles;
-    std::vector<Vector3> transformedVertices;
+    // Rotation matrix of _Orientation, rebuilt once when the orientation changes
+    Matrix rotation = MatrixIdentity();
+    bool rotationUpdateRequired = true;
+
+    std::vector<Vector3> transformedVertices; // world space box vertices, from BoxVertexTemplate
     AABB aabb;
     bool transformUpdateRequired = true;
     bool aabbUpdateRequired = true;
 
+    // Where the body queues itself when it moves. Copies start detached, so a body copied out of
+    // a World never queues into it; the World attaches its bodies again when the list changes.
+    struct DirtyHook
+    {
+        BodyDirtyList* List = nullptr;
+        int Index = 0;
+        bool Queued = false;
+
+        DirtyHook() = default;
+        DirtyHook(const DirtyHook&) {}
+        DirtyHook& operator=(const DirtyHook&)
+        {
+            this->List = nullptr;
+            this->Queued = false;
+            return *this;
+        }
+    };
+    DirtyHook dirtyHook;
+
 public:
-    Model Mesh; // Mesh model of the body
+    Model Mesh = {}; // Mesh model of the body (empty until LoadMesh)
     bool DrawMesh = true;
     Matrix Transformation = MatrixIdentity();
     Color color;
@@ -42,7 +113,16 @@ public:
     float Restitution;
     float Volume;
 
+    // Principal moments of inertia in body space (the shapes are symmetric, so the tensor is diagonal)
+    Vector3 Inertia;
+    Vector3 InvInertia;
+
     bool IsStatic; // Indicates if the body is static
+    int Gravity = GravitySourceReceiver; // GravityFlags of the body
+    // Two bodies are only tested for collision when the layer of each one is in the mask of the
+    // other; the broad phase checks it before any narrow-phase work
+    uint32_t CollisionLayer = 1;
+    uint32_t CollisionMask = 0xFFFFFFFFu;
 
     float Radius; // Radius of the body (for spherical shapes)
     Vector3 Size; // Size of the body (for box shapes)
@@ -58,6 +138,7 @@ public:
     void Position(Vector3 position)
     {
         this->_Position = position;
+        this->MarkMoved();
     }
 
     Vector3 LinearVelocity() const
@@ -70,6 +151,28 @@ public:
         this->_LinearVelocity = vel;
     }
 
+    Quaternion Orientation() const
+    {
+        return this->_Orientation;
+    }
+
+    void Orientation(Quaternion orientation)
+    {
+        this->_Orientation = QuaternionNormalize(orientation);
+        this->rotationUpdateRequired = true;
+        this->MarkMoved();
+    }
+
+    Vector3 AngularVelocity() const
+    {
+        return this->_AngularVelocity;
+    }
+
+    void AngularVelocity(Vector3 vel)
+    {
+        this->_AngularVelocity = vel;
+    }
+
     bool operator==(const Body &otro) const {
         // Aqu defines la lgica de comparacin. Por ejemplo:
         return this == &otro;
@@ -91,22 +194,72 @@ private:
     );
 
     static std::vector<Vector3> CreateBoxVertices(Vector3 size);
-    static std::vector<int> CreateBoxTriangles();
+    static Vector3 CreateSphereInertia(float mass, float radius);
+    static Vector3 CreateBoxInertia(float mass, Vector3 size);
+
+    // Integrates the angular velocity and orientation over time and clears the torque
+    void StepRotation(float time);
+
+    // The transform and AABB need an update; queues the body on the dirty list of its World
+    void MarkMoved()
+    {
+        this->transformUpdateRequired = true;
+        this->aabbUpdateRequired = true;
+        if (this->dirtyHook.List != nullptr && !this->dirtyHook.Queued)
+        {
+            this->dirtyHook.Queued = true;
+            this->dirtyHook.List->Push(this->dirtyHook.Index);
+        }
+    }
 
 public:
     Body() = default;
     ~Body();
-    std::vector<Vector3> GetTransformedVertices();
-    AABB GetAABB();
+    // Declared explicitly: the destructor above would otherwise turn every move into a copy
+    Body(const Body&) = default;
+    Body(Body&&) = default;
+    Body& operator=(const Body&) = default;
+    Body& operator=(Body&&) = default;
+    // Rebuilds the cached world transform (and box vertices) if the body moved since the last update
+    void UpdateTransform();
+    // Cached world transform (rotation + translation) without the mesh scale
+    const Matrix& GetWorldTransform();
+    // Cached world space box vertices, empty for spheres
+    const std::vector<Vector3>& GetTransformedVertices();
+    const AABB& GetAABB();
+    // Heap bytes of the vertex array of the body
+    size_t HeapBytes() const;
+    // Vertices of a box of unit size, 4 per face, shared by every box and never modified.
+    // A box scales them by its Size when its transform is rebuilt.
+    static const std::vector<Vector3>& BoxVertexTemplate();
+    // Semi-implicit Euler step
     void Step(float time, int iterations);
+    // Velocity Verlet halves, around a single force evaluation
+    void KickDrift(float time, Vector3 acceleration);
+    void Kick(float time, Vector3 acceleration);
+    // Sets the state produced by an external integrator (RK) and advances the rotation
+    void StepTo(Vector3 position, Vector3 velocity, float time);
+    // Acceleration due to the forces accumulated with AddForce
+    Vector3 ForceAcceleration() const;
     // Method to move the body by a specific amount
     void Move(Vector3 amount);
     // Method to move the body to a specific position
     void MoveTo(Vector3 position);
     void AddForce(Vector3 amount);
+    // Adds a world space torque, consumed by the next Step
+    void AddTorque(Vector3 amount);
+    // Cached rotation matrix of the current orientation
+    const Matrix& GetRotation();
+    // Applies the world space inverse inertia tensor (R * InvInertia * R^T) to a vector
+    Vector3 ApplyInvInertia(Vector3 v);
+    // Loads a GPU mesh for this body alone; bodies from CreateBody or a snapshot start without one
+    void LoadMesh();
+    // Creates a body from a description without a GPU mesh
+    static bool CreateBody(const BodyDesc& desc, Body* body, const char** error);
     // Static method to create a spherical body
     static bool CreateSphereBody(Vector3 position, float radius, float density, bool isStatic, float restitution, Color color, Body* body, const char** error);
     // Static method to create a box-shaped body
     static bool CreateBoxBody(Vector3 position, Vector3 size, float density, bool isStatic, float restitution, Color color, Body* body, const char** error);
     Matrix GetTransformation(Vector3 scale, Vector3 rotation, Vector3 position);
+    Matrix GetTransformation(Vector3 scale, const Matrix& rotation, Vector3 position);
 };
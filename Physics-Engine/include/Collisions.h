@@ -21,6 +21,13 @@ public:
     static void FindContactPoints(Body& bodyA, Body& bodyB,
         Vector3& contact1, Vector3& contact2, int& contactCount);
 
+    // Punto de contacto entre dos esferas
+    static void FindSpheresContactPoint(const Vector3& centerA, float radiusA,
+        const Vector3& centerB, Vector3& contact);
+
+    // Punto de contacto entre una esfera y una caja orientada
+    static void FindSphereBoxContactPoint(const Vector3& sphereCenter, Body& box, Vector3& contact);
+
     // Colisin entre dos cuerpos en 3D
     static bool Collide(Body& bodyA, Body& bodyB,
         Vector3& normal, float& depth);
@@ -40,7 +47,45 @@ public:
         const Vector3& centerB, float radiusB,
         Vector3& normal, float& depth);
 
+    // Punto de un tringulo ms cercano a p
+    static Vector3 ClosestPointOnTriangle(const Vector3& p, const Vector3& a, const Vector3& b, const Vector3& c);
+
+    // Colisin entre una esfera y un tringulo de una sola cara (la de enfrente, antihoraria); la
+    // normal va del tringulo a la esfera y nunca apunta hacia atrs
+    static bool IntersectSphereTriangle(const Vector3& center, float radius,
+        const Vector3& a, const Vector3& b, const Vector3& c,
+        Vector3& normal, float& depth, Vector3& contact);
+
+    // Colisin entre una caja orientada y un tringulo de una sola cara por SAT (13 ejes); la normal
+    // va del tringulo a la caja, hacia enfrente, y el contacto es el centroide de los vrtices ms
+    // hundidos de la caja, como entre dos cajas
+    static bool IntersectBoxTriangle(Body& box, const Vector3& a, const Vector3& b, const Vector3& c,
+        Vector3& normal, float& depth, Vector3& contact);
+
 private:
+    // Maximo de ejes candidatos por prueba SAT
+    static constexpr int MaxAxes = 32;
+
+    // Holgura para considerar que un vertice toca al otro cuerpo
+    static constexpr float ContactTolerance = 0.01f;
+
+    // Centroide de los vertices de cada poliedro que tocan al otro
+    static bool FindPolygonsContactPoint(const std::vector<Vector3>& verticesA,
+        const std::vector<Vector3>& verticesB, Vector3& contact);
+
+    // Verifica si un punto esta dentro de un poliedro convexo (con holgura)
+    static bool IsPointInsidePolygon(const Vector3& point, const std::vector<Vector3>& vertices,
+        const Vector3* axes, int axisCount);
+
+    // Agrega un eje normalizado si no es nulo ni paralelo a uno existente
+    static int AddAxis(Vector3* axes, int axisCount, Vector3 axis);
+
+    // Normales de las caras (grupos de 4 vertices)
+    static int FindFaceAxes(const std::vector<Vector3>& vertices, Vector3* axes, int axisCount);
+
+    // Direcciones unicas de las aristas
+    static int FindEdgeAxes(const std::vector<Vector3>& vertices, Vector3* axes);
+
     // Proyecta vrtices en un eje en 3D
     static void ProjectVertices(const std::vector<Vector3>& vertices, const Vector3& axis,
         float& min, float& max);
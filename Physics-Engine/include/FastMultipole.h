@@ -0,0 +1,109 @@
+#pragma once
+#include <raylib.h>
+#include <raymath.h>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// Gravity by the fast multipole method.
+// Particles are sorted into an adaptive octree; every cell carries a Cartesian multipole
+// expansion (M, about its center of mass) and a local Taylor expansion (L, about its box
+// center) up to a configurable order. A dual tree traversal pairs well separated cells
+// (M2L) and leaves the rest to direct summation (P2P), which makes the cost O(N).
+class FastMultipole
+{
+public:
+    static constexpr int MinOrder = 1;
+    static constexpr int MaxOrder = 10;
+    static constexpr int MaxDepth = 32;
+
+private:
+    struct Cell
+    {
+        int first;       // First particle (sorted order)
+        int count;       // Number of particles
+        int firstChild;  // Children are contiguous, -1 for leaves
+        int childCount;
+        int level;
+        double center[3]; // Box center
+        double halfSize;
+        double mass;
+        double com[3];    // Expansion center of M
+        double radiusM;   // Farthest particle from com
+        double local[3];  // Expansion center of L (center of the particle bounds)
+        double radiusL;   // Farthest particle from local
+    };
+
+    int order;
+    int termCount;
+    double theta;
+    int leafSize;
+    double softeningSqr;
+
+    // Multi-indices n = (x, y, z) with |n| <= order, sorted by |n|
+    std::vector<int> termX, termY, termZ;
+    std::vector<int> termIndex;      // (x, y, z) -> term
+    std::vector<double> termInvFactorial; // 1 / n!
+    std::vector<double> termSign;    // (-1)^|n|
+    std::vector<int> termPrev1;      // n - e_a along the recurrence axis a
+    std::vector<int> termPrev2;      // n - 2 e_a, or -1
+    std::vector<int> termAxis;
+    std::vector<int> orderEnd;       // number of terms with |n| <= L
+    std::vector<double> binomial;    // binomial[(order + 1) * n + k]
+
+    std::vector<Cell> cells;
+    std::vector<std::vector<int>> levels;
+    std::vector<int> leaves;
+    std::vector<int> sortedIndex;
+    std::vector<int> sortScratch;
+    std::vector<double> px, py, pz, pm;
+    std::vector<double> ax, ay, az;
+    std::vector<double> multipoles;
+    std::vector<double> locals;
+    std::vector<std::vector<int>> m2lList;
+    std::vector<std::vector<int>> p2pList;
+
+public:
+    FastMultipole();
+
+    // theta is the opening angle of the separation test: (rA + rB) < theta * |cA - cB|
+    void Configure(int order, float theta, int leafSize, float softening);
+
+    int GetOrder() const
+    {
+        return this->order;
+    }
+
+    int CellCount() const
+    {
+        return (int)this->cells.size();
+    }
+
+    // Heap bytes held by the expansion tables, the tree and the expansions
+    size_t MemoryBytes() const;
+    // Frees the tree, the particles and the expansions of the last Compute; the tables stay
+    void Clear();
+
+    // a_i = G * sum_j m_j (x_j - x_i) / (|x_j - x_i|^2 + e^2)^(3/2); zero mass particles only receive
+    void Compute(const Vector3* positions, const float* masses, int count, float G,
+        Vector3* accelerations, ThreadPool& pool);
+
+    // Direct O(N * targets) reference with the same kernel, for the given targets only
+    static void ComputeDirect(const Vector3* positions, const float* masses, int count, float G, float softening,
+        const int* targets, int targetCount, Vector3* accelerations, ThreadPool& pool);
+
+private:
+    void BuildTerms();
+    void BuildTree(const Vector3* positions, const float* masses, int count);
+    void SplitCell(int cellIndex, const Vector3* positions);
+    void ComputeCellBounds(Cell& cell);
+    void Interact(int target, int source);
+
+    void ParticleToMultipole(const Cell& cell, double* m) const;
+    void MultipoleToMultipole(const Cell& child, const Cell& parent, const double* mChild, double* m) const;
+    void MultipoleToLocal(const Cell& target, const Cell& source, const double* m, double* l, double* derivatives) const;
+    void LocalToLocal(const Cell& parent, const Cell& child, const double* l, double* lChild) const;
+    void LocalToParticle(const Cell& cell, const double* l, double G);
+    void ParticleToParticle(const Cell& target, const Cell& source, double G);
+    void Powers(double x, double y, double z, double* powX, double* powY, double* powZ) const;
+};
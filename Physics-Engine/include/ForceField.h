@@ -0,0 +1,98 @@
+#pragma once
+#include <raylib.h>
+#include <raymath.h>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "AABB.h"
+#include "ThreadPool.h"
+
+enum ForceFieldType
+{
+    UniformField = 0, // constant acceleration (surface gravity)
+    RadialField,      // acceleration toward Center, away from it with a negative Strength
+    DragField,        // force against the velocity relative to FlowVelocity (air drag, wind)
+    CustomField       // Callback
+};
+
+// Writes the acceleration of count bodies into accelerations, zeroed before the call. Static
+// bodies have an inverse mass of 0, their result is ignored. Called from several threads at once
+// on separate ranges, for the bodies and for the particles.
+using ForceFieldCallback = std::function<void(const Vector3* positions, const Vector3* velocities, const float* invMasses,
+    int count, Vector3* accelerations)>;
+
+// An external force acting on every body and particle inside its region, see World::AddForceField
+struct ForceField
+{
+    ForceFieldType Type = UniformField;
+    bool Bounded = false;         // only acts on the centers inside Bounds
+    AABB Bounds;
+    uint32_t Mask = 0xFFFFFFFFu;  // only acts on the collision layers in it, see Body::CollisionLayer
+
+    Vector3 Acceleration = { 0.0f, -9.81f, 0.0f }; // UniformField
+
+    // RadialField: a = Strength / d^Falloff toward Center, d no shorter than MinDistance
+    Vector3 Center = { 0, 0, 0 };
+    float Strength = 1.0f;
+    float Falloff = 2.0f;
+    float MinDistance = 0.1f;
+
+    // DragField: F = -(Linear + Quadratic |u|) u, u = velocity - FlowVelocity (wind when not zero)
+    Vector3 FlowVelocity = { 0, 0, 0 };
+    float Linear = 0.0f;    // N s/m
+    float Quadratic = 0.0f; // N s^2/m^2
+
+    ForceFieldCallback Callback; // CustomField
+};
+
+// The force fields of a World, applied in one pass over state arrays (positions, velocities,
+// inverse masses) instead of one AddForce call per body. The arrays are split in chunks on the
+// thread pool; a chunk is bounded first, so a bounded field skips the chunks it does not overlap,
+// and then each field runs over the chunk as one tight loop while it is in cache. Drag is limited
+// to stopping the body relative to the flow within the step, so strong drag on light bodies does
+// not reverse their velocity.
+class ForceFields
+{
+public:
+    static constexpr int Chunk = 256; // bodies per task
+
+private:
+    std::vector<ForceField> fields;
+
+public:
+    // Returns the index of the field, or -1 when its settings are invalid (inverted bounds,
+    // negative drag, MinDistance <= 0, a CustomField without callback)
+    int Add(const ForceField& field);
+    // Later fields move down one index
+    bool Remove(int index);
+    void Clear()
+    {
+        this->fields.clear();
+    }
+
+    int Count() const
+    {
+        return (int)this->fields.size();
+    }
+
+    // Editable between steps; a change is not validated again
+    ForceField* Get(int index)
+    {
+        return index >= 0 && index < (int)this->fields.size() ? &this->fields[index] : nullptr;
+    }
+
+    // Acceleration of every field on count bodies over a step of time seconds, written to
+    // accelerations. layers holds one collision layer per body, or nullptr when they all share
+    // layer. Bodies with an inverse mass of 0 get none.
+    void Apply(const Vector3* positions, const Vector3* velocities, const float* invMasses, const uint32_t* layers, uint32_t layer,
+        int count, float time, Vector3* accelerations, ThreadPool& pool) const;
+
+    size_t MemoryBytes() const;
+
+private:
+    static bool Valid(const ForceField& field);
+    // Adds one field to the bodies [begin, end)
+    static void ApplyField(const ForceField& field, const Vector3* positions, const Vector3* velocities, const float* invMasses,
+        const uint32_t* layers, uint32_t layer, int begin, int end, float time, Vector3* accelerations);
+};
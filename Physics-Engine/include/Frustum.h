@@ -0,0 +1,26 @@
+#pragma once
+#include <raylib.h>
+#include <raymath.h>
+
+#include "AABB.h"
+
+enum CullResult
+{
+    CullOutside = 0,
+    CullIntersect, // partly inside, the contents have to be tested one by one
+    CullInside
+};
+
+// View frustum as six planes (a, b, c, d) with normals pointing inwards: a x + b y + c z + d >= 0 inside
+struct Frustum
+{
+    Vector4 Planes[6];
+
+    // Planes of a projection * view matrix (Gribb-Hartmann)
+    static Frustum FromMatrix(const Matrix& viewProjection);
+    // Frustum BeginMode3D renders with, for a target of the given width / height
+    static Frustum FromCamera(const Camera& camera, float aspect, float nearPlane, float farPlane);
+
+    CullResult TestAABB(const AABB& box) const;
+    bool ContainsSphere(Vector3 center, float radius) const;
+};
@@ -0,0 +1,116 @@
+#pragma once
+#include <raylib.h>
+#include <raymath.h>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "AABB.h"
+
+// Broad phase over a stack of uniform grids whose cell size doubles from one level to the next.
+// Every body goes to the finest level whose cells are at least twice as large as its AABB, so it
+// overlaps at most 2 x 2 x 2 cells there whatever its size. Pairs are found inside the cells of
+// each level and by looking every body up in the coarser levels in use.
+//
+// The grid is incremental: Build inserts every body once, Update only revisits the dynamic bodies
+// whose AABB changed, moves them between cells when their cell range changes and replaces the
+// cached pairs of those bodies. Static bodies are never revisited, so their cost is paid once.
+class HierarchicalGrid
+{
+public:
+    static constexpr int MaxLevels = 16;
+    // Bodies spanning more cells per axis than this on the coarsest level are tested against
+    // every body instead (only with a fixed cell size far below their size)
+    static constexpr int MaxSpan = 4;
+
+private:
+    static constexpr int Oversized = MaxLevels; // level of the bodies tested against everything
+
+    struct Cell
+    {
+        uint64_t Key;
+        std::vector<int> Bodies; // emptied cells stay until the next rebuild
+    };
+
+    struct Record
+    {
+        int Level = 0;
+        int Min[3] = {};
+        int Max[3] = {};
+        int LevelSlot = 0; // position in levelBodies[Level]
+        bool Dynamic = false;
+    };
+
+    float cellSize = 1.0f; // level 0
+    float inverseSize[MaxLevels];
+
+    std::vector<AABB> bounds;
+    std::vector<Record> records;
+    std::vector<int> levelBodies[MaxLevels + 1];
+    std::vector<Cell> cells;
+    int liveCells = 0;
+    std::vector<int> table; // cell index per slot, -1 for empty slots
+    std::vector<std::pair<int, int>> pairs;
+    std::vector<uint8_t> moved;
+    std::vector<int> movedList;
+    std::vector<float> extents; // FitCellSize scratch
+
+public:
+    HierarchicalGrid();
+
+    // Cell size of level 0, level l has cells of size * 2^l. Takes effect on the next Build.
+    void SetCellSize(float size);
+    // Sets the cell size of level 0 from body size statistics: twice the median of the largest
+    // AABB side, rounded up to a power of two so it only moves when the scene changes noticeably
+    void FitCellSize(const AABB* bounds, int count);
+
+    float CellSize(int level = 0) const
+    {
+        return 1.0f / this->inverseSize[level];
+    }
+
+    // Cells holding at least one body
+    int CellCount() const
+    {
+        return this->liveCells;
+    }
+
+    // Number of levels from 0 up to the coarsest one holding bodies
+    int LevelCount() const;
+
+    // Heap bytes held by the cells, body records and pairs
+    size_t MemoryBytes() const;
+    // Frees every cell, record and pair; Build has to run again before the next Update
+    void Clear();
+
+    // Every pair of bodies whose AABBs overlapped at the last Build / Update, as (lower index,
+    // higher index), in no particular order. Pairs of two static bodies are left out.
+    const std::vector<std::pair<int, int>>& Pairs() const
+    {
+        return this->pairs;
+    }
+
+    // Inserts every body; the bodies listed in dynamic are the ones Update may move
+    void Build(const AABB* bounds, int count, const int* dynamic, int dynamicCount);
+    // New bounds of the dynamic bodies (bounds holds every body, only dynamic[i] are read)
+    void Update(const AABB* bounds, const int* dynamic, int dynamicCount);
+
+private:
+    static uint64_t CellKey(int level, int x, int y, int z);
+    int CellCoordinate(float value, int level) const;
+    uint64_t PointKey(Vector3 point, int level) const;
+    // Index of the cell, -1 when there is none
+    int FindCell(uint64_t key) const;
+    int AddCell(uint64_t key);
+    void Rehash(size_t capacity);
+
+    Record Locate(const AABB& box) const;
+    void Insert(int body);
+    void Erase(int body);
+    void Rebuild();
+    // Pairs from scratch: inside the cells, then every body against the coarser levels
+    void FindAllPairs();
+    // Appends the pairs of one moved body against every level
+    void FindBodyPairs(int body);
+    void AddPair(int a, int b);
+};
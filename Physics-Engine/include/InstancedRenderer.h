@@ -0,0 +1,87 @@
+#pragma once
+#include <raylib.h>
+#include <raymath.h>
+#include <vector>
+
+#include "Body.h"
+
+// Draws bodies that do not own a mesh with one shared unit mesh per ShapeType and one instanced
+// draw call per mesh. Every instance carries its model matrix (scale * world transform) and its
+// color; the shader reads them from the instanceTransform / instanceColor attributes when the
+// "instanced" uniform is 1 (see resources/shaders/glsl330/lighting.vert).
+// Shaders without those attributes (GLSL 100) fall back to one DrawMesh per body.
+// Spheres come in SphereLodCount levels of detail, picked by their apparent size (radius / distance).
+class InstancedRenderer
+{
+public:
+    static constexpr int SphereLodCount = 3;
+    static constexpr int BatchCount = SphereLodCount + 1; // sphere levels, then boxes
+
+private:
+    // Per-instance vertex data, column major like OpenGL expects
+    struct Instance
+    {
+        float transform[16];
+        float color[4];
+    };
+
+    struct Batch
+    {
+        Mesh mesh = {};
+        std::vector<Instance> instances;
+        unsigned int buffer = 0; // instance VBO, kept between frames
+        int bufferCapacity = 0;  // instances
+    };
+
+    Batch batches[BatchCount];
+    float lodThresholds[SphereLodCount - 1] = { 0.02f, 0.005f }; // radius / distance above which a level is used
+    Material material = {};
+    int transformLocation = -1;
+    int colorLocation = -1;
+    int instancedLocation = -1;
+    int drawCalls = 0;
+    bool loaded = false;
+
+public:
+    InstancedRenderer() = default;
+    ~InstancedRenderer();
+
+    InstancedRenderer(const InstancedRenderer&) = delete;
+    InstancedRenderer& operator=(const InstancedRenderer&) = delete;
+
+    // Needs a GL context; the shared meshes are created here
+    void Load(Shader shader);
+    void Unload();
+
+    // Collects the bodies to draw: visible (DrawMesh) and without a mesh of their own, at full detail
+    void Build(std::vector<Body>& bodies);
+    // Same, limited to the given body indices (e.g. World::CullBodies), spheres at the level of detail
+    // their distance to eye calls for
+    void Build(std::vector<Body>& bodies, const int* indices, int count, Vector3 eye);
+
+    // Apparent sizes (radius / distance) below which spheres switch to the next coarser level,
+    // decreasing. 0.02 is about a 10 pixel radius with a 60 degree field of view at 600 pixels.
+    void SetSphereLod(float medium, float low);
+
+    // Inside BeginMode3D
+    void Draw();
+
+    int InstanceCount(ShapeType shape) const;
+
+    // Spheres drawn at a level of detail, 0 being the finest
+    int SphereLodInstanceCount(int lod) const
+    {
+        return (int)this->batches[lod].instances.size();
+    }
+
+    // Draw calls issued by the last Draw
+    int DrawCallCount() const
+    {
+        return this->drawCalls;
+    }
+
+private:
+    void AddInstance(Body& body, int batch);
+    int SphereLod(const Body& body, Vector3 eye) const;
+    void DrawBatch(Batch& batch);
+};
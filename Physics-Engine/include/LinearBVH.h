@@ -0,0 +1,83 @@
+#pragma once
+#include <raylib.h>
+#include <raymath.h>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "AABB.h"
+#include "ThreadPool.h"
+
+// Broad phase that rebuilds a linear bounding volume hierarchy from scratch on every call.
+// The AABB centers are turned into 30 bit Morton codes over the bounds of all centers and
+// radix sorted, which places nearby bodies next to each other. The tree over the sorted bodies
+// is then built in O(N) following Karras ("Maximizing parallelism in the construction of BVHs,
+// octrees and k-d trees", 2012): every inner node finds its own range and split from the codes
+// alone, so all of them are built at once, and the bounds are filled bottom-up with one thread
+// per leaf, where the second child to arrive at a node computes it. Pairs are found by walking
+// the tree once per body, again in parallel. Every stage runs on the thread pool and nothing is
+// kept between calls, so it suits scenes where most bodies move every step.
+class LinearBVH
+{
+public:
+    static constexpr int RadixBits = 10;   // three passes over the 30 bit codes
+    static constexpr int MaxDepth = 64;    // codes are unique 64 bit keys, see keys
+
+private:
+    struct Node
+    {
+        Vector3 Min;
+        int Left;  // inner node index, or ~leaf for a leaf
+        Vector3 Max;
+        int Right;
+    };
+
+    // Morton code in the high 32 bits, body index in the low ones: unique, so the tree needs no
+    // special case for bodies with the same code
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> sortScratch;
+    std::vector<int> histograms; // (1 << RadixBits) counters per sort chunk
+
+    std::vector<Node> nodes;     // count - 1 inner nodes, node 0 is the root
+    std::vector<int> nodeParent;
+    std::vector<int> nodeLast;   // highest dynamic leaf below the node, INT_MAX with a static leaf
+    std::vector<int> visits;     // bottom-up pass: children that reached the node
+    std::vector<AABB> leafBounds; // in sorted order
+    std::vector<int> leafBody;
+    std::vector<int> leafParent;
+    std::vector<uint8_t> leafStatic;
+
+    std::vector<std::vector<std::pair<int, int>>> chunkPairs;
+    std::vector<std::pair<int, int>> pairs;
+
+public:
+    // Builds the tree over count bodies and finds every pair whose AABBs overlap.
+    // isStatic (one flag per body) keeps pairs of two static bodies out.
+    void Build(const AABB* bounds, const uint8_t* isStatic, int count, ThreadPool& pool);
+
+    // Pairs of the last Build as (lower index, higher index). The order only depends on the
+    // bounds, not on the number of threads.
+    const std::vector<std::pair<int, int>>& Pairs() const
+    {
+        return this->pairs;
+    }
+
+    int NodeCount() const
+    {
+        return (int)this->nodes.size();
+    }
+
+    // Heap bytes held by the tree, the sort buffers and the pairs
+    size_t MemoryBytes() const;
+    // Frees the tree and the pairs, until the next Build
+    void Clear();
+
+private:
+    void SortKeys(int count, ThreadPool& pool);
+    // Children and range of inner node i (Karras, section 4)
+    void BuildNode(int i, int count);
+    // Walks up from a leaf, computing the bounds of every node it is the second to reach
+    void Refit(int leaf);
+    void FindLeafPairs(int leaf, std::vector<std::pair<int, int>>& out) const;
+    int CommonPrefix(int i, int j, int count) const;
+};
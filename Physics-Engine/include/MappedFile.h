@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+
+// Read-only memory mapping of a whole file (mmap / MapViewOfFile).
+// Kept apart from raylib on purpose: windows.h and raylib.h cannot share a translation unit.
+class MappedFile
+{
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#if defined(_WIN32)
+    void* file = nullptr;
+    void* mapping = nullptr;
+#else
+    int file = -1;
+#endif
+
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const char* path, const char** error);
+    void Close();
+
+    const unsigned char* Data() const
+    {
+        return this->data;
+    }
+
+    size_t Size() const
+    {
+        return this->size;
+    }
+};
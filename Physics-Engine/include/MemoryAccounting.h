@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Helpers for the MemoryBytes / Clear methods behind World::MemoryUsage and World::Compact.
+// Sizes are capacities: memory held, whether it is in use or not.
+
+template <typename T>
+size_t VectorBytes(const std::vector<T>& v)
+{
+    return v.capacity() * sizeof(T);
+}
+
+template <typename T>
+size_t VectorBytes(const std::vector<std::vector<T>>& v)
+{
+    size_t bytes = v.capacity() * sizeof(std::vector<T>);
+    for (const std::vector<T>& inner : v)
+    {
+        bytes += inner.capacity() * sizeof(T);
+    }
+    return bytes;
+}
+
+// Empties v and gives its memory back (clear alone keeps the capacity)
+template <typename T>
+void ReleaseVector(std::vector<T>& v)
+{
+    std::vector<T>().swap(v);
+}
+
+// Drops the elements past size and the spare capacity, keeping the rest
+template <typename T>
+void ShrinkVector(std::vector<T>& v, size_t size)
+{
+    if (v.size() > size)
+    {
+        v.resize(size);
+    }
+    v.shrink_to_fit();
+}
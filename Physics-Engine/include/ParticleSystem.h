@@ -0,0 +1,139 @@
+#pragma once
+#include <raylib.h>
+#include <raymath.h>
+#include <cstdint>
+#include <vector>
+
+#include "AABB.h"
+#include "Body.h"
+#include "ThreadPool.h"
+#include "TriangleMesh.h"
+
+// Settings shared by every particle of a ParticleSystem
+struct ParticleConfig
+{
+    float Density = 1.0f;
+    float Restitution = 0.3f;          // against bodies and meshes the lower of the two is used
+    Vector3 Acceleration = { 0, 0, 0 }; // uniform acceleration on every particle (surface gravity, wind)
+    bool SelfCollision = true;          // particles collide with each other
+    uint32_t CollisionLayer = 1;        // against bodies and meshes, see Body::CollisionLayer
+    uint32_t CollisionMask = 0xFFFFFFFFu;
+};
+
+// Collision-only spheres for debris in large numbers: no mesh, no rotation, one restitution.
+// The state is kept as separate arrays (position, velocity, radius, inverse mass), 32 bytes a
+// particle and about 100 with the grid, against close to 500 for a Body, and every stage runs
+// on the thread pool.
+//
+// Each sub-step the particles are binned by center in a uniform grid of cells twice the largest
+// radius over their bounds and counting sorted by cell, row by row, so every particle finds its
+// neighbours in the 27 cells around its own, three consecutive cells at a time. The cell index
+// wraps around a table of about two slots per particle, so a sparse cloud still costs O(N).
+// Particle contacts are solved Jacobi style: each particle computes its own correction and
+// impulse from the state before the pass, so the result does not depend on the thread count.
+// Bodies look up the particles of the cells their AABB covers, and their contacts are applied
+// in body order, moving and pushing both the particle and the body.
+class ParticleSystem
+{
+public:
+    static constexpr int MinCells = 1024; // smallest slot table of the grid
+    static constexpr int Chunk = 1024;    // particles per task
+
+private:
+    std::vector<Vector3> positions;
+    std::vector<Vector3> velocities;
+    std::vector<float> radii;
+    std::vector<float> invMasses;
+    ParticleConfig config;
+    float maxRadius = 0.0f;
+
+    // Grid of the last Collide: cell key of every particle and the particles sorted by slot
+    float inverseCellSize = 1.0f;
+    Vector3 origin = { 0, 0, 0 }; // corner of cell (0, 0, 0), the minimum of the bounds
+    int cellCounts[3] = {};       // cells per axis over the bounds
+    std::vector<uint64_t> cellKeys;
+    std::vector<int> slotStart;    // first sorted particle of each slot, one more entry than slots
+    std::vector<int> sortedIndex;  // particle of each sorted position
+    std::vector<uint64_t> sortedKeys;
+    std::vector<Vector3> sortedPositions;
+    std::vector<Vector3> sortedVelocities;
+    std::vector<float> sortedRadii;
+    std::vector<float> sortedInvMasses;
+    AABB bounds;                   // of the particle centers at the last Collide
+
+    struct BodyContact
+    {
+        int Body;
+        int Particle;
+        Vector3 Normal; // from the body to the particle
+        float Depth;
+    };
+    std::vector<int> bodyCandidates;
+    std::vector<std::vector<BodyContact>> chunkContacts;
+
+public:
+    void SetConfig(const ParticleConfig& config);
+    const ParticleConfig& GetConfig() const
+    {
+        return this->config;
+    }
+
+    int Count() const
+    {
+        return (int)this->positions.size();
+    }
+
+    // Appends count particles; velocities may be nullptr for particles at rest.
+    // Nothing is added if a radius is not positive.
+    bool Add(const Vector3* positions, const Vector3* velocities, const float* radii, int count, const char** error);
+    // The last particle takes the index of the removed one
+    bool Remove(int index);
+    void Clear();
+
+    // Editable in place between steps
+    Vector3* Positions()
+    {
+        return this->positions.data();
+    }
+
+    Vector3* Velocities()
+    {
+        return this->velocities.data();
+    }
+
+    const float* Radii() const
+    {
+        return this->radii.data();
+    }
+
+    const float* InvMasses() const
+    {
+        return this->invMasses.data();
+    }
+
+    float Mass(int index) const
+    {
+        return 1.0f / this->invMasses[index];
+    }
+
+    // Semi-implicit Euler step; accelerations holds one entry per particle (gravity), or nullptr
+    void Integrate(float time, const Vector3* accelerations, ThreadPool& pool);
+    // Rebuilds the grid and, with SelfCollision, separates the particles that overlap
+    void Collide(ThreadPool& pool);
+    // Particles against the bodies, through the grid of the last Collide
+    void CollideBodies(std::vector<Body>& bodies, int count, ThreadPool& pool);
+    // Particles against static triangle meshes, each particle on its own
+    void CollideMeshes(const std::vector<TriangleMesh>& meshes, ThreadPool& pool);
+
+    // Heap bytes of the particles and of the grid
+    size_t MemoryBytes() const;
+    // Frees the grid and the contact scratch, until the next Collide
+    void ReleaseScratch();
+
+private:
+    uint64_t CellKey(Vector3 p) const;
+    // Slot of a cell: its row-major index wrapped to the slotStart.size() - 1 slots
+    int CellSlot(int x, int y, int z) const;
+    // Contacts of one body with the particles, appended to out
+    void FindBodyContacts(Body& body, int bodyIndex, std::vector<BodyContact>& out) const;
+};
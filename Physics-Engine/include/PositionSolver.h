@@ -0,0 +1,121 @@
+#pragma once
+#include <raylib.h>
+#include <raymath.h>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "Body.h"
+#include "Manifold.h"
+#include "ThreadPool.h"
+
+// How World resolves the contacts of the bodies
+enum ContactSolver
+{
+    ImpulseSolver = 0, // one projection pass, then one impulse per contact (World::ResolveCollision)
+    PositionBased      // XPBD position constraints relaxed over several passes (PositionSolver)
+};
+
+// Contact solver settings of a World; all but Solver only apply to PositionBased
+struct SolverConfig
+{
+    ContactSolver Solver = ImpulseSolver;
+    int Iterations = 4;           // position passes per sub-step
+    float Compliance = 0.0f;      // inverse contact stiffness in m/N, 0 = rigid
+    float Friction = 0.5f;        // Coulomb coefficient, static and dynamic
+    float RollingFriction = 0.1f; // rolling resistance, as a fraction of the contact lever
+    float RestingSpeed = 0.2f;    // contacts closing slower than this do not bounce
+};
+
+// Extended position based dynamics for contacts (Macklin et al., "XPBD: position-based simulation
+// of compliant constrained dynamics", 2016; Mueller et al., "Detailed rigid body simulation with
+// extended position based dynamics", 2020). Every contact point becomes a constraint that keeps
+// two anchors, fixed in the bodies, from passing each other along the normal. The passes move
+// and turn the bodies directly, so a pile at rest is held by its positions instead of by
+// impulses that have to cancel gravity exactly every sub-step, which is what makes it jitter.
+// Static friction keeps the anchors from sliding relative to the start of the sub-step while
+// the friction cone allows it; the velocities are then taken from the corrections, and one
+// velocity pass adds restitution and dynamic friction.
+//
+// The points of one body pair are solved together, Jacobi style, so a box on its face is pushed
+// out evenly instead of tipping corner by corner. The pairs are colored greedily so no two of a
+// color share a dynamic body, and every color is solved in parallel: Gauss-Seidel between colors,
+// independent within one. The colors only depend on the contact order, so the result does not
+// depend on the thread count.
+class PositionSolver
+{
+public:
+    static constexpr int MaxColors = 32;   // pairs past them go to one last color, solved serially
+    static constexpr int MaxIterations = 64;
+    static constexpr int MaxPoints = 16;   // points of one pair: the corners of two boxes
+    static constexpr int Chunk = 64;       // pairs per task
+    static constexpr float CornerMargin = 0.01f; // box corners this close to the other box get a point
+
+private:
+    // Constraints of one body pair, points[First, First + Count)
+    struct Contact
+    {
+        int BodyA;
+        int BodyB;
+        Vector3 Normal; // from A to B
+        float Restitution;
+        int First;
+        int Count;
+        int Color;
+    };
+
+    struct Point
+    {
+        Vector3 LocalA;      // anchors in body space
+        Vector3 LocalB;
+        float NormalSpeed;   // closing speed along the normal before the passes (negative closes)
+        float Lambda;        // accumulated normal correction (impulse * time)
+        float LambdaTangent; // accumulated static friction correction
+    };
+
+    std::vector<Contact> contacts;
+    std::vector<Point> points;
+    std::vector<Contact> carriedContacts; // kept for the next sub-step (BuildContacts)
+    std::vector<Point> carriedPoints;
+    std::vector<std::pair<int, int>> pairs; // body pairs of the detected contacts, sorted
+    std::vector<int> colorOrder;  // contacts sorted by color
+    std::vector<int> colorStart;  // first entry of each color in colorOrder, one more than colors
+    std::vector<uint32_t> bodyColors; // colors used by each body while coloring
+    std::vector<uint8_t> touched;     // dynamic bodies with a contact this sub-step
+    std::vector<int> touchedList;
+
+    std::vector<Vector3> startPositions; // pose at the start of the sub-step (static friction)
+    std::vector<Quaternion> startOrientations;
+    std::vector<Vector3> solvePositions; // pose before the passes (velocity update)
+    std::vector<Quaternion> solveOrientations;
+
+public:
+    // Records the pose of every body before the sub-step integrates them
+    void BeginSubStep(const std::vector<Body>& bodies, int count);
+
+    // Resolves contacts, which point into bodies, over a sub-step of time seconds: positions,
+    // velocities and spins of the dynamic bodies are updated, static bodies are never moved
+    void Solve(std::vector<Body>& bodies, const std::vector<Manifold>& manifolds, float time, const SolverConfig& config, ThreadPool& pool);
+
+    // Heap bytes of the constraints and the saved poses
+    size_t MemoryBytes() const;
+    // Frees the scratch of the last sub-step; the carried contacts stay
+    void Clear();
+    // Forgets the contacts carried to the next sub-step, for when the body indices change
+    void ClearContacts()
+    {
+        this->carriedContacts.clear();
+        this->carriedPoints.clear();
+    }
+
+private:
+    // Returns how many contacts come from manifolds, the carried ones follow them
+    int BuildContacts(std::vector<Body>& bodies, const std::vector<Manifold>& manifolds);
+    void ColorContacts(int bodyCount);
+    // Runs solve(contact) over every color in order, each color on the pool
+    template <typename Function>
+    void ForEachColor(ThreadPool& pool, Function solve);
+    void SolvePosition(std::vector<Body>& bodies, Contact& contact, float compliance, float friction);
+    void SolveVelocity(std::vector<Body>& bodies, const Contact& contact, float time, float friction, float rollingFriction, float restingSpeed);
+    void UpdateVelocities(std::vector<Body>& bodies, float time);
+};
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Body.h"
+
+class World;
+
+// Scene files: a list of BodyDesc, as text or binary.
+//
+// Text, one body per line ('#' starts a comment):
+//   sphere x y z radius density restitution static r g b a [vx vy vz [gravity [layer mask]]]
+//   box x y z sx sy sz density restitution static r g b a [vx vy vz [gravity [layer mask]]]
+// layer and mask are hexadecimal (0x prefix optional).
+// Binary: Header followed by BodyCount BodyDesc records, mapped and handed to World::AddBodies as is.
+// Version 1 records end before CollisionLayer; they are copied and get the default filter.
+class Scene
+{
+public:
+    static constexpr uint32_t Magic = 0x43534550; // "PESC"
+    static constexpr uint32_t Version = 2;
+
+    struct Header
+    {
+        uint32_t Magic;
+        uint32_t Version;
+        uint32_t HeaderSize; // the records start here
+        uint32_t DescSize;   // sizeof(BodyDesc) of the writer
+        uint64_t BodyCount;
+    };
+
+    // Adds the bodies of a text or binary scene (told apart by the magic) to world
+    static bool Load(World* world, const char* path, const char** error);
+
+    static bool LoadText(const char* path, std::vector<BodyDesc>* bodies, const char** error);
+    static bool SaveText(const char* path, const BodyDesc* bodies, int count, const char** error);
+    static bool SaveBinary(const char* path, const BodyDesc* bodies, int count, const char** error);
+};
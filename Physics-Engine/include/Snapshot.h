@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+
+class World;
+
+// Versioned binary checkpoint of a World.
+//
+// Layout (little endian): Header, then Header::SectionCount Section entries, then the
+// sections themselves, 16 byte aligned. Every section is one per-body array (positions,
+// velocities, ...), so a reader can take a single field without touching the others.
+// Loading maps the file and reads each array in place. Body is stored as an array of structs,
+// so the arrays are still scattered into the bodies, but without parsing or a staging copy.
+class Snapshot
+{
+public:
+    static constexpr uint32_t Magic = 0x4E534550; // "PESN"
+    static constexpr uint32_t Version = 2; // 2 added the contact solver settings
+
+    struct Header
+    {
+        uint32_t Magic;
+        uint32_t Version;
+        uint32_t HeaderSize;   // sizeof(Header) of the writer, the section table follows it
+        uint32_t SectionCount;
+        uint64_t BodyCount;
+
+        // World settings
+        float G;
+        int32_t BroadPhase;
+        float GridNodeSize;
+        int32_t Integrator;
+        float AdaptiveTolerance;
+        float AdaptiveStep;
+        float Softening;
+        float Cutoff;
+        int32_t Solver;
+        int32_t Order;
+        float Theta;
+        int32_t LeafSize;
+
+        // Version 2; version 1 files load with the default contact solver
+        int32_t ContactSolver;
+        int32_t SolverIterations;
+        float Compliance;
+        float Friction;
+        float RollingFriction;
+        float RestingSpeed;
+    };
+
+    struct Section
+    {
+        uint32_t Id;
+        uint32_t Stride; // bytes per body
+        uint64_t Offset; // from the start of the file
+    };
+
+    // SectionShape element
+    struct ShapeRecord
+    {
+        int32_t Type;
+        float Radius;
+        float Size[3];
+    };
+
+    // SectionCollisionFilter element
+    struct CollisionFilterRecord
+    {
+        uint32_t Layer;
+        uint32_t Mask;
+    };
+
+    // SectionFlags bits
+    static constexpr uint32_t FlagStatic = 1 << 0;
+    static constexpr uint32_t GravityShift = 1; // GravityFlags stored in bits 1-2
+
+    enum SectionId : uint32_t
+    {
+        SectionPosition = 1,
+        SectionLinearVelocity,
+        SectionOrientation,
+        SectionAngularVelocity,
+        SectionForce,
+        SectionTorque,
+        SectionShape,
+        SectionMass,
+        SectionDensity,
+        SectionRestitution,
+        SectionFlags,
+        SectionColor,
+        SectionAcceleration, // Velocity Verlet cache, only present while it is valid
+        SectionCollisionFilter, // optional, bodies collide with everything without it
+    };
+
+    // Writes the state of the world to path
+    static bool Save(const World& world, const char* path, const char** error);
+    // Replaces the bodies and settings of world with the snapshot at path.
+    // Without loadMeshes the bodies get no GPU mesh of their own (see Body::LoadMesh),
+    // which also allows loading without a window.
+    static bool Load(World* world, const char* path, bool loadMeshes, const char** error);
+};
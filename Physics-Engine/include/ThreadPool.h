@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that split index ranges between them.
+// The calling thread also takes chunks, so a pool of N threads has N - 1 workers.
+class ThreadPool
+{
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::mutex callMutex; // one ParallelFor at a time; concurrent calls run inline, nested ones never take it
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const std::function<void(int, int)>* job = nullptr;
+    int jobCount = 0;
+    int jobGrain = 1;
+    std::atomic<int> next{ 0 };
+    int active = 0;
+    unsigned int generation = 0;
+    bool stopping = false;
+
+public:
+    // threadCount <= 0 uses every hardware thread
+    explicit ThreadPool(int threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int ThreadCount() const
+    {
+        return (int)this->workers.size() + 1;
+    }
+
+    // Runs fn(begin, end) over [0, count) in chunks of grain indices and waits for all of them
+    void ParallelFor(int count, int grain, const std::function<void(int, int)>& fn);
+
+    // Pool shared by the engine
+    static ThreadPool& Default();
+
+private:
+    void WorkerLoop();
+    void RunChunks(const std::function<void(int, int)>& fn, int count, int grain);
+};
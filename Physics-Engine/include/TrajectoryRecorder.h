@@ -0,0 +1,171 @@
+#pragma once
+#include <raylib.h>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MappedFile.h"
+
+class Body;
+
+// How frames are stored relative to the previous frame of the same chunk
+enum TrajectoryEncoding
+{
+    QuantizedDelta = 0, // values rounded to a fixed precision, zigzag varint of the difference
+    FloatXor            // lossless, varint of the XOR of the float bits
+};
+
+struct RecorderConfig
+{
+    TrajectoryEncoding Encoding = QuantizedDelta;
+    float PositionPrecision = 1e-3f; // QuantizedDelta step, in world units
+    float VelocityPrecision = 1e-3f;
+    int FramesPerChunk = 60;         // every chunk starts with a key frame and is listed in the index
+    int Interval = 1;                // record one of every Interval captures
+};
+
+// Trajectory file layout
+namespace Trajectory
+{
+    static constexpr uint32_t Magic = 0x52544550; // "PETR"
+    static constexpr uint32_t Version = 1;
+
+    struct FileHeader
+    {
+        uint32_t Magic;
+        uint32_t Version;
+        uint32_t Encoding;
+        uint32_t FramesPerChunk;
+        float PositionPrecision;
+        float VelocityPrecision;
+    };
+
+    // Precedes every frame; the varint payload holds px, py, pz, vx, vy, vz, one component at a time
+    struct FrameHeader
+    {
+        uint32_t Bytes; // payload size
+        uint32_t BodyCount;
+        uint32_t KeyFrame; // 1 when the payload does not depend on the previous frame
+        uint32_t Reserved;
+        double Time;
+    };
+
+    struct ChunkEntry
+    {
+        uint64_t Offset; // of the key frame
+        double Time;
+        uint32_t FirstFrame;
+        uint32_t FrameCount;
+    };
+
+    // Last bytes of a closed file
+    struct Footer
+    {
+        uint64_t IndexOffset;
+        uint32_t ChunkCount;
+        uint32_t Magic;
+    };
+}
+
+// Streams body positions and velocities to a file from a background thread.
+// Capture only copies the state into a buffer; encoding and disk writes happen on the writer
+// thread while the simulation continues. With two buffers, a capture only waits when the writer
+// is still busy with the frame before the previous one.
+class TrajectoryRecorder
+{
+private:
+    struct Frame
+    {
+        double time = 0.0;
+        uint32_t bodyCount = 0;
+        std::vector<uint32_t> values; // quantized ints or float bits, component major
+    };
+
+    RecorderConfig config;
+    FILE* file = nullptr;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable consumed;
+    bool stopping = false;
+    bool hasPending = false;
+    bool failed = false;
+
+    Frame capture; // filled by the simulation thread
+    Frame pending; // handed to the writer
+    Frame working; // being encoded by the writer
+
+    int captureCount = 0;
+    int stallCount = 0;
+
+    // Writer thread state
+    std::vector<uint32_t> previous;
+    std::vector<unsigned char> encoded;
+    std::vector<Trajectory::ChunkEntry> chunks;
+    uint64_t fileOffset = 0;
+    uint32_t frameCount = 0;
+
+public:
+    TrajectoryRecorder() = default;
+    ~TrajectoryRecorder();
+
+    TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+    TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+    bool Open(const char* path, const RecorderConfig& config, const char** error);
+    // Flushes the queued frames and writes the chunk index
+    bool Close(const char** error);
+
+    bool IsOpen() const
+    {
+        return this->file != nullptr;
+    }
+
+    // Number of captures that had to wait for the writer
+    int StallCount() const
+    {
+        return this->stallCount;
+    }
+
+    // Queues the state of the bodies at the given simulation time
+    void Capture(const std::vector<Body>& bodies, double time);
+
+private:
+    void WriterLoop();
+    void WriteFrame(const Frame& frame);
+};
+
+// Random access to a recorded trajectory
+class TrajectoryReader
+{
+private:
+    MappedFile file;
+    Trajectory::FileHeader header = {};
+    std::vector<Trajectory::ChunkEntry> chunks;
+    std::vector<uint32_t> values; // last decoded frame
+    uint32_t frameCount = 0;
+    int lastFrame = -1;
+    uint64_t nextOffset = 0; // frame after lastFrame, so sequential reads do not seek
+
+public:
+    // Uses the index of a closed file, or scans the frames of one that was not closed
+    bool Open(const char* path, const char** error);
+
+    int FrameCount() const
+    {
+        return (int)this->frameCount;
+    }
+
+    // Decodes a frame; seeks to the key frame of its chunk and replays the deltas from there
+    bool ReadFrame(int frame, double* time, std::vector<Vector3>* positions, std::vector<Vector3>* velocities,
+        const char** error);
+
+private:
+    // The footer index must list consecutive chunks from frame 0 with key frames inside the
+    // frame data, which ends at end; anything else is treated as an unclosed file
+    bool IndexValid(uint64_t end) const;
+    bool DecodeFrame(uint64_t offset, uint64_t* next, double* time, uint32_t* bodyCount);
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include <raylib.h>
+#include <raymath.h>
+#include <cstdint>
+#include <vector>
+
+#include "AABB.h"
+
+// Static collider made of triangles, for level geometry that never moves (floors, terrain).
+// It does not take part in the broad phase: World tests every dynamic body against the meshes.
+// The triangles are kept in a bounding volume hierarchy built once when the mesh is created,
+// with binned SAH splits: 32 byte nodes in depth-first order (the left child follows its
+// parent) and the triangles of each leaf stored contiguously, so a query walks memory forward.
+class TriangleMesh
+{
+public:
+    static constexpr int LeafSize = 4;
+    static constexpr int MaxDepth = 48;
+
+    struct Triangle
+    {
+        Vector3 A;
+        Vector3 B;
+        Vector3 C;
+    };
+
+    float Restitution = 0.5f;
+    uint32_t CollisionLayer = 1; // see Body::CollisionLayer
+    uint32_t CollisionMask = 0xFFFFFFFFu;
+
+private:
+    struct Node
+    {
+        Vector3 Min;
+        int Offset; // leaves: first triangle, inner nodes: right child (the left one is the next node)
+        Vector3 Max;
+        int Count;  // triangles of a leaf, 0 for inner nodes
+    };
+
+    std::vector<Node> nodes;
+    std::vector<Triangle> triangles;
+
+public:
+    // Triangles from indices into vertices (three per triangle). Degenerate triangles are dropped.
+    static bool Create(const Vector3* vertices, int vertexCount, const int* indices, int indexCount,
+        TriangleMesh* mesh, const char** error);
+    // Triangles of a raylib mesh, indexed or not, placed in the world by transform
+    static bool FromMesh(const Mesh& mesh, Matrix transform, TriangleMesh* result, const char** error);
+
+    int TriangleCount() const
+    {
+        return (int)this->triangles.size();
+    }
+
+    int NodeCount() const
+    {
+        return (int)this->nodes.size();
+    }
+
+    const Triangle& GetTriangle(int index) const
+    {
+        return this->triangles[index];
+    }
+
+    // Heap bytes of the nodes and triangles
+    size_t MemoryBytes() const
+    {
+        return this->nodes.capacity() * sizeof(Node) + this->triangles.capacity() * sizeof(Triangle);
+    }
+
+    AABB Bounds() const
+    {
+        return AABB(this->nodes[0].Min, this->nodes[0].Max);
+    }
+
+    // Calls visit(triangle index) for the triangles of every leaf whose bounds overlap box
+    template <typename Visit>
+    void Query(const AABB& box, Visit visit) const
+    {
+        int stack[MaxDepth + 1];
+        int top = 0;
+        int index = 0;
+
+        while (true)
+        {
+            const Node& node = this->nodes[index];
+
+            if (node.Min.x <= box.Max.x && node.Max.x >= box.Min.x &&
+                node.Min.y <= box.Max.y && node.Max.y >= box.Min.y &&
+                node.Min.z <= box.Max.z && node.Max.z >= box.Min.z)
+            {
+                if (node.Count == 0)
+                {
+                    stack[top++] = node.Offset;
+                    index++;
+                    continue;
+                }
+
+                for (int i = node.Offset; i < node.Offset + node.Count; i++)
+                {
+                    visit(i);
+                }
+            }
+
+            if (top == 0) break;
+            index = stack[--top];
+        }
+    }
+
+private:
+    // Builds the subtree of order[first, first + count) and returns its node
+    int BuildNode(std::vector<int>& order, int first, int count, const std::vector<AABB>& bounds,
+        const std::vector<Vector3>& centroids, int depth);
+};
@@ -1,32 +1,113 @@
 #pragma once
 #include <raylib.h>
 #include <raymath.h>
-#include <map>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
 #include <vector>
 
 #include "Body.h"
 #include "Manifold.h"
 #include "Collisions.h"
+#include "FastMultipole.h"
+#include "ForceField.h"
+#include "Frustum.h"
+#include "HierarchicalGrid.h"
+#include "LinearBVH.h"
+#include "ParticleSystem.h"
+#include "PositionSolver.h"
+#include "TriangleMesh.h"
+
+class TrajectoryRecorder;
 
 enum BroadPhase
 {
     BruteForce = 0,
-    Grid
+    Grid,     // incremental hierarchical grid, best when most bodies rest or are static
+    MortonBVH // linear BVH rebuilt every sub-step on the thread pool, best when most bodies move
 };
 
-class World
+enum GravitySolver
 {
-public:
-    static int TransformCount;
-    static int NoTransformCount;
+    DirectSum = 0, // O(N^2) pairwise sum, honours Cutoff
+    Multipole      // fast multipole method, O(N), ignores Cutoff
+};
 
-    static void AddTransformCount() {
-        TransformCount++;
-    }
-    static void AddNoTransformCount() {
-        NoTransformCount++;
-    }
+// Gravity settings of a World
+struct GravityConfig
+{
+    float Softening = 0.0f; // Plummer softening length, a = G m r / (r^2 + e^2)^(3/2)
+    float Cutoff = 0.0f;    // Sources farther than this are ignored (0 = no cutoff)
+    GravitySolver Solver = DirectSum;
+    int Order = 4;          // Multipole expansion order, higher is more accurate
+    float Theta = 0.5f;     // Multipole opening angle, lower is more accurate
+    int LeafSize = 64;      // Multipole bodies per octree leaf
+};
+
+// Bytes held by a World per subsystem: capacity of its containers, in use or not
+struct MemoryStats
+{
+    size_t Bodies = 0;     // body array and the vertex arrays of every body
+    size_t Contacts = 0;   // manifolds, contact points and contact events
+    size_t BroadPhase = 0; // body AABBs, dirty list, grid, tree and candidate pairs
+    size_t Gravity = 0;    // source lists, cutoff grid and multipole solver
+    size_t Integrator = 0; // per-body state of the integrators and the force fields
+    size_t Queries = 0;    // culling and query cells
+    size_t Meshes = 0;     // static triangle meshes
+    size_t Particles = 0;  // particle state, particle grid and particle gravity
+    size_t Total = 0;
+};
+
+// Capacity limits of a World, 0 = unlimited. Past them the World degrades instead of growing.
+struct MemoryLimits
+{
+    int MaxBodies = 0;        // AddBody, AddBodies and Snapshot::Load fail past it
+    int MaxContacts = 0;      // contacts resolved per sub-step; the deepest ones are kept
+    int MaxContactPoints = 0; // debug contact points kept per Step
+    int MaxParticles = 0;     // AddParticles fails past it
+};
+
+// Time integration scheme used by World::Step
+enum Integrator
+{
+    SemiImplicitEuler = 0, // one force evaluation per sub-step, first order
+    VelocityVerlet,        // kick-drift-kick, one force evaluation per sub-step, symplectic
+    AdaptiveRK             // Bogacki-Shampine 3(2) with error control, three evaluations per accepted step
+};
+
+enum ContactEventType
+{
+    ContactBegin = 0, // the pair touches and did not in the previous Step
+    ContactPersist,   // touched in the previous Step too
+    ContactEnd        // touched in the previous Step and no longer does
+};
 
+// A pair of bodies that touched during a Step (or stopped touching), see World::ContactEvents
+struct ContactEvent
+{
+    ContactEventType Type;
+    int BodyA;      // BodyA < BodyB
+    int BodyB;
+    Vector3 Normal; // from A to B, of the deepest contact of the Step (zero for ContactEnd)
+    float Depth;
+    Vector3 Point;  // a contact point of that contact
+};
+
+// Result of a ray query
+struct RayHit
+{
+    int Body = -1;         // index of the body hit, -1 when nothing was hit
+    float Distance = 0.0f; // along the ray, in world units
+    Vector3 Point = {};
+    Vector3 Normal = {};   // surface normal at Point (minus the direction when the ray starts inside)
+};
+
+class World
+{
+    friend class Snapshot;
+
+public:
     static constexpr float MinBodySize = 0.01f * 0.01f * 0.01f;
     static constexpr float MaxBodySize = 64.0f * 64.0f * 64.0f;
 
@@ -39,15 +120,118 @@ public:
     static constexpr float MinNodeSize = 1;
     static constexpr float MaxNodeSize = 32;
 
+    static constexpr float MinAdaptiveTolerance = 1e-8f;
+    static constexpr float MaxAdaptiveTolerance = 1e-1f;
+    static constexpr int MaxAdaptiveSteps = 4096;
+
 private:
     float G;
     float bodyCount = 0;
     std::vector<Body> bodyList;
     std::vector<Manifold> contactList;
+    std::vector<std::vector<Manifold>> chunkContacts; // detection output per chunk of pairs
+    std::vector<Vector3> corrections; // CorrectPositions: how far each body was moved, zero in between
     std::vector<Vector3> ContactPointsList;
-    std::map<int, std::vector<int>> grid;
+    // AABB of every body, refreshed by UpdateTransforms for the bodies on the dirty list only; the
+    // broad phases and the queries read it instead of the bodies
+    std::vector<AABB> bodyBounds;
+    std::unique_ptr<BodyDirtyList> dirtyBodies = std::make_unique<BodyDirtyList>(); // stable address for the bodies
+    bool dirtyListStale = true; // bodies added, removed or reallocated: every body is attached and refreshed
+    HierarchicalGrid grid;
+    std::vector<int> dynamicList; // bodies that are not static, the only ones the grid revisits
+    bool gridDirty = true; // bodies added or removed or cell size changed, rebuilt at the next Step
+    LinearBVH tree;
+    std::vector<uint8_t> treeStatic;
     BroadPhase broadPhase;
-    float gridNodeSize;
+    float gridNodeSize; // cell size of the finest grid level, 0 = fitted to the bodies
+    double elapsedTime = 0.0; // simulated seconds
+
+    bool deterministic = false;
+    float stateQuantum = 0.0f; // power of two the state is snapped to after each step (0 = off)
+    std::vector<std::pair<int, int>> pairList; // candidate pairs of the brute force and deterministic collision steps
+    std::vector<ContactEvent> stepContacts;     // every contact of the current Step, all sub-steps
+    std::vector<std::pair<int, int>> touchingPairs; // pairs in contact at the end of the last Step, sorted
+    std::vector<std::pair<int, int>> nextTouchingPairs;
+    std::vector<ContactEvent> contactEvents;
+    TrajectoryRecorder* recorder = nullptr;
+
+    std::vector<TriangleMesh> staticMeshes;
+    Body meshBody; // stands in for the meshes in ResolveCollision: static, at rest
+
+    SolverConfig solver;
+    PositionSolver positionSolver;
+    float subStepTime = 0.0f; // length of the current sub-step, for the position solver
+
+    ParticleSystem particles;
+    std::vector<Vector3> particleAccelerations; // gravity of the sources on every particle
+    std::vector<Vector3> particleFieldAccelerations; // of the force fields, plus the gravity when there are sources
+
+    ForceFields forceFields;
+    std::vector<Vector3> fieldAccelerations; // of the force fields on every body, this sub-step
+    std::vector<float> invMassList;
+    std::vector<uint32_t> layerList;
+
+    GravityConfig gravity;
+    std::vector<int> sourceList; // bodies flagged GravitySource, rebuilt per force evaluation
+    std::vector<std::pair<int, int>> gravityCells; // (cell of size Cutoff, source), sorted, rebuilt per force evaluation
+    FastMultipole multipole;
+    std::vector<int> multipoleIndex; // body of every particle handed to the multipole solver
+    std::vector<Vector3> multipolePositions;
+    std::vector<float> multipoleMasses;
+    std::vector<Vector3> multipoleAccelerations;
+
+    // Culling and spatial queries: the bodies are bucketed by center in coarse cells sized for
+    // about QueryCellBodies bodies each; the bodies of a cell are sorted along its longest axis and
+    // split in bricks of QueryBrickSize with tight bounds. Rebuilt on the first query after AddBody
+    // or RemoveBody; after a Step only the bricks of the moved bodies are refit, until the bodies
+    // drifted far enough from their cells that the bricks cover QueryRebuildArea times their area
+    // at the last rebuild.
+    static constexpr int QueryBrickSize = 32;
+    static constexpr int QueryCellBodies = 256;
+    static constexpr float QueryRebuildArea = 2.0f;
+    struct QueryNode
+    {
+        AABB Bounds;
+        int First; // cells: into queryBricks, bricks: into queryIndices / queryBounds
+        int Count;
+    };
+    std::vector<QueryNode> queryCells;
+    std::vector<QueryNode> queryBricks;
+    std::vector<int> queryIndices;
+    std::vector<AABB> queryBounds; // AABB of queryIndices[i], so bodies are only read for exact tests
+    std::vector<std::pair<float, int>> querySort;
+    std::vector<std::pair<uint64_t, int>> queryKeys; // (coarse cell, body), sorted
+    std::vector<int> querySlots;  // index of every body in queryIndices
+    std::vector<int> queryMoved;  // bodies refreshed by UpdateTransforms since the last refit
+    std::vector<int> queryRefit;  // bricks to refit
+    bool queryRefitAll = false;   // too many moved bodies to list, every brick is refit
+    float queryArea = 0.0f;       // summed surface of the bricks
+    float queryBuiltArea = 0.0f;  // the same right after the last rebuild
+    AABB queryWorldBounds;
+    bool queryCellsDirty = true;
+
+    Integrator integrator;
+    float adaptiveTolerance;
+    float adaptiveStep; // last accepted step of the adaptive integrator
+    bool accelerationsValid; // accelerationList holds a(t) for the current positions (Verlet)
+    std::vector<Vector3> positionList;
+    std::vector<Vector3> velocityList;
+    std::vector<Vector3> accelerationList;
+    std::vector<Vector3> externalList; // AddForce contribution, constant over a step
+    // Adaptive RK scratch: stage state and derivatives (dx = v, dv = a)
+    std::vector<Vector3> stagePositionList;
+    std::vector<Vector3> stageVelocityList;
+    std::vector<Vector3> nextPositionList;
+    std::vector<Vector3> nextVelocityList;
+    std::vector<Vector3> stageDx[4];
+    std::vector<Vector3> stageDv[4];
+
+    using StepFunction = void (World::*)(float, int);
+    StepFunction stepFunction; // StepWith of the current broad phase, integrator and solver (SelectStep)
+
+    MemoryLimits memoryLimits;
+    mutable MemoryStats peakMemory; // folded in by MemoryUsage
+    int droppedContacts = 0; // contacts left out by MaxContacts in the current Step
 
 public:
     int BodyCount() const
@@ -55,17 +239,246 @@ public:
         return this->bodyCount;
     }
 
+    double Time() const
+    {
+        return this->elapsedTime;
+    }
+
+    bool IsDeterministic() const
+    {
+        return this->deterministic;
+    }
+
+    BroadPhase GetBroadPhase() const
+    {
+        return this->broadPhase;
+    }
+
+    Integrator GetIntegrator() const
+    {
+        return this->integrator;
+    }
+
+    const GravityConfig& GetGravity() const
+    {
+        return this->gravity;
+    }
+
+    const SolverConfig& GetSolver() const
+    {
+        return this->solver;
+    }
+
     World();
+    void SetGravity(const GravityConfig& config);
+    void SetIntegrator(Integrator integrator);
+    // Relative/absolute error target per adaptive step
+    void SetAdaptiveTolerance(float tolerance);
+    // Cell size of the finest level of the hierarchical grid broad phase. 0 (the default) fits it
+    // to the median body size whenever the grid is rebuilt.
+    // The grid is rebuilt when bodies are added or removed; in between only bodies that are not
+    // static are revisited, so static bodies moved by hand keep their old cells until then.
+    void SetGridNodeSize(float size);
+    void SetBroadPhase(BroadPhase broadPhase);
+    // Deterministic mode: collision pairs are resolved in (indexA, indexB) order, so results only
+    // depend on the state, not on the broad phase or thread count.
+    // With quantum > 0 positions and velocities are also snapped to a power of two grid after each
+    // step, which absorbs last bit differences between compilers and platforms (lockstep clients).
+    void SetDeterministic(bool deterministic, float quantum = 0.0f);
+    // Contact solver of the body pairs. PositionBased (see PositionSolver) holds stacks and piles
+    // at rest where the impulses jitter, for Iterations passes per sub-step; contacts with static
+    // meshes and particles keep using impulses. Settings out of range are clamped.
+    void SetSolver(const SolverConfig& config);
+    // 64 bit hash of the position, orientation and velocities of every body, in body order
+    uint64_t StateHash() const;
+    // Every Step ends with a capture into the recorder (not owned, nullptr to stop)
+    void SetRecorder(TrajectoryRecorder* recorder);
     std::vector<Body>* BodyList() { return &bodyList; }
-    void AddBody(Body body);
+    // Contacts of the last Step, sorted by (BodyA, BodyB): one event per pair that touched at
+    // any sub-step (ContactBegin / ContactPersist) plus one ContactEnd per pair that stopped.
+    // Pairs of a removed body end without an event. Contacts with static meshes are not reported.
+    const std::vector<ContactEvent>& ContactEvents() const
+    {
+        return this->contactEvents;
+    }
+    // False when the body limit is reached
+    bool AddBody(Body body);
+    // Creates count bodies from descriptions in one go, without GPU meshes.
+    // Nothing is added if any description is invalid or the body limit would be passed.
+    bool AddBodies(const BodyDesc* descs, int count, const char** error);
     bool RemoveBody(int index);
     Body *GetBody(int index);
+    // Static triangle mesh collider, tested against every body that is not static after the body
+    // collisions of each sub-step. Returns its index, or -1 for a mesh without triangles.
+    int AddStaticMesh(TriangleMesh mesh);
+    bool RemoveStaticMesh(int index);
+    int StaticMeshCount() const
+    {
+        return (int)this->staticMeshes.size();
+    }
+    const TriangleMesh* GetStaticMesh(int index) const;
+    // Lightweight collision-only spheres (see ParticleSystem), stepped after the bodies in every
+    // sub-step whatever the integrator. They collide with each other, with the bodies, which they
+    // push back, and with the static meshes, and are pulled by the GravitySource bodies without
+    // pulling anything. They are not part of snapshots, StateHash, contact events or queries.
+    // velocities may be nullptr. Fails past MemoryLimits::MaxParticles or on a radius <= 0.
+    bool AddParticles(const Vector3* positions, const Vector3* velocities, const float* radii, int count, const char** error);
+    // The last particle takes the index of the removed one
+    bool RemoveParticle(int index);
+    int ParticleCount() const
+    {
+        return this->particles.Count();
+    }
+    void SetParticleConfig(const ParticleConfig& config);
+    const ParticleConfig& GetParticleConfig() const
+    {
+        return this->particles.GetConfig();
+    }
+    // Particle arrays, editable between steps
+    ParticleSystem* Particles() { return &particles; }
+    // External forces (see ForceField): uniform gravity, attractors, drag and wind, callbacks.
+    // They act on every body that is not static and on the particles, once per sub-step at its
+    // start like the forces of AddForce, whatever the integrator. They are not part of snapshots.
+    // Returns the index of the field, or -1 when its settings are invalid.
+    int AddForceField(const ForceField& field);
+    // Later fields move down one index
+    bool RemoveForceField(int index);
+    int ForceFieldCount() const
+    {
+        return this->forceFields.Count();
+    }
+    // Editable between steps
+    ForceField* GetForceField(int index)
+    {
+        return this->forceFields.Get(index);
+    }
+    // Advances the world by time in iterations sub-steps, with the broad phase, integrator and
+    // contact solver of the settings. They are resolved into a StepWith instantiation when they
+    // change, not per Step.
     void Step(float time, int iterations);
+    // Step with the broad phase, integrator and contact solver fixed at compile time, whatever the
+    // settings: every choice between them is an if constexpr, so a fixed configuration compiles to
+    // one straight step loop. Every combination of the enums is instantiated in World.cpp.
+    template <BroadPhase broadPhase, Integrator integrator, ContactSolver contactSolver>
+    void StepWith(float time, int iterations);
     void ResolveCollision(Manifold* contact);
 
+    void SetMemoryLimits(const MemoryLimits& limits);
+    const MemoryLimits& GetMemoryLimits() const
+    {
+        return this->memoryLimits;
+    }
+    // Bytes held right now, per subsystem
+    MemoryStats MemoryUsage() const;
+    // Largest MemoryUsage of each subsystem since creation or ResetPeakMemory. Sizes are capacities,
+    // which only grow until Compact, RemoveBody, RemoveStaticMesh or Snapshot::Load free them, so
+    // the peaks are sampled there and on these calls instead of after every Step.
+    const MemoryStats& PeakMemoryUsage() const;
+    void ResetPeakMemory();
+    // Contacts left out by MemoryLimits::MaxContacts during the last Step
+    int DroppedContacts() const
+    {
+        return this->droppedContacts;
+    }
+    // Gives back the memory of scratch buffers and caches, which otherwise keep the size of the
+    // largest Step so far (after removing many bodies, or a burst of contacts). The broad phase
+    // and the query cells are rebuilt when next used.
+    void Compact();
+    // Refreshes the cached transform and AABB of the bodies that moved since the last call, which
+    // queued themselves on the dirty list (Body::Move, MoveTo, Step, the setters), on the thread pool
+    void UpdateTransforms();
+    // Bodies whose bounds touch the frustum and come within maxDistance of eye (0 = no limit).
+    // Walks the query cells: cells out of view are skipped whole, cells in view are taken whole
+    // and only bodies of partly visible cells are tested one by one.
+    // Bodies moved outside Step are culled at their position of the last Step until the next one.
+    // Writes up to capacity body indices and returns the number of visible bodies, which is larger
+    // than capacity when the buffer is too small. Does not allocate once warmed up.
+    int CullBodies(const Frustum& frustum, Vector3 eye, float maxDistance, int* indices, int capacity);
+
+    // Spatial queries over the same cells as CullBodies, with exact tests against the body shapes.
+    // maxDistance <= 0 means unbounded. Queries that write a list return the total number of
+    // results, which is larger than capacity when the buffer is too small.
+    // Closest body hit by the ray
+    bool RayCast(Ray ray, float maxDistance, RayHit* hit);
+    // Every body hit by the ray; keeps the capacity closest, sorted by distance
+    int RayCastAll(Ray ray, float maxDistance, RayHit* hits, int capacity);
+    // Bodies whose AABB overlaps the box
+    int OverlapAABB(const AABB& box, int* indices, int capacity);
+    // Bodies whose shape overlaps the sphere
+    int OverlapSphere(Vector3 center, float radius, int* indices, int capacity);
+    // The k bodies with the closest centers, nearest first; returns how many were found (<= k)
+    int NearestBodies(Vector3 point, int k, int* indices, float* distances);
+
+    // Batched queries, split over the default ThreadPool. The world must not change meanwhile.
+    // hits[i] of a ray that hits nothing has Body = -1
+    void RayCastBatch(const Ray* rays, int count, float maxDistance, RayHit* hits);
+    // Query i writes up to capacity indices at indices + i * capacity and its total to counts[i]
+    void OverlapSphereBatch(const Vector3* centers, const float* radii, int count, int* indices, int capacity, int* counts);
+    // k results per point at indices / distances + i * k, padded with -1 / INFINITY
+    void NearestBodiesBatch(const Vector3* points, int count, int k, int* indices, float* distances);
+
 private:
+    // Gravitational acceleration of every body at the given positions
+    void ComputeGravity(const std::vector<Vector3>& positions, std::vector<Vector3>& accelerations);
+    void ComputeGravityMultipole(const std::vector<Vector3>& positions, std::vector<Vector3>& accelerations);
+    // Direct sum over sourceList, or over the gravityCells around each receiver with cutoff
+    template <bool cutoff>
+    void ComputeGravityDirect(const std::vector<Vector3>& positions, std::vector<Vector3>& accelerations);
+    void BuildGravityGrid(const std::vector<Vector3>& positions);
+    static int GravityCellKey(int x, int y, int z);
+    void GatherPositions();
+    // Acceleration of the force fields on every body over a sub-step into fieldAccelerations;
+    // false when there are no fields
+    bool ComputeFieldAccelerations(float time);
+    void IntegrateEuler(float time, int iterations);
+    void IntegrateVerlet(float time);
+    void IntegrateAdaptiveRK(float time);
+    void EvaluateDerivative(const std::vector<Vector3>& positions, const std::vector<Vector3>& velocities,
+        std::vector<Vector3>& dx, std::vector<Vector3>& dv);
+
     void CollisionStepBruteForce();
-    void BuildNodeGrid(int* columns);
-    void CollisionStepGrid(int columns);
-    bool ContactListContainsPair(Body* bodyA, Body* bodyB);
+    // Sizes the cells and inserts every body, when the bodies changed since the last Step
+    void BuildNodeGrid();
+    // Hands the current AABBs of the dynamic bodies to the grid, which updates its pairs
+    void FillNodeGrid();
+    void CollisionStepGrid();
+    // Rebuilds the linear BVH from the current AABBs of every body
+    void FillTree();
+    void CollisionStepTree();
+    // Narrow phase of the candidate pairs in three stages: detection, which only reads the bodies
+    // and runs on the thread pool, then position correction and impulses over the whole contactList
+    void CollidePairs(const std::vector<std::pair<int, int>>& pairs);
+    // Separates the bodies of every contact in contactList order
+    void CorrectPositions();
+    void SelectStep();
+    // Appends the points of a contact to ContactPointsList, up to MaxContactPoints
+    void AddContactPoints(const Manifold& contact);
+    // Brings the query cells up to date with the current AABBs before queries read them
+    void PrepareQueries();
+    void RefreshQueryCells();
+    // Refits the bricks and cells of the bodies on queryMoved, or of every body with queryRefitAll
+    void RefitQueryCells();
+    // Read only, so the batched queries can run them from several threads after PrepareQueries
+    bool QueryRayCast(Ray ray, float maxDistance, RayHit* hit) const;
+    int QueryRayCastAll(Ray ray, float maxDistance, RayHit* hits, int capacity) const;
+    int QueryOverlapSphere(Vector3 center, float radius, int* indices, int capacity) const;
+    int QueryNearest(Vector3 point, int k, int* indices, float* distances) const;
+    // Calls visit(body index) for the bodies whose cached AABB passes overlaps, testing cells and
+    // bricks first
+    template <typename Overlaps, typename Visit>
+    void ForEachQueryBody(Overlaps overlaps, Visit visit) const;
+    void CollisionStepDeterministic(BroadPhase broadPhase);
+    // Bodies against the static meshes: the deepest triangle contact of each body and mesh is
+    // separated and resolved against meshBody
+    void CollisionStepMeshes();
+    // Gravity, integration and collisions of the particles over one sub-step
+    void StepParticles(float time);
+    // Acceleration of every particle due to the GravitySource bodies into particleAccelerations;
+    // false when there are no sources
+    bool ComputeParticleGravity();
+    void SnapState();
+    // Adds the contacts of contactList to stepContacts
+    void RecordContacts();
+    // Turns stepContacts into contactEvents against the pairs of the previous Step
+    void BuildContactEvents();
 };
\ No newline at end of file
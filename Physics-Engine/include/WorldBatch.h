@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "ThreadPool.h"
+#include "World.h"
+
+// Many small independent Worlds stepped together (parameter sweeps, Monte Carlo runs).
+// Each world is one task on the thread pool and stays on it for all the steps of a call, so the
+// worlds run side by side instead of splitting every Step of a single world. On the default pool
+// the parallel loops inside a World run inline on the thread that owns it (ThreadPool::ParallelFor).
+// Worlds share nothing mutable; box bodies share their vertex template (Body::BoxVertexTemplate).
+class WorldBatch
+{
+public:
+    // Fills an empty world from a seed. Called from several threads at once, so it must only
+    // touch the world it is given; bodies are added without GPU meshes (World::AddBodies).
+    using SceneBuilder = std::function<bool(World* world, uint64_t seed, int index, const char** error)>;
+
+    struct Stats
+    {
+        long long Steps = 0;     // World::Step calls, summed over the worlds
+        long long BodySteps = 0; // bodies advanced by those steps
+        double Seconds = 0.0;    // wall clock spent in Step
+    };
+
+private:
+    std::vector<std::unique_ptr<World>> worlds;
+    Stats stats;
+
+public:
+    // Seed of world index: base seed mixed with the index (SplitMix64), so runs with the same base
+    // seed build the same worlds whatever the thread count or world count
+    static uint64_t WorldSeed(uint64_t baseSeed, int index);
+
+    // Replaces the worlds with count new ones built in parallel by build(world, WorldSeed(baseSeed, i), i).
+    // On failure no world is kept and error is the one of the lowest failing index.
+    bool Create(int count, uint64_t baseSeed, const SceneBuilder& build, ThreadPool& pool, const char** error);
+
+    // Calls World::Step(time, iterations) steps times on every world
+    void Step(float time, int iterations, int steps, ThreadPool& pool);
+
+    int WorldCount() const
+    {
+        return (int)this->worlds.size();
+    }
+
+    World* GetWorld(int index)
+    {
+        return this->worlds[index].get();
+    }
+
+    // Totals since Create or ResetStats
+    const Stats& GetStats() const
+    {
+        return this->stats;
+    }
+
+    void ResetStats()
+    {
+        this->stats = Stats();
+    }
+};
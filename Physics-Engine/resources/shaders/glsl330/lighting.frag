@@ -5,6 +5,7 @@ in vec3 fragPosition;
 in vec2 fragTexCoord;
 //in vec4 fragColor;
 in vec3 fragNormal;
+in vec4 fragTint;           // colDiffuse, or the instance color
 
 // Input uniform values
 uniform sampler2D texture0;
@@ -71,8 +72,8 @@ void main()
 		}
 	}
 
-	finalColor = (texelColor*((colDiffuse + vec4(specular, 1.0))*vec4(lightDot, 1.0)));
-	finalColor += texelColor*(ambient/10.0)*colDiffuse;
+	finalColor = (texelColor*((fragTint + vec4(specular, 1.0))*vec4(lightDot, 1.0)));
+	finalColor += texelColor*(ambient/10.0)*fragTint;
 
 	// Gamma correction
 	finalColor = pow(finalColor, vec4(1.0/2.2));
@@ -6,27 +6,50 @@ in vec2 vertexTexCoord;
 in vec3 vertexNormal;
 in vec4 vertexColor;
 
+// Per-instance attributes (InstancedRenderer)
+in mat4 instanceTransform;
+in vec4 instanceColor;
+
 // Input uniform values
 uniform mat4 mvp;
 uniform mat4 matModel;
 uniform mat4 matNormal;
+uniform vec4 colDiffuse;
+uniform int instanced;      // 1: model matrix and color come from the instance attributes, mvp is view*projection
 
 // Output vertex attributes (to fragment shader)
 out vec3 fragPosition;
 out vec2 fragTexCoord;
 out vec4 fragColor;
 out vec3 fragNormal;
+out vec4 fragTint;
 
 // NOTE: Add here your custom variables
 
 void main()
 {
+    if (instanced == 1)
+    {
+        // Instance matrices are rotation * scale, so the normal matrix is the same columns divided by scale^2
+        mat3 model = mat3(instanceTransform);
+        vec3 scaleSqr = vec3(dot(model[0], model[0]), dot(model[1], model[1]), dot(model[2], model[2]));
+
+        fragPosition = vec3(instanceTransform*vec4(vertexPosition, 1.0));
+        fragNormal = normalize(model*(vertexNormal/scaleSqr));
+        fragTint = instanceColor;
+        gl_Position = mvp*vec4(fragPosition, 1.0);
+    }
+    else
+    {
+        fragPosition = vec3(matModel*vec4(vertexPosition, 1.0));
+        fragNormal = normalize(vec3(matNormal*vec4(vertexNormal, 1.0)));
+        fragTint = colDiffuse;
+
+        // Calculate final vertex position
+        gl_Position = mvp*vec4(vertexPosition, 1.0);
+    }
+
     // Send vertex attributes to fragment shader
-    fragPosition = vec3(matModel*vec4(vertexPosition, 1.0));
     fragTexCoord = vertexTexCoord;
     fragColor = vertexColor;
-    fragNormal = normalize(vec3(matNormal*vec4(vertexNormal, 1.0)));
-
-    // Calculate final vertex position
-    gl_Position = mvp*vec4(vertexPosition, 1.0);
 }
@@ -0,0 +1,637 @@
+#include "Benchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "FastMultipole.h"
+#include "World.h"
+#include "WorldBatch.h"
+
+namespace
+{
+    double ElapsedMs(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void PrintThroughput(const char* name, int count, double ms)
+    {
+        printf("  %-24s %10.2f ms  %12.0f queries/s\n", name, ms, count / (ms / 1000.0));
+    }
+}
+
+void Benchmark::GravityAccuracy(int bodyCount, int sampleCount)
+{
+    if (bodyCount < 2) bodyCount = 2;
+    if (sampleCount < 1 || sampleCount > bodyCount) sampleCount = bodyCount;
+
+    const float G = 6.674e-11f;
+    const float softening = 1.0f;
+
+    // Same spread as the demo scene: bodies in a 2000 unit cube with a few heavy ones
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> coordinate(-1000.0f, 1000.0f);
+    std::uniform_real_distribution<float> mass(1e3f, 1e5f);
+
+    std::vector<Vector3> positions(bodyCount);
+    std::vector<float> masses(bodyCount);
+    for (int i = 0; i < bodyCount; i++)
+    {
+        positions[i] = { coordinate(random), coordinate(random), coordinate(random) };
+        masses[i] = i % 1000 == 0 ? 1e10f : mass(random);
+    }
+
+    std::vector<int> targets(sampleCount);
+    for (int i = 0; i < sampleCount; i++)
+    {
+        targets[i] = (int)((long long)i * bodyCount / sampleCount);
+    }
+
+    ThreadPool& pool = ThreadPool::Default();
+    std::vector<Vector3> reference(sampleCount);
+
+    auto start = std::chrono::steady_clock::now();
+    FastMultipole::ComputeDirect(positions.data(), masses.data(), bodyCount, G, softening,
+        targets.data(), sampleCount, reference.data(), pool);
+    double directMs = ElapsedMs(start) * bodyCount / sampleCount;
+
+    printf("Gravity: %d bodies, %d threads, %d sampled targets\n", bodyCount, pool.ThreadCount(), sampleCount);
+    printf("  direct sum   %10.1f ms%s\n", directMs, sampleCount < bodyCount ? " (extrapolated)" : "");
+
+    std::vector<Vector3> accelerations(bodyCount);
+    const int orders[] = { 2, 4, 6, 8 };
+
+    for (int order : orders)
+    {
+        FastMultipole multipole;
+        multipole.Configure(order, 0.5f, 64, softening);
+
+        start = std::chrono::steady_clock::now();
+        multipole.Compute(positions.data(), masses.data(), bodyCount, G, accelerations.data(), pool);
+        double multipoleMs = ElapsedMs(start);
+
+        double errorSqr = 0.0, referenceSqr = 0.0, maxError = 0.0;
+        for (int i = 0; i < sampleCount; i++)
+        {
+            double error = Vector3Length(Vector3Subtract(accelerations[targets[i]], reference[i]));
+            double length = Vector3Length(reference[i]);
+            errorSqr += error * error;
+            referenceSqr += length * length;
+            if (length > 0.0 && error / length > maxError) maxError = error / length;
+        }
+
+        printf("  multipole p=%d %10.1f ms  speedup %6.1fx  rms error %.2e  max error %.2e  (%d cells)\n",
+            order, multipoleMs, directMs / multipoleMs, sqrt(errorSqr / referenceSqr), maxError, multipole.CellCount());
+    }
+}
+
+void Benchmark::SpatialQueries(int bodyCount, int queryCount)
+{
+    if (bodyCount < 1) bodyCount = 1;
+    if (queryCount < 1) queryCount = 1;
+
+    const int k = 8;
+    const float overlapRadius = 50.0f;
+    const int linearCount = queryCount < 500 ? queryCount : 500; // the scans are extrapolated from these
+
+    // Same spread as the demo scene: spheres of radius 1 to 5 in a 2000 unit cube
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> coordinate(-1000.0f, 1000.0f);
+    std::uniform_real_distribution<float> radius(1.0f, 5.0f);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+
+    std::vector<BodyDesc> descs(bodyCount);
+    for (BodyDesc& desc : descs)
+    {
+        desc.Position = { coordinate(random), coordinate(random), coordinate(random) };
+        desc.Radius = radius(random);
+        desc.Density = 15.0f;
+    }
+
+    World world;
+    GravityConfig gravity;
+    gravity.Solver = Multipole;
+    world.SetGravity(gravity);
+
+    const char* error;
+    if (!world.AddBodies(descs.data(), bodyCount, &error))
+    {
+        printf("Spatial queries: %s\n", error);
+        return;
+    }
+    // Queries normally follow a Step
+    world.Step(1.0f / 60.0f, 1);
+
+    std::vector<Ray> rays(queryCount);
+    std::vector<Vector3> points(queryCount);
+    std::vector<float> radii(queryCount, overlapRadius);
+    for (int i = 0; i < queryCount; i++)
+    {
+        points[i] = { coordinate(random), coordinate(random), coordinate(random) };
+        rays[i].position = points[i];
+        rays[i].direction = Vector3Normalize({ normal(random), normal(random), normal(random) });
+    }
+
+    ThreadPool& pool = ThreadPool::Default();
+    std::vector<Body>& bodies = *world.BodyList();
+    printf("Spatial queries: %d bodies, %d queries, %d threads\n", bodyCount, queryCount, pool.ThreadCount());
+
+    // Linear scans over every body, as gameplay code did before
+    std::vector<int> linearRay(linearCount), linearOverlap(linearCount), linearNearest(linearCount);
+    auto start = std::chrono::steady_clock::now();
+    for (int q = 0; q < linearCount; q++)
+    {
+        float best = INFINITY;
+        linearRay[q] = -1;
+        for (int i = 0; i < bodyCount; i++)
+        {
+            // Same stable discriminant as World::RayCast, so the results can be compared exactly
+            Vector3 m = Vector3Subtract(rays[q].position, bodies[i].Position());
+            float b = Vector3DotProduct(m, rays[q].direction);
+            float radiusSqr = bodies[i].Radius * bodies[i].Radius;
+            float c = Vector3DotProduct(m, m) - radiusSqr;
+            Vector3 offset = Vector3Subtract(m, Vector3Scale(rays[q].direction, b));
+            float discriminant = radiusSqr - Vector3DotProduct(offset, offset);
+            if ((c > 0.0f && b > 0.0f) || discriminant < 0.0f) continue;
+            float t = fmaxf(-b - sqrtf(discriminant), 0.0f);
+            if (t < best) { best = t; linearRay[q] = i; }
+        }
+    }
+    double linearRayMs = ElapsedMs(start) * queryCount / linearCount;
+
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < linearCount; q++)
+    {
+        linearOverlap[q] = 0;
+        for (int i = 0; i < bodyCount; i++)
+        {
+            float r = overlapRadius + bodies[i].Radius;
+            if (Vector3DistanceSqr(points[q], bodies[i].Position()) <= r * r) linearOverlap[q]++;
+        }
+    }
+    double linearOverlapMs = ElapsedMs(start) * queryCount / linearCount;
+
+    start = std::chrono::steady_clock::now();
+    std::vector<float> nearestSqr(k);
+    for (int q = 0; q < linearCount; q++)
+    {
+        std::fill(nearestSqr.begin(), nearestSqr.end(), INFINITY);
+        for (int i = 0; i < bodyCount; i++)
+        {
+            float d = Vector3DistanceSqr(points[q], bodies[i].Position());
+            if (d >= nearestSqr[k - 1]) continue;
+            int slot = k - 1;
+            while (slot > 0 && nearestSqr[slot - 1] > d) { nearestSqr[slot] = nearestSqr[slot - 1]; slot--; }
+            nearestSqr[slot] = d;
+        }
+        linearNearest[q] = (int)(sqrtf(nearestSqr[k - 1]) * 1000.0f);
+    }
+    double linearNearestMs = ElapsedMs(start) * queryCount / linearCount;
+
+    // One query at a time
+    std::vector<RayHit> hits(queryCount);
+    std::vector<int> overlapIndices((size_t)queryCount * 64), overlapCounts(queryCount);
+    std::vector<int> nearestIndices((size_t)queryCount * k);
+    std::vector<float> nearestDistances((size_t)queryCount * k);
+
+    world.RayCast(rays[0], 0.0f, &hits[0]); // builds the query cells outside the timings
+
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < queryCount; q++) world.RayCast(rays[q], 0.0f, &hits[q]);
+    double rayMs = ElapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < queryCount; q++) overlapCounts[q] = world.OverlapSphere(points[q], overlapRadius, &overlapIndices[(size_t)q * 64], 64);
+    double overlapMs = ElapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < queryCount; q++) world.NearestBodies(points[q], k, &nearestIndices[(size_t)q * k], &nearestDistances[(size_t)q * k]);
+    double nearestMs = ElapsedMs(start);
+
+    int mismatches = 0;
+    for (int q = 0; q < linearCount; q++)
+    {
+        if (hits[q].Body != linearRay[q]) mismatches++;
+        if (overlapCounts[q] != linearOverlap[q]) mismatches++;
+        if ((int)(nearestDistances[(size_t)q * k + k - 1] * 1000.0f) != linearNearest[q]) mismatches++;
+    }
+
+    // Batched
+    start = std::chrono::steady_clock::now();
+    world.RayCastBatch(rays.data(), queryCount, 0.0f, hits.data());
+    double rayBatchMs = ElapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    world.OverlapSphereBatch(points.data(), radii.data(), queryCount, overlapIndices.data(), 64, overlapCounts.data());
+    double overlapBatchMs = ElapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    world.NearestBodiesBatch(points.data(), queryCount, k, nearestIndices.data(), nearestDistances.data());
+    double nearestBatchMs = ElapsedMs(start);
+
+    PrintThroughput("ray cast, linear scan", queryCount, linearRayMs);
+    PrintThroughput("ray cast", queryCount, rayMs);
+    PrintThroughput("ray cast, batched", queryCount, rayBatchMs);
+    PrintThroughput("overlap r=50, linear", queryCount, linearOverlapMs);
+    PrintThroughput("overlap r=50", queryCount, overlapMs);
+    PrintThroughput("overlap r=50, batched", queryCount, overlapBatchMs);
+    PrintThroughput("8 nearest, linear", queryCount, linearNearestMs);
+    PrintThroughput("8 nearest", queryCount, nearestMs);
+    PrintThroughput("8 nearest, batched", queryCount, nearestBatchMs);
+    printf("  %d of %d checked results differ from the linear scans\n", mismatches, linearCount * 3);
+}
+
+void Benchmark::WorldBatchThroughput(int worldCount, int bodyCount, int stepCount)
+{
+    if (worldCount < 1) worldCount = 1;
+    if (bodyCount < 1) bodyCount = 1;
+    if (stepCount < 1) stepCount = 1;
+
+    // Boxes and spheres thrown at each other in a 40 unit cube, different in every world
+    auto build = [bodyCount](World* world, uint64_t seed, int, const char** error)
+    {
+        std::mt19937_64 random(seed);
+        std::uniform_real_distribution<float> coordinate(-20.0f, 20.0f);
+        std::uniform_real_distribution<float> size(0.5f, 2.0f);
+
+        std::vector<BodyDesc> descs(bodyCount);
+        for (int i = 0; i < bodyCount; i++)
+        {
+            BodyDesc& desc = descs[i];
+            desc.Shape = i % 2 == 0 ? Sphere : Box;
+            desc.Position = { coordinate(random), coordinate(random), coordinate(random) };
+            desc.LinearVelocity = Vector3Scale(desc.Position, -0.25f);
+            desc.Radius = size(random) * 0.5f;
+            desc.Size = { size(random), size(random), size(random) };
+            desc.Gravity = GravityNone;
+        }
+        return world->AddBodies(descs.data(), bodyCount, error);
+    };
+
+    ThreadPool& pool = ThreadPool::Default();
+    const float dt = 1.0f / 60.0f;
+    const char* error;
+    printf("World batch: %d worlds of %d bodies, %d steps, %d threads\n", worldCount, bodyCount, stepCount, pool.ThreadCount());
+
+    // One world after the other, as a serial loop over the worlds would
+    std::vector<uint64_t> serialHashes(worldCount);
+    double serialMs = 0.0;
+    for (int i = 0; i < worldCount; i++)
+    {
+        World world;
+        if (!build(&world, WorldBatch::WorldSeed(1234, i), i, &error))
+        {
+            printf("World batch: %s\n", error);
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int s = 0; s < stepCount; s++) world.Step(dt, 4);
+        serialMs += ElapsedMs(start);
+        serialHashes[i] = world.StateHash();
+    }
+
+    WorldBatch batch;
+    if (!batch.Create(worldCount, 1234, build, pool, &error))
+    {
+        printf("World batch: %s\n", error);
+        return;
+    }
+    batch.Step(dt, 4, stepCount, pool);
+
+    int mismatches = 0;
+    for (int i = 0; i < worldCount; i++)
+    {
+        if (batch.GetWorld(i)->StateHash() != serialHashes[i]) mismatches++;
+    }
+
+    const WorldBatch::Stats& stats = batch.GetStats();
+    double batchMs = stats.Seconds * 1000.0;
+    printf("  %-24s %10.2f ms  %12.0f steps/s  %14.0f body steps/s\n", "one world at a time", serialMs,
+        stats.Steps / (serialMs / 1000.0), stats.BodySteps / (serialMs / 1000.0));
+    printf("  %-24s %10.2f ms  %12.0f steps/s  %14.0f body steps/s\n", "batch", batchMs,
+        stats.Steps / stats.Seconds, stats.BodySteps / stats.Seconds);
+    printf("  %d of %d worlds end in a different state than their serial run\n", mismatches, worldCount);
+}
+
+void Benchmark::Particles(int particleCount, int stepCount)
+{
+    if (particleCount < 1) particleCount = 1;
+    if (stepCount < 1) stepCount = 1;
+
+    const float radius = 0.1f;
+    const float spacing = 0.25f;
+    const float dt = 1.0f / 60.0f;
+    const int iterations = 2;
+
+    // Debris on a cubic lattice above a 200 unit floor, slightly jittered so it does not stack
+    int side = (int)ceilf(cbrtf((float)particleCount));
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> jitter(-0.02f, 0.02f);
+    std::uniform_real_distribution<float> speed(-1.0f, 1.0f);
+
+    std::vector<Vector3> positions(particleCount), velocities(particleCount);
+    std::vector<float> radii(particleCount, radius);
+    for (int i = 0; i < particleCount; i++)
+    {
+        int x = i % side, y = (i / side) % side, z = i / (side * side);
+        positions[i] = { (x - side * 0.5f) * spacing + jitter(random), 1.0f + y * spacing, (z - side * 0.5f) * spacing + jitter(random) };
+        velocities[i] = { speed(random), 0.0f, speed(random) };
+    }
+
+    const Vector3 floorVertices[4] = { { -100, 0, -100 }, { 100, 0, -100 }, { 100, 0, 100 }, { -100, 0, 100 } };
+    const int floorIndices[6] = { 0, 2, 1, 0, 3, 2 };
+    TriangleMesh floor;
+    const char* error;
+    if (!TriangleMesh::Create(floorVertices, 4, floorIndices, 6, &floor, &error))
+    {
+        printf("Particles: %s\n", error);
+        return;
+    }
+
+    // Heavy bodies thrown through the cloud from the sides
+    std::vector<BodyDesc> throwers(32);
+    for (int i = 0; i < (int)throwers.size(); i++)
+    {
+        BodyDesc& desc = throwers[i];
+        float angle = i * 2.0f * PI / throwers.size();
+        desc.Shape = i % 2 == 0 ? Sphere : Box;
+        desc.Position = { cosf(angle) * side * spacing, 1.0f + (i % 4) * side * spacing * 0.25f, sinf(angle) * side * spacing };
+        desc.LinearVelocity = Vector3Scale(desc.Position, -1.0f);
+        desc.LinearVelocity.y = 0.0f;
+        desc.Radius = 0.5f;
+        desc.Size = { 1.0f, 1.0f, 1.0f };
+        desc.Density = 8.0f;
+        desc.Gravity = GravityNone;
+    }
+
+    ParticleConfig config;
+    config.Acceleration = { 0.0f, -9.81f, 0.0f };
+
+    World world;
+    world.AddStaticMesh(floor);
+    world.SetParticleConfig(config);
+    if (!world.AddBodies(throwers.data(), (int)throwers.size(), &error) ||
+        !world.AddParticles(positions.data(), velocities.data(), radii.data(), particleCount, &error))
+    {
+        printf("Particles: %s\n", error);
+        return;
+    }
+
+    ThreadPool& pool = ThreadPool::Default();
+    printf("Particles: %d particles, %d bodies, %d steps of %d sub-steps, %d threads\n", particleCount,
+        (int)throwers.size(), stepCount, iterations, pool.ThreadCount());
+
+    auto start = std::chrono::steady_clock::now();
+    for (int s = 0; s < stepCount; s++) world.Step(dt, iterations);
+    double particleMs = ElapsedMs(start);
+
+    // Particles that ended up under the floor or far from the pile went through something
+    const Vector3* finalPositions = world.Particles()->Positions();
+    int escaped = 0;
+    float lowest = INFINITY;
+    for (int i = 0; i < particleCount; i++)
+    {
+        lowest = fminf(lowest, finalPositions[i].y);
+        if (finalPositions[i].y < 0.0f || fabsf(finalPositions[i].x) > 100.0f || fabsf(finalPositions[i].z) > 100.0f) escaped++;
+    }
+
+    MemoryStats memory = world.MemoryUsage();
+    printf("  %-24s %10.2f ms/step  %14.0f particle steps/s  %6.0f bytes/particle\n", "particles",
+        particleMs / stepCount, (double)particleCount * stepCount / (particleMs / 1000.0), (double)memory.Particles / particleCount);
+    printf("  lowest particle at y = %.3f (radius %.2f), %d below the floor or off it\n", lowest, radius, escaped);
+
+    // The same debris drifting without the uniform acceleration, which bodies do not have, as
+    // particles and as sphere bodies, the way the scenes made debris before
+    int referenceCount = std::min(particleCount, 10000);
+    std::vector<BodyDesc> debris(referenceCount);
+    for (int i = 0; i < referenceCount; i++)
+    {
+        debris[i].Position = positions[i];
+        debris[i].LinearVelocity = velocities[i];
+        debris[i].Radius = radius;
+        debris[i].Gravity = GravityNone;
+    }
+
+    World drifting, reference;
+    drifting.AddStaticMesh(floor);
+    reference.AddStaticMesh(floor);
+    if (!drifting.AddBodies(throwers.data(), (int)throwers.size(), &error) ||
+        !drifting.AddParticles(positions.data(), velocities.data(), radii.data(), referenceCount, &error) ||
+        !reference.AddBodies(throwers.data(), (int)throwers.size(), &error) ||
+        !reference.AddBodies(debris.data(), referenceCount, &error))
+    {
+        printf("Particles: %s\n", error);
+        return;
+    }
+
+    start = std::chrono::steady_clock::now();
+    for (int s = 0; s < stepCount; s++) drifting.Step(dt, iterations);
+    double driftingMs = ElapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int s = 0; s < stepCount; s++) reference.Step(dt, iterations);
+    double bodyMs = ElapsedMs(start);
+
+    printf("  %d drifting debris, no acceleration:\n", referenceCount);
+    printf("  %-24s %10.2f ms/step  %14.0f particle steps/s  %6.0f bytes/particle\n", "as particles",
+        driftingMs / stepCount, (double)referenceCount * stepCount / (driftingMs / 1000.0), (double)drifting.MemoryUsage().Particles / referenceCount);
+    printf("  %-24s %10.2f ms/step  %14.0f body steps/s      %6.0f bytes/body\n", "as sphere bodies",
+        bodyMs / stepCount, (double)referenceCount * stepCount / (bodyMs / 1000.0), (double)reference.MemoryUsage().Bodies / (referenceCount + throwers.size()));
+}
+
+void Benchmark::Stacking(int side, int layers, int stepCount)
+{
+    if (side < 1) side = 1;
+    if (layers < 1) layers = 1;
+    if (stepCount < 2) stepCount = 2;
+
+    const float dt = 1.0f / 60.0f;
+    const int iterations = 4;
+
+    BodyDesc floor;
+    floor.Shape = Box;
+    floor.Position = { 0.0f, -0.5f, 0.0f };
+    floor.Size = { 200.0f, 1.0f, 200.0f };
+    floor.IsStatic = 1;
+    floor.Gravity = GravityNone;
+
+    // Unit boxes 2 cm apart, every other layer shifted by a tenth so the layers interlock
+    std::vector<BodyDesc> block = { floor };
+    for (int y = 0; y < layers; y++)
+    {
+        for (int i = 0; i < side * side; i++)
+        {
+            BodyDesc desc;
+            desc.Shape = Box;
+            desc.Position = { (i % side - side * 0.5f) * 1.02f + (y % 2) * 0.1f, 0.5f + y * 1.02f, (i / side - side * 0.5f) * 1.02f };
+            desc.Restitution = 0.2f;
+            desc.Gravity = GravityNone;
+            block.push_back(desc);
+        }
+    }
+
+    // Spheres of the same count on a jittered lattice, dropped into a pile
+    std::vector<BodyDesc> pile = { floor };
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> jitter(-0.02f, 0.02f);
+    for (int y = 0; y < layers; y++)
+    {
+        for (int i = 0; i < side * side; i++)
+        {
+            BodyDesc desc;
+            desc.Position = { (i % side - side * 0.5f) * 0.55f + jitter(random), 0.5f + y * 0.55f, (i / side - side * 0.5f) * 0.55f + jitter(random) };
+            desc.Radius = 0.25f;
+            desc.Restitution = 0.2f;
+            desc.Gravity = GravityNone;
+            pile.push_back(desc);
+        }
+    }
+
+    printf("Stacking: %d bodies per scene, %d steps of %d sub-steps, %d threads\n", side * side * layers, stepCount,
+        iterations, ThreadPool::Default().ThreadCount());
+
+    const struct { const char* Name; const std::vector<BodyDesc>* Bodies; } scenes[] = { { "boxes", &block }, { "spheres", &pile } };
+    const struct { const char* Name; ContactSolver Solver; } solvers[] = { { "impulse", ImpulseSolver }, { "position based", PositionBased } };
+
+    for (const auto& scene : scenes)
+    {
+        for (const auto& solver : solvers)
+        {
+            World world;
+            SolverConfig config;
+            config.Solver = solver.Solver;
+            world.SetSolver(config);
+            world.SetBroadPhase(Grid);
+            world.AddForceField(ForceField()); // uniform gravity, the default field
+
+            const char* error;
+            if (!world.AddBodies(scene.Bodies->data(), (int)scene.Bodies->size(), &error))
+            {
+                printf("Stacking: %s\n", error);
+                return;
+            }
+
+            std::vector<Vector3> settled;
+            float maxSpeed = 0.0f;
+            double energy = 0.0;
+            auto start = std::chrono::steady_clock::now();
+
+            for (int s = 0; s < stepCount; s++)
+            {
+                world.Step(dt, iterations);
+
+                if (s == stepCount / 2)
+                {
+                    for (int i = 0; i < world.BodyCount(); i++) settled.push_back(world.GetBody(i)->Position());
+                }
+                else if (s > stepCount / 2)
+                {
+                    for (int i = 1; i < world.BodyCount(); i++)
+                    {
+                        Body* body = world.GetBody(i);
+                        float speed = Vector3Length(body->LinearVelocity());
+                        maxSpeed = fmaxf(maxSpeed, speed);
+                        if (s == stepCount - 1) energy += 0.5 * body->Mass * speed * speed;
+                    }
+                }
+            }
+            double ms = ElapsedMs(start);
+
+            float creep = 0.0f;
+            for (int i = 1; i < world.BodyCount() && !settled.empty(); i++)
+            {
+                creep = fmaxf(creep, Vector3Distance(world.GetBody(i)->Position(), settled[i]));
+            }
+
+            char name[64];
+            snprintf(name, sizeof(name), "%s, %s", scene.Name, solver.Name);
+            printf("  %-24s %10.2f ms/step  %10.4f J left  %8.4f m/s fastest  %8.3f m crept\n", name, ms / stepCount,
+                energy, maxSpeed, creep);
+        }
+    }
+}
+
+void Benchmark::ForceFields(int bodyCount, int stepCount)
+{
+    if (bodyCount < 1) bodyCount = 1;
+    if (stepCount < 1) stepCount = 1;
+
+    const float dt = 1.0f / 60.0f;
+    const float g = 9.81f;
+    const float drag = 0.5f; // N s^2/m^2
+
+    // Spheres 3 m apart, so only the forces and the integration are measured
+    int side = (int)ceilf(sqrtf((float)bodyCount));
+    std::vector<BodyDesc> descs(bodyCount);
+    for (int i = 0; i < bodyCount; i++)
+    {
+        descs[i].Position = { (i % side) * 3.0f, 1000.0f, (i / side) * 3.0f };
+        descs[i].Radius = 0.5f;
+        descs[i].Gravity = GravityNone;
+    }
+
+    ForceField gravity;
+    gravity.Acceleration = { 0.0f, -g, 0.0f };
+
+    ForceField air;
+    air.Type = DragField;
+    air.Quadratic = drag;
+
+    ForceField wind = air;
+    wind.FlowVelocity = { 10.0f, 0.0f, 0.0f };
+    wind.Bounded = true;
+    wind.Bounds = AABB({ -1.0f, -INFINITY, -1.0f }, { side * 0.3f, INFINITY, side * 0.3f });
+
+    printf("Force fields: %d bodies, %d steps, %d threads\n", bodyCount, stepCount, ThreadPool::Default().ThreadCount());
+
+    const char* names[] = { "AddForce per body", "gravity and drag fields", "with a wind field" };
+    for (int mode = 0; mode < 3; mode++)
+    {
+        World world;
+        world.SetBroadPhase(Grid);
+
+        const char* error;
+        if (!world.AddBodies(descs.data(), bodyCount, &error))
+        {
+            printf("Force fields: %s\n", error);
+            return;
+        }
+
+        if (mode > 0)
+        {
+            world.AddForceField(gravity);
+            world.AddForceField(air);
+        }
+        if (mode > 1)
+        {
+            world.AddForceField(wind);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int s = 0; s < stepCount; s++)
+        {
+            if (mode == 0)
+            {
+                for (int i = 0; i < world.BodyCount(); i++)
+                {
+                    Body* body = world.GetBody(i);
+                    Vector3 velocity = body->LinearVelocity();
+                    Vector3 force = Vector3Scale(velocity, -drag * Vector3Length(velocity));
+                    force.y -= g * body->Mass;
+                    body->AddForce(force);
+                }
+            }
+            world.Step(dt, 1);
+        }
+        double ms = ElapsedMs(start);
+
+        // Every body is alike, so the last one stands for them; it is outside the wind
+        Body* body = world.GetBody(bodyCount - 1);
+        printf("  %-24s %10.2f ms/step  %8.3f m/s falling, terminal %.3f\n", names[mode], ms / stepCount,
+            -body->LinearVelocity().y, sqrtf(body->Mass * g / drag));
+    }
+}
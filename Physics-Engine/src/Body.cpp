@@ -1,5 +1,4 @@
 #include "Body.h"
-#include "World.h"
 
 // Constructor for the Body class
 Body::Body(
@@ -16,10 +15,11 @@ Body::Body(
 ) {
     this->_Position = position;
     this->_LinearVelocity = Vector3Zero();
-    //this->rotation = 0.0f;
-    //this->rotationalVelocity = 0.0f;
+    this->_Orientation = QuaternionIdentity();
+    this->_AngularVelocity = Vector3Zero();
 
     this->force = Vector3Zero();
+    this->torque = Vector3Zero();
 
     this->Density = density;
     this->Mass = mass;
@@ -32,22 +32,32 @@ Body::Body(
     this->shapeType = shapeType;
     this->color = color;
 
+    if (this->shapeType == Box)
+    {
+        this->Inertia = Body::CreateBoxInertia(this->Mass, this->Size);
+    }
+    else
+    {
+        this->Inertia = Body::CreateSphereInertia(this->Mass, this->Radius);
+    }
+
     if (!this->IsStatic)
     {
         this->InvMass = 1.f / this->Mass;
+        this->InvInertia = { 1.f / this->Inertia.x, 1.f / this->Inertia.y, 1.f / this->Inertia.z };
     }
     else
     {
         this->InvMass = 0.f;
+        this->InvInertia = Vector3Zero();
     }
 
     if (this->shapeType == Box)
     {
-        this->vertices = Body::CreateBoxVertices(this->Size);
-        this->Triangles = Body::CreateBoxTriangles();
-        this->transformedVertices.resize(this->vertices.size());
+        this->transformedVertices.resize(Body::BoxVertexTemplate().size());
     }
 
+    this->rotationUpdateRequired = true;
     this->transformUpdateRequired = true;
     this->aabbUpdateRequired = true;
 }
@@ -66,7 +76,7 @@ std::vector<Vector3> Body::CreateBoxVertices(Vector3 size)
     float back = front + size.z;
 
     std::vector<Vector3> vertices;
-    vertices.resize(23);
+    vertices.resize(24);
 
     // Vrtices en orden antihorario (mirando desde afuera) para cada cara:
     vertices[0] = { left, top, front };      // Cara frontal
@@ -102,27 +112,100 @@ std::vector<Vector3> Body::CreateBoxVertices(Vector3 size)
     return vertices;
 }
 
-std::vector<int> Body::CreateBoxTriangles() {
-    return { 0, 1, 2, 0, 2, 3 }; // Inicializacin directa
+const std::vector<Vector3>& Body::BoxVertexTemplate()
+{
+    static const std::vector<Vector3> vertices = Body::CreateBoxVertices({ 1.0f, 1.0f, 1.0f });
+    return vertices;
 }
 
-std::vector<Vector3> Body::GetTransformedVertices()
+// Solid sphere: I = 2/5 * m * r^2 on every axis
+Vector3 Body::CreateSphereInertia(float mass, float radius)
 {
-    if (this->transformUpdateRequired)
+    float i = 0.4f * mass * radius * radius;
+    return { i, i, i };
+}
+
+// Solid box: I = m/12 * (b^2 + c^2) for each principal axis
+Vector3 Body::CreateBoxInertia(float mass, Vector3 size)
+{
+    float k = mass / 12.f;
+    return {
+        k * (size.y * size.y + size.z * size.z),
+        k * (size.x * size.x + size.z * size.z),
+        k * (size.x * size.x + size.y * size.y)
+    };
+}
+
+const Matrix& Body::GetRotation()
+{
+    if (this->rotationUpdateRequired)
     {
-        for (int i = 0; i < vertices.size(); i++)
-        {
-            Vector3 v = this->vertices[i];
-            this->transformedVertices[i] = Vector3Transform(v, GetTransformation({ 1, 1, 1 }, { 0, 0, 0 }, this->_Position));
-            //this->transformedVertices[i] = v;
-        }
+        this->rotation = QuaternionToMatrix(this->_Orientation);
+        this->rotationUpdateRequired = false;
+    }
+
+    return this->rotation;
+}
+
+Vector3 Body::ApplyInvInertia(Vector3 v)
+{
+    if (this->IsStatic)
+    {
+        return Vector3Zero();
+    }
+
+    // Rotate into body space, scale by the principal inverse moments and rotate back
+    const Matrix& r = this->GetRotation();
+    Vector3 local = {
+        r.m0 * v.x + r.m1 * v.y + r.m2 * v.z,
+        r.m4 * v.x + r.m5 * v.y + r.m6 * v.z,
+        r.m8 * v.x + r.m9 * v.y + r.m10 * v.z
+    };
+    local = Vector3Multiply(local, this->InvInertia);
+    return {
+        r.m0 * local.x + r.m4 * local.y + r.m8 * local.z,
+        r.m1 * local.x + r.m5 * local.y + r.m9 * local.z,
+        r.m2 * local.x + r.m6 * local.y + r.m10 * local.z
+    };
+}
+
+void Body::UpdateTransform()
+{
+    if (!this->transformUpdateRequired)
+    {
+        return;
+    }
+
+    // One matrix per dirty step, shared by the vertices, the AABB and the renderer
+    this->Transformation = GetTransformation({ 1, 1, 1 }, this->GetRotation(), this->_Position);
+
+    const std::vector<Vector3>& vertices = Body::BoxVertexTemplate();
+    for (int i = 0; i < (int)this->transformedVertices.size(); i++)
+    {
+        this->transformedVertices[i] = Vector3Transform(Vector3Multiply(vertices[i], this->Size), this->Transformation);
     }
 
     this->transformUpdateRequired = false;
+}
+
+const Matrix& Body::GetWorldTransform()
+{
+    this->UpdateTransform();
+    return this->Transformation;
+}
+
+const std::vector<Vector3>& Body::GetTransformedVertices()
+{
+    this->UpdateTransform();
     return this->transformedVertices;
 }
 
-AABB Body::GetAABB()
+size_t Body::HeapBytes() const
+{
+    return this->transformedVertices.capacity() * sizeof(Vector3);
+}
+
+const AABB& Body::GetAABB()
 {
     if (this->aabbUpdateRequired)
     {
@@ -135,19 +218,19 @@ AABB Body::GetAABB()
 
         if (this->shapeType == Box)
         {
-            std::vector<Vector3> vertices = this->GetTransformedVertices();
-
-            for (int i = 0; i < vertices.size(); i++)
-            {
-                Vector3 v = vertices[i];
-
-                if (v.x < minX) { minX = v.x; }
-                if (v.x > maxX) { maxX = v.x; }
-                if (v.y < minY) { minY = v.y; }
-                if (v.y > maxY) { maxY = v.y; }
-                if (v.z < minZ) { minZ = v.z; }
-                if (v.z > maxZ) { maxZ = v.z; }
-            }
+            // Extents of the oriented box straight from the cached transform: e = |R| * halfSize
+            const Matrix& t = this->GetWorldTransform();
+            Vector3 h = Vector3Scale(this->Size, 0.5f);
+            float ex = fabsf(t.m0) * h.x + fabsf(t.m4) * h.y + fabsf(t.m8) * h.z;
+            float ey = fabsf(t.m1) * h.x + fabsf(t.m5) * h.y + fabsf(t.m9) * h.z;
+            float ez = fabsf(t.m2) * h.x + fabsf(t.m6) * h.y + fabsf(t.m10) * h.z;
+
+            minX = t.m12 - ex;
+            minY = t.m13 - ey;
+            minZ = t.m14 - ez;
+            maxX = t.m12 + ex;
+            maxY = t.m13 + ey;
+            maxZ = t.m14 + ez;
         }
         else if (this->shapeType == Sphere)
         {
@@ -188,27 +271,91 @@ void Body::Step(float time, int iterations)
 
     this->_Position = Vector3Add(this->_Position, Vector3Scale(this->_LinearVelocity, time));
 
-    //this->_Rotation = Vector3Add(this->_Rotation, Vector3Scale(this->_RotationalVelocity, time));
+    this->StepRotation(time);
 
     this->force = Vector3Zero();
-    this->transformUpdateRequired = true;
-    this->aabbUpdateRequired = true;
+    this->MarkMoved();
+}
+
+// First half of a velocity Verlet step: v(t + dt/2) = v(t) + a(t) dt/2, x(t + dt) = x(t) + v(t + dt/2) dt
+void Body::KickDrift(float time, Vector3 acceleration)
+{
+    if (this->IsStatic)
+    {
+        return;
+    }
+
+    this->_LinearVelocity = Vector3Add(this->_LinearVelocity, Vector3Scale(acceleration, 0.5f * time));
+    this->_Position = Vector3Add(this->_Position, Vector3Scale(this->_LinearVelocity, time));
+
+    this->StepRotation(time);
+
+    this->MarkMoved();
+}
+
+// Second half of a velocity Verlet step: v(t + dt) = v(t + dt/2) + a(t + dt) dt/2
+void Body::Kick(float time, Vector3 acceleration)
+{
+    if (this->IsStatic)
+    {
+        return;
+    }
+
+    this->_LinearVelocity = Vector3Add(this->_LinearVelocity, Vector3Scale(acceleration, 0.5f * time));
+    this->force = Vector3Zero();
+}
+
+// Sets the linear state computed by an external integrator and advances the rotation
+void Body::StepTo(Vector3 position, Vector3 velocity, float time)
+{
+    if (this->IsStatic)
+    {
+        return;
+    }
+
+    this->_Position = position;
+    this->_LinearVelocity = velocity;
+
+    this->StepRotation(time);
+
+    this->force = Vector3Zero();
+    this->MarkMoved();
+}
+
+Vector3 Body::ForceAcceleration() const
+{
+    return Vector3Scale(this->force, this->InvMass);
+}
+
+void Body::StepRotation(float time)
+{
+    // angular acc = I^-1 * torque (gyroscopic term ignored)
+    this->_AngularVelocity = Vector3Add(this->_AngularVelocity, Vector3Scale(this->ApplyInvInertia(this->torque), time));
+
+    if (Vector3LengthSqr(this->_AngularVelocity) > 0.f)
+    {
+        // q' = q + dt/2 * (w, 0) * q
+        Vector3 w = this->_AngularVelocity;
+        Quaternion spin = QuaternionMultiply({ w.x, w.y, w.z, 0.f }, this->_Orientation);
+        this->_Orientation = QuaternionNormalize(QuaternionAdd(this->_Orientation, QuaternionScale(spin, 0.5f * time)));
+        this->rotationUpdateRequired = true;
+    }
+
+    this->torque = Vector3Zero();
 }
 
 // Method to move the body by a specific amount
 void Body::Move(Vector3 amount)
 {
     this->_Position = Vector3Add(this->_Position, amount); // Update the position of the body
-    this->transformUpdateRequired = true;
-    this->aabbUpdateRequired = true;
+    this->MarkMoved();
 }
 
 // Method to move the body to a specific position
 void Body::MoveTo(Vector3 pos)
 {
     this->_Position = pos; // Set the new position of the body
-    this->transformUpdateRequired = true;
-    this->aabbUpdateRequired = true;
+    this->MarkMoved();
 }
 
 void Body::AddForce(Vector3 amount)
@@ -216,6 +363,11 @@ void Body::AddForce(Vector3 amount)
     this->force = Vector3Add(this->force, amount);
 }
 
+void Body::AddTorque(Vector3 amount)
+{
+    this->torque = Vector3Add(this->torque, amount);
+}
+
 // Static method to create a spherical body
 bool Body::CreateSphereBody(Vector3 position, float radius, float density, bool isStatic, float restitution, Color color, Body* body, const char** error)
 {
@@ -227,8 +379,7 @@ bool Body::CreateSphereBody(Vector3 position, float radius, float density, bool
 
     // Create a new instance of Body with a sphere shape
     *body = Body(position, { 0, 0, 0 }, radius, density, mass, restitution, volume, isStatic, Sphere, color);
-    // Load the mesh model for the sphere
-    body->Mesh = LoadModelFromMesh(GenMeshSphere(1, 20, 20));
+    body->LoadMesh();
     //body->Transformation = body->GetTransformation({ 1, 1, 1 }, { 0, 0, 0 }, { 0, 0, 0 });
     //body->Mesh.transform = body->Transformation;
     return true;
@@ -245,20 +396,86 @@ bool Body::CreateBoxBody(Vector3 position, Vector3 size, float density, bool isS
 
     // Create a new instance of Body with a box shape
     *body = Body(position, size, 0.f, density, mass, restitution, volume, isStatic, Box, color);
-    // Normalize the size of the box
-    Vector3 SizeN = Vector3Normalize(size);
-    // Load the mesh model for the box
-    body->Mesh = LoadModelFromMesh(GenMeshCube(SizeN.x, SizeN.y, SizeN.z));
+    body->LoadMesh();
     //(*body)->Transformation = (*body)->GetTransformation({ 1, 1, 1 }, { 0, 0, 0 }, { 0, 0, 0 });
     //(*body)->Mesh.transform = (*body)->Transformation;
     return true;
 }
 
+bool Body::CreateBody(const BodyDesc& desc, Body* body, const char** error)
+{
+    *error = "";
+
+    if (desc.Shape != Sphere && desc.Shape != Box)
+    {
+        *error = "Unknown body shape";
+        return false;
+    }
+
+    if (!(desc.Density > 0.0f))
+    {
+        *error = "Body density must be positive";
+        return false;
+    }
+
+    float restitution = Clamp(desc.Restitution, 0.0f, 1.0f);
+    bool isStatic = desc.IsStatic != 0;
+
+    if (desc.Shape == Sphere)
+    {
+        if (!(desc.Radius > 0.0f))
+        {
+            *error = "Sphere radius must be positive";
+            return false;
+        }
+
+        float volume = desc.Radius * desc.Radius * desc.Radius * PI * 4 / 3;
+        *body = Body(desc.Position, { 0, 0, 0 }, desc.Radius, desc.Density, volume * desc.Density, restitution, volume, isStatic, Sphere, desc.color);
+    }
+    else
+    {
+        if (!(desc.Size.x > 0.0f && desc.Size.y > 0.0f && desc.Size.z > 0.0f))
+        {
+            *error = "Box size must be positive";
+            return false;
+        }
+
+        float volume = desc.Size.x * desc.Size.y * desc.Size.z;
+        *body = Body(desc.Position, desc.Size, 0.f, desc.Density, volume * desc.Density, restitution, volume, isStatic, Box, desc.color);
+    }
+
+    body->_LinearVelocity = desc.LinearVelocity;
+    body->Gravity = desc.Gravity & GravitySourceReceiver;
+    body->CollisionLayer = desc.CollisionLayer;
+    body->CollisionMask = desc.CollisionMask;
+    return true;
+}
+
+void Body::LoadMesh()
+{
+    if (this->shapeType == Box)
+    {
+        // Normalize the size of the box
+        Vector3 SizeN = Vector3Normalize(this->Size);
+        // Load the mesh model for the box
+        this->Mesh = LoadModelFromMesh(GenMeshCube(SizeN.x, SizeN.y, SizeN.z));
+    }
+    else
+    {
+        // Load the mesh model for the sphere
+        this->Mesh = LoadModelFromMesh(GenMeshSphere(1, 20, 20));
+    }
+}
+
 Matrix Body::GetTransformation(Vector3 scale, Vector3 rotation, Vector3 position)
 {
-    Matrix transform = MatrixIdentity();
-    transform = MatrixMultiply(transform, MatrixScale(scale.x, scale.y, scale.z));
-    transform = MatrixRotateXYZ(rotation);
+    return GetTransformation(scale, MatrixRotateXYZ(rotation), position);
+}
+
+Matrix Body::GetTransformation(Vector3 scale, const Matrix& rotation, Vector3 position)
+{
+    Matrix transform = MatrixScale(scale.x, scale.y, scale.z);
+    transform = MatrixMultiply(transform, rotation);
     transform = MatrixMultiply(transform, MatrixTranslate(position.x, position.y, position.z));
     return transform;
 }
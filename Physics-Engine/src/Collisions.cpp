@@ -45,15 +45,201 @@ bool Collisions::IntersectSpheres(const Vector3& centerA, float radiusA,
     return true;
 }
 
+Vector3 Collisions::ClosestPointOnTriangle(const Vector3& p, const Vector3& a, const Vector3& b, const Vector3& c) {
+    // Regiones de Voronoi de vrtices, aristas y cara (Ericson, Real-Time Collision Detection 5.1.5)
+    Vector3 ab = Vector3Subtract(b, a);
+    Vector3 ac = Vector3Subtract(c, a);
+    Vector3 ap = Vector3Subtract(p, a);
+    float d1 = Vector3DotProduct(ab, ap);
+    float d2 = Vector3DotProduct(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) return a;
+
+    Vector3 bp = Vector3Subtract(p, b);
+    float d3 = Vector3DotProduct(ab, bp);
+    float d4 = Vector3DotProduct(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) return b;
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+        return Vector3Add(a, Vector3Scale(ab, d1 / (d1 - d3)));
+    }
+
+    Vector3 cp = Vector3Subtract(p, c);
+    float d5 = Vector3DotProduct(ab, cp);
+    float d6 = Vector3DotProduct(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6) return c;
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+        return Vector3Add(a, Vector3Scale(ac, d2 / (d2 - d6)));
+    }
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+        return Vector3Add(b, Vector3Scale(Vector3Subtract(c, b), (d4 - d3) / ((d4 - d3) + (d5 - d6))));
+    }
+
+    float denom = 1.0f / (va + vb + vc);
+    return Vector3Add(a, Vector3Add(Vector3Scale(ab, vb * denom), Vector3Scale(ac, vc * denom)));
+}
+
+bool Collisions::IntersectSphereTriangle(const Vector3& center, float radius,
+    const Vector3& a, const Vector3& b, const Vector3& c,
+    Vector3& normal, float& depth, Vector3& contact) {
+    Vector3 faceNormal = Vector3Normalize(Vector3CrossProduct(Vector3Subtract(b, a), Vector3Subtract(c, a)));
+    float side = Vector3DotProduct(Vector3Subtract(center, a), faceNormal);
+
+    // Completamente detrs de la cara
+    if (side <= -radius) {
+        return false;
+    }
+
+    contact = ClosestPointOnTriangle(center, a, b, c);
+    Vector3 delta = Vector3Subtract(center, contact);
+    float distanceSq = Vector3DotProduct(delta, delta);
+
+    if (distanceSq >= radius * radius) {
+        return false;
+    }
+
+    float distance = sqrtf(distanceSq);
+    if (side > 1e-6f && distance > 1e-6f) {
+        normal = Vector3Scale(delta, 1.0f / distance);
+        depth = radius - distance;
+    }
+    else {
+        // Centro sobre el plano o detrs: se empuja hacia enfrente
+        normal = faceNormal;
+        depth = radius - side;
+    }
+    return true;
+}
+
+bool Collisions::IntersectBoxTriangle(Body& box, const Vector3& a, const Vector3& b, const Vector3& c,
+    Vector3& normal, float& depth, Vector3& contact) {
+    const Matrix& t = box.GetWorldTransform();
+    Vector3 center = box.Position();
+    Vector3 axes[3] = { { t.m0, t.m1, t.m2 }, { t.m4, t.m5, t.m6 }, { t.m8, t.m9, t.m10 } };
+    float half[3] = { box.Size.x * 0.5f, box.Size.y * 0.5f, box.Size.z * 0.5f };
+
+    // Tringulo relativo al centro de la caja
+    Vector3 v[3] = { Vector3Subtract(a, center), Vector3Subtract(b, center), Vector3Subtract(c, center) };
+    Vector3 edges[3] = { Vector3Subtract(v[1], v[0]), Vector3Subtract(v[2], v[1]), Vector3Subtract(v[0], v[2]) };
+
+    // Normal del tringulo primero: las aristas y caras de la caja solo la reemplazan si separan
+    // claramente menos, as las aristas internas de una malla no desvan los contactos
+    Vector3 faceNormal = Vector3Normalize(Vector3CrossProduct(edges[0], edges[1]));
+    Vector3 candidates[13];
+    int candidateCount = 0;
+    candidates[candidateCount++] = Vector3CrossProduct(edges[0], edges[1]);
+    for (int i = 0; i < 3; i++) {
+        candidates[candidateCount++] = axes[i];
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            candidates[candidateCount++] = Vector3CrossProduct(axes[i], edges[j]);
+        }
+    }
+
+    depth = std::numeric_limits<float>::max();
+
+    for (int k = 0; k < candidateCount; k++) {
+        float lengthSq = Vector3DotProduct(candidates[k], candidates[k]);
+        if (lengthSq < 1e-12f) {
+            continue;
+        }
+        Vector3 axis = Vector3Scale(candidates[k], 1.0f / sqrtf(lengthSq));
+
+        float r = half[0] * fabsf(Vector3DotProduct(axes[0], axis)) +
+            half[1] * fabsf(Vector3DotProduct(axes[1], axis)) +
+            half[2] * fabsf(Vector3DotProduct(axes[2], axis));
+        float p0 = Vector3DotProduct(v[0], axis);
+        float p1 = Vector3DotProduct(v[1], axis);
+        float p2 = Vector3DotProduct(v[2], axis);
+        float minP = fminf(p0, fminf(p1, p2));
+        float maxP = fmaxf(p0, fmaxf(p1, p2));
+
+        if (minP >= r || maxP <= -r) {
+            return false;
+        }
+
+        // La caja sale hacia -axis (r - minP) o hacia +axis (maxP + r); solo hacia enfrente
+        // salvo en los ejes paralelos a la cara
+        float down = r - minP;
+        float up = maxP + r;
+        float facing = Vector3DotProduct(axis, faceNormal);
+        if (facing > 1e-4f) {
+            down = std::numeric_limits<float>::max();
+        }
+        else if (facing < -1e-4f) {
+            up = std::numeric_limits<float>::max();
+        }
+        float overlap = fminf(down, up);
+
+        if (k == 0 ? overlap < depth : overlap < depth * 0.95f) {
+            depth = overlap;
+            normal = down < up ? Vector3Negate(axis) : axis;
+        }
+    }
+
+    // Vrtices de la caja ms hundidos contra la normal
+    Vector3 corners[8];
+    float deepest = std::numeric_limits<float>::max();
+    for (int i = 0; i < 8; i++) {
+        Vector3 corner = center;
+        for (int k = 0; k < 3; k++) {
+            corner = Vector3Add(corner, Vector3Scale(axes[k], (i >> k) & 1 ? half[k] : -half[k]));
+        }
+        corners[i] = corner;
+        deepest = fminf(deepest, Vector3DotProduct(corner, normal));
+    }
+
+    contact = Vector3Zero();
+    int count = 0;
+    for (int i = 0; i < 8; i++) {
+        if (Vector3DotProduct(corners[i], normal) <= deepest + ContactTolerance) {
+            contact = Vector3Add(contact, corners[i]);
+            count++;
+        }
+    }
+    contact = Vector3Scale(contact, 1.0f / count);
+
+    return true;
+}
+
 void Collisions::FindContactPoints(Body& bodyA, Body& bodyB,
     Vector3& contact1, Vector3& contact2, int& contactCount) {
     contact1 = Vector3Zero();
     contact2 = Vector3Zero();
     contactCount = 0;
 
+    if (bodyA.shapeType == Sphere && bodyB.shapeType == Sphere) {
+        FindSpheresContactPoint(bodyA.Position(), bodyA.Radius, bodyB.Position(), contact1);
+        contactCount = 1;
+        return;
+    }
+
+    if (bodyA.shapeType == Sphere && bodyB.shapeType == Box) {
+        FindSphereBoxContactPoint(bodyA.Position(), bodyB, contact1);
+        contactCount = 1;
+        return;
+    }
+
+    if (bodyA.shapeType == Box && bodyB.shapeType == Sphere) {
+        FindSphereBoxContactPoint(bodyB.Position(), bodyA, contact1);
+        contactCount = 1;
+        return;
+    }
+
     // Obtener los vrtices transformados de los cuerpos
-    std::vector<Vector3> verticesA = bodyA.GetTransformedVertices();
-    std::vector<Vector3> verticesB = bodyB.GetTransformedVertices();
+    const std::vector<Vector3>& verticesA = bodyA.GetTransformedVertices();
+    const std::vector<Vector3>& verticesB = bodyB.GetTransformedVertices();
+
+    // Contacto cara-cara o arista-cara: centroide de los vertices que tocan al otro cuerpo
+    if (FindPolygonsContactPoint(verticesA, verticesB, contact1)) {
+        contactCount = 1;
+        return;
+    }
 
     float minDistSq = std::numeric_limits<float>::max();
 
@@ -63,7 +249,7 @@ void Collisions::FindContactPoints(Body& bodyA, Body& bodyB,
 
         for (size_t j = 0; j < verticesB.size(); j++) {
             Vector3 va = verticesB[j];
-            Vector3 vb = verticesB[(j + 1) % verticesB.size()];
+            Vector3 vb = verticesB[(j & ~3u) + (j + 1) % 4];
 
             float distSq;
             Vector3 cp;
@@ -89,7 +275,7 @@ void Collisions::FindContactPoints(Body& bodyA, Body& bodyB,
 
         for (size_t j = 0; j < verticesA.size(); j++) {
             Vector3 va = verticesA[j];
-            Vector3 vb = verticesA[(j + 1) % verticesA.size()];
+            Vector3 vb = verticesA[(j & ~3u) + (j + 1) % 4];
 
             float distSq;
             Vector3 cp;
@@ -110,14 +296,85 @@ void Collisions::FindContactPoints(Body& bodyA, Body& bodyB,
     }
 }
 
+bool Collisions::FindPolygonsContactPoint(const std::vector<Vector3>& verticesA,
+    const std::vector<Vector3>& verticesB, Vector3& contact) {
+    Vector3 sum = Vector3Zero();
+    int count = 0;
+
+    Vector3 axesA[MaxAxes];
+    Vector3 axesB[MaxAxes];
+    int axisCountA = FindFaceAxes(verticesA, axesA, 0);
+    int axisCountB = FindFaceAxes(verticesB, axesB, 0);
+
+    for (const auto& vertex : verticesA) {
+        if (IsPointInsidePolygon(vertex, verticesB, axesB, axisCountB)) {
+            sum = Vector3Add(sum, vertex);
+            count++;
+        }
+    }
+
+    for (const auto& vertex : verticesB) {
+        if (IsPointInsidePolygon(vertex, verticesA, axesA, axisCountA)) {
+            sum = Vector3Add(sum, vertex);
+            count++;
+        }
+    }
+
+    if (count == 0) {
+        return false;
+    }
+
+    contact = Vector3Scale(sum, 1.0f / (float)count);
+    return true;
+}
+
+bool Collisions::IsPointInsidePolygon(const Vector3& point, const std::vector<Vector3>& vertices,
+    const Vector3* axes, int axisCount) {
+    for (int i = 0; i < axisCount; i++) {
+        float min, max;
+        ProjectVertices(vertices, axes[i], min, max);
+
+        float proj = Vector3DotProduct(point, axes[i]);
+        if (proj < min - ContactTolerance || proj > max + ContactTolerance) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Collisions::FindSpheresContactPoint(const Vector3& centerA, float radiusA,
+    const Vector3& centerB, Vector3& contact) {
+    Vector3 direction = Vector3Normalize(Vector3Subtract(centerB, centerA));
+    contact = Vector3Add(centerA, Vector3Scale(direction, radiusA));
+}
+
+void Collisions::FindSphereBoxContactPoint(const Vector3& sphereCenter, Body& box, Vector3& contact) {
+    // Llevar el centro de la esfera al espacio local de la caja y recortarlo a sus semiejes
+    const Matrix& r = box.GetRotation();
+    Vector3 d = Vector3Subtract(sphereCenter, box.Position());
+    Vector3 local = {
+        r.m0 * d.x + r.m1 * d.y + r.m2 * d.z,
+        r.m4 * d.x + r.m5 * d.y + r.m6 * d.z,
+        r.m8 * d.x + r.m9 * d.y + r.m10 * d.z
+    };
+
+    Vector3 half = Vector3Scale(box.Size, 0.5f);
+    local.x = Clamp(local.x, -half.x, half.x);
+    local.y = Clamp(local.y, -half.y, half.y);
+    local.z = Clamp(local.z, -half.z, half.z);
+
+    contact = Vector3Add(box.Position(), Vector3Transform(local, r));
+}
+
 bool Collisions::Collide(Body& bodyA, Body& bodyB,
     Vector3& normal, float& depth) {
     normal = Vector3Zero();
     depth = 0.0f;
 
     // Obtener los vrtices transformados de los cuerpos
-    std::vector<Vector3> verticesA = bodyA.GetTransformedVertices();
-    std::vector<Vector3> verticesB = bodyB.GetTransformedVertices();
+    const std::vector<Vector3>& verticesA = bodyA.GetTransformedVertices();
+    const std::vector<Vector3>& verticesB = bodyB.GetTransformedVertices();
 
     // Verificar colisin entre polgonos
     if (bodyA.shapeType == Box && bodyB.shapeType == Box) {
@@ -149,13 +406,29 @@ bool Collisions::IntersectSpherePolygon(const Vector3& sphereCenter, float spher
     normal = Vector3Zero();
     depth = std::numeric_limits<float>::max();
 
-    // Proyectar la esfera y el polgono en cada eje de las aristas del polgono
-    for (size_t i = 0; i < vertices.size(); i++) {
-        Vector3 va = vertices[i];
-        Vector3 vb = vertices[(i + 1) % vertices.size()];
+    // Ejes candidatos: normales de las caras del poliedro
+    Vector3 axes[MaxAxes];
+    int axisCount = FindFaceAxes(vertices, axes, 0);
 
-        Vector3 edge = Vector3Subtract(vb, va);
-        Vector3 axis = Vector3Normalize({ -edge.y, edge.x, 0 });
+    // Y el eje desde el centro de la esfera al punto mas cercano de las aristas
+    float minDistSq = std::numeric_limits<float>::max();
+    Vector3 closest = polygonCenter;
+    for (size_t f = 0; f + 3 < vertices.size(); f += 4) {
+        for (size_t e = 0; e < 4; e++) {
+            float distSq;
+            Vector3 cp;
+            PointSegmentDistance(sphereCenter, vertices[f + e], vertices[f + (e + 1) % 4], distSq, cp);
+
+            if (distSq < minDistSq) {
+                minDistSq = distSq;
+                closest = cp;
+            }
+        }
+    }
+    axisCount = AddAxis(axes, axisCount, Vector3Subtract(closest, sphereCenter));
+
+    for (int i = 0; i < axisCount; i++) {
+        Vector3 axis = axes[i];
 
         float minA, maxA, minB, maxB;
         ProjectVertices(vertices, axis, minA, maxA);
@@ -172,26 +445,7 @@ bool Collisions::IntersectSpherePolygon(const Vector3& sphereCenter, float spher
         }
     }
 
-    // Verificar el eje desde el centro de la esfera al punto ms cercano del polgono
-    int cpIndex = FindClosestPointOnPolygon(sphereCenter, vertices);
-    Vector3 cp = vertices[cpIndex];
-
-    Vector3 axis = Vector3Normalize(Vector3Subtract(cp, sphereCenter));
-    float minA, maxA, minB, maxB;
-    ProjectVertices(vertices, axis, minA, maxA);
-    ProjectSphere(sphereCenter, sphereRadius, axis, minB, maxB);
-
-    if (minA >= maxB || minB >= maxA) {
-        return false;
-    }
-
-    float axisDepth = std::min(maxB - minA, maxA - minB);
-    if (axisDepth < depth) {
-        depth = axisDepth;
-        normal = axis;
-    }
-
-    // Asegurar que la normal apunte desde el polgono hacia la esfera
+    // Asegurar que la normal apunte desde la esfera hacia el poligono
     Vector3 direction = Vector3Subtract(polygonCenter, sphereCenter);
     if (Vector3DotProduct(direction, normal) < 0.0f) {
         normal = Vector3Negate(normal);
@@ -206,36 +460,24 @@ bool Collisions::IntersectPolygons(const Vector3& centerA, const std::vector<Vec
     normal = Vector3Zero();
     depth = std::numeric_limits<float>::max();
 
-    // Verificar las aristas del polgono A
-    for (size_t i = 0; i < verticesA.size(); i++) {
-        Vector3 va = verticesA[i];
-        Vector3 vb = verticesA[(i + 1) % verticesA.size()];
+    // Ejes candidatos (SAT 3D): normales de las caras de A y B y productos cruz de sus aristas
+    Vector3 axes[MaxAxes];
+    int axisCount = FindFaceAxes(verticesA, axes, 0);
+    axisCount = FindFaceAxes(verticesB, axes, axisCount);
 
-        Vector3 edge = Vector3Subtract(vb, va);
-        Vector3 axis = Vector3Normalize({ -edge.y, edge.x, 0 });
+    Vector3 edgesA[MaxAxes];
+    Vector3 edgesB[MaxAxes];
+    int edgeCountA = FindEdgeAxes(verticesA, edgesA);
+    int edgeCountB = FindEdgeAxes(verticesB, edgesB);
 
-        float minA, maxA, minB, maxB;
-        ProjectVertices(verticesA, axis, minA, maxA);
-        ProjectVertices(verticesB, axis, minB, maxB);
-
-        if (minA >= maxB || minB >= maxA) {
-            return false;
-        }
-
-        float axisDepth = std::min(maxB - minA, maxA - minB);
-        if (axisDepth < depth) {
-            depth = axisDepth;
-            normal = axis;
+    for (int i = 0; i < edgeCountA; i++) {
+        for (int j = 0; j < edgeCountB; j++) {
+            axisCount = AddAxis(axes, axisCount, Vector3CrossProduct(edgesA[i], edgesB[j]));
         }
     }
 
-    // Verificar las aristas del polgono B
-    for (size_t i = 0; i < verticesB.size(); i++) {
-        Vector3 va = verticesB[i];
-        Vector3 vb = verticesB[(i + 1) % verticesB.size()];
-
-        Vector3 edge = Vector3Subtract(vb, va);
-        Vector3 axis = Vector3Normalize({ -edge.y, edge.x, 0 });
+    for (int i = 0; i < axisCount; i++) {
+        Vector3 axis = axes[i];
 
         float minA, maxA, minB, maxB;
         ProjectVertices(verticesA, axis, minA, maxA);
@@ -261,6 +503,47 @@ bool Collisions::IntersectPolygons(const Vector3& centerA, const std::vector<Vec
     return true;
 }
 
+int Collisions::AddAxis(Vector3* axes, int axisCount, Vector3 axis) {
+    float lengthSq = Vector3LengthSqr(axis);
+    if (lengthSq < 1e-12f || axisCount >= MaxAxes) {
+        return axisCount;
+    }
+
+    axis = Vector3Scale(axis, 1.0f / sqrtf(lengthSq));
+
+    // Descartar ejes paralelos a uno ya existente
+    for (int i = 0; i < axisCount; i++) {
+        if (std::abs(Vector3DotProduct(axes[i], axis)) > 0.9999f) {
+            return axisCount;
+        }
+    }
+
+    axes[axisCount] = axis;
+    return axisCount + 1;
+}
+
+int Collisions::FindFaceAxes(const std::vector<Vector3>& vertices, Vector3* axes, int axisCount) {
+    // Los vertices vienen agrupados en caras de 4
+    for (size_t f = 0; f + 3 < vertices.size(); f += 4) {
+        Vector3 e1 = Vector3Subtract(vertices[f + 1], vertices[f]);
+        Vector3 e2 = Vector3Subtract(vertices[f + 3], vertices[f]);
+        axisCount = AddAxis(axes, axisCount, Vector3CrossProduct(e1, e2));
+    }
+
+    return axisCount;
+}
+
+int Collisions::FindEdgeAxes(const std::vector<Vector3>& vertices, Vector3* axes) {
+    int axisCount = 0;
+
+    for (size_t f = 0; f + 3 < vertices.size(); f += 4) {
+        axisCount = AddAxis(axes, axisCount, Vector3Subtract(vertices[f + 1], vertices[f]));
+        axisCount = AddAxis(axes, axisCount, Vector3Subtract(vertices[f + 3], vertices[f]));
+    }
+
+    return axisCount;
+}
+
 void Collisions::ProjectVertices(const std::vector<Vector3>& vertices, const Vector3& axis,
     float& min, float& max) {
     min = std::numeric_limits<float>::max();
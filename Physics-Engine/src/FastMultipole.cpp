@@ -0,0 +1,712 @@
+#include "FastMultipole.h"
+#include <algorithm>
+#include <cmath>
+
+#include "MemoryAccounting.h"
+
+FastMultipole::FastMultipole()
+{
+    this->order = 0;
+    this->termCount = 0;
+    this->theta = 0.5;
+    this->leafSize = 16;
+    this->softeningSqr = 0.0;
+    this->Configure(4, 0.5f, 16, 0.0f);
+}
+
+size_t FastMultipole::MemoryBytes() const
+{
+    return VectorBytes(this->termX) + VectorBytes(this->termY) + VectorBytes(this->termZ) +
+        VectorBytes(this->termIndex) + VectorBytes(this->termInvFactorial) + VectorBytes(this->termSign) +
+        VectorBytes(this->termPrev1) + VectorBytes(this->termPrev2) + VectorBytes(this->termAxis) +
+        VectorBytes(this->orderEnd) + VectorBytes(this->binomial) +
+        VectorBytes(this->cells) + VectorBytes(this->levels) + VectorBytes(this->leaves) +
+        VectorBytes(this->sortedIndex) + VectorBytes(this->sortScratch) +
+        VectorBytes(this->px) + VectorBytes(this->py) + VectorBytes(this->pz) + VectorBytes(this->pm) +
+        VectorBytes(this->ax) + VectorBytes(this->ay) + VectorBytes(this->az) +
+        VectorBytes(this->multipoles) + VectorBytes(this->locals) +
+        VectorBytes(this->m2lList) + VectorBytes(this->p2pList);
+}
+
+void FastMultipole::Clear()
+{
+    ReleaseVector(this->cells);
+    ReleaseVector(this->levels);
+    ReleaseVector(this->leaves);
+    ReleaseVector(this->sortedIndex);
+    ReleaseVector(this->sortScratch);
+    ReleaseVector(this->px);
+    ReleaseVector(this->py);
+    ReleaseVector(this->pz);
+    ReleaseVector(this->pm);
+    ReleaseVector(this->ax);
+    ReleaseVector(this->ay);
+    ReleaseVector(this->az);
+    ReleaseVector(this->multipoles);
+    ReleaseVector(this->locals);
+    ReleaseVector(this->m2lList);
+    ReleaseVector(this->p2pList);
+}
+
+void FastMultipole::Configure(int order, float theta, int leafSize, float softening)
+{
+    order = std::min(std::max(order, FastMultipole::MinOrder), FastMultipole::MaxOrder);
+    this->theta = Clamp(theta, 0.05f, 1.0f);
+    this->leafSize = std::max(leafSize, 1);
+    this->softeningSqr = (double)softening * (double)softening;
+
+    if (order != this->order)
+    {
+        this->order = order;
+        this->BuildTerms();
+    }
+}
+
+void FastMultipole::BuildTerms()
+{
+    int p = this->order;
+    int side = p + 1;
+
+    this->termX.clear();
+    this->termY.clear();
+    this->termZ.clear();
+    this->termIndex.assign(side * side * side, -1);
+    this->orderEnd.clear();
+
+    for (int l = 0; l <= p; l++)
+    {
+        for (int x = l; x >= 0; x--)
+        for (int y = l - x; y >= 0; y--)
+        {
+            int z = l - x - y;
+            this->termIndex[(x * side + y) * side + z] = (int)this->termX.size();
+            this->termX.push_back(x);
+            this->termY.push_back(y);
+            this->termZ.push_back(z);
+        }
+        this->orderEnd.push_back((int)this->termX.size());
+    }
+
+    this->termCount = (int)this->termX.size();
+
+    std::vector<double> factorial(side, 1.0);
+    for (int i = 1; i < side; i++)
+    {
+        factorial[i] = factorial[i - 1] * i;
+    }
+
+    this->termInvFactorial.resize(this->termCount);
+    this->termSign.resize(this->termCount);
+    this->termAxis.resize(this->termCount);
+    this->termPrev1.resize(this->termCount);
+    this->termPrev2.resize(this->termCount);
+
+    for (int t = 0; t < this->termCount; t++)
+    {
+        int n[3] = { this->termX[t], this->termY[t], this->termZ[t] };
+        this->termInvFactorial[t] = 1.0 / (factorial[n[0]] * factorial[n[1]] * factorial[n[2]]);
+        this->termSign[t] = ((n[0] + n[1] + n[2]) & 1) ? -1.0 : 1.0;
+
+        int axis = n[0] > 0 ? 0 : (n[1] > 0 ? 1 : 2);
+        this->termAxis[t] = axis;
+        this->termPrev1[t] = -1;
+        this->termPrev2[t] = -1;
+
+        if (t == 0) continue;
+
+        n[axis] -= 1;
+        this->termPrev1[t] = this->termIndex[(n[0] * side + n[1]) * side + n[2]];
+        if (n[axis] > 0)
+        {
+            n[axis] -= 1;
+            this->termPrev2[t] = this->termIndex[(n[0] * side + n[1]) * side + n[2]];
+        }
+    }
+
+    this->binomial.assign(side * side, 0.0);
+    for (int n = 0; n < side; n++)
+    {
+        for (int k = 0; k <= n; k++)
+        {
+            this->binomial[n * side + k] = factorial[n] / (factorial[k] * factorial[n - k]);
+        }
+    }
+}
+
+void FastMultipole::Powers(double x, double y, double z, double* powX, double* powY, double* powZ) const
+{
+    powX[0] = powY[0] = powZ[0] = 1.0;
+    for (int i = 1; i <= this->order; i++)
+    {
+        powX[i] = powX[i - 1] * x;
+        powY[i] = powY[i - 1] * y;
+        powZ[i] = powZ[i - 1] * z;
+    }
+}
+
+void FastMultipole::BuildTree(const Vector3* positions, const float* masses, int count)
+{
+    this->sortedIndex.resize(count);
+    this->sortScratch.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        this->sortedIndex[i] = i;
+    }
+
+    Vector3 min = positions[0];
+    Vector3 max = positions[0];
+    for (int i = 1; i < count; i++)
+    {
+        min = Vector3Min(min, positions[i]);
+        max = Vector3Max(max, positions[i]);
+    }
+
+    Cell root = {};
+    root.first = 0;
+    root.count = count;
+    root.firstChild = -1;
+    root.level = 0;
+    root.center[0] = 0.5 * ((double)min.x + max.x);
+    root.center[1] = 0.5 * ((double)min.y + max.y);
+    root.center[2] = 0.5 * ((double)min.z + max.z);
+    root.halfSize = 0.5 * std::max({ (double)max.x - min.x, (double)max.y - min.y, (double)max.z - min.z }) * 1.0001 + 1e-6;
+
+    this->cells.clear();
+    this->cells.push_back(root);
+    this->SplitCell(0, positions);
+
+    // Particle data in tree order so that every cell reads a contiguous range
+    this->px.resize(count);
+    this->py.resize(count);
+    this->pz.resize(count);
+    this->pm.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        int index = this->sortedIndex[i];
+        this->px[i] = positions[index].x;
+        this->py[i] = positions[index].y;
+        this->pz[i] = positions[index].z;
+        this->pm[i] = masses[index];
+    }
+
+    this->levels.clear();
+    this->leaves.clear();
+    for (int c = 0; c < (int)this->cells.size(); c++)
+    {
+        Cell& cell = this->cells[c];
+        this->ComputeCellBounds(cell);
+
+        if ((int)this->levels.size() <= cell.level)
+        {
+            this->levels.resize(cell.level + 1);
+        }
+        this->levels[cell.level].push_back(c);
+
+        if (cell.firstChild < 0)
+        {
+            this->leaves.push_back(c);
+        }
+    }
+}
+
+void FastMultipole::SplitCell(int cellIndex, const Vector3* positions)
+{
+    Cell cell = this->cells[cellIndex];
+
+    if (cell.count <= this->leafSize || cell.level >= FastMultipole::MaxDepth)
+    {
+        return;
+    }
+
+    // Counting sort of the cell's range by octant
+    int counts[8] = { 0 };
+    auto octant = [&](int index)
+    {
+        const Vector3& p = positions[index];
+        return (p.x >= cell.center[0] ? 1 : 0) | (p.y >= cell.center[1] ? 2 : 0) | (p.z >= cell.center[2] ? 4 : 0);
+    };
+
+    for (int i = cell.first; i < cell.first + cell.count; i++)
+    {
+        counts[octant(this->sortedIndex[i])]++;
+    }
+
+    int offsets[8];
+    int offset = cell.first;
+    for (int o = 0; o < 8; o++)
+    {
+        offsets[o] = offset;
+        offset += counts[o];
+    }
+
+    for (int i = cell.first; i < cell.first + cell.count; i++)
+    {
+        int index = this->sortedIndex[i];
+        this->sortScratch[offsets[octant(index)]++] = index;
+    }
+    std::copy(this->sortScratch.begin() + cell.first, this->sortScratch.begin() + cell.first + cell.count,
+        this->sortedIndex.begin() + cell.first);
+
+    int firstChild = (int)this->cells.size();
+    int childCount = 0;
+    double quarter = cell.halfSize * 0.5;
+    int first = cell.first;
+
+    for (int o = 0; o < 8; o++)
+    {
+        if (counts[o] == 0)
+        {
+            continue;
+        }
+
+        Cell child = {};
+        child.first = first;
+        child.count = counts[o];
+        child.firstChild = -1;
+        child.level = cell.level + 1;
+        child.center[0] = cell.center[0] + ((o & 1) ? quarter : -quarter);
+        child.center[1] = cell.center[1] + ((o & 2) ? quarter : -quarter);
+        child.center[2] = cell.center[2] + ((o & 4) ? quarter : -quarter);
+        child.halfSize = quarter;
+        this->cells.push_back(child);
+
+        first += counts[o];
+        childCount++;
+    }
+
+    this->cells[cellIndex].firstChild = firstChild;
+    this->cells[cellIndex].childCount = childCount;
+
+    for (int c = firstChild; c < firstChild + childCount; c++)
+    {
+        this->SplitCell(c, positions);
+    }
+}
+
+void FastMultipole::ComputeCellBounds(Cell& cell)
+{
+    double mass = 0.0;
+    double com[3] = { 0.0, 0.0, 0.0 };
+    double min[3] = { 1e300, 1e300, 1e300 };
+    double max[3] = { -1e300, -1e300, -1e300 };
+
+    for (int i = cell.first; i < cell.first + cell.count; i++)
+    {
+        double p[3] = { this->px[i], this->py[i], this->pz[i] };
+        mass += this->pm[i];
+        for (int a = 0; a < 3; a++)
+        {
+            com[a] += this->pm[i] * p[a];
+            min[a] = std::min(min[a], p[a]);
+            max[a] = std::max(max[a], p[a]);
+        }
+    }
+
+    cell.mass = mass;
+    for (int a = 0; a < 3; a++)
+    {
+        cell.local[a] = 0.5 * (min[a] + max[a]);
+        cell.com[a] = mass > 0.0 ? com[a] / mass : cell.local[a];
+    }
+
+    double radiusM = 0.0;
+    double radiusL = 0.0;
+    for (int i = cell.first; i < cell.first + cell.count; i++)
+    {
+        double dm[3] = { this->px[i] - cell.com[0], this->py[i] - cell.com[1], this->pz[i] - cell.com[2] };
+        double dl[3] = { this->px[i] - cell.local[0], this->py[i] - cell.local[1], this->pz[i] - cell.local[2] };
+        radiusM = std::max(radiusM, dm[0] * dm[0] + dm[1] * dm[1] + dm[2] * dm[2]);
+        radiusL = std::max(radiusL, dl[0] * dl[0] + dl[1] * dl[1] + dl[2] * dl[2]);
+    }
+
+    cell.radiusM = std::sqrt(radiusM);
+    cell.radiusL = std::sqrt(radiusL);
+}
+
+void FastMultipole::Interact(int target, int source)
+{
+    const Cell& a = this->cells[target];
+    const Cell& b = this->cells[source];
+
+    if (b.mass == 0.0)
+    {
+        return;
+    }
+
+    if (target == source)
+    {
+        if (a.firstChild < 0)
+        {
+            this->p2pList[target].push_back(source);
+            return;
+        }
+
+        int firstChild = a.firstChild;
+        int childCount = a.childCount;
+        for (int i = firstChild; i < firstChild + childCount; i++)
+        for (int j = firstChild; j < firstChild + childCount; j++)
+        {
+            this->Interact(i, j);
+        }
+        return;
+    }
+
+    double dx = a.local[0] - b.com[0];
+    double dy = a.local[1] - b.com[1];
+    double dz = a.local[2] - b.com[2];
+    double distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+    if (a.radiusL + b.radiusM < this->theta * distance)
+    {
+        this->m2lList[target].push_back(source);
+        return;
+    }
+
+    bool leafA = a.firstChild < 0;
+    bool leafB = b.firstChild < 0;
+
+    if (leafA && leafB)
+    {
+        this->p2pList[target].push_back(source);
+        return;
+    }
+
+    // Open the larger cell
+    if (leafB || (!leafA && a.radiusL >= b.radiusM))
+    {
+        int firstChild = a.firstChild;
+        int childCount = a.childCount;
+        for (int i = firstChild; i < firstChild + childCount; i++)
+        {
+            this->Interact(i, source);
+        }
+    }
+    else
+    {
+        int firstChild = b.firstChild;
+        int childCount = b.childCount;
+        for (int j = firstChild; j < firstChild + childCount; j++)
+        {
+            this->Interact(target, j);
+        }
+    }
+}
+
+void FastMultipole::ParticleToMultipole(const Cell& cell, double* m) const
+{
+    double powX[MaxOrder + 1], powY[MaxOrder + 1], powZ[MaxOrder + 1];
+
+    for (int i = cell.first; i < cell.first + cell.count; i++)
+    {
+        if (this->pm[i] == 0.0) continue;
+
+        this->Powers(this->px[i] - cell.com[0], this->py[i] - cell.com[1], this->pz[i] - cell.com[2], powX, powY, powZ);
+
+        // M_n = sum m (y - c)^n / n!
+        for (int t = 0; t < this->termCount; t++)
+        {
+            m[t] += this->pm[i] * powX[this->termX[t]] * powY[this->termY[t]] * powZ[this->termZ[t]] * this->termInvFactorial[t];
+        }
+    }
+}
+
+void FastMultipole::MultipoleToMultipole(const Cell& child, const Cell& parent, const double* mChild, double* m) const
+{
+    double powX[MaxOrder + 1], powY[MaxOrder + 1], powZ[MaxOrder + 1];
+    this->Powers(child.com[0] - parent.com[0], child.com[1] - parent.com[1], child.com[2] - parent.com[2], powX, powY, powZ);
+
+    int side = this->order + 1;
+
+    // M_n(parent) = sum_{k <= n} M_k(child) d^(n - k) / (n - k)!
+    for (int t = 0; t < this->termCount; t++)
+    {
+        int nx = this->termX[t], ny = this->termY[t], nz = this->termZ[t];
+        double sum = 0.0;
+
+        for (int kx = 0; kx <= nx; kx++)
+        for (int ky = 0; ky <= ny; ky++)
+        for (int kz = 0; kz <= nz; kz++)
+        {
+            int k = this->termIndex[(kx * side + ky) * side + kz];
+            int j = this->termIndex[((nx - kx) * side + (ny - ky)) * side + (nz - kz)];
+            sum += mChild[k] * powX[nx - kx] * powY[ny - ky] * powZ[nz - kz] * this->termInvFactorial[j];
+        }
+
+        m[t] += sum;
+    }
+}
+
+void FastMultipole::MultipoleToLocal(const Cell& target, const Cell& source, const double* m, double* l, double* derivatives) const
+{
+    int p = this->order;
+    int count = this->termCount;
+    int side = p + 1;
+
+    double r[3] = { target.local[0] - source.com[0], target.local[1] - source.com[1], target.local[2] - source.com[2] };
+    double invR2 = 1.0 / (r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+
+    // Derivatives of 1/r by the McMurchie-Davidson recurrence:
+    // R(m)_000 = (-1)^m (2m - 1)!! / r^(2m + 1), R(m)_{n + e} = n_a R(m + 1)_{n - e} + r_a R(m + 1)_n
+    double base = std::sqrt(invR2);
+    for (int mm = 0; mm <= p; mm++)
+    {
+        derivatives[mm * count] = base;
+        base *= -(2.0 * mm + 1.0) * invR2;
+    }
+
+    for (int t = 1; t < count; t++)
+    {
+        int level = this->termX[t] + this->termY[t] + this->termZ[t];
+        int axis = this->termAxis[t];
+        int prev1 = this->termPrev1[t];
+        int prev2 = this->termPrev2[t];
+        int n = axis == 0 ? this->termX[t] : (axis == 1 ? this->termY[t] : this->termZ[t]);
+
+        for (int mm = 0; mm <= p - level; mm++)
+        {
+            double value = r[axis] * derivatives[(mm + 1) * count + prev1];
+            if (prev2 >= 0)
+            {
+                value += (n - 1) * derivatives[(mm + 1) * count + prev2];
+            }
+            derivatives[mm * count + t] = value;
+        }
+    }
+
+    // L_k = 1/k! sum_n (-1)^|n| M_n D_{n + k}
+    for (int k = 0; k < count; k++)
+    {
+        int kx = this->termX[k], ky = this->termY[k], kz = this->termZ[k];
+        int end = this->orderEnd[p - (kx + ky + kz)];
+        double sum = 0.0;
+
+        for (int n = 0; n < end; n++)
+        {
+            int index = this->termIndex[((this->termX[n] + kx) * side + (this->termY[n] + ky)) * side + (this->termZ[n] + kz)];
+            sum += this->termSign[n] * m[n] * derivatives[index];
+        }
+
+        l[k] += sum * this->termInvFactorial[k];
+    }
+}
+
+void FastMultipole::LocalToLocal(const Cell& parent, const Cell& child, const double* l, double* lChild) const
+{
+    double powX[MaxOrder + 1], powY[MaxOrder + 1], powZ[MaxOrder + 1];
+    this->Powers(child.local[0] - parent.local[0], child.local[1] - parent.local[1], child.local[2] - parent.local[2], powX, powY, powZ);
+
+    int p = this->order;
+    int side = p + 1;
+
+    // L_k(child) = sum_{n >= k} C(n, k) L_n d^(n - k)
+    for (int k = 0; k < this->termCount; k++)
+    {
+        int kx = this->termX[k], ky = this->termY[k], kz = this->termZ[k];
+        double sum = 0.0;
+
+        for (int nx = kx; nx <= p; nx++)
+        for (int ny = ky; ny <= p - nx; ny++)
+        for (int nz = kz; nz <= p - nx - ny; nz++)
+        {
+            int n = this->termIndex[(nx * side + ny) * side + nz];
+            double c = this->binomial[nx * side + kx] * this->binomial[ny * side + ky] * this->binomial[nz * side + kz];
+            sum += l[n] * c * powX[nx - kx] * powY[ny - ky] * powZ[nz - kz];
+        }
+
+        lChild[k] += sum;
+    }
+}
+
+void FastMultipole::LocalToParticle(const Cell& cell, const double* l, double G)
+{
+    double powX[MaxOrder + 1], powY[MaxOrder + 1], powZ[MaxOrder + 1];
+
+    for (int i = cell.first; i < cell.first + cell.count; i++)
+    {
+        this->Powers(this->px[i] - cell.local[0], this->py[i] - cell.local[1], this->pz[i] - cell.local[2], powX, powY, powZ);
+
+        // a = G grad(sum_k L_k (x - c)^k)
+        double gx = 0.0, gy = 0.0, gz = 0.0;
+        for (int k = 1; k < this->termCount; k++)
+        {
+            int kx = this->termX[k], ky = this->termY[k], kz = this->termZ[k];
+            if (kx > 0) gx += l[k] * kx * powX[kx - 1] * powY[ky] * powZ[kz];
+            if (ky > 0) gy += l[k] * ky * powX[kx] * powY[ky - 1] * powZ[kz];
+            if (kz > 0) gz += l[k] * kz * powX[kx] * powY[ky] * powZ[kz - 1];
+        }
+
+        this->ax[i] += G * gx;
+        this->ay[i] += G * gy;
+        this->az[i] += G * gz;
+    }
+}
+
+void FastMultipole::ParticleToParticle(const Cell& target, const Cell& source, double G)
+{
+    for (int i = target.first; i < target.first + target.count; i++)
+    {
+        double gx = 0.0, gy = 0.0, gz = 0.0;
+
+        for (int j = source.first; j < source.first + source.count; j++)
+        {
+            if (i == j || this->pm[j] == 0.0) continue;
+
+            double dx = this->px[j] - this->px[i];
+            double dy = this->py[j] - this->py[i];
+            double dz = this->pz[j] - this->pz[i];
+            double r2 = dx * dx + dy * dy + dz * dz + this->softeningSqr;
+            if (r2 == 0.0) continue;
+
+            double scale = this->pm[j] / (r2 * std::sqrt(r2));
+            gx += dx * scale;
+            gy += dy * scale;
+            gz += dz * scale;
+        }
+
+        this->ax[i] += G * gx;
+        this->ay[i] += G * gy;
+        this->az[i] += G * gz;
+    }
+}
+
+void FastMultipole::Compute(const Vector3* positions, const float* masses, int count, float G,
+    Vector3* accelerations, ThreadPool& pool)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    this->BuildTree(positions, masses, count);
+
+    int cellCount = (int)this->cells.size();
+    int terms = this->termCount;
+    this->multipoles.assign((size_t)cellCount * terms, 0.0);
+    this->locals.assign((size_t)cellCount * terms, 0.0);
+    this->ax.assign(count, 0.0);
+    this->ay.assign(count, 0.0);
+    this->az.assign(count, 0.0);
+
+    // Upward pass: P2M at the leaves, M2M towards the root, one level at a time
+    for (int level = (int)this->levels.size() - 1; level >= 0; level--)
+    {
+        const std::vector<int>& levelCells = this->levels[level];
+        pool.ParallelFor((int)levelCells.size(), 16, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                const Cell& cell = this->cells[levelCells[i]];
+                double* m = &this->multipoles[(size_t)levelCells[i] * terms];
+
+                if (cell.firstChild < 0)
+                {
+                    this->ParticleToMultipole(cell, m);
+                    continue;
+                }
+
+                for (int c = cell.firstChild; c < cell.firstChild + cell.childCount; c++)
+                {
+                    this->MultipoleToMultipole(this->cells[c], cell, &this->multipoles[(size_t)c * terms], m);
+                }
+            }
+        });
+    }
+
+    // Interaction lists, recorded per target cell
+    this->m2lList.resize(cellCount);
+    this->p2pList.resize(cellCount);
+    for (int c = 0; c < cellCount; c++)
+    {
+        this->m2lList[c].clear();
+        this->p2pList[c].clear();
+    }
+    this->Interact(0, 0);
+
+    // M2L: every target cell only writes its own local expansion
+    pool.ParallelFor(cellCount, 32, [&](int begin, int end)
+    {
+        std::vector<double> derivatives((size_t)(this->order + 1) * terms);
+
+        for (int c = begin; c < end; c++)
+        {
+            double* l = &this->locals[(size_t)c * terms];
+            for (int source : this->m2lList[c])
+            {
+                this->MultipoleToLocal(this->cells[c], this->cells[source], &this->multipoles[(size_t)source * terms], l, derivatives.data());
+            }
+        }
+    });
+
+    // Downward pass: L2L from the root to the leaves
+    for (int level = 0; level < (int)this->levels.size(); level++)
+    {
+        const std::vector<int>& levelCells = this->levels[level];
+        pool.ParallelFor((int)levelCells.size(), 16, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                const Cell& cell = this->cells[levelCells[i]];
+                const double* l = &this->locals[(size_t)levelCells[i] * terms];
+
+                for (int c = cell.firstChild; c < cell.firstChild + cell.childCount; c++)
+                {
+                    this->LocalToLocal(cell, this->cells[c], l, &this->locals[(size_t)c * terms]);
+                }
+            }
+        });
+    }
+
+    // Leaves: far field from L2P, near field from P2P
+    pool.ParallelFor((int)this->leaves.size(), 8, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            int c = this->leaves[i];
+            const Cell& cell = this->cells[c];
+
+            this->LocalToParticle(cell, &this->locals[(size_t)c * terms], G);
+            for (int source : this->p2pList[c])
+            {
+                this->ParticleToParticle(cell, this->cells[source], G);
+            }
+        }
+    });
+
+    for (int i = 0; i < count; i++)
+    {
+        accelerations[this->sortedIndex[i]] = { (float)this->ax[i], (float)this->ay[i], (float)this->az[i] };
+    }
+}
+
+void FastMultipole::ComputeDirect(const Vector3* positions, const float* masses, int count, float G, float softening,
+    const int* targets, int targetCount, Vector3* accelerations, ThreadPool& pool)
+{
+    double softeningSqr = (double)softening * softening;
+
+    pool.ParallelFor(targetCount, 16, [&](int begin, int end)
+    {
+        for (int t = begin; t < end; t++)
+        {
+            int i = targets[t];
+            double gx = 0.0, gy = 0.0, gz = 0.0;
+
+            for (int j = 0; j < count; j++)
+            {
+                if (i == j || masses[j] == 0.0f) continue;
+
+                double dx = (double)positions[j].x - positions[i].x;
+                double dy = (double)positions[j].y - positions[i].y;
+                double dz = (double)positions[j].z - positions[i].z;
+                double r2 = dx * dx + dy * dy + dz * dz + softeningSqr;
+                if (r2 == 0.0) continue;
+
+                double scale = masses[j] / (r2 * std::sqrt(r2));
+                gx += dx * scale;
+                gy += dy * scale;
+                gz += dz * scale;
+            }
+
+            accelerations[t] = { (float)(G * gx), (float)(G * gy), (float)(G * gz) };
+        }
+    });
+}
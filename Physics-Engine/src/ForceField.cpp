@@ -0,0 +1,181 @@
+#include "ForceField.h"
+
+#include <algorithm>
+
+#include "MemoryAccounting.h"
+
+int ForceFields::Add(const ForceField& field)
+{
+    if (!Valid(field))
+    {
+        return -1;
+    }
+
+    this->fields.push_back(field);
+    return (int)this->fields.size() - 1;
+}
+
+bool ForceFields::Remove(int index)
+{
+    if (index < 0 || index >= (int)this->fields.size())
+    {
+        return false;
+    }
+
+    this->fields.erase(this->fields.begin() + index);
+    return true;
+}
+
+bool ForceFields::Valid(const ForceField& field)
+{
+    if (field.Type < UniformField || field.Type > CustomField)
+    {
+        return false;
+    }
+
+    if (field.Bounded && (field.Bounds.Min.x > field.Bounds.Max.x || field.Bounds.Min.y > field.Bounds.Max.y ||
+        field.Bounds.Min.z > field.Bounds.Max.z))
+    {
+        return false;
+    }
+
+    switch (field.Type)
+    {
+    case RadialField:
+        return field.MinDistance > 0.0f;
+    case DragField:
+        return field.Linear >= 0.0f && field.Quadratic >= 0.0f;
+    case CustomField:
+        return (bool)field.Callback;
+    default:
+        return true;
+    }
+}
+
+void ForceFields::Apply(const Vector3* positions, const Vector3* velocities, const float* invMasses, const uint32_t* layers, uint32_t layer,
+    int count, float time, Vector3* accelerations, ThreadPool& pool) const
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    if (this->fields.empty() || time <= 0.0f)
+    {
+        std::fill(accelerations, accelerations + count, Vector3Zero());
+        return;
+    }
+
+    pool.ParallelFor(count, Chunk, [&](int begin, int end)
+    {
+        // Inline calls get the whole range, so it is split again to keep each pass in cache
+        for (int first = begin; first < end; first += Chunk)
+        {
+            int last = std::min(first + Chunk, end);
+            std::fill(accelerations + first, accelerations + last, Vector3Zero());
+
+            // Plain comparisons rather than AABB::ExpandToInclude, whose fminf is not inlined everywhere
+            AABB bounds(positions[first], positions[first]);
+            for (int i = first + 1; i < last; i++)
+            {
+                Vector3 p = positions[i];
+                bounds.Min.x = p.x < bounds.Min.x ? p.x : bounds.Min.x;
+                bounds.Min.y = p.y < bounds.Min.y ? p.y : bounds.Min.y;
+                bounds.Min.z = p.z < bounds.Min.z ? p.z : bounds.Min.z;
+                bounds.Max.x = p.x > bounds.Max.x ? p.x : bounds.Max.x;
+                bounds.Max.y = p.y > bounds.Max.y ? p.y : bounds.Max.y;
+                bounds.Max.z = p.z > bounds.Max.z ? p.z : bounds.Max.z;
+            }
+
+            for (const ForceField& field : this->fields)
+            {
+                // Bounds touching only on a face still count, unlike AABB::Intersects
+                if (field.Bounded && (bounds.Max.x < field.Bounds.Min.x || bounds.Min.x > field.Bounds.Max.x ||
+                    bounds.Max.y < field.Bounds.Min.y || bounds.Min.y > field.Bounds.Max.y ||
+                    bounds.Max.z < field.Bounds.Min.z || bounds.Min.z > field.Bounds.Max.z))
+                {
+                    continue;
+                }
+
+                ApplyField(field, positions, velocities, invMasses, layers, layer, first, last, time, accelerations);
+            }
+        }
+    });
+}
+
+void ForceFields::ApplyField(const ForceField& field, const Vector3* positions, const Vector3* velocities, const float* invMasses,
+    const uint32_t* layers, uint32_t layer, int begin, int end, float time, Vector3* accelerations)
+{
+    // 1 for the bodies the field acts on, 0 for the others, which the loops below scale by
+    float weights[Chunk];
+    AABB region = field.Bounds;
+    for (int i = begin; i < end; i++)
+    {
+        Vector3 p = positions[i];
+        bool inside = !field.Bounded || (p.x >= region.Min.x && p.x <= region.Max.x && p.y >= region.Min.y &&
+            p.y <= region.Max.y && p.z >= region.Min.z && p.z <= region.Max.z);
+        bool masked = ((layers != nullptr ? layers[i] : layer) & field.Mask) != 0;
+        weights[i - begin] = inside && masked && invMasses[i] > 0.0f ? 1.0f : 0.0f;
+    }
+
+    switch (field.Type)
+    {
+    case UniformField:
+        for (int i = begin; i < end; i++)
+        {
+            accelerations[i] = Vector3Add(accelerations[i], Vector3Scale(field.Acceleration, weights[i - begin]));
+        }
+        break;
+
+    case RadialField:
+    {
+        float minDistanceSqr = field.MinDistance * field.MinDistance;
+        bool inverseSquare = field.Falloff == 2.0f;
+        for (int i = begin; i < end; i++)
+        {
+            Vector3 delta = Vector3Subtract(field.Center, positions[i]);
+            float distanceSqr = Vector3LengthSqr(delta);
+            float clampedSqr = distanceSqr > minDistanceSqr ? distanceSqr : minDistanceSqr;
+            float magnitude = inverseSquare ? 1.0f / clampedSqr : powf(clampedSqr, -0.5f * field.Falloff);
+            // delta / |delta| is the direction, a body on the center is not pulled
+            float scale = distanceSqr > 0.0f ? field.Strength * magnitude / sqrtf(distanceSqr) : 0.0f;
+            accelerations[i] = Vector3Add(accelerations[i], Vector3Scale(delta, scale * weights[i - begin]));
+        }
+        break;
+    }
+
+    case DragField:
+    {
+        float inverseTime = 1.0f / time;
+        for (int i = begin; i < end; i++)
+        {
+            Vector3 relative = Vector3Subtract(velocities[i], field.FlowVelocity);
+            float speed = Vector3Length(relative);
+            // At most the whole relative velocity is taken away within the step
+            float rate = (field.Linear + field.Quadratic * speed) * invMasses[i];
+            rate = rate < inverseTime ? rate : inverseTime;
+            accelerations[i] = Vector3Subtract(accelerations[i], Vector3Scale(relative, rate * weights[i - begin]));
+        }
+        break;
+    }
+
+    case CustomField:
+    {
+        Vector3 custom[Chunk];
+        int count = end - begin;
+        std::fill(custom, custom + count, Vector3Zero());
+        field.Callback(positions + begin, velocities + begin, invMasses + begin, count, custom);
+        // Selected rather than scaled, so whatever the callback left for the others is dropped
+        for (int i = begin; i < end; i++)
+        {
+            if (weights[i - begin] > 0.0f) accelerations[i] = Vector3Add(accelerations[i], custom[i - begin]);
+        }
+        break;
+    }
+    }
+}
+
+size_t ForceFields::MemoryBytes() const
+{
+    return VectorBytes(this->fields);
+}
@@ -0,0 +1,85 @@
+#include "Frustum.h"
+
+namespace
+{
+    Vector4 NormalizePlane(float a, float b, float c, float d)
+    {
+        float length = sqrtf(a * a + b * b + c * c);
+        if (length == 0.0f)
+        {
+            return { 0.0f, 0.0f, 0.0f, d };
+        }
+        return { a / length, b / length, c / length, d / length };
+    }
+}
+
+Frustum Frustum::FromMatrix(const Matrix& m)
+{
+    // Rows of the matrix: row i is (m[i], m[i + 4], m[i + 8], m[i + 12])
+    Frustum frustum;
+    frustum.Planes[0] = NormalizePlane(m.m3 + m.m0, m.m7 + m.m4, m.m11 + m.m8, m.m15 + m.m12);  // left
+    frustum.Planes[1] = NormalizePlane(m.m3 - m.m0, m.m7 - m.m4, m.m11 - m.m8, m.m15 - m.m12);  // right
+    frustum.Planes[2] = NormalizePlane(m.m3 + m.m1, m.m7 + m.m5, m.m11 + m.m9, m.m15 + m.m13);  // bottom
+    frustum.Planes[3] = NormalizePlane(m.m3 - m.m1, m.m7 - m.m5, m.m11 - m.m9, m.m15 - m.m13);  // top
+    frustum.Planes[4] = NormalizePlane(m.m3 + m.m2, m.m7 + m.m6, m.m11 + m.m10, m.m15 + m.m14); // near
+    frustum.Planes[5] = NormalizePlane(m.m3 - m.m2, m.m7 - m.m6, m.m11 - m.m10, m.m15 - m.m14); // far
+    return frustum;
+}
+
+Frustum Frustum::FromCamera(const Camera& camera, float aspect, float nearPlane, float farPlane)
+{
+    Matrix view = MatrixLookAt(camera.position, camera.target, camera.up);
+    Matrix projection;
+
+    if (camera.projection == CAMERA_ORTHOGRAPHIC)
+    {
+        double top = camera.fovy / 2.0;
+        double right = top * aspect;
+        projection = MatrixOrtho(-right, right, -top, top, nearPlane, farPlane);
+    }
+    else
+    {
+        projection = MatrixPerspective(camera.fovy * DEG2RAD, aspect, nearPlane, farPlane);
+    }
+
+    return FromMatrix(MatrixMultiply(view, projection));
+}
+
+CullResult Frustum::TestAABB(const AABB& box) const
+{
+    CullResult result = CullInside;
+
+    for (const Vector4& plane : this->Planes)
+    {
+        // Corner farthest along the normal, and the one farthest against it
+        float front = plane.x * (plane.x >= 0.0f ? box.Max.x : box.Min.x)
+            + plane.y * (plane.y >= 0.0f ? box.Max.y : box.Min.y)
+            + plane.z * (plane.z >= 0.0f ? box.Max.z : box.Min.z) + plane.w;
+        if (front < 0.0f)
+        {
+            return CullOutside;
+        }
+
+        float back = plane.x * (plane.x >= 0.0f ? box.Min.x : box.Max.x)
+            + plane.y * (plane.y >= 0.0f ? box.Min.y : box.Max.y)
+            + plane.z * (plane.z >= 0.0f ? box.Min.z : box.Max.z) + plane.w;
+        if (back < 0.0f)
+        {
+            result = CullIntersect;
+        }
+    }
+
+    return result;
+}
+
+bool Frustum::ContainsSphere(Vector3 center, float radius) const
+{
+    for (const Vector4& plane : this->Planes)
+    {
+        if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius)
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,487 @@
+#include "HierarchicalGrid.h"
+#include <algorithm>
+
+#include "MemoryAccounting.h"
+
+namespace
+{
+    bool Overlap(const AABB& a, const AABB& b)
+    {
+        return !(a.Max.x <= b.Min.x || b.Max.x <= a.Min.x ||
+            a.Max.y <= b.Min.y || b.Max.y <= a.Min.y ||
+            a.Max.z <= b.Min.z || b.Max.z <= a.Min.z);
+    }
+
+    // Lowest corner of the overlap of two boxes; the pair is reported by the cell holding it,
+    // which both boxes are inserted in
+    Vector3 OverlapCorner(const AABB& a, const AABB& b)
+    {
+        return { fmaxf(a.Min.x, b.Min.x), fmaxf(a.Min.y, b.Min.y), fmaxf(a.Min.z, b.Min.z) };
+    }
+
+    size_t Slot(uint64_t key, size_t mask)
+    {
+        return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    }
+}
+
+HierarchicalGrid::HierarchicalGrid()
+{
+    this->SetCellSize(1.0f);
+}
+
+void HierarchicalGrid::SetCellSize(float size)
+{
+    this->cellSize = size > 0.0f ? size : 1.0f;
+
+    for (int level = 0; level < MaxLevels; level++)
+    {
+        this->inverseSize[level] = 1.0f / ldexpf(this->cellSize, level);
+    }
+}
+
+void HierarchicalGrid::FitCellSize(const AABB* bounds, int count)
+{
+    if (count <= 0) return;
+
+    this->extents.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        Vector3 size = bounds[i].GetSize();
+        this->extents[i] = fmaxf(size.x, fmaxf(size.y, size.z));
+    }
+
+    auto middle = this->extents.begin() + count / 2;
+    std::nth_element(this->extents.begin(), middle, this->extents.end());
+    float median = *middle;
+    if (!(median > 0.0f)) return;
+
+    // Smallest power of two >= twice the median
+    int exponent;
+    float mantissa = frexpf(median, &exponent);
+    float size = ldexpf(1.0f, mantissa == 0.5f ? exponent : exponent + 1);
+
+    if (size != this->cellSize)
+    {
+        this->SetCellSize(size);
+    }
+}
+
+int HierarchicalGrid::LevelCount() const
+{
+    for (int level = MaxLevels - 1; level >= 0; level--)
+    {
+        if (!this->levelBodies[level].empty()) return level + 1;
+    }
+    return 0;
+}
+
+size_t HierarchicalGrid::MemoryBytes() const
+{
+    size_t bytes = VectorBytes(this->bounds) + VectorBytes(this->records) + VectorBytes(this->cells) +
+        VectorBytes(this->table) + VectorBytes(this->pairs) + VectorBytes(this->moved) +
+        VectorBytes(this->movedList) + VectorBytes(this->extents);
+
+    for (const std::vector<int>& level : this->levelBodies)
+    {
+        bytes += VectorBytes(level);
+    }
+
+    for (const Cell& cell : this->cells)
+    {
+        bytes += VectorBytes(cell.Bodies);
+    }
+    return bytes;
+}
+
+void HierarchicalGrid::Clear()
+{
+    ReleaseVector(this->bounds);
+    ReleaseVector(this->records);
+    ReleaseVector(this->cells);
+    ReleaseVector(this->table);
+    ReleaseVector(this->pairs);
+    ReleaseVector(this->moved);
+    ReleaseVector(this->movedList);
+    ReleaseVector(this->extents);
+    for (std::vector<int>& level : this->levelBodies)
+    {
+        ReleaseVector(level);
+    }
+    this->liveCells = 0;
+}
+
+uint64_t HierarchicalGrid::CellKey(int level, int x, int y, int z)
+{
+    // 20 bits per axis; far cells wrap onto each other, which only adds candidates
+    return ((uint64_t)level << 60) | ((uint64_t)(x & 0xFFFFF) << 40) | ((uint64_t)(y & 0xFFFFF) << 20) | (uint64_t)(z & 0xFFFFF);
+}
+
+int HierarchicalGrid::CellCoordinate(float value, int level) const
+{
+    float cell = floorf(value * this->inverseSize[level]);
+    return (int)Clamp(cell, -1073741824.0f, 1073741824.0f);
+}
+
+uint64_t HierarchicalGrid::PointKey(Vector3 point, int level) const
+{
+    return CellKey(level, this->CellCoordinate(point.x, level), this->CellCoordinate(point.y, level), this->CellCoordinate(point.z, level));
+}
+
+int HierarchicalGrid::FindCell(uint64_t key) const
+{
+    if (this->table.empty()) return -1;
+    size_t mask = this->table.size() - 1;
+
+    for (size_t slot = Slot(key, mask); this->table[slot] >= 0; slot = (slot + 1) & mask)
+    {
+        if (this->cells[this->table[slot]].Key == key) return this->table[slot];
+    }
+    return -1;
+}
+
+int HierarchicalGrid::AddCell(uint64_t key)
+{
+    int cell = this->FindCell(key);
+    if (cell >= 0) return cell;
+
+    // At most half full
+    if ((this->cells.size() + 1) * 2 > this->table.size())
+    {
+        this->Rehash(std::max((size_t)16, this->table.size() * 2));
+    }
+
+    size_t mask = this->table.size() - 1;
+    size_t slot = Slot(key, mask);
+    while (this->table[slot] >= 0)
+    {
+        slot = (slot + 1) & mask;
+    }
+    this->table[slot] = (int)this->cells.size();
+    this->cells.push_back({ key, {} });
+    return (int)this->cells.size() - 1;
+}
+
+void HierarchicalGrid::Rehash(size_t capacity)
+{
+    this->table.assign(capacity, -1);
+
+    for (int c = 0; c < (int)this->cells.size(); c++)
+    {
+        size_t slot = Slot(this->cells[c].Key, capacity - 1);
+        while (this->table[slot] >= 0)
+        {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        this->table[slot] = c;
+    }
+}
+
+HierarchicalGrid::Record HierarchicalGrid::Locate(const AABB& box) const
+{
+    Record record;
+    Vector3 size = box.GetSize();
+    float extent = fmaxf(size.x, fmaxf(size.y, size.z));
+
+    // Cells at least twice the size of the body: it mostly overlaps one or two per axis
+    int level = 0;
+    while (level < MaxLevels - 1 && extent * this->inverseSize[level] > 0.5f)
+    {
+        level++;
+    }
+
+    record.Level = level;
+    record.Min[0] = this->CellCoordinate(box.Min.x, level);
+    record.Min[1] = this->CellCoordinate(box.Min.y, level);
+    record.Min[2] = this->CellCoordinate(box.Min.z, level);
+    record.Max[0] = this->CellCoordinate(box.Max.x, level);
+    record.Max[1] = this->CellCoordinate(box.Max.y, level);
+    record.Max[2] = this->CellCoordinate(box.Max.z, level);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (record.Max[axis] - record.Min[axis] >= MaxSpan)
+        {
+            record.Level = Oversized;
+        }
+    }
+    return record;
+}
+
+void HierarchicalGrid::Insert(int body)
+{
+    Record& record = this->records[body];
+    std::vector<int>& level = this->levelBodies[record.Level];
+    record.LevelSlot = (int)level.size();
+    level.push_back(body);
+
+    if (record.Level == Oversized) return;
+
+    for (int z = record.Min[2]; z <= record.Max[2]; z++)
+    for (int y = record.Min[1]; y <= record.Max[1]; y++)
+    for (int x = record.Min[0]; x <= record.Max[0]; x++)
+    {
+        std::vector<int>& bodies = this->cells[this->AddCell(CellKey(record.Level, x, y, z))].Bodies;
+        if (bodies.empty()) this->liveCells++;
+        bodies.push_back(body);
+    }
+}
+
+void HierarchicalGrid::Erase(int body)
+{
+    Record& record = this->records[body];
+    std::vector<int>& level = this->levelBodies[record.Level];
+    int last = level.back();
+    level[record.LevelSlot] = last;
+    this->records[last].LevelSlot = record.LevelSlot;
+    level.pop_back();
+
+    if (record.Level == Oversized) return;
+
+    for (int z = record.Min[2]; z <= record.Max[2]; z++)
+    for (int y = record.Min[1]; y <= record.Max[1]; y++)
+    for (int x = record.Min[0]; x <= record.Max[0]; x++)
+    {
+        std::vector<int>& bodies = this->cells[this->FindCell(CellKey(record.Level, x, y, z))].Bodies;
+        *std::find(bodies.begin(), bodies.end(), body) = bodies.back();
+        bodies.pop_back();
+        if (bodies.empty()) this->liveCells--;
+    }
+}
+
+void HierarchicalGrid::Build(const AABB* bounds, int count, const int* dynamic, int dynamicCount)
+{
+    this->bounds.assign(bounds, bounds + count);
+    this->records.assign(count, Record());
+    this->moved.assign(count, 0);
+
+    for (int i = 0; i < dynamicCount; i++)
+    {
+        this->records[dynamic[i]].Dynamic = true;
+    }
+
+    this->Rebuild();
+}
+
+void HierarchicalGrid::Rebuild()
+{
+    this->cells.clear();
+    this->table.clear();
+    this->liveCells = 0;
+    for (std::vector<int>& level : this->levelBodies)
+    {
+        level.clear();
+    }
+
+    for (int i = 0; i < (int)this->bounds.size(); i++)
+    {
+        bool dynamic = this->records[i].Dynamic;
+        this->records[i] = this->Locate(this->bounds[i]);
+        this->records[i].Dynamic = dynamic;
+        this->Insert(i);
+    }
+
+    this->pairs.clear();
+    this->FindAllPairs();
+}
+
+void HierarchicalGrid::Update(const AABB* bounds, const int* dynamic, int dynamicCount)
+{
+    this->movedList.clear();
+
+    for (int d = 0; d < dynamicCount; d++)
+    {
+        int i = dynamic[d];
+        const AABB& box = bounds[i];
+        AABB& last = this->bounds[i];
+
+        if (box.Min.x == last.Min.x && box.Min.y == last.Min.y && box.Min.z == last.Min.z &&
+            box.Max.x == last.Max.x && box.Max.y == last.Max.y && box.Max.z == last.Max.z)
+        {
+            continue;
+        }
+
+        last = box;
+        this->moved[i] = 1;
+        this->movedList.push_back(i);
+
+        // Cell membership only changes when the cell range does
+        Record record = this->Locate(box);
+        Record& current = this->records[i];
+        if (record.Level != current.Level ||
+            record.Min[0] != current.Min[0] || record.Min[1] != current.Min[1] || record.Min[2] != current.Min[2] ||
+            record.Max[0] != current.Max[0] || record.Max[1] != current.Max[1] || record.Max[2] != current.Max[2])
+        {
+            this->Erase(i);
+            record.Dynamic = true;
+            current = record;
+            this->Insert(i);
+        }
+    }
+
+    if (this->cells.size() > (size_t)this->liveCells * 4 + 1024)
+    {
+        // Mostly cells the bodies have left
+        this->Rebuild();
+    }
+    else if (this->movedList.size() * 2 > this->bounds.size())
+    {
+        // Most bodies moved: redoing every pair is cheaper than replacing them body by body
+        this->pairs.clear();
+        this->FindAllPairs();
+    }
+    else if (!this->movedList.empty())
+    {
+        size_t kept = 0;
+        for (const std::pair<int, int>& pair : this->pairs)
+        {
+            if (this->moved[pair.first] || this->moved[pair.second]) continue;
+            this->pairs[kept++] = pair;
+        }
+        this->pairs.resize(kept);
+
+        for (int i : this->movedList)
+        {
+            this->FindBodyPairs(i);
+        }
+    }
+
+    for (int i : this->movedList)
+    {
+        this->moved[i] = 0;
+    }
+}
+
+void HierarchicalGrid::AddPair(int a, int b)
+{
+    if (!this->records[a].Dynamic && !this->records[b].Dynamic) return;
+    this->pairs.push_back({ std::min(a, b), std::max(a, b) });
+}
+
+void HierarchicalGrid::FindAllPairs()
+{
+    // Pairs on the same level
+    for (const Cell& cell : this->cells)
+    {
+        int level = (int)(cell.Key >> 60);
+        const std::vector<int>& bodies = cell.Bodies;
+
+        for (int a = 0; a + 1 < (int)bodies.size(); a++)
+        {
+            int i = bodies[a];
+            const AABB& boxA = this->bounds[i];
+
+            for (int b = a + 1; b < (int)bodies.size(); b++)
+            {
+                int j = bodies[b];
+                const AABB& boxB = this->bounds[j];
+
+                if (!Overlap(boxA, boxB)) continue;
+                if (this->PointKey(OverlapCorner(boxA, boxB), level) != cell.Key) continue;
+                this->AddPair(i, j);
+            }
+        }
+    }
+
+    // Every body against the coarser levels, where it spans at most 2 x 2 x 2 cells
+    for (int i = 0; i < (int)this->bounds.size(); i++)
+    {
+        int bodyLevel = this->records[i].Level;
+        if (bodyLevel == Oversized) continue;
+
+        const AABB& box = this->bounds[i];
+
+        for (int level = bodyLevel + 1; level < MaxLevels; level++)
+        {
+            if (this->levelBodies[level].empty()) continue;
+
+            int minX = this->CellCoordinate(box.Min.x, level), maxX = this->CellCoordinate(box.Max.x, level);
+            int minY = this->CellCoordinate(box.Min.y, level), maxY = this->CellCoordinate(box.Max.y, level);
+            int minZ = this->CellCoordinate(box.Min.z, level), maxZ = this->CellCoordinate(box.Max.z, level);
+
+            for (int z = minZ; z <= maxZ; z++)
+            for (int y = minY; y <= maxY; y++)
+            for (int x = minX; x <= maxX; x++)
+            {
+                uint64_t key = CellKey(level, x, y, z);
+                int cell = this->FindCell(key);
+                if (cell < 0) continue;
+
+                for (int j : this->cells[cell].Bodies)
+                {
+                    const AABB& other = this->bounds[j];
+
+                    if (!Overlap(box, other)) continue;
+                    if (this->PointKey(OverlapCorner(box, other), level) != key) continue;
+                    this->AddPair(i, j);
+                }
+            }
+        }
+    }
+
+    // Oversized bodies against everything
+    for (int i : this->levelBodies[Oversized])
+    {
+        for (int j = 0; j < (int)this->bounds.size(); j++)
+        {
+            if (j == i || (this->records[j].Level == Oversized && j < i)) continue;
+            if (!Overlap(this->bounds[i], this->bounds[j])) continue;
+            this->AddPair(i, j);
+        }
+    }
+}
+
+void HierarchicalGrid::FindBodyPairs(int body)
+{
+    const AABB& box = this->bounds[body];
+
+    // Two moved bodies find each other, the lower index keeps the pair
+    auto visit = [&](int j)
+    {
+        if (j == body || (this->moved[j] && j < body)) return;
+        if (!Overlap(box, this->bounds[j])) return;
+        this->AddPair(body, j);
+    };
+
+    for (int level = 0; level < MaxLevels; level++)
+    {
+        const std::vector<int>& levelBodies = this->levelBodies[level];
+        if (levelBodies.empty()) continue;
+
+        int minX = this->CellCoordinate(box.Min.x, level), maxX = this->CellCoordinate(box.Max.x, level);
+        int minY = this->CellCoordinate(box.Min.y, level), maxY = this->CellCoordinate(box.Max.y, level);
+        int minZ = this->CellCoordinate(box.Min.z, level), maxZ = this->CellCoordinate(box.Max.z, level);
+
+        // On levels much finer than the body its cell range can hold more cells than the level
+        // holds bodies: the bodies are cheaper to test directly then
+        double cellCount = (double)(maxX - minX + 1) * (maxY - minY + 1) * (maxZ - minZ + 1);
+        if (cellCount > (double)levelBodies.size())
+        {
+            for (int j : levelBodies)
+            {
+                visit(j);
+            }
+            continue;
+        }
+
+        for (int z = minZ; z <= maxZ; z++)
+        for (int y = minY; y <= maxY; y++)
+        for (int x = minX; x <= maxX; x++)
+        {
+            uint64_t key = CellKey(level, x, y, z);
+            int cell = this->FindCell(key);
+            if (cell < 0) continue;
+
+            for (int j : this->cells[cell].Bodies)
+            {
+                if (this->PointKey(OverlapCorner(box, this->bounds[j]), level) != key) continue;
+                visit(j);
+            }
+        }
+    }
+
+    for (int j : this->levelBodies[Oversized])
+    {
+        visit(j);
+    }
+}
@@ -0,0 +1,241 @@
+#include "InstancedRenderer.h"
+#include <rlgl.h>
+#include <algorithm>
+
+namespace
+{
+    // rlSetVertexAttribute takes the offset as an int since raylib 5.5, as a pointer before
+    void SetInstanceAttribute(int location, int size, int stride, int offset)
+    {
+        rlEnableVertexAttribute(location);
+#if (RAYLIB_VERSION_MAJOR > 5) || (RAYLIB_VERSION_MAJOR == 5 && RAYLIB_VERSION_MINOR >= 5)
+        rlSetVertexAttribute(location, size, RL_FLOAT, false, stride, offset);
+#else
+        rlSetVertexAttribute(location, size, RL_FLOAT, false, stride, (const void*)(size_t)offset);
+#endif
+        rlSetVertexAttributeDivisor(location, 1);
+    }
+}
+
+InstancedRenderer::~InstancedRenderer()
+{
+    this->Unload();
+}
+
+void InstancedRenderer::Load(Shader shader)
+{
+    this->Unload();
+
+    this->material = LoadMaterialDefault();
+    this->material.shader = shader;
+
+    // Rings and slices per sphere level of detail
+    const int segments[SphereLodCount] = { 20, 10, 6 };
+    for (int lod = 0; lod < SphereLodCount; lod++)
+    {
+        this->batches[lod].mesh = GenMeshSphere(1, segments[lod], segments[lod]);
+    }
+    this->batches[SphereLodCount].mesh = GenMeshCube(1, 1, 1);
+
+    this->transformLocation = GetShaderLocationAttrib(shader, "instanceTransform");
+    this->colorLocation = GetShaderLocationAttrib(shader, "instanceColor");
+    this->instancedLocation = GetShaderLocation(shader, "instanced");
+    this->loaded = true;
+}
+
+void InstancedRenderer::Unload()
+{
+    if (!this->loaded)
+    {
+        return;
+    }
+
+    for (Batch& batch : this->batches)
+    {
+        if (batch.buffer != 0) rlUnloadVertexBuffer(batch.buffer);
+        UnloadMesh(batch.mesh);
+        batch = Batch();
+    }
+
+    // The shader belongs to the caller, so only the maps of the default material are released
+    MemFree(this->material.maps);
+    this->material = {};
+    this->loaded = false;
+}
+
+void InstancedRenderer::Build(std::vector<Body>& bodies)
+{
+    for (Batch& batch : this->batches)
+    {
+        batch.instances.clear();
+    }
+
+    for (Body& body : bodies)
+    {
+        this->AddInstance(body, body.shapeType == Box ? SphereLodCount : 0);
+    }
+}
+
+void InstancedRenderer::Build(std::vector<Body>& bodies, const int* indices, int count, Vector3 eye)
+{
+    for (Batch& batch : this->batches)
+    {
+        batch.instances.clear();
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        Body& body = bodies[indices[i]];
+        this->AddInstance(body, body.shapeType == Box ? SphereLodCount : this->SphereLod(body, eye));
+    }
+}
+
+void InstancedRenderer::SetSphereLod(float medium, float low)
+{
+    this->lodThresholds[0] = fmaxf(medium, 0.0f);
+    this->lodThresholds[1] = Clamp(low, 0.0f, this->lodThresholds[0]);
+}
+
+int InstancedRenderer::InstanceCount(ShapeType shape) const
+{
+    if (shape == Box)
+    {
+        return (int)this->batches[SphereLodCount].instances.size();
+    }
+
+    int count = 0;
+    for (int lod = 0; lod < SphereLodCount; lod++)
+    {
+        count += (int)this->batches[lod].instances.size();
+    }
+    return count;
+}
+
+int InstancedRenderer::SphereLod(const Body& body, Vector3 eye) const
+{
+    // radius / distance > threshold, compared squared
+    float distanceSqr = Vector3DistanceSqr(body.Position(), eye);
+    float radiusSqr = body.Radius * body.Radius;
+
+    for (int lod = 0; lod < SphereLodCount - 1; lod++)
+    {
+        if (radiusSqr > this->lodThresholds[lod] * this->lodThresholds[lod] * distanceSqr)
+        {
+            return lod;
+        }
+    }
+    return SphereLodCount - 1;
+}
+
+void InstancedRenderer::AddInstance(Body& body, int batch)
+{
+    if (!body.DrawMesh || body.Mesh.meshCount > 0)
+    {
+        return;
+    }
+
+    Vector3 scale = body.shapeType == Box ? body.Size : Vector3{ body.Radius, body.Radius, body.Radius };
+    Matrix m = MatrixMultiply(MatrixScale(scale.x, scale.y, scale.z), body.GetWorldTransform());
+
+    Instance instance = {
+        { m.m0, m.m1, m.m2, m.m3, m.m4, m.m5, m.m6, m.m7, m.m8, m.m9, m.m10, m.m11, m.m12, m.m13, m.m14, m.m15 },
+        { body.color.r / 255.0f, body.color.g / 255.0f, body.color.b / 255.0f, body.color.a / 255.0f }
+    };
+    this->batches[batch].instances.push_back(instance);
+}
+
+void InstancedRenderer::Draw()
+{
+    this->drawCalls = 0;
+
+    if (!this->loaded)
+    {
+        return;
+    }
+
+    for (Batch& batch : this->batches)
+    {
+        this->DrawBatch(batch);
+    }
+}
+
+void InstancedRenderer::DrawBatch(Batch& batch)
+{
+    int count = (int)batch.instances.size();
+    if (count == 0)
+    {
+        return;
+    }
+
+    if (this->transformLocation < 0 || this->colorLocation < 0 || this->instancedLocation < 0 || batch.mesh.vaoId == 0)
+    {
+        // No instancing support in the shader: one draw per body
+        for (const Instance& instance : batch.instances)
+        {
+            const float* t = instance.transform;
+            Matrix m = { t[0], t[4], t[8], t[12], t[1], t[5], t[9], t[13], t[2], t[6], t[10], t[14], t[3], t[7], t[11], t[15] };
+            this->material.maps[MATERIAL_MAP_DIFFUSE].color = {
+                (unsigned char)(instance.color[0] * 255.0f), (unsigned char)(instance.color[1] * 255.0f),
+                (unsigned char)(instance.color[2] * 255.0f), (unsigned char)(instance.color[3] * 255.0f)
+            };
+            DrawMesh(batch.mesh, this->material, m);
+            this->drawCalls++;
+        }
+        return;
+    }
+
+    // The instance buffer lives in the mesh VAO and only grows
+    if (batch.buffer == 0 || count > batch.bufferCapacity)
+    {
+        if (batch.buffer != 0) rlUnloadVertexBuffer(batch.buffer);
+        batch.bufferCapacity = std::max(count, batch.bufferCapacity * 2);
+
+        rlEnableVertexArray(batch.mesh.vaoId);
+        batch.buffer = rlLoadVertexBuffer(nullptr, batch.bufferCapacity * (int)sizeof(Instance), true);
+        for (int i = 0; i < 4; i++)
+        {
+            SetInstanceAttribute(this->transformLocation + i, 4, sizeof(Instance), i * 4 * sizeof(float));
+        }
+        SetInstanceAttribute(this->colorLocation, 4, sizeof(Instance), 16 * sizeof(float));
+        rlDisableVertexBuffer();
+        rlDisableVertexArray();
+    }
+
+    rlUpdateVertexBuffer(batch.buffer, batch.instances.data(), count * (int)sizeof(Instance), 0);
+
+    Shader shader = this->material.shader;
+    rlEnableShader(shader.id);
+
+    int instanced = 1;
+    rlSetUniform(this->instancedLocation, &instanced, RL_SHADER_UNIFORM_INT, 1);
+
+    // The model matrix comes per instance, the uniform only holds view * projection
+    Matrix viewProjection = MatrixMultiply(MatrixMultiply(rlGetMatrixTransform(), rlGetMatrixModelview()), rlGetMatrixProjection());
+    rlSetUniformMatrix(shader.locs[SHADER_LOC_MATRIX_MVP], viewProjection);
+
+    int slot = 0;
+    rlActiveTextureSlot(0);
+    rlEnableTexture(this->material.maps[MATERIAL_MAP_DIFFUSE].texture.id);
+    if (shader.locs[SHADER_LOC_MAP_DIFFUSE] != -1)
+    {
+        rlSetUniform(shader.locs[SHADER_LOC_MAP_DIFFUSE], &slot, RL_SHADER_UNIFORM_INT, 1);
+    }
+
+    rlEnableVertexArray(batch.mesh.vaoId);
+    if (batch.mesh.indices != nullptr)
+    {
+        rlDrawVertexArrayElementsInstanced(0, batch.mesh.triangleCount * 3, 0, count);
+    }
+    else
+    {
+        rlDrawVertexArrayInstanced(0, batch.mesh.vertexCount, count);
+    }
+    rlDisableVertexArray();
+    rlDisableTexture();
+
+    instanced = 0;
+    rlSetUniform(this->instancedLocation, &instanced, RL_SHADER_UNIFORM_INT, 1);
+    rlDisableShader();
+
+    this->drawCalls++;
+}
@@ -0,0 +1,414 @@
+#include "LinearBVH.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <climits>
+
+#include "MemoryAccounting.h"
+
+namespace
+{
+    constexpr int MinChunk = 4096; // bodies per chunk of the center bounds and of the sort
+    constexpr int PairChunk = 256; // leaves per chunk of the pair search
+    constexpr int CodeBits = 30;
+
+    bool Overlap(const AABB& a, Vector3 min, Vector3 max)
+    {
+        return !(a.Max.x <= min.x || max.x <= a.Min.x ||
+            a.Max.y <= min.y || max.y <= a.Min.y ||
+            a.Max.z <= min.z || max.z <= a.Min.z);
+    }
+
+    // Spreads the low 10 bits of v so two zero bits follow each of them
+    uint32_t ExpandBits(uint32_t v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    uint32_t Quantize(float value, float low, float scale)
+    {
+        return (uint32_t)std::clamp((value - low) * scale, 0.0f, 1023.0f);
+    }
+
+    // First index of chunk c when count items are split in chunkCount chunks
+    int ChunkBegin(int c, int count, int chunkCount)
+    {
+        return (int)((int64_t)count * c / chunkCount);
+    }
+}
+
+void LinearBVH::Build(const AABB* bounds, const uint8_t* isStatic, int count, ThreadPool& pool)
+{
+    this->pairs.clear();
+    this->nodes.clear();
+
+    if (count < 2)
+    {
+        return;
+    }
+
+    // Bounds of the centers, one box per chunk merged afterwards
+    int chunkCount = std::clamp(count / MinChunk, 1, pool.ThreadCount());
+    std::vector<AABB> chunkBounds(chunkCount);
+    pool.ParallelFor(chunkCount, 1, [&](int begin, int end)
+    {
+        for (int c = begin; c < end; c++)
+        {
+            int first = ChunkBegin(c, count, chunkCount);
+            AABB box(bounds[first].GetCenter(), bounds[first].GetCenter());
+            for (int i = first + 1; i < ChunkBegin(c + 1, count, chunkCount); i++)
+            {
+                box.ExpandToInclude(bounds[i].GetCenter());
+            }
+            chunkBounds[c] = box;
+        }
+    });
+
+    AABB centers = chunkBounds[0];
+    for (int c = 1; c < chunkCount; c++)
+    {
+        centers.ExpandToInclude(chunkBounds[c]);
+    }
+
+    Vector3 size = centers.GetSize();
+    Vector3 scale = {
+        size.x > 0.0f ? 1024.0f / size.x : 0.0f,
+        size.y > 0.0f ? 1024.0f / size.y : 0.0f,
+        size.z > 0.0f ? 1024.0f / size.z : 0.0f
+    };
+
+    this->keys.resize(count);
+    pool.ParallelFor(count, MinChunk, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            Vector3 center = bounds[i].GetCenter();
+            uint32_t code = (ExpandBits(Quantize(center.x, centers.Min.x, scale.x)) << 2) |
+                (ExpandBits(Quantize(center.y, centers.Min.y, scale.y)) << 1) |
+                ExpandBits(Quantize(center.z, centers.Min.z, scale.z));
+            this->keys[i] = ((uint64_t)code << 32) | (uint32_t)i;
+        }
+    });
+
+    this->SortKeys(count, pool);
+
+    // Leaves in code order, then every inner node on its own
+    this->leafBounds.resize(count);
+    this->leafBody.resize(count);
+    this->leafParent.resize(count);
+    this->leafStatic.resize(count);
+    this->nodes.resize(count - 1);
+    this->nodeParent.resize(count - 1);
+    this->nodeLast.resize(count - 1);
+    this->visits.assign(count - 1, 0);
+    this->nodeParent[0] = -1;
+
+    pool.ParallelFor(count, MinChunk, [&](int begin, int end)
+    {
+        for (int leaf = begin; leaf < end; leaf++)
+        {
+            int body = (int)(uint32_t)this->keys[leaf];
+            this->leafBody[leaf] = body;
+            this->leafBounds[leaf] = bounds[body];
+            this->leafStatic[leaf] = isStatic[body];
+        }
+    });
+
+    pool.ParallelFor(count - 1, MinChunk, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            this->BuildNode(i, count);
+        }
+    });
+
+    pool.ParallelFor(count, MinChunk, [&](int begin, int end)
+    {
+        for (int leaf = begin; leaf < end; leaf++)
+        {
+            this->Refit(leaf);
+        }
+    });
+
+    // Fixed chunks with a pair list each, joined in chunk order
+    int pairChunks = (count + PairChunk - 1) / PairChunk;
+    if ((int)this->chunkPairs.size() < pairChunks)
+    {
+        this->chunkPairs.resize(pairChunks);
+    }
+
+    pool.ParallelFor(pairChunks, 1, [&](int begin, int end)
+    {
+        for (int c = begin; c < end; c++)
+        {
+            std::vector<std::pair<int, int>>& out = this->chunkPairs[c];
+            out.clear();
+            for (int leaf = c * PairChunk; leaf < std::min((c + 1) * PairChunk, count); leaf++)
+            {
+                if (!this->leafStatic[leaf])
+                {
+                    this->FindLeafPairs(leaf, out);
+                }
+            }
+        }
+    });
+
+    for (int c = 0; c < pairChunks; c++)
+    {
+        this->pairs.insert(this->pairs.end(), this->chunkPairs[c].begin(), this->chunkPairs[c].end());
+    }
+}
+
+size_t LinearBVH::MemoryBytes() const
+{
+    return VectorBytes(this->keys) + VectorBytes(this->sortScratch) + VectorBytes(this->histograms) +
+        VectorBytes(this->nodes) + VectorBytes(this->nodeParent) + VectorBytes(this->nodeLast) +
+        VectorBytes(this->visits) + VectorBytes(this->leafBounds) + VectorBytes(this->leafBody) +
+        VectorBytes(this->leafParent) + VectorBytes(this->leafStatic) + VectorBytes(this->chunkPairs) +
+        VectorBytes(this->pairs);
+}
+
+void LinearBVH::Clear()
+{
+    ReleaseVector(this->keys);
+    ReleaseVector(this->sortScratch);
+    ReleaseVector(this->histograms);
+    ReleaseVector(this->nodes);
+    ReleaseVector(this->nodeParent);
+    ReleaseVector(this->nodeLast);
+    ReleaseVector(this->visits);
+    ReleaseVector(this->leafBounds);
+    ReleaseVector(this->leafBody);
+    ReleaseVector(this->leafParent);
+    ReleaseVector(this->leafStatic);
+    ReleaseVector(this->chunkPairs);
+    ReleaseVector(this->pairs);
+}
+
+void LinearBVH::SortKeys(int count, ThreadPool& pool)
+{
+    // Least significant digit first; each pass is stable, so equal codes stay in body order
+    constexpr int Buckets = 1 << RadixBits;
+    int chunkCount = std::clamp(count / MinChunk, 1, pool.ThreadCount());
+    this->histograms.resize((size_t)chunkCount * Buckets);
+    this->sortScratch.resize(count);
+
+    uint64_t* source = this->keys.data();
+    uint64_t* target = this->sortScratch.data();
+
+    for (int shift = 32; shift < 32 + CodeBits; shift += RadixBits)
+    {
+        std::fill(this->histograms.begin(), this->histograms.end(), 0);
+
+        pool.ParallelFor(chunkCount, 1, [&](int begin, int end)
+        {
+            for (int c = begin; c < end; c++)
+            {
+                int* histogram = &this->histograms[(size_t)c * Buckets];
+                for (int i = ChunkBegin(c, count, chunkCount); i < ChunkBegin(c + 1, count, chunkCount); i++)
+                {
+                    histogram[(source[i] >> shift) & (Buckets - 1)]++;
+                }
+            }
+        });
+
+        // Histograms become the first slot of each (digit, chunk)
+        bool sorted = false;
+        int offset = 0;
+        for (int digit = 0; digit < Buckets; digit++)
+        {
+            int total = 0;
+            for (int c = 0; c < chunkCount; c++)
+            {
+                int& slot = this->histograms[(size_t)c * Buckets + digit];
+                int n = slot;
+                slot = offset;
+                offset += n;
+                total += n;
+            }
+            sorted = sorted || total == count;
+        }
+
+        // Every key has the same digit: the pass would not move anything
+        if (sorted)
+        {
+            continue;
+        }
+
+        pool.ParallelFor(chunkCount, 1, [&](int begin, int end)
+        {
+            for (int c = begin; c < end; c++)
+            {
+                int* histogram = &this->histograms[(size_t)c * Buckets];
+                for (int i = ChunkBegin(c, count, chunkCount); i < ChunkBegin(c + 1, count, chunkCount); i++)
+                {
+                    target[histogram[(source[i] >> shift) & (Buckets - 1)]++] = source[i];
+                }
+            }
+        });
+
+        std::swap(source, target);
+    }
+
+    if (source != this->keys.data())
+    {
+        this->keys.swap(this->sortScratch);
+    }
+}
+
+int LinearBVH::CommonPrefix(int i, int j, int count) const
+{
+    if (j < 0 || j >= count)
+    {
+        return -1;
+    }
+    return std::countl_zero(this->keys[i] ^ this->keys[j]);
+}
+
+void LinearBVH::BuildNode(int i, int count)
+{
+    // The node extends towards the neighbour sharing the longer prefix
+    int direction = this->CommonPrefix(i, i + 1, count) > this->CommonPrefix(i, i - 1, count) ? 1 : -1;
+    int minPrefix = this->CommonPrefix(i, i - direction, count);
+
+    // Other end of the range: exponential search, then binary search
+    int maxLength = 2;
+    while (this->CommonPrefix(i, i + maxLength * direction, count) > minPrefix)
+    {
+        maxLength *= 2;
+    }
+
+    int length = 0;
+    for (int step = maxLength / 2; step >= 1; step /= 2)
+    {
+        if (this->CommonPrefix(i, i + (length + step) * direction, count) > minPrefix)
+        {
+            length += step;
+        }
+    }
+
+    int j = i + length * direction;
+    int nodePrefix = this->CommonPrefix(i, j, count);
+
+    // Split: the last key sharing more than nodePrefix bits with key i
+    int split = 0;
+    int step = length;
+    do
+    {
+        step = (step + 1) / 2;
+        if (this->CommonPrefix(i, i + (split + step) * direction, count) > nodePrefix)
+        {
+            split += step;
+        }
+    } while (step > 1);
+
+    int gamma = i + split * direction + std::min(direction, 0);
+    int first = std::min(i, j);
+    int last = std::max(i, j);
+
+    Node& node = this->nodes[i];
+    if (first == gamma)
+    {
+        node.Left = ~gamma;
+        this->leafParent[gamma] = i;
+    }
+    else
+    {
+        node.Left = gamma;
+        this->nodeParent[gamma] = i;
+    }
+
+    if (last == gamma + 1)
+    {
+        node.Right = ~(gamma + 1);
+        this->leafParent[gamma + 1] = i;
+    }
+    else
+    {
+        node.Right = gamma + 1;
+        this->nodeParent[gamma + 1] = i;
+    }
+}
+
+void LinearBVH::Refit(int leaf)
+{
+    int index = this->leafParent[leaf];
+
+    while (index >= 0)
+    {
+        // The first child to arrive stops; the second one sees the bounds of both
+        if (std::atomic_ref<int>(this->visits[index]).fetch_add(1, std::memory_order_acq_rel) == 0)
+        {
+            return;
+        }
+
+        Node& node = this->nodes[index];
+        AABB box;
+        int last = 0;
+        for (int child : { node.Left, node.Right })
+        {
+            AABB childBox;
+            int childLast;
+            if (child < 0)
+            {
+                childBox = this->leafBounds[~child];
+                childLast = this->leafStatic[~child] ? INT_MAX : ~child;
+            }
+            else
+            {
+                childBox = AABB(this->nodes[child].Min, this->nodes[child].Max);
+                childLast = this->nodeLast[child];
+            }
+
+            if (child == node.Left) box = childBox;
+            else box.ExpandToInclude(childBox);
+            last = std::max(last, childLast);
+        }
+
+        node.Min = box.Min;
+        node.Max = box.Max;
+        this->nodeLast[index] = last;
+        index = this->nodeParent[index];
+    }
+}
+
+void LinearBVH::FindLeafPairs(int leaf, std::vector<std::pair<int, int>>& out) const
+{
+    // A pair of dynamic bodies is reported from the lower leaf, so subtrees holding only
+    // dynamic leaves up to this one are skipped; static leaves are reported from here always
+    const AABB& box = this->leafBounds[leaf];
+    int body = this->leafBody[leaf];
+    int stack[MaxDepth + 1];
+    int top = 0;
+    int index = 0;
+
+    while (true)
+    {
+        const Node& node = this->nodes[index];
+
+        for (int child : { node.Left, node.Right })
+        {
+            if (child < 0)
+            {
+                int other = ~child;
+                if ((other > leaf || (this->leafStatic[other] && other != leaf)) &&
+                    Overlap(box, this->leafBounds[other].Min, this->leafBounds[other].Max))
+                {
+                    int otherBody = this->leafBody[other];
+                    out.push_back({ std::min(body, otherBody), std::max(body, otherBody) });
+                }
+            }
+            else if (this->nodeLast[child] > leaf && Overlap(box, this->nodes[child].Min, this->nodes[child].Max))
+            {
+                stack[top++] = child;
+            }
+        }
+
+        if (top == 0) break;
+        index = stack[--top];
+    }
+}
@@ -0,0 +1,119 @@
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    this->Close();
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const char* path, const char** error)
+{
+    *error = "";
+    this->Close();
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        *error = "Could not open the file";
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        *error = "The file is empty";
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (view == nullptr)
+    {
+        if (mapping != nullptr) CloseHandle(mapping);
+        CloseHandle(file);
+        *error = "Could not map the file";
+        return false;
+    }
+
+    this->file = file;
+    this->mapping = mapping;
+    this->data = (const unsigned char*)view;
+    this->size = (size_t)size.QuadPart;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (this->data != nullptr) UnmapViewOfFile(this->data);
+    if (this->mapping != nullptr) CloseHandle((HANDLE)this->mapping);
+    if (this->file != nullptr) CloseHandle((HANDLE)this->file);
+
+    this->data = nullptr;
+    this->mapping = nullptr;
+    this->file = nullptr;
+    this->size = 0;
+}
+
+#else
+
+bool MappedFile::Open(const char* path, const char** error)
+{
+    *error = "";
+    this->Close();
+
+    int file = open(path, O_RDONLY);
+    if (file < 0)
+    {
+        *error = "Could not open the file";
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0)
+    {
+        close(file);
+        *error = "The file is empty";
+        return false;
+    }
+
+    void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (view == MAP_FAILED)
+    {
+        close(file);
+        *error = "Could not map the file";
+        return false;
+    }
+
+    // Every page is read right away, start the read-ahead for the whole file
+    madvise(view, (size_t)info.st_size, MADV_WILLNEED);
+
+    this->file = file;
+    this->data = (const unsigned char*)view;
+    this->size = (size_t)info.st_size;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (this->data != nullptr) munmap((void*)this->data, this->size);
+    if (this->file >= 0) close(this->file);
+
+    this->data = nullptr;
+    this->file = -1;
+    this->size = 0;
+}
+
+#endif
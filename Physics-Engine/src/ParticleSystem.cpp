@@ -0,0 +1,616 @@
+#include "ParticleSystem.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include "Collisions.h"
+#include "MemoryAccounting.h"
+
+namespace
+{
+    constexpr int CellBits = 21;
+    constexpr uint64_t CellMask = (1ull << CellBits) - 1;
+    constexpr int BodyChunk = 16; // bodies per task of the body contacts
+
+    uint64_t PackCell(int x, int y, int z)
+    {
+        return ((uint64_t)x & CellMask) | (((uint64_t)y & CellMask) << CellBits) | (((uint64_t)z & CellMask) << (2 * CellBits));
+    }
+
+    int CellCoordinate(float value, float inverseSize)
+    {
+        return (int)std::clamp(floorf(value * inverseSize), 0.0f, (float)CellMask);
+    }
+
+    float SphereInvMass(float radius, float density)
+    {
+        return 1.0f / (density * (4.0f / 3.0f) * PI * radius * radius * radius);
+    }
+}
+
+void ParticleSystem::SetConfig(const ParticleConfig& config)
+{
+    this->config = config;
+    this->config.Density = fmaxf(config.Density, 1e-3f);
+    this->config.Restitution = Clamp(config.Restitution, 0.0f, 1.0f);
+
+    for (size_t i = 0; i < this->radii.size(); i++)
+    {
+        this->invMasses[i] = SphereInvMass(this->radii[i], this->config.Density);
+    }
+}
+
+bool ParticleSystem::Add(const Vector3* positions, const Vector3* velocities, const float* radii, int count, const char** error)
+{
+    *error = "";
+    if (count <= 0)
+    {
+        return true;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (!(radii[i] > 0.0f) || !std::isfinite(radii[i]))
+        {
+            *error = "Particle radius must be positive";
+            return false;
+        }
+    }
+
+    size_t first = this->positions.size();
+    this->positions.insert(this->positions.end(), positions, positions + count);
+    if (velocities != nullptr)
+    {
+        this->velocities.insert(this->velocities.end(), velocities, velocities + count);
+    }
+    else
+    {
+        this->velocities.resize(first + count, Vector3Zero());
+    }
+    this->radii.insert(this->radii.end(), radii, radii + count);
+
+    this->invMasses.resize(first + count);
+    for (int i = 0; i < count; i++)
+    {
+        this->invMasses[first + i] = SphereInvMass(radii[i], this->config.Density);
+        this->maxRadius = fmaxf(this->maxRadius, radii[i]);
+    }
+    return true;
+}
+
+bool ParticleSystem::Remove(int index)
+{
+    if (index < 0 || index >= this->Count())
+    {
+        return false;
+    }
+
+    float radius = this->radii[index];
+    this->positions[index] = this->positions.back();
+    this->velocities[index] = this->velocities.back();
+    this->radii[index] = this->radii.back();
+    this->invMasses[index] = this->invMasses.back();
+    this->positions.pop_back();
+    this->velocities.pop_back();
+    this->radii.pop_back();
+    this->invMasses.pop_back();
+
+    if (radius == this->maxRadius)
+    {
+        this->maxRadius = this->radii.empty() ? 0.0f : *std::max_element(this->radii.begin(), this->radii.end());
+    }
+    return true;
+}
+
+void ParticleSystem::Clear()
+{
+    this->positions.clear();
+    this->velocities.clear();
+    this->radii.clear();
+    this->invMasses.clear();
+    this->maxRadius = 0.0f;
+    this->slotStart.clear();
+}
+
+void ParticleSystem::Integrate(float time, const Vector3* accelerations, ThreadPool& pool)
+{
+    Vector3 uniform = this->config.Acceleration;
+
+    pool.ParallelFor(this->Count(), Chunk, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            Vector3 acceleration = accelerations != nullptr ? Vector3Add(accelerations[i], uniform) : uniform;
+            this->velocities[i] = Vector3Add(this->velocities[i], Vector3Scale(acceleration, time));
+            this->positions[i] = Vector3Add(this->positions[i], Vector3Scale(this->velocities[i], time));
+        }
+    });
+}
+
+uint64_t ParticleSystem::CellKey(Vector3 p) const
+{
+    return PackCell(CellCoordinate(p.x - this->origin.x, this->inverseCellSize), CellCoordinate(p.y - this->origin.y, this->inverseCellSize),
+        CellCoordinate(p.z - this->origin.z, this->inverseCellSize));
+}
+
+int ParticleSystem::CellSlot(int x, int y, int z) const
+{
+    int64_t index = x + (int64_t)this->cellCounts[0] * (y + (int64_t)this->cellCounts[1] * z);
+    return (int)(index & (int64_t)(this->slotStart.size() - 2));
+}
+
+void ParticleSystem::Collide(ThreadPool& pool)
+{
+    int count = this->Count();
+    if (count == 0)
+    {
+        this->slotStart.clear();
+        return;
+    }
+
+    this->bounds = AABB(this->positions[0], this->positions[0]);
+    for (int i = 1; i < count; i++)
+    {
+        this->bounds.Min = Vector3Min(this->bounds.Min, this->positions[i]);
+        this->bounds.Max = Vector3Max(this->bounds.Max, this->positions[i]);
+    }
+
+    // Cells of twice the largest radius: two particles that touch are in neighbouring cells
+    this->inverseCellSize = 1.0f / (2.0f * this->maxRadius);
+    this->origin = this->bounds.Min;
+    Vector3 extent = Vector3Subtract(this->bounds.Max, this->bounds.Min);
+    this->cellCounts[0] = CellCoordinate(extent.x, this->inverseCellSize) + 1;
+    this->cellCounts[1] = CellCoordinate(extent.y, this->inverseCellSize) + 1;
+    this->cellCounts[2] = CellCoordinate(extent.z, this->inverseCellSize) + 1;
+
+    this->cellKeys.resize(count);
+    pool.ParallelFor(count, Chunk, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            this->cellKeys[i] = this->CellKey(this->positions[i]);
+        }
+    });
+
+    // Counting sort by slot; the reverse scatter leaves slotStart at the first particle of each
+    // slot and keeps the particles of a slot in index order
+    int slots = (int)std::bit_ceil((unsigned int)std::max(2 * count, MinCells));
+    this->slotStart.assign(slots + 1, 0);
+    auto slotOf = [&](uint64_t key)
+    {
+        return this->CellSlot((int)(key & CellMask), (int)((key >> CellBits) & CellMask), (int)(key >> (2 * CellBits)));
+    };
+    for (int i = 0; i < count; i++)
+    {
+        this->slotStart[slotOf(this->cellKeys[i])]++;
+    }
+    for (int s = 1; s <= slots; s++)
+    {
+        this->slotStart[s] += this->slotStart[s - 1];
+    }
+    this->sortedIndex.resize(count);
+    for (int i = count - 1; i >= 0; i--)
+    {
+        this->sortedIndex[--this->slotStart[slotOf(this->cellKeys[i])]] = i;
+    }
+
+    this->sortedKeys.resize(count);
+    this->sortedPositions.resize(count);
+    this->sortedVelocities.resize(count);
+    this->sortedRadii.resize(count);
+    this->sortedInvMasses.resize(count);
+    pool.ParallelFor(count, Chunk, [&](int begin, int end)
+    {
+        for (int k = begin; k < end; k++)
+        {
+            int i = this->sortedIndex[k];
+            this->sortedKeys[k] = this->cellKeys[i];
+            this->sortedPositions[k] = this->positions[i];
+            this->sortedVelocities[k] = this->velocities[i];
+            this->sortedRadii[k] = this->radii[i];
+            this->sortedInvMasses[k] = this->invMasses[i];
+        }
+    });
+
+    if (!this->config.SelfCollision || count < 2)
+    {
+        return;
+    }
+
+    float e = this->config.Restitution;
+
+    pool.ParallelFor(count, Chunk, [&](int begin, int end)
+    {
+        for (int k = begin; k < end; k++)
+        {
+            int i = this->sortedIndex[k];
+            Vector3 position = this->sortedPositions[k];
+            Vector3 velocity = this->sortedVelocities[k];
+            float radius = this->sortedRadii[k];
+            float invMass = this->sortedInvMasses[k];
+
+            uint64_t key = this->sortedKeys[k];
+            int cx = (int)(key & CellMask);
+            int cy = (int)((key >> CellBits) & CellMask);
+            int cz = (int)((key >> (2 * CellBits)) & CellMask);
+
+            Vector3 correction = Vector3Zero();
+            Vector3 impulse = Vector3Zero();
+            int contacts = 0;
+
+            int x0 = std::max(cx - 1, 0), x1 = std::min(cx + 1, this->cellCounts[0] - 1);
+            int y0 = std::max(cy - 1, 0), y1 = std::min(cy + 1, this->cellCounts[1] - 1);
+            int z0 = std::max(cz - 1, 0), z1 = std::min(cz + 1, this->cellCounts[2] - 1);
+
+            auto visit = [&](int m)
+            {
+                Vector3 delta = Vector3Subtract(position, this->sortedPositions[m]);
+                float distanceSqr = Vector3LengthSqr(delta);
+                float reach = radius + this->sortedRadii[m];
+                if (m == k || distanceSqr >= reach * reach) return;
+
+                // Coincident centers split along y, in opposite directions for the two
+                float distance = sqrtf(distanceSqr);
+                Vector3 normal = distance > 1e-6f ? Vector3Scale(delta, 1.0f / distance) : Vector3{ 0.0f, k > m ? 1.0f : -1.0f, 0.0f };
+                float share = invMass / (invMass + this->sortedInvMasses[m]);
+
+                correction = Vector3Add(correction, Vector3Scale(normal, (reach - distance) * share));
+                contacts++;
+
+                float approach = Vector3DotProduct(Vector3Subtract(velocity, this->sortedVelocities[m]), normal);
+                if (approach < 0.0f)
+                {
+                    impulse = Vector3Add(impulse, Vector3Scale(normal, -(1.0f + e) * approach * share));
+                }
+            };
+
+            // The cells x0..x1 of a row have consecutive slots unless they wrap around the table.
+            // Slots can be shared with cells of other rows, the keys tell the particles of this one.
+            int lastSlot = (int)this->slotStart.size() - 2;
+            for (int z = z0; z <= z1; z++)
+            for (int y = y0; y <= y1; y++)
+            {
+                uint64_t first = PackCell(x0, y, z);
+                uint64_t last = PackCell(x1, y, z);
+                int slot = this->CellSlot(x0, y, z);
+
+                if (slot + (x1 - x0) <= lastSlot)
+                {
+                    for (int m = this->slotStart[slot]; m < this->slotStart[slot + x1 - x0 + 1]; m++)
+                    {
+                        if (this->sortedKeys[m] >= first && this->sortedKeys[m] <= last) visit(m);
+                    }
+                    continue;
+                }
+
+                for (int x = x0; x <= x1; x++)
+                {
+                    uint64_t cell = PackCell(x, y, z);
+                    slot = this->CellSlot(x, y, z);
+                    for (int m = this->slotStart[slot]; m < this->slotStart[slot + 1]; m++)
+                    {
+                        if (this->sortedKeys[m] == cell) visit(m);
+                    }
+                }
+            }
+
+            if (contacts == 0) continue;
+
+            // Averaged over the contacts (Jacobi relaxation): summed, the pushes of every neighbour
+            // of a particle in a pile add up and can throw it through the floor in one sub-step
+            float relaxation = 1.0f / (float)contacts;
+            this->positions[i] = Vector3Add(position, Vector3Scale(correction, relaxation));
+            this->velocities[i] = Vector3Add(velocity, Vector3Scale(impulse, relaxation));
+        }
+    });
+}
+
+void ParticleSystem::FindBodyContacts(Body& body, int bodyIndex, std::vector<BodyContact>& out) const
+{
+    // Particles may have moved up to about a radius since they were binned, hence the extra margin
+    AABB box = body.GetAABB();
+    float margin = 3.0f * this->maxRadius;
+    Vector3 center = body.Position();
+    const Matrix& rotation = body.GetRotation();
+    Vector3 half = Vector3Scale(body.Size, 0.5f);
+
+    auto test = [&](int i)
+    {
+        Vector3 p = this->positions[i];
+        float radius = this->radii[i];
+        if (p.x + radius <= box.Min.x || p.x - radius >= box.Max.x ||
+            p.y + radius <= box.Min.y || p.y - radius >= box.Max.y ||
+            p.z + radius <= box.Min.z || p.z - radius >= box.Max.z)
+        {
+            return;
+        }
+
+        Vector3 d = Vector3Subtract(p, center);
+        Vector3 normal;
+        float depth;
+
+        if (body.shapeType == Sphere)
+        {
+            float reach = radius + body.Radius;
+            float distanceSqr = Vector3LengthSqr(d);
+            if (distanceSqr >= reach * reach) return;
+
+            float distance = sqrtf(distanceSqr);
+            normal = distance > 1e-6f ? Vector3Scale(d, 1.0f / distance) : Vector3{ 0.0f, 1.0f, 0.0f };
+            depth = reach - distance;
+        }
+        else
+        {
+            // Same local frame as Collisions::FindSphereBoxContactPoint
+            Vector3 axes[3] = {
+                { rotation.m0, rotation.m1, rotation.m2 },
+                { rotation.m4, rotation.m5, rotation.m6 },
+                { rotation.m8, rotation.m9, rotation.m10 }
+            };
+            float local[3] = { Vector3DotProduct(axes[0], d), Vector3DotProduct(axes[1], d), Vector3DotProduct(axes[2], d) };
+            float extent[3] = { half.x, half.y, half.z };
+
+            float outside[3];
+            float outsideSqr = 0.0f;
+            for (int a = 0; a < 3; a++)
+            {
+                outside[a] = local[a] - Clamp(local[a], -extent[a], extent[a]);
+                outsideSqr += outside[a] * outside[a];
+            }
+
+            if (outsideSqr > 1e-12f)
+            {
+                if (outsideSqr >= radius * radius) return;
+
+                float distance = sqrtf(outsideSqr);
+                normal = Vector3Zero();
+                for (int a = 0; a < 3; a++)
+                {
+                    normal = Vector3Add(normal, Vector3Scale(axes[a], outside[a] / distance));
+                }
+                depth = radius - distance;
+            }
+            else
+            {
+                // Center inside the box: out through the nearest face
+                int axis = 0;
+                float nearest = INFINITY;
+                for (int a = 0; a < 3; a++)
+                {
+                    float gap = extent[a] - fabsf(local[a]);
+                    if (gap < nearest)
+                    {
+                        nearest = gap;
+                        axis = a;
+                    }
+                }
+                normal = Vector3Scale(axes[axis], local[axis] < 0.0f ? -1.0f : 1.0f);
+                depth = radius + nearest;
+            }
+        }
+
+        out.push_back({ bodyIndex, i, normal, depth });
+    };
+
+    // Cells out of the bounds hold no particle
+    int x0 = CellCoordinate(box.Min.x - margin - this->origin.x, this->inverseCellSize);
+    int y0 = CellCoordinate(box.Min.y - margin - this->origin.y, this->inverseCellSize);
+    int z0 = CellCoordinate(box.Min.z - margin - this->origin.z, this->inverseCellSize);
+    int x1 = std::min(CellCoordinate(box.Max.x + margin - this->origin.x, this->inverseCellSize), this->cellCounts[0] - 1);
+    int y1 = std::min(CellCoordinate(box.Max.y + margin - this->origin.y, this->inverseCellSize), this->cellCounts[1] - 1);
+    int z1 = std::min(CellCoordinate(box.Max.z + margin - this->origin.z, this->inverseCellSize), this->cellCounts[2] - 1);
+    if (x0 > x1 || y0 > y1 || z0 > z1)
+    {
+        return;
+    }
+    double cells = (double)(x1 - x0 + 1) * (double)(y1 - y0 + 1) * (double)(z1 - z0 + 1);
+
+    // A body much larger than the cells (a floor) is cheaper to test against every particle
+    if (cells >= (double)this->Count())
+    {
+        for (int k = 0; k < this->Count(); k++)
+        {
+            test(this->sortedIndex[k]);
+        }
+        return;
+    }
+
+    for (int z = z0; z <= z1; z++)
+    for (int y = y0; y <= y1; y++)
+    for (int x = x0; x <= x1; x++)
+    {
+        uint64_t cell = PackCell(x, y, z);
+        int slot = this->CellSlot(x, y, z);
+
+        for (int m = this->slotStart[slot]; m < this->slotStart[slot + 1]; m++)
+        {
+            if (this->sortedKeys[m] == cell)
+            {
+                test(this->sortedIndex[m]);
+            }
+        }
+    }
+}
+
+void ParticleSystem::CollideBodies(std::vector<Body>& bodies, int count, ThreadPool& pool)
+{
+    if (this->slotStart.empty())
+    {
+        return;
+    }
+
+    // Cached AABB and rotation are refreshed here, so the tasks below only read the bodies
+    AABB reach(Vector3SubtractValue(this->bounds.Min, 3.0f * this->maxRadius), Vector3AddValue(this->bounds.Max, 3.0f * this->maxRadius));
+    this->bodyCandidates.clear();
+    for (int b = 0; b < count; b++)
+    {
+        Body& body = bodies[b];
+        if ((body.CollisionLayer & this->config.CollisionMask) == 0 || (this->config.CollisionLayer & body.CollisionMask) == 0)
+        {
+            continue;
+        }
+
+        if (!Collisions::IntersectAABBs(body.GetAABB(), reach))
+        {
+            continue;
+        }
+
+        body.GetRotation();
+        this->bodyCandidates.push_back(b);
+    }
+
+    int chunkCount = ((int)this->bodyCandidates.size() + BodyChunk - 1) / BodyChunk;
+    if (chunkCount == 0)
+    {
+        return;
+    }
+
+    if ((int)this->chunkContacts.size() < chunkCount)
+    {
+        this->chunkContacts.resize(chunkCount);
+    }
+    pool.ParallelFor(chunkCount, 1, [&](int begin, int end)
+    {
+        for (int c = begin; c < end; c++)
+        {
+            std::vector<BodyContact>& out = this->chunkContacts[c];
+            out.clear();
+
+            int last = std::min((c + 1) * BodyChunk, (int)this->bodyCandidates.size());
+            for (int n = c * BodyChunk; n < last; n++)
+            {
+                int b = this->bodyCandidates[n];
+                this->FindBodyContacts(bodies[b], b, out);
+            }
+        }
+    });
+
+    // Applied in body order: the particle and the body are separated by inverse mass and the
+    // impulse goes through the contact point, so it also spins the body
+    for (int c = 0; c < chunkCount; c++)
+    {
+        for (const BodyContact& contact : this->chunkContacts[c])
+        {
+            Body& body = bodies[contact.Body];
+            int i = contact.Particle;
+            Vector3 normal = contact.Normal;
+            float particleInvMass = this->invMasses[i];
+            float bodyInvMass = body.IsStatic ? 0.0f : body.InvMass;
+            float totalInvMass = particleInvMass + bodyInvMass;
+
+            this->positions[i] = Vector3Add(this->positions[i], Vector3Scale(normal, contact.Depth * particleInvMass / totalInvMass));
+            if (bodyInvMass > 0.0f)
+            {
+                body.Move(Vector3Scale(normal, -contact.Depth * bodyInvMass / totalInvMass));
+            }
+
+            Vector3 point = Vector3Subtract(this->positions[i], Vector3Scale(normal, this->radii[i]));
+            Vector3 r = Vector3Subtract(point, body.Position());
+            Vector3 bodyVelocity = Vector3Add(body.LinearVelocity(), Vector3CrossProduct(body.AngularVelocity(), r));
+            float approach = Vector3DotProduct(Vector3Subtract(this->velocities[i], bodyVelocity), normal);
+            if (approach >= 0.0f) continue;
+
+            Vector3 rCrossN = Vector3CrossProduct(r, normal);
+            float denominator = totalInvMass;
+            if (bodyInvMass > 0.0f)
+            {
+                denominator += Vector3DotProduct(rCrossN, body.ApplyInvInertia(rCrossN));
+            }
+
+            float e = fminf(this->config.Restitution, body.Restitution);
+            float j = -(1.0f + e) * approach / denominator;
+            Vector3 impulse = Vector3Scale(normal, j);
+
+            this->velocities[i] = Vector3Add(this->velocities[i], Vector3Scale(impulse, particleInvMass));
+            if (bodyInvMass > 0.0f)
+            {
+                body.LinearVelocity(Vector3Subtract(body.LinearVelocity(), Vector3Scale(impulse, bodyInvMass)));
+                body.AngularVelocity(Vector3Subtract(body.AngularVelocity(), body.ApplyInvInertia(Vector3CrossProduct(r, impulse))));
+            }
+        }
+    }
+}
+
+void ParticleSystem::CollideMeshes(const std::vector<TriangleMesh>& meshes, ThreadPool& pool)
+{
+    bool any = false;
+    for (const TriangleMesh& mesh : meshes)
+    {
+        any |= (this->config.CollisionLayer & mesh.CollisionMask) != 0 && (mesh.CollisionLayer & this->config.CollisionMask) != 0;
+    }
+    if (!any)
+    {
+        return;
+    }
+
+    pool.ParallelFor(this->Count(), Chunk, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            float radius = this->radii[i];
+
+            for (const TriangleMesh& mesh : meshes)
+            {
+                if ((this->config.CollisionLayer & mesh.CollisionMask) == 0 || (mesh.CollisionLayer & this->config.CollisionMask) == 0)
+                {
+                    continue;
+                }
+
+                Vector3 p = this->positions[i];
+                AABB box(Vector3SubtractValue(p, radius), Vector3AddValue(p, radius));
+                if (!Collisions::IntersectAABBs(box, mesh.Bounds()))
+                {
+                    continue;
+                }
+
+                // Deepest triangle, as for the bodies in World::CollisionStepMeshes
+                Vector3 normal = Vector3Zero();
+                float depth = 0.0f;
+                mesh.Query(box, [&](int index)
+                {
+                    const TriangleMesh::Triangle& triangle = mesh.GetTriangle(index);
+                    Vector3 triangleNormal, trianglePoint;
+                    float triangleDepth;
+                    if (Collisions::IntersectSphereTriangle(p, radius, triangle.A, triangle.B, triangle.C, triangleNormal, triangleDepth, trianglePoint) &&
+                        triangleDepth > depth)
+                    {
+                        normal = triangleNormal;
+                        depth = triangleDepth;
+                    }
+                });
+
+                if (depth <= 0.0f) continue;
+
+                this->positions[i] = Vector3Add(p, Vector3Scale(normal, depth));
+                float approach = Vector3DotProduct(this->velocities[i], normal);
+                if (approach < 0.0f)
+                {
+                    float e = fminf(this->config.Restitution, mesh.Restitution);
+                    this->velocities[i] = Vector3Subtract(this->velocities[i], Vector3Scale(normal, (1.0f + e) * approach));
+                }
+            }
+        }
+    });
+}
+
+size_t ParticleSystem::MemoryBytes() const
+{
+    return VectorBytes(this->positions) + VectorBytes(this->velocities) + VectorBytes(this->radii) + VectorBytes(this->invMasses) +
+        VectorBytes(this->cellKeys) + VectorBytes(this->slotStart) + VectorBytes(this->sortedIndex) + VectorBytes(this->sortedKeys) +
+        VectorBytes(this->sortedPositions) + VectorBytes(this->sortedVelocities) + VectorBytes(this->sortedRadii) + VectorBytes(this->sortedInvMasses) + VectorBytes(this->bodyCandidates) +
+        VectorBytes(this->chunkContacts);
+}
+
+void ParticleSystem::ReleaseScratch()
+{
+    ReleaseVector(this->cellKeys);
+    ReleaseVector(this->slotStart);
+    ReleaseVector(this->sortedIndex);
+    ReleaseVector(this->sortedKeys);
+    ReleaseVector(this->sortedPositions);
+    ReleaseVector(this->sortedVelocities);
+    ReleaseVector(this->sortedRadii);
+    ReleaseVector(this->sortedInvMasses);
+    ReleaseVector(this->bodyCandidates);
+    ReleaseVector(this->chunkContacts);
+}
@@ -0,0 +1,698 @@
+#include "PositionSolver.h"
+#include <algorithm>
+#include <bit>
+#include <cfloat>
+
+#include "MemoryAccounting.h"
+
+namespace
+{
+    // Inverse mass seen by a correction along direction through the anchor r
+    float GeneralizedInvMass(Body& body, Vector3 r, Vector3 direction)
+    {
+        if (body.IsStatic)
+        {
+            return 0.0f;
+        }
+
+        Vector3 rCrossN = Vector3CrossProduct(r, direction);
+        return body.InvMass + Vector3DotProduct(rCrossN, body.ApplyInvInertia(rCrossN));
+    }
+
+    // Impulses (or positional impulses) on one body from the points of a contact, summed so the
+    // body is moved once per contact
+    struct Push
+    {
+        Vector3 Linear = { 0, 0, 0 };
+        Vector3 Angular = { 0, 0, 0 }; // sum of r x p
+
+        void Add(Vector3 r, Vector3 p)
+        {
+            this->Linear = Vector3Add(this->Linear, p);
+            this->Angular = Vector3Add(this->Angular, Vector3CrossProduct(r, p));
+        }
+    };
+
+    void ApplyCorrection(Body& body, const Push& push)
+    {
+        if (body.IsStatic)
+        {
+            return;
+        }
+
+        body.Move(Vector3Scale(push.Linear, body.InvMass));
+
+        // q' = q + 1/2 * (dw, 0) * q, as in Body::StepRotation
+        Vector3 w = body.ApplyInvInertia(push.Angular);
+        Quaternion q = body.Orientation();
+        Quaternion spin = QuaternionMultiply({ w.x, w.y, w.z, 0.0f }, q);
+        body.Orientation(QuaternionAdd(q, QuaternionScale(spin, 0.5f)));
+    }
+
+    void ApplyImpulse(Body& body, const Push& push)
+    {
+        if (body.IsStatic)
+        {
+            return;
+        }
+
+        body.LinearVelocity(Vector3Add(body.LinearVelocity(), Vector3Scale(push.Linear, body.InvMass)));
+        body.AngularVelocity(Vector3Add(body.AngularVelocity(), body.ApplyInvInertia(push.Angular)));
+    }
+
+    Vector3 PointVelocity(const Body& body, Vector3 r)
+    {
+        return Vector3Add(body.LinearVelocity(), Vector3CrossProduct(body.AngularVelocity(), r));
+    }
+
+    struct OrientedBox
+    {
+        Vector3 Center;
+        Vector3 Axes[3];
+        float Half[3];
+        Vector3 Corners[8];
+
+        explicit OrientedBox(Body& box)
+        {
+            const Matrix& r = box.GetRotation();
+            this->Center = box.Position();
+            this->Axes[0] = { r.m0, r.m1, r.m2 };
+            this->Axes[1] = { r.m4, r.m5, r.m6 };
+            this->Axes[2] = { r.m8, r.m9, r.m10 };
+            this->Half[0] = box.Size.x * 0.5f;
+            this->Half[1] = box.Size.y * 0.5f;
+            this->Half[2] = box.Size.z * 0.5f;
+
+            for (int i = 0; i < 8; i++)
+            {
+                Vector3 corner = this->Center;
+                for (int k = 0; k < 3; k++)
+                {
+                    corner = Vector3Add(corner, Vector3Scale(this->Axes[k], (i >> k) & 1 ? this->Half[k] : -this->Half[k]));
+                }
+                this->Corners[i] = corner;
+            }
+        }
+
+        bool Contains(Vector3 point, float margin) const
+        {
+            Vector3 d = Vector3Subtract(point, this->Center);
+            for (int k = 0; k < 3; k++)
+            {
+                if (fabsf(Vector3DotProduct(d, this->Axes[k])) > this->Half[k] + margin)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    // Depth of a point under the face of box that faces along direction, measured along direction;
+    // false when no face is within about 45 degrees of it (edge contacts)
+    bool FaceDepth(const OrientedBox& box, Vector3 direction, Vector3 point, float& depth)
+    {
+        int axis = 0;
+        float best = 0.0f;
+        for (int k = 0; k < 3; k++)
+        {
+            float alignment = Vector3DotProduct(box.Axes[k], direction);
+            if (fabsf(alignment) > fabsf(best))
+            {
+                best = alignment;
+                axis = k;
+            }
+        }
+
+        if (fabsf(best) < 0.7f)
+        {
+            return false;
+        }
+
+        Vector3 face = Vector3Scale(box.Axes[axis], best > 0.0f ? 1.0f : -1.0f);
+        depth = (box.Half[axis] - Vector3DotProduct(Vector3Subtract(point, box.Center), face)) / fabsf(best);
+        return true;
+    }
+
+    // The box-box narrow phase gives one point, the centroid of the touching corners, and a box
+    // held at a single point tips over. Every corner of one box inside the other becomes an anchor
+    // pair instead, apart by how far the corner is under the face of the other box along the
+    // normal. Returns 0 for edge contacts, which keep the manifold point.
+    int BoxAnchors(Body& bodyA, Body& bodyB, Vector3 normal, float maxDepth, float margin, Vector3* anchorsA, Vector3* anchorsB)
+    {
+        OrientedBox boxA(bodyA);
+        OrientedBox boxB(bodyB);
+
+        int count = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            float depth;
+            if (boxB.Contains(boxA.Corners[i], margin))
+            {
+                // Under the face of B turned towards A
+                if (!FaceDepth(boxB, Vector3Negate(normal), boxA.Corners[i], depth)) return 0;
+                anchorsA[count] = boxA.Corners[i];
+                anchorsB[count] = Vector3Subtract(boxA.Corners[i], Vector3Scale(normal, fminf(depth, maxDepth)));
+                count++;
+            }
+        }
+
+        for (int i = 0; i < 8; i++)
+        {
+            float depth;
+            if (boxA.Contains(boxB.Corners[i], margin))
+            {
+                if (!FaceDepth(boxA, normal, boxB.Corners[i], depth)) return 0;
+                anchorsA[count] = Vector3Add(boxB.Corners[i], Vector3Scale(normal, fminf(depth, maxDepth)));
+                anchorsB[count] = boxB.Corners[i];
+                count++;
+            }
+        }
+
+        return count;
+    }
+}
+
+void PositionSolver::BeginSubStep(const std::vector<Body>& bodies, int count)
+{
+    this->startPositions.resize(count);
+    this->startOrientations.resize(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        this->startPositions[i] = bodies[i].Position();
+        this->startOrientations[i] = bodies[i].Orientation();
+    }
+}
+
+template <typename Function>
+void PositionSolver::ForEachColor(ThreadPool& pool, Function solve)
+{
+    for (int c = 0; c < MaxColors; c++)
+    {
+        int first = this->colorStart[c];
+        int count = this->colorStart[c + 1] - first;
+        if (count == 0) continue;
+
+        pool.ParallelFor(count, Chunk, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                solve(this->contacts[this->colorOrder[first + i]]);
+            }
+        });
+    }
+
+    // Contacts that found no free color may share bodies
+    for (int i = this->colorStart[MaxColors]; i < this->colorStart[MaxColors + 1]; i++)
+    {
+        solve(this->contacts[this->colorOrder[i]]);
+    }
+}
+
+void PositionSolver::Solve(std::vector<Body>& bodies, const std::vector<Manifold>& manifolds, float time, const SolverConfig& config, ThreadPool& pool)
+{
+    this->contacts.clear();
+    this->points.clear();
+    if ((manifolds.empty() && this->carriedContacts.empty()) || time <= 0.0f)
+    {
+        return;
+    }
+
+    int detected = this->BuildContacts(bodies, manifolds);
+    this->ColorContacts((int)bodies.size());
+
+    int iterations = std::clamp(config.Iterations, 1, MaxIterations);
+    float compliance = fmaxf(config.Compliance, 0.0f) / (time * time);
+    float friction = fmaxf(config.Friction, 0.0f);
+
+    for (int it = 0; it < iterations; it++)
+    {
+        this->ForEachColor(pool, [&](Contact& contact)
+        {
+            this->SolvePosition(bodies, contact, compliance, friction);
+        });
+    }
+
+    this->UpdateVelocities(bodies, time);
+
+    float rollingFriction = fmaxf(config.RollingFriction, 0.0f);
+    float restingSpeed = fmaxf(config.RestingSpeed, 0.0f);
+    this->ForEachColor(pool, [&](Contact& contact)
+    {
+        this->SolveVelocity(bodies, contact, time, friction, rollingFriction, restingSpeed);
+    });
+
+    // Carried into the next sub-step: what was detected now, and older contacts still pushing
+    this->carriedContacts.clear();
+    this->carriedPoints.clear();
+    for (int i = 0; i < (int)this->contacts.size(); i++)
+    {
+        const Contact& contact = this->contacts[i];
+        bool pushing = false;
+        for (int k = contact.First; k < contact.First + contact.Count; k++)
+        {
+            pushing = pushing || this->points[k].Lambda > 0.0f;
+        }
+
+        if (i < detected || pushing)
+        {
+            Contact carried = contact;
+            carried.First = (int)this->carriedPoints.size();
+            this->carriedContacts.push_back(carried);
+            this->carriedPoints.insert(this->carriedPoints.end(), this->points.begin() + contact.First,
+                this->points.begin() + contact.First + contact.Count);
+        }
+    }
+
+    for (int b : this->touchedList)
+    {
+        this->touched[b] = 0;
+    }
+    this->touchedList.clear();
+}
+
+int PositionSolver::BuildContacts(std::vector<Body>& bodies, const std::vector<Manifold>& manifolds)
+{
+    size_t count = bodies.size();
+
+    // Bodies added since BeginSubStep start the sub-step where they are
+    for (size_t i = this->startPositions.size(); i < count; i++)
+    {
+        this->startPositions.push_back(bodies[i].Position());
+        this->startOrientations.push_back(bodies[i].Orientation());
+    }
+    this->touched.resize(count, 0);
+    this->solvePositions.resize(count);
+    this->solveOrientations.resize(count);
+
+    auto touch = [&](int i)
+    {
+        if (!bodies[i].IsStatic && !this->touched[i])
+        {
+            this->touched[i] = 1;
+            this->touchedList.push_back(i);
+            this->solvePositions[i] = bodies[i].Position();
+            this->solveOrientations[i] = bodies[i].Orientation();
+        }
+    };
+
+    auto closingSpeed = [&](const Contact& contact, const Point& point)
+    {
+        Body& bodyA = bodies[contact.BodyA];
+        Body& bodyB = bodies[contact.BodyB];
+        Vector3 ra = Vector3RotateByQuaternion(point.LocalA, bodyA.Orientation());
+        Vector3 rb = Vector3RotateByQuaternion(point.LocalB, bodyB.Orientation());
+        return Vector3DotProduct(Vector3Subtract(PointVelocity(bodyB, rb), PointVelocity(bodyA, ra)), contact.Normal);
+    };
+
+    this->pairs.clear();
+    for (const Manifold& manifold : manifolds)
+    {
+        int a = (int)(manifold.BodyA - bodies.data());
+        int b = (int)(manifold.BodyB - bodies.data());
+        this->pairs.push_back({ a, b });
+        Body& bodyA = bodies[a];
+        Body& bodyB = bodies[b];
+        Vector3 normal = manifold.Normal;
+
+        Vector3 anchorsA[MaxPoints];
+        Vector3 anchorsB[MaxPoints];
+        int anchorCount = 0;
+        if (bodyA.shapeType == Box && bodyB.shapeType == Box)
+        {
+            anchorCount = BoxAnchors(bodyA, bodyB, normal, manifold.Depth, CornerMargin, anchorsA, anchorsB);
+        }
+
+        if (anchorCount == 0)
+        {
+            // Anchors on either side of each point, depth apart: A reaches past B along the normal.
+            // Without contact points the constraint acts between the centers.
+            Vector3 manifoldPoints[2] = { manifold.Contact1, manifold.Contact2 };
+            anchorCount = manifold.ContactCount;
+            if (anchorCount == 0)
+            {
+                manifoldPoints[0] = Vector3Lerp(bodyA.Position(), bodyB.Position(), 0.5f);
+                anchorCount = 1;
+            }
+
+            for (int k = 0; k < anchorCount; k++)
+            {
+                anchorsA[k] = Vector3Add(manifoldPoints[k], Vector3Scale(normal, manifold.Depth * 0.5f));
+                anchorsB[k] = Vector3Subtract(manifoldPoints[k], Vector3Scale(normal, manifold.Depth * 0.5f));
+            }
+        }
+
+        Contact contact;
+        contact.BodyA = a;
+        contact.BodyB = b;
+        contact.Normal = normal;
+        contact.Restitution = fminf(bodyA.Restitution, bodyB.Restitution);
+        contact.First = (int)this->points.size();
+        contact.Count = anchorCount;
+        contact.Color = 0;
+
+        Quaternion inverseA = QuaternionInvert(bodyA.Orientation());
+        Quaternion inverseB = QuaternionInvert(bodyB.Orientation());
+
+        for (int k = 0; k < anchorCount; k++)
+        {
+            Point point;
+            point.LocalA = Vector3RotateByQuaternion(Vector3Subtract(anchorsA[k], bodyA.Position()), inverseA);
+            point.LocalB = Vector3RotateByQuaternion(Vector3Subtract(anchorsB[k], bodyB.Position()), inverseB);
+            point.NormalSpeed = closingSpeed(contact, point);
+            point.Lambda = 0.0f;
+            point.LambdaTangent = 0.0f;
+            this->points.push_back(point);
+        }
+
+        this->contacts.push_back(contact);
+        touch(a);
+        touch(b);
+    }
+
+    // Detection only sees pairs that overlap after integrating, but a body resting on another can
+    // be apart from it then and only be pushed into it by the contacts below. Contacts of the
+    // last sub-step whose pair was not detected again stay, with their anchors, and only act if
+    // the anchors pass each other again.
+    int detected = (int)this->contacts.size();
+    std::sort(this->pairs.begin(), this->pairs.end());
+
+    for (Contact contact : this->carriedContacts)
+    {
+        if (contact.BodyA >= (int)count || contact.BodyB >= (int)count ||
+            std::binary_search(this->pairs.begin(), this->pairs.end(), std::make_pair(contact.BodyA, contact.BodyB)))
+        {
+            continue;
+        }
+
+        int first = contact.First;
+        contact.First = (int)this->points.size();
+        for (int k = 0; k < contact.Count; k++)
+        {
+            Point point = this->carriedPoints[first + k];
+            point.NormalSpeed = closingSpeed(contact, point);
+            point.Lambda = 0.0f;
+            point.LambdaTangent = 0.0f;
+            this->points.push_back(point);
+        }
+
+        this->contacts.push_back(contact);
+        touch(contact.BodyA);
+        touch(contact.BodyB);
+    }
+
+    return detected;
+}
+
+void PositionSolver::ColorContacts(int bodyCount)
+{
+    // Greedy: the lowest color that neither dynamic body uses yet. Static bodies are only read,
+    // so any number of contacts of one color may share them.
+    this->bodyColors.resize(bodyCount, 0);
+    int counts[MaxColors + 1] = {};
+
+    for (Contact& contact : this->contacts)
+    {
+        uint32_t colorsA = this->touched[contact.BodyA] ? this->bodyColors[contact.BodyA] : 0;
+        uint32_t colorsB = this->touched[contact.BodyB] ? this->bodyColors[contact.BodyB] : 0;
+        uint32_t used = colorsA | colorsB;
+
+        contact.Color = used == ~0u ? MaxColors : std::countr_zero(~used);
+        if (contact.Color < MaxColors)
+        {
+            if (this->touched[contact.BodyA]) this->bodyColors[contact.BodyA] |= 1u << contact.Color;
+            if (this->touched[contact.BodyB]) this->bodyColors[contact.BodyB] |= 1u << contact.Color;
+        }
+        counts[contact.Color]++;
+    }
+
+    for (int b : this->touchedList)
+    {
+        this->bodyColors[b] = 0;
+    }
+
+    this->colorStart.assign(MaxColors + 2, 0);
+    for (int c = 0; c <= MaxColors; c++)
+    {
+        this->colorStart[c + 1] = this->colorStart[c] + counts[c];
+    }
+
+    this->colorOrder.resize(this->contacts.size());
+    int fill[MaxColors + 1];
+    std::copy(this->colorStart.begin(), this->colorStart.end() - 1, fill);
+    for (int i = 0; i < (int)this->contacts.size(); i++)
+    {
+        this->colorOrder[fill[this->contacts[i].Color]++] = i;
+    }
+}
+
+void PositionSolver::SolvePosition(std::vector<Body>& bodies, Contact& contact, float compliance, float friction)
+{
+    Body& bodyA = bodies[contact.BodyA];
+    Body& bodyB = bodies[contact.BodyB];
+    Vector3 normal = contact.Normal;
+    Point* points = this->points.data() + contact.First;
+
+    // Every point from the same poses, the corrections averaged over the points that act
+    Vector3 ra[MaxPoints];
+    Vector3 rb[MaxPoints];
+    float deltas[MaxPoints];
+    int active = 0;
+
+    for (int k = 0; k < contact.Count; k++)
+    {
+        ra[k] = Vector3RotateByQuaternion(points[k].LocalA, bodyA.Orientation());
+        rb[k] = Vector3RotateByQuaternion(points[k].LocalB, bodyB.Orientation());
+        deltas[k] = 0.0f;
+
+        float depth = Vector3DotProduct(Vector3Subtract(Vector3Add(bodyA.Position(), ra[k]), Vector3Add(bodyB.Position(), rb[k])), normal);
+        float w = GeneralizedInvMass(bodyA, ra[k], normal) + GeneralizedInvMass(bodyB, rb[k], normal);
+        if (depth <= 0.0f || w <= 0.0f)
+        {
+            continue;
+        }
+
+        // XPBD update of the multiplier, which never pulls
+        deltas[k] = fmaxf((depth - compliance * points[k].Lambda) / (w + compliance), -points[k].Lambda);
+        active++;
+    }
+
+    if (active == 0)
+    {
+        return;
+    }
+
+    // A is pushed back along -normal, B along +normal
+    Push pushA;
+    Push pushB;
+    for (int k = 0; k < contact.Count; k++)
+    {
+        float deltaLambda = deltas[k] / (float)active;
+        points[k].Lambda += deltaLambda;
+        Vector3 p = Vector3Scale(normal, deltaLambda);
+        pushA.Add(ra[k], Vector3Negate(p));
+        pushB.Add(rb[k], p);
+    }
+    ApplyCorrection(bodyA, pushA);
+    ApplyCorrection(bodyB, pushB);
+
+    if (friction <= 0.0f)
+    {
+        return;
+    }
+
+    // Static friction: undo the sliding of the anchors since the start of the sub-step, as long
+    // as the correction stays inside the friction cone of the normal one
+    Vector3 corrections[MaxPoints];
+    int sticking = 0;
+
+    for (int k = 0; k < contact.Count; k++)
+    {
+        corrections[k] = Vector3Zero();
+        if (points[k].Lambda <= 0.0f) continue;
+
+        ra[k] = Vector3RotateByQuaternion(points[k].LocalA, bodyA.Orientation());
+        rb[k] = Vector3RotateByQuaternion(points[k].LocalB, bodyB.Orientation());
+        Vector3 startA = Vector3Add(this->startPositions[contact.BodyA],
+            Vector3RotateByQuaternion(points[k].LocalA, this->startOrientations[contact.BodyA]));
+        Vector3 startB = Vector3Add(this->startPositions[contact.BodyB],
+            Vector3RotateByQuaternion(points[k].LocalB, this->startOrientations[contact.BodyB]));
+        Vector3 slip = Vector3Subtract(Vector3Subtract(Vector3Add(bodyA.Position(), ra[k]), startA),
+            Vector3Subtract(Vector3Add(bodyB.Position(), rb[k]), startB));
+        slip = Vector3Subtract(slip, Vector3Scale(normal, Vector3DotProduct(slip, normal)));
+
+        float length = Vector3Length(slip);
+        if (length < 1e-7f) continue;
+
+        Vector3 tangent = Vector3Scale(slip, 1.0f / length);
+        float wt = GeneralizedInvMass(bodyA, ra[k], tangent) + GeneralizedInvMass(bodyB, rb[k], tangent);
+        if (wt <= 0.0f) continue;
+
+        float lambdaTangent = length / wt;
+        if (points[k].LambdaTangent + lambdaTangent > friction * points[k].Lambda) continue;
+
+        corrections[k] = Vector3Scale(tangent, lambdaTangent);
+        sticking++;
+    }
+
+    if (sticking == 0)
+    {
+        return;
+    }
+
+    pushA = Push();
+    pushB = Push();
+    for (int k = 0; k < contact.Count; k++)
+    {
+        Vector3 p = Vector3Scale(corrections[k], 1.0f / (float)sticking);
+        points[k].LambdaTangent += Vector3Length(p);
+        pushA.Add(ra[k], Vector3Negate(p));
+        pushB.Add(rb[k], p);
+    }
+    ApplyCorrection(bodyA, pushA);
+    ApplyCorrection(bodyB, pushB);
+}
+
+void PositionSolver::UpdateVelocities(std::vector<Body>& bodies, float time)
+{
+    // The passes moved the bodies, the velocities take the same change. Only the change is added,
+    // so what the integrator computed is kept for the motion of the sub-step itself.
+    for (int i : this->touchedList)
+    {
+        Body& body = bodies[i];
+        Vector3 moved = Vector3Subtract(body.Position(), this->solvePositions[i]);
+        body.LinearVelocity(Vector3Add(body.LinearVelocity(), Vector3Scale(moved, 1.0f / time)));
+
+        Quaternion turn = QuaternionMultiply(body.Orientation(), QuaternionInvert(this->solveOrientations[i]));
+        float sign = turn.w < 0.0f ? -1.0f : 1.0f;
+        Vector3 spin = { turn.x, turn.y, turn.z };
+        body.AngularVelocity(Vector3Add(body.AngularVelocity(), Vector3Scale(spin, 2.0f * sign / time)));
+    }
+}
+
+void PositionSolver::SolveVelocity(std::vector<Body>& bodies, const Contact& contact, float time, float friction, float rollingFriction, float restingSpeed)
+{
+    Body& bodyA = bodies[contact.BodyA];
+    Body& bodyB = bodies[contact.BodyB];
+    Vector3 normal = contact.Normal;
+    const Point* points = this->points.data() + contact.First;
+
+    // Like the position pass: every point from the same velocities, the impulses averaged
+    Vector3 ra[MaxPoints];
+    Vector3 rb[MaxPoints];
+    Vector3 impulses[MaxPoints];
+    int active = 0;
+
+    for (int k = 0; k < contact.Count; k++)
+    {
+        impulses[k] = Vector3Zero();
+        if (points[k].Lambda <= 0.0f) continue;
+
+        ra[k] = Vector3RotateByQuaternion(points[k].LocalA, bodyA.Orientation());
+        rb[k] = Vector3RotateByQuaternion(points[k].LocalB, bodyB.Orientation());
+        Vector3 relative = Vector3Subtract(PointVelocity(bodyB, rb[k]), PointVelocity(bodyA, ra[k]));
+        float normalSpeed = Vector3DotProduct(relative, normal);
+        Vector3 tangentVelocity = Vector3Subtract(relative, Vector3Scale(normal, normalSpeed));
+
+        // Restitution against the closing speed before the passes; slow contacts come to rest. The
+        // target may also take back separation speed the position passes added.
+        float restitution = -points[k].NormalSpeed > restingSpeed ? contact.Restitution : 0.0f;
+        float targetSpeed = fmaxf(-restitution * points[k].NormalSpeed, 0.0f);
+        float wn = GeneralizedInvMass(bodyA, ra[k], normal) + GeneralizedInvMass(bodyB, rb[k], normal);
+        if (wn > 0.0f)
+        {
+            impulses[k] = Vector3Scale(normal, (targetSpeed - normalSpeed) / wn);
+        }
+
+        // Dynamic friction, at most the normal correction of the passes times the coefficient
+        float slideSpeed = Vector3Length(tangentVelocity);
+        if (friction > 0.0f && slideSpeed >= 1e-7f)
+        {
+            Vector3 tangent = Vector3Scale(tangentVelocity, 1.0f / slideSpeed);
+            float wt = GeneralizedInvMass(bodyA, ra[k], tangent) + GeneralizedInvMass(bodyB, rb[k], tangent);
+            if (wt > 0.0f)
+            {
+                float impulse = fminf(slideSpeed / wt, friction * points[k].Lambda / time);
+                impulses[k] = Vector3Subtract(impulses[k], Vector3Scale(tangent, impulse));
+            }
+        }
+        active++;
+    }
+
+    if (active == 0)
+    {
+        return;
+    }
+
+    Push pushA;
+    Push pushB;
+    for (int k = 0; k < contact.Count; k++)
+    {
+        if (points[k].Lambda <= 0.0f) continue;
+
+        Vector3 p = Vector3Scale(impulses[k], 1.0f / (float)active);
+        pushA.Add(ra[k], Vector3Negate(p));
+        pushB.Add(rb[k], p);
+    }
+    ApplyImpulse(bodyA, pushA);
+    ApplyImpulse(bodyB, pushB);
+
+    // Rolling resistance: the spin of B against A is slowed by at most the coefficient times the
+    // normal impulse times the lever of the contact, so grains come to rest instead of rolling off
+    Vector3 spin = Vector3Subtract(bodyB.AngularVelocity(), bodyA.AngularVelocity());
+    float spinSpeed = Vector3Length(spin);
+    if (rollingFriction <= 0.0f || spinSpeed < 1e-7f)
+    {
+        return;
+    }
+
+    Vector3 axis = Vector3Scale(spin, 1.0f / spinSpeed);
+    float wr = Vector3DotProduct(axis, bodyA.ApplyInvInertia(axis)) + Vector3DotProduct(axis, bodyB.ApplyInvInertia(axis));
+    float lambda = 0.0f;
+    float lever = FLT_MAX;
+    for (int k = 0; k < contact.Count; k++)
+    {
+        if (points[k].Lambda <= 0.0f) continue;
+
+        lambda += points[k].Lambda;
+        if (!bodyA.IsStatic) lever = fminf(lever, Vector3Length(ra[k]));
+        if (!bodyB.IsStatic) lever = fminf(lever, Vector3Length(rb[k]));
+    }
+
+    if (wr <= 0.0f || lever == FLT_MAX)
+    {
+        return;
+    }
+
+    Vector3 torque = Vector3Scale(axis, fminf(spinSpeed / wr, rollingFriction * lever * lambda / time));
+    if (!bodyA.IsStatic) bodyA.AngularVelocity(Vector3Add(bodyA.AngularVelocity(), bodyA.ApplyInvInertia(torque)));
+    if (!bodyB.IsStatic) bodyB.AngularVelocity(Vector3Subtract(bodyB.AngularVelocity(), bodyB.ApplyInvInertia(torque)));
+}
+
+size_t PositionSolver::MemoryBytes() const
+{
+    return VectorBytes(this->contacts) + VectorBytes(this->points) + VectorBytes(this->carriedContacts) +
+        VectorBytes(this->carriedPoints) + VectorBytes(this->pairs) + VectorBytes(this->colorOrder) +
+        VectorBytes(this->colorStart) + VectorBytes(this->bodyColors) + VectorBytes(this->touched) +
+        VectorBytes(this->touchedList) + VectorBytes(this->startPositions) + VectorBytes(this->startOrientations) +
+        VectorBytes(this->solvePositions) + VectorBytes(this->solveOrientations);
+}
+
+void PositionSolver::Clear()
+{
+    ReleaseVector(this->contacts);
+    ReleaseVector(this->points);
+    this->carriedContacts.shrink_to_fit();
+    this->carriedPoints.shrink_to_fit();
+    ReleaseVector(this->pairs);
+    ReleaseVector(this->colorOrder);
+    ReleaseVector(this->colorStart);
+    ReleaseVector(this->bodyColors);
+    ReleaseVector(this->touched);
+    ReleaseVector(this->touchedList);
+    ReleaseVector(this->startPositions);
+    ReleaseVector(this->startOrientations);
+    ReleaseVector(this->solvePositions);
+    ReleaseVector(this->solveOrientations);
+}
@@ -0,0 +1,233 @@
+#include "Scene.h"
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include "MappedFile.h"
+#include "World.h"
+
+namespace
+{
+    // Error messages that carry the line number
+    const char* LineError(int line, const char* message)
+    {
+        static thread_local char buffer[128];
+        snprintf(buffer, sizeof(buffer), "Line %d: %s", line, message);
+        return buffer;
+    }
+
+    bool ParseLine(const char* line, BodyDesc* desc)
+    {
+        char shape[16];
+        int isStatic, r, g, b, a, gravity = GravitySourceReceiver;
+        unsigned int layer = 1, mask = 0xFFFFFFFFu;
+        Vector3 p, size = { 1, 1, 1 }, v = { 0, 0, 0 };
+        float radius = 1.0f, density, restitution;
+        int read;
+
+        if (sscanf(line, "%15s", shape) != 1)
+        {
+            return false;
+        }
+
+        if (strcmp(shape, "sphere") == 0)
+        {
+            read = sscanf(line, "%*s %f %f %f %f %f %f %d %d %d %d %d %f %f %f %d %x %x",
+                &p.x, &p.y, &p.z, &radius, &density, &restitution, &isStatic, &r, &g, &b, &a, &v.x, &v.y, &v.z, &gravity, &layer, &mask);
+            if (read != 11 && read != 14 && read != 15 && read != 17) return false;
+            desc->Shape = Sphere;
+        }
+        else if (strcmp(shape, "box") == 0)
+        {
+            read = sscanf(line, "%*s %f %f %f %f %f %f %f %f %d %d %d %d %d %f %f %f %d %x %x",
+                &p.x, &p.y, &p.z, &size.x, &size.y, &size.z, &density, &restitution, &isStatic, &r, &g, &b, &a, &v.x, &v.y, &v.z, &gravity, &layer, &mask);
+            if (read != 13 && read != 16 && read != 17 && read != 19) return false;
+            desc->Shape = Box;
+        }
+        else
+        {
+            return false;
+        }
+
+        desc->Position = p;
+        desc->LinearVelocity = v;
+        desc->Size = size;
+        desc->Radius = radius;
+        desc->Density = density;
+        desc->Restitution = restitution;
+        desc->IsStatic = isStatic != 0;
+        desc->Gravity = gravity;
+        desc->CollisionLayer = layer;
+        desc->CollisionMask = mask;
+        desc->color = { (unsigned char)r, (unsigned char)g, (unsigned char)b, (unsigned char)a };
+        return true;
+    }
+}
+
+bool Scene::Load(World* world, const char* path, const char** error)
+{
+    MappedFile file;
+    if (!file.Open(path, error))
+    {
+        return false;
+    }
+
+    Header header = {};
+    if (file.Size() >= sizeof(Header))
+    {
+        memcpy(&header, file.Data(), sizeof(Header));
+    }
+
+    if (header.Magic != Magic)
+    {
+        file.Close();
+        std::vector<BodyDesc> bodies;
+        return LoadText(path, &bodies, error) && world->AddBodies(bodies.data(), (int)bodies.size(), error);
+    }
+
+    // Version 1 records are BodyDesc without the collision filter
+    const size_t version1Size = offsetof(BodyDesc, CollisionLayer);
+    bool version1 = header.Version == 1 && header.DescSize == version1Size;
+
+    bool current = header.Version == Version && header.DescSize == sizeof(BodyDesc);
+
+    if ((!current && !version1) ||
+        header.HeaderSize % alignof(BodyDesc) != 0)
+    {
+        *error = "Unsupported scene version";
+        return false;
+    }
+
+    if (header.HeaderSize > file.Size() || header.BodyCount > (file.Size() - header.HeaderSize) / header.DescSize ||
+        header.BodyCount > INT32_MAX)
+    {
+        *error = "The scene is truncated";
+        return false;
+    }
+
+    if (version1)
+    {
+        std::vector<BodyDesc> bodies((size_t)header.BodyCount);
+        for (size_t i = 0; i < bodies.size(); i++)
+        {
+            memcpy((void*)&bodies[i], file.Data() + header.HeaderSize + i * version1Size, version1Size);
+        }
+        return world->AddBodies(bodies.data(), (int)bodies.size(), error);
+    }
+
+    // The mapping is page aligned and HeaderSize a multiple of the alignment, so the records are used in place
+    const BodyDesc* bodies = (const BodyDesc*)(file.Data() + header.HeaderSize);
+    return world->AddBodies(bodies, (int)header.BodyCount, error);
+}
+
+bool Scene::LoadText(const char* path, std::vector<BodyDesc>* bodies, const char** error)
+{
+    *error = "";
+
+    FILE* file = fopen(path, "r");
+    if (file == nullptr)
+    {
+        *error = "Could not open the scene file";
+        return false;
+    }
+
+    char line[512];
+    int lineNumber = 0;
+
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        lineNumber++;
+
+        char* start = line + strspn(line, " \t\r\n");
+        if (*start == '\0' || *start == '#') continue;
+
+        BodyDesc desc;
+        if (!ParseLine(start, &desc))
+        {
+            fclose(file);
+            *error = LineError(lineNumber, "expected a sphere or box line");
+            return false;
+        }
+
+        bodies->push_back(desc);
+    }
+
+    fclose(file);
+    return true;
+}
+
+bool Scene::SaveText(const char* path, const BodyDesc* bodies, int count, const char** error)
+{
+    *error = "";
+
+    FILE* file = fopen(path, "w");
+    if (file == nullptr)
+    {
+        *error = "Could not create the scene file";
+        return false;
+    }
+
+    fprintf(file, "# sphere x y z radius density restitution static r g b a vx vy vz gravity layer mask\n");
+    fprintf(file, "# box x y z sx sy sz density restitution static r g b a vx vy vz gravity layer mask\n");
+
+    for (int i = 0; i < count; i++)
+    {
+        const BodyDesc& b = bodies[i];
+        const Color& c = b.color;
+
+        // %.9g round-trips every float
+        if (b.Shape == Box)
+        {
+            fprintf(file, "box %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %d %d %d %d %d %.9g %.9g %.9g %d 0x%x 0x%x\n",
+                b.Position.x, b.Position.y, b.Position.z, b.Size.x, b.Size.y, b.Size.z, b.Density, b.Restitution,
+                b.IsStatic != 0, c.r, c.g, c.b, c.a, b.LinearVelocity.x, b.LinearVelocity.y, b.LinearVelocity.z, b.Gravity,
+                b.CollisionLayer, b.CollisionMask);
+        }
+        else
+        {
+            fprintf(file, "sphere %.9g %.9g %.9g %.9g %.9g %.9g %d %d %d %d %d %.9g %.9g %.9g %d 0x%x 0x%x\n",
+                b.Position.x, b.Position.y, b.Position.z, b.Radius, b.Density, b.Restitution,
+                b.IsStatic != 0, c.r, c.g, c.b, c.a, b.LinearVelocity.x, b.LinearVelocity.y, b.LinearVelocity.z, b.Gravity,
+                b.CollisionLayer, b.CollisionMask);
+        }
+    }
+
+    if (fclose(file) != 0)
+    {
+        *error = "Could not write the scene file";
+        return false;
+    }
+
+    return true;
+}
+
+bool Scene::SaveBinary(const char* path, const BodyDesc* bodies, int count, const char** error)
+{
+    *error = "";
+
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        *error = "Could not create the scene file";
+        return false;
+    }
+
+    Header header = {};
+    header.Magic = Magic;
+    header.Version = Version;
+    header.HeaderSize = sizeof(Header);
+    header.DescSize = sizeof(BodyDesc);
+    header.BodyCount = count > 0 ? (uint64_t)count : 0;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(bodies, sizeof(BodyDesc), (size_t)header.BodyCount, file) == header.BodyCount;
+    ok = fclose(file) == 0 && ok;
+
+    if (!ok)
+    {
+        *error = "Could not write the scene file";
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,380 @@
+#include "Snapshot.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "MappedFile.h"
+#include "World.h"
+
+namespace
+{
+    const uint64_t SectionAlignment = 16;
+
+    uint64_t Align(uint64_t offset)
+    {
+        return (offset + SectionAlignment - 1) & ~(SectionAlignment - 1);
+    }
+
+    // Pads the file from position up to offset (the next section)
+    bool WritePadding(FILE* file, uint64_t& position, uint64_t offset)
+    {
+        static const unsigned char padding[SectionAlignment] = {};
+        if (position > offset || offset - position > SectionAlignment) return false;
+
+        size_t count = (size_t)(offset - position);
+        position = offset;
+        return fwrite(padding, 1, count, file) == count;
+    }
+
+    // Writes one per-body array at offset
+    template <typename T, typename F>
+    bool WriteSection(FILE* file, uint64_t& position, const std::vector<Body>& bodies, uint64_t offset, F get)
+    {
+        if (!WritePadding(file, position, offset)) return false;
+
+        // Gather in blocks so the scratch buffer stays small for any body count
+        const size_t blockSize = 4096;
+        std::vector<T> block(std::min(blockSize, bodies.size()));
+
+        for (size_t first = 0; first < bodies.size(); first += blockSize)
+        {
+            size_t count = std::min(blockSize, bodies.size() - first);
+            for (size_t i = 0; i < count; i++)
+            {
+                block[i] = get(bodies[first + i]);
+            }
+            if (fwrite(block.data(), sizeof(T), count, file) != count) return false;
+            position += count * sizeof(T);
+        }
+
+        return true;
+    }
+
+    const Snapshot::Section* FindSection(const Snapshot::Section* sections, uint32_t count, uint32_t id)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (sections[i].Id == id) return &sections[i];
+        }
+        return nullptr;
+    }
+
+    // Unaligned read of element i of a section
+    template <typename T>
+    T Read(const unsigned char* section, size_t i)
+    {
+        T value;
+        memcpy(&value, section + i * sizeof(T), sizeof(T));
+        return value;
+    }
+}
+
+bool Snapshot::Save(const World& world, const char* path, const char** error)
+{
+    *error = "";
+
+    const std::vector<Body>& bodies = world.bodyList;
+    const uint64_t n = bodies.size();
+    const bool accelerations = world.accelerationsValid && world.accelerationList.size() == n;
+
+    Section sections[] = {
+        { SectionPosition, sizeof(Vector3), 0 },
+        { SectionLinearVelocity, sizeof(Vector3), 0 },
+        { SectionOrientation, sizeof(Quaternion), 0 },
+        { SectionAngularVelocity, sizeof(Vector3), 0 },
+        { SectionForce, sizeof(Vector3), 0 },
+        { SectionTorque, sizeof(Vector3), 0 },
+        { SectionShape, sizeof(ShapeRecord), 0 },
+        { SectionMass, sizeof(float), 0 },
+        { SectionDensity, sizeof(float), 0 },
+        { SectionRestitution, sizeof(float), 0 },
+        { SectionFlags, sizeof(uint32_t), 0 },
+        { SectionColor, sizeof(Color), 0 },
+        { SectionCollisionFilter, sizeof(CollisionFilterRecord), 0 },
+        { SectionAcceleration, sizeof(Vector3), 0 }, // last, left out when not valid
+    };
+    const uint32_t sectionCount = sizeof(sections) / sizeof(sections[0]) - (accelerations ? 0 : 1);
+
+    uint64_t offset = Align(sizeof(Header) + sectionCount * sizeof(Section));
+    for (uint32_t i = 0; i < sectionCount; i++)
+    {
+        sections[i].Offset = offset;
+        offset = Align(offset + n * sections[i].Stride);
+    }
+
+    Header header = {};
+    header.Magic = Magic;
+    header.Version = Version;
+    header.HeaderSize = sizeof(Header);
+    header.SectionCount = sectionCount;
+    header.BodyCount = n;
+    header.G = world.G;
+    header.BroadPhase = world.broadPhase;
+    header.GridNodeSize = world.gridNodeSize;
+    header.Integrator = world.integrator;
+    header.AdaptiveTolerance = world.adaptiveTolerance;
+    header.AdaptiveStep = world.adaptiveStep;
+    header.Softening = world.gravity.Softening;
+    header.Cutoff = world.gravity.Cutoff;
+    header.Solver = world.gravity.Solver;
+    header.Order = world.gravity.Order;
+    header.Theta = world.gravity.Theta;
+    header.LeafSize = world.gravity.LeafSize;
+    header.ContactSolver = world.solver.Solver;
+    header.SolverIterations = world.solver.Iterations;
+    header.Compliance = world.solver.Compliance;
+    header.Friction = world.solver.Friction;
+    header.RollingFriction = world.solver.RollingFriction;
+    header.RestingSpeed = world.solver.RestingSpeed;
+
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        *error = "Could not create the snapshot file";
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(sections, sizeof(Section), sectionCount, file) == sectionCount;
+    uint64_t position = sizeof(header) + sectionCount * sizeof(Section);
+
+    ok = ok && WriteSection<Vector3>(file, position, bodies, sections[0].Offset, [](const Body& b) { return b._Position; });
+    ok = ok && WriteSection<Vector3>(file, position, bodies, sections[1].Offset, [](const Body& b) { return b._LinearVelocity; });
+    ok = ok && WriteSection<Quaternion>(file, position, bodies, sections[2].Offset, [](const Body& b) { return b._Orientation; });
+    ok = ok && WriteSection<Vector3>(file, position, bodies, sections[3].Offset, [](const Body& b) { return b._AngularVelocity; });
+    ok = ok && WriteSection<Vector3>(file, position, bodies, sections[4].Offset, [](const Body& b) { return b.force; });
+    ok = ok && WriteSection<Vector3>(file, position, bodies, sections[5].Offset, [](const Body& b) { return b.torque; });
+    ok = ok && WriteSection<ShapeRecord>(file, position, bodies, sections[6].Offset, [](const Body& b)
+        {
+            return ShapeRecord{ b.shapeType, b.Radius, { b.Size.x, b.Size.y, b.Size.z } };
+        });
+    ok = ok && WriteSection<float>(file, position, bodies, sections[7].Offset, [](const Body& b) { return b.Mass; });
+    ok = ok && WriteSection<float>(file, position, bodies, sections[8].Offset, [](const Body& b) { return b.Density; });
+    ok = ok && WriteSection<float>(file, position, bodies, sections[9].Offset, [](const Body& b) { return b.Restitution; });
+    ok = ok && WriteSection<uint32_t>(file, position, bodies, sections[10].Offset, [](const Body& b)
+        {
+            return (b.IsStatic ? FlagStatic : 0u) | ((uint32_t)b.Gravity << GravityShift);
+        });
+    ok = ok && WriteSection<Color>(file, position, bodies, sections[11].Offset, [](const Body& b) { return b.color; });
+    ok = ok && WriteSection<CollisionFilterRecord>(file, position, bodies, sections[12].Offset, [](const Body& b)
+        {
+            return CollisionFilterRecord{ b.CollisionLayer, b.CollisionMask };
+        });
+
+    if (ok && accelerations)
+    {
+        ok = WritePadding(file, position, sections[13].Offset) &&
+            fwrite(world.accelerationList.data(), sizeof(Vector3), (size_t)n, file) == n;
+    }
+
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+    {
+        *error = "Could not write the snapshot file";
+        return false;
+    }
+
+    return true;
+}
+
+bool Snapshot::Load(World* world, const char* path, bool loadMeshes, const char** error)
+{
+    MappedFile file;
+    if (!file.Open(path, error))
+    {
+        return false;
+    }
+
+    const unsigned char* data = file.Data();
+    const uint64_t size = file.Size();
+
+    // Version 1 ends before the contact solver settings
+    const uint64_t headerSizeV1 = offsetof(Header, ContactSolver);
+    Header header = {};
+    if (size < headerSizeV1)
+    {
+        *error = "The file is not a snapshot";
+        return false;
+    }
+    memcpy(&header, data, (size_t)std::min<uint64_t>(size, sizeof(Header)));
+
+    if (header.Magic != Magic)
+    {
+        *error = "The file is not a snapshot";
+        return false;
+    }
+
+    if (header.Version < 1 || header.Version > Version || header.HeaderSize < (header.Version == 1 ? headerSizeV1 : sizeof(Header)))
+    {
+        *error = "Unsupported snapshot version";
+        return false;
+    }
+
+    SolverConfig solver;
+    if (header.Version >= 2)
+    {
+        solver.Solver = (ContactSolver)header.ContactSolver;
+        solver.Iterations = header.SolverIterations;
+        solver.Compliance = header.Compliance;
+        solver.Friction = header.Friction;
+        solver.RollingFriction = header.RollingFriction;
+        solver.RestingSpeed = header.RestingSpeed;
+    }
+
+    if (header.HeaderSize + (uint64_t)header.SectionCount * sizeof(Section) > size)
+    {
+        *error = "The snapshot is truncated";
+        return false;
+    }
+
+    std::vector<Section> sections(header.SectionCount);
+    memcpy(sections.data(), data + header.HeaderSize, sections.size() * sizeof(Section));
+
+    const uint64_t n = header.BodyCount;
+    for (const Section& section : sections)
+    {
+        // Divided rather than multiplied, so a huge BodyCount cannot wrap past the check
+        if (section.Offset > size || (section.Stride != 0 && n > (size - section.Offset) / section.Stride))
+        {
+            *error = "The snapshot is truncated";
+            return false;
+        }
+    }
+
+    // Required sections must exist with the expected element size; unknown ones are skipped
+    const unsigned char* arrays[SectionCollisionFilter + 1] = {};
+    const uint32_t strides[SectionCollisionFilter + 1] = {
+        0,
+        sizeof(Vector3), sizeof(Vector3), sizeof(Quaternion), sizeof(Vector3), sizeof(Vector3), sizeof(Vector3),
+        sizeof(ShapeRecord), sizeof(float), sizeof(float), sizeof(float), sizeof(uint32_t), sizeof(Color),
+        sizeof(Vector3), sizeof(CollisionFilterRecord)
+    };
+
+    for (uint32_t id = SectionPosition; id <= SectionCollisionFilter; id++)
+    {
+        const Section* section = FindSection(sections.data(), header.SectionCount, id);
+        bool optional = id == SectionForce || id == SectionTorque || id == SectionAcceleration || id == SectionCollisionFilter;
+
+        if (section == nullptr)
+        {
+            if (optional) continue;
+            *error = "The snapshot is missing body data";
+            return false;
+        }
+
+        if (section->Stride != strides[id])
+        {
+            *error = "Snapshot section has an unexpected size";
+            return false;
+        }
+
+        arrays[id] = data + section->Offset;
+    }
+
+    if (header.BroadPhase < BruteForce || header.BroadPhase > MortonBVH || !(header.GridNodeSize >= 0.0f) ||
+        header.Integrator < SemiImplicitEuler || header.Integrator > AdaptiveRK ||
+        header.Solver < DirectSum || header.Solver > Multipole ||
+        solver.Solver < ImpulseSolver || solver.Solver > PositionBased)
+    {
+        *error = "Invalid snapshot data";
+        return false;
+    }
+
+    if (world->memoryLimits.MaxBodies > 0 && n > (uint64_t)world->memoryLimits.MaxBodies)
+    {
+        *error = "The snapshot has more bodies than the world body limit";
+        return false;
+    }
+
+    world->MemoryUsage(); // folds the bodies about to be freed into the peaks
+    for (int i = 0; i < world->bodyCount; i++)
+    {
+        UnloadModel(world->bodyList[i].Mesh);
+    }
+    world->bodyList.clear();
+    world->bodyList.reserve((size_t)n);
+    world->contactList.clear();
+    world->ContactPointsList.clear();
+    world->dirtyListStale = true;
+    world->gridDirty = true;
+    world->queryCellsDirty = true;
+    world->touchingPairs.clear();
+    world->contactEvents.clear();
+
+    for (size_t i = 0; i < n; i++)
+    {
+        ShapeRecord shape = Read<ShapeRecord>(arrays[SectionShape], i);
+        uint32_t flags = Read<uint32_t>(arrays[SectionFlags], i);
+        ShapeType type = shape.Type == Box ? Box : Sphere;
+        Vector3 boxSize = { shape.Size[0], shape.Size[1], shape.Size[2] };
+        float volume = type == Box ? boxSize.x * boxSize.y * boxSize.z : shape.Radius * shape.Radius * shape.Radius * PI * 4 / 3;
+
+        world->bodyList.push_back(Body(
+            Read<Vector3>(arrays[SectionPosition], i),
+            type == Box ? boxSize : Vector3Zero(),
+            type == Box ? 0.f : shape.Radius,
+            Read<float>(arrays[SectionDensity], i),
+            Read<float>(arrays[SectionMass], i),
+            Read<float>(arrays[SectionRestitution], i),
+            volume,
+            (flags & FlagStatic) != 0,
+            type,
+            Read<Color>(arrays[SectionColor], i)));
+
+        Body& body = world->bodyList.back();
+        body._LinearVelocity = Read<Vector3>(arrays[SectionLinearVelocity], i);
+        body._Orientation = Read<Quaternion>(arrays[SectionOrientation], i);
+        body._AngularVelocity = Read<Vector3>(arrays[SectionAngularVelocity], i);
+        if (arrays[SectionForce] != nullptr) body.force = Read<Vector3>(arrays[SectionForce], i);
+        if (arrays[SectionTorque] != nullptr) body.torque = Read<Vector3>(arrays[SectionTorque], i);
+        body.Gravity = (int)((flags >> GravityShift) & GravitySourceReceiver);
+        if (arrays[SectionCollisionFilter] != nullptr)
+        {
+            CollisionFilterRecord filter = Read<CollisionFilterRecord>(arrays[SectionCollisionFilter], i);
+            body.CollisionLayer = filter.Layer;
+            body.CollisionMask = filter.Mask;
+        }
+
+        if (loadMeshes)
+        {
+            body.LoadMesh();
+        }
+    }
+
+    world->bodyCount = (float)n;
+    world->G = header.G;
+    world->broadPhase = (BroadPhase)header.BroadPhase;
+    world->gridNodeSize = header.GridNodeSize;
+    world->integrator = (Integrator)header.Integrator;
+    world->SelectStep();
+    world->adaptiveTolerance = header.AdaptiveTolerance;
+    world->adaptiveStep = header.AdaptiveStep;
+
+    GravityConfig gravity;
+    gravity.Softening = header.Softening;
+    gravity.Cutoff = header.Cutoff;
+    gravity.Solver = (GravitySolver)header.Solver;
+    gravity.Order = header.Order;
+    gravity.Theta = header.Theta;
+    gravity.LeafSize = header.LeafSize;
+    world->SetGravity(gravity);
+    world->SetSolver(solver);
+
+    // The Verlet cache is the only array that maps 1:1 onto World storage
+    if (arrays[SectionAcceleration] != nullptr)
+    {
+        // Copied bytewise like Read, the section may be unaligned
+        world->accelerationList.resize(n);
+        memcpy(world->accelerationList.data(), arrays[SectionAcceleration], n * sizeof(Vector3));
+        world->accelerationsValid = true;
+    }
+    else
+    {
+        world->accelerationList.clear();
+    }
+
+    *error = "";
+    return true;
+}
@@ -0,0 +1,137 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace
+{
+    // Jobs the current thread is running chunks of, of any pool; a ParallelFor from inside one
+    // runs inline instead of replacing the job its own pool is still running
+    thread_local int jobDepth = 0;
+
+    struct JobScope
+    {
+        JobScope() { jobDepth++; }
+        ~JobScope() { jobDepth--; }
+    };
+}
+
+ThreadPool::ThreadPool(int threadCount)
+{
+    if (threadCount <= 0)
+    {
+        threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+
+    for (int i = 1; i < threadCount; i++)
+    {
+        this->workers.emplace_back(&ThreadPool::WorkerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+
+    for (auto& worker : this->workers)
+    {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::Default()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::RunChunks(const std::function<void(int, int)>& fn, int count, int grain)
+{
+    JobScope scope;
+    while (true)
+    {
+        int begin = this->next.fetch_add(grain);
+        if (begin >= count) break;
+        fn(begin, std::min(begin + grain, count));
+    }
+}
+
+void ThreadPool::ParallelFor(int count, int grain, const std::function<void(int, int)>& fn)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    grain = std::max(grain, 1);
+
+    // Small jobs, single thread pools and calls from inside a running job go inline
+    if (jobDepth > 0 || this->workers.empty() || count <= grain)
+    {
+        fn(0, count);
+        return;
+    }
+
+    // Another thread is running a job on this pool
+    std::unique_lock<std::mutex> call(this->callMutex, std::try_to_lock);
+    if (!call.owns_lock())
+    {
+        fn(0, count);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->job = &fn;
+        this->jobCount = count;
+        this->jobGrain = grain;
+        this->next = 0;
+        this->generation++;
+    }
+    this->wake.notify_all();
+
+    this->RunChunks(fn, count, grain);
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->done.wait(lock, [this] { return this->active == 0; });
+    this->job = nullptr;
+}
+
+void ThreadPool::WorkerLoop()
+{
+    unsigned int seen = 0;
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (true)
+    {
+        this->wake.wait(lock, [&] { return this->stopping || this->generation != seen; });
+        if (this->stopping)
+        {
+            return;
+        }
+
+        seen = this->generation;
+
+        // The job may already be finished by the time a worker wakes up
+        if (this->job == nullptr)
+        {
+            continue;
+        }
+
+        const std::function<void(int, int)>* fn = this->job;
+        int count = this->jobCount;
+        int grain = this->jobGrain;
+        this->active++;
+
+        lock.unlock();
+        this->RunChunks(*fn, count, grain);
+        lock.lock();
+
+        if (--this->active == 0)
+        {
+            this->done.notify_all();
+        }
+    }
+}
@@ -0,0 +1,509 @@
+#include "TrajectoryRecorder.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Body.h"
+
+namespace
+{
+    const int Components = 6; // px, py, pz, vx, vy, vz
+
+    uint32_t Quantize(float value, float inverseStep)
+    {
+        double q = std::round((double)value * inverseStep);
+        q = std::min(std::max(q, (double)INT32_MIN), (double)INT32_MAX);
+        return (uint32_t)(int32_t)q;
+    }
+
+    uint32_t FloatBits(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    float BitsFloat(uint32_t bits)
+    {
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    uint32_t ZigZag(uint32_t delta)
+    {
+        return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+    }
+
+    uint32_t UnZigZag(uint32_t value)
+    {
+        return (value >> 1) ^ (0u - (value & 1));
+    }
+
+    void PutVarint(std::vector<unsigned char>& out, uint32_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back((unsigned char)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((unsigned char)value);
+    }
+
+    bool GetVarint(const unsigned char*& in, const unsigned char* end, uint32_t* value)
+    {
+        uint32_t result = 0;
+        for (int shift = 0; shift < 35 && in < end; shift += 7)
+        {
+            unsigned char byte = *in++;
+            result |= (uint32_t)(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                *value = result;
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+TrajectoryRecorder::~TrajectoryRecorder()
+{
+    const char* error;
+    this->Close(&error);
+}
+
+bool TrajectoryRecorder::Open(const char* path, const RecorderConfig& config, const char** error)
+{
+    *error = "";
+
+    if (this->file != nullptr)
+    {
+        *error = "The recorder is already open";
+        return false;
+    }
+
+    this->config = config;
+    this->config.PositionPrecision = fmaxf(config.PositionPrecision, 1e-9f);
+    this->config.VelocityPrecision = fmaxf(config.VelocityPrecision, 1e-9f);
+    this->config.FramesPerChunk = std::max(config.FramesPerChunk, 1);
+    this->config.Interval = std::max(config.Interval, 1);
+
+    this->file = fopen(path, "wb");
+    if (this->file == nullptr)
+    {
+        *error = "Could not create the trajectory file";
+        return false;
+    }
+
+    Trajectory::FileHeader header = {};
+    header.Magic = Trajectory::Magic;
+    header.Version = Trajectory::Version;
+    header.Encoding = this->config.Encoding;
+    header.FramesPerChunk = this->config.FramesPerChunk;
+    header.PositionPrecision = this->config.PositionPrecision;
+    header.VelocityPrecision = this->config.VelocityPrecision;
+
+    if (fwrite(&header, sizeof(header), 1, this->file) != 1)
+    {
+        fclose(this->file);
+        this->file = nullptr;
+        *error = "Could not write the trajectory file";
+        return false;
+    }
+
+    this->fileOffset = sizeof(header);
+    this->frameCount = 0;
+    this->captureCount = 0;
+    this->stallCount = 0;
+    this->chunks.clear();
+    this->previous.clear();
+    this->stopping = false;
+    this->hasPending = false;
+    this->failed = false;
+    this->writer = std::thread(&TrajectoryRecorder::WriterLoop, this);
+    return true;
+}
+
+bool TrajectoryRecorder::Close(const char** error)
+{
+    *error = "";
+
+    if (this->file == nullptr)
+    {
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->ready.notify_all();
+    this->writer.join();
+
+    // Chunk index and footer, so readers can seek without scanning
+    Trajectory::Footer footer = {};
+    footer.IndexOffset = this->fileOffset;
+    footer.ChunkCount = (uint32_t)this->chunks.size();
+    footer.Magic = Trajectory::Magic;
+
+    bool ok = !this->failed &&
+        fwrite(this->chunks.data(), sizeof(Trajectory::ChunkEntry), this->chunks.size(), this->file) == this->chunks.size() &&
+        fwrite(&footer, sizeof(footer), 1, this->file) == 1;
+    ok = fclose(this->file) == 0 && ok;
+    this->file = nullptr;
+
+    if (!ok)
+    {
+        *error = "Could not write the trajectory file";
+        return false;
+    }
+
+    return true;
+}
+
+void TrajectoryRecorder::Capture(const std::vector<Body>& bodies, double time)
+{
+    if (this->file == nullptr || this->captureCount++ % this->config.Interval != 0)
+    {
+        return;
+    }
+
+    const size_t n = bodies.size();
+    Frame& frame = this->capture;
+    frame.time = time;
+    frame.bodyCount = (uint32_t)n;
+    frame.values.resize(n * Components);
+
+    uint32_t* values = frame.values.data();
+    if (this->config.Encoding == QuantizedDelta)
+    {
+        float inversePosition = 1.0f / this->config.PositionPrecision;
+        float inverseVelocity = 1.0f / this->config.VelocityPrecision;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            Vector3 p = bodies[i].Position();
+            Vector3 v = bodies[i].LinearVelocity();
+            values[0 * n + i] = Quantize(p.x, inversePosition);
+            values[1 * n + i] = Quantize(p.y, inversePosition);
+            values[2 * n + i] = Quantize(p.z, inversePosition);
+            values[3 * n + i] = Quantize(v.x, inverseVelocity);
+            values[4 * n + i] = Quantize(v.y, inverseVelocity);
+            values[5 * n + i] = Quantize(v.z, inverseVelocity);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            Vector3 p = bodies[i].Position();
+            Vector3 v = bodies[i].LinearVelocity();
+            values[0 * n + i] = FloatBits(p.x);
+            values[1 * n + i] = FloatBits(p.y);
+            values[2 * n + i] = FloatBits(p.z);
+            values[3 * n + i] = FloatBits(v.x);
+            values[4 * n + i] = FloatBits(v.y);
+            values[5 * n + i] = FloatBits(v.z);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (this->hasPending)
+    {
+        this->stallCount++;
+        this->consumed.wait(lock, [this] { return !this->hasPending; });
+    }
+
+    std::swap(this->capture, this->pending);
+    this->hasPending = true;
+    lock.unlock();
+    this->ready.notify_one();
+}
+
+void TrajectoryRecorder::WriterLoop()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (true)
+    {
+        this->ready.wait(lock, [this] { return this->stopping || this->hasPending; });
+        if (!this->hasPending)
+        {
+            return;
+        }
+
+        std::swap(this->pending, this->working);
+        this->hasPending = false;
+        lock.unlock();
+        this->consumed.notify_one();
+
+        this->WriteFrame(this->working);
+        lock.lock();
+    }
+}
+
+void TrajectoryRecorder::WriteFrame(const Frame& frame)
+{
+    if (this->failed)
+    {
+        return;
+    }
+
+    // A new chunk starts every FramesPerChunk frames, and whenever the body count changes
+    bool key = this->chunks.empty() || this->chunks.back().FrameCount >= (uint32_t)this->config.FramesPerChunk ||
+        this->previous.size() != frame.values.size();
+
+    if (key)
+    {
+        this->previous.assign(frame.values.size(), 0);
+        this->chunks.push_back({ this->fileOffset, frame.time, this->frameCount, 0 });
+    }
+
+    this->encoded.clear();
+    for (size_t k = 0; k < frame.values.size(); k++)
+    {
+        uint32_t value = frame.values[k];
+        uint32_t last = this->previous[k];
+        PutVarint(this->encoded, this->config.Encoding == QuantizedDelta ? ZigZag(value - last) : value ^ last);
+    }
+    this->previous = frame.values;
+
+    Trajectory::FrameHeader header = {};
+    header.Bytes = (uint32_t)this->encoded.size();
+    header.BodyCount = frame.bodyCount;
+    header.KeyFrame = key ? 1 : 0;
+    header.Time = frame.time;
+
+    if (fwrite(&header, sizeof(header), 1, this->file) != 1 ||
+        fwrite(this->encoded.data(), 1, this->encoded.size(), this->file) != this->encoded.size())
+    {
+        this->failed = true;
+        return;
+    }
+
+    this->fileOffset += sizeof(header) + this->encoded.size();
+    this->chunks.back().FrameCount++;
+    this->frameCount++;
+}
+
+bool TrajectoryReader::Open(const char* path, const char** error)
+{
+    if (!this->file.Open(path, error))
+    {
+        return false;
+    }
+
+    const unsigned char* data = this->file.Data();
+    const uint64_t size = this->file.Size();
+
+    if (size < sizeof(Trajectory::FileHeader))
+    {
+        *error = "The file is not a trajectory";
+        return false;
+    }
+    memcpy(&this->header, data, sizeof(this->header));
+
+    if (this->header.Magic != Trajectory::Magic)
+    {
+        *error = "The file is not a trajectory";
+        return false;
+    }
+
+    if (this->header.Version != Trajectory::Version)
+    {
+        *error = "Unsupported trajectory version";
+        return false;
+    }
+
+    this->chunks.clear();
+    this->frameCount = 0;
+    this->lastFrame = -1;
+
+    Trajectory::Footer footer = {};
+    if (size >= sizeof(Trajectory::FileHeader) + sizeof(footer))
+    {
+        memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+    }
+
+    // Frames end where the index starts, or at the end of the file when there is no footer
+    uint64_t end = size;
+    bool closed = footer.Magic == Trajectory::Magic && footer.IndexOffset >= sizeof(Trajectory::FileHeader) &&
+        footer.IndexOffset <= size - sizeof(footer);
+    if (closed)
+    {
+        end = footer.IndexOffset;
+    }
+
+    uint64_t indexBytes = (uint64_t)footer.ChunkCount * sizeof(Trajectory::ChunkEntry);
+    if (closed && footer.IndexOffset + indexBytes + sizeof(footer) == size)
+    {
+        this->chunks.resize(footer.ChunkCount);
+        memcpy(this->chunks.data(), data + footer.IndexOffset, indexBytes);
+        if (!this->IndexValid(end))
+        {
+            this->chunks.clear();
+        }
+    }
+
+    if (this->chunks.empty())
+    {
+        // Not closed (crash or still recording) or a bad index: rebuild it from the complete frames
+        uint64_t offset = sizeof(Trajectory::FileHeader);
+        while (offset + sizeof(Trajectory::FrameHeader) <= end)
+        {
+            Trajectory::FrameHeader frame;
+            memcpy(&frame, data + offset, sizeof(frame));
+            if (frame.Bytes > end - offset - sizeof(frame)) break;
+
+            if (frame.KeyFrame || this->chunks.empty())
+            {
+                this->chunks.push_back({ offset, frame.Time, this->frameCount, 0 });
+            }
+
+            this->chunks.back().FrameCount++;
+            this->frameCount++;
+            offset += sizeof(frame) + frame.Bytes;
+        }
+    }
+
+    this->frameCount = 0;
+    for (const Trajectory::ChunkEntry& chunk : this->chunks)
+    {
+        this->frameCount += chunk.FrameCount;
+    }
+
+    *error = "";
+    return true;
+}
+
+bool TrajectoryReader::IndexValid(uint64_t end) const
+{
+    uint64_t firstFrame = 0;
+    uint64_t offset = sizeof(Trajectory::FileHeader);
+
+    for (const Trajectory::ChunkEntry& chunk : this->chunks)
+    {
+        if (chunk.FirstFrame != firstFrame || chunk.FrameCount == 0) return false;
+        if (chunk.Offset < offset || chunk.Offset + sizeof(Trajectory::FrameHeader) > end) return false;
+
+        // Key frames are in file order, each at least one frame header past the previous one
+        firstFrame += chunk.FrameCount;
+        offset = chunk.Offset + sizeof(Trajectory::FrameHeader);
+    }
+
+    // ReadFrame takes int frame numbers
+    return firstFrame <= (uint64_t)INT32_MAX;
+}
+
+bool TrajectoryReader::DecodeFrame(uint64_t offset, uint64_t* next, double* time, uint32_t* bodyCount)
+{
+    const unsigned char* data = this->file.Data();
+    const uint64_t size = this->file.Size();
+
+    Trajectory::FrameHeader frame;
+    if (offset + sizeof(frame) > size) return false;
+    memcpy(&frame, data + offset, sizeof(frame));
+    if (frame.Bytes > size - offset - sizeof(frame)) return false;
+
+    size_t count = (size_t)frame.BodyCount * Components;
+    if (frame.KeyFrame)
+    {
+        this->values.assign(count, 0);
+    }
+    else if (this->values.size() != count)
+    {
+        return false;
+    }
+
+    const unsigned char* in = data + offset + sizeof(frame);
+    const unsigned char* end = in + frame.Bytes;
+    bool quantized = this->header.Encoding == QuantizedDelta;
+
+    for (size_t k = 0; k < count; k++)
+    {
+        uint32_t value;
+        if (!GetVarint(in, end, &value)) return false;
+        this->values[k] = quantized ? this->values[k] + UnZigZag(value) : this->values[k] ^ value;
+    }
+
+    *next = offset + sizeof(frame) + frame.Bytes;
+    *time = frame.Time;
+    *bodyCount = frame.BodyCount;
+    return true;
+}
+
+bool TrajectoryReader::ReadFrame(int frame, double* time, std::vector<Vector3>* positions, std::vector<Vector3>* velocities,
+    const char** error)
+{
+    *error = "";
+
+    if (frame < 0 || frame >= (int)this->frameCount)
+    {
+        *error = "Frame out of range";
+        return false;
+    }
+
+    uint64_t offset;
+    int current;
+
+    if (this->lastFrame >= 0 && frame == this->lastFrame + 1)
+    {
+        offset = this->nextOffset;
+        current = frame;
+    }
+    else
+    {
+        // Last chunk starting at or before the frame
+        auto chunk = std::upper_bound(this->chunks.begin(), this->chunks.end(), (uint32_t)frame,
+            [](uint32_t value, const Trajectory::ChunkEntry& entry) { return value < entry.FirstFrame; }) - 1;
+        offset = chunk->Offset;
+        current = (int)chunk->FirstFrame;
+    }
+
+    uint32_t bodyCount = 0;
+    for (; current <= frame; current++)
+    {
+        if (!this->DecodeFrame(offset, &offset, time, &bodyCount))
+        {
+            this->lastFrame = -1;
+            *error = "The trajectory is corrupt";
+            return false;
+        }
+    }
+
+    this->lastFrame = frame;
+    this->nextOffset = offset;
+
+    const size_t n = bodyCount;
+    const uint32_t* values = this->values.data();
+    bool quantized = this->header.Encoding == QuantizedDelta;
+    float positionStep = this->header.PositionPrecision;
+    float velocityStep = this->header.VelocityPrecision;
+
+    auto decode = [&](int component, size_t i, float step)
+    {
+        uint32_t value = values[component * n + i];
+        return quantized ? (float)((double)(int32_t)value * step) : BitsFloat(value);
+    };
+
+    if (positions != nullptr)
+    {
+        positions->resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            (*positions)[i] = { decode(0, i, positionStep), decode(1, i, positionStep), decode(2, i, positionStep) };
+        }
+    }
+
+    if (velocities != nullptr)
+    {
+        velocities->resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            (*velocities)[i] = { decode(3, i, velocityStep), decode(4, i, velocityStep), decode(5, i, velocityStep) };
+        }
+    }
+
+    return true;
+}
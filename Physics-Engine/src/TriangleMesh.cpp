@@ -0,0 +1,223 @@
+#include "TriangleMesh.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+    constexpr int BinCount = 16;
+
+    float Component(Vector3 v, int axis)
+    {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+
+    float SurfaceArea(const AABB& box)
+    {
+        Vector3 size = box.GetSize();
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    bool IsFinite(Vector3 v)
+    {
+        return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z);
+    }
+}
+
+bool TriangleMesh::Create(const Vector3* vertices, int vertexCount, const int* indices, int indexCount,
+    TriangleMesh* mesh, const char** error)
+{
+    *error = "";
+
+    if (indexCount <= 0 || indexCount % 3 != 0)
+    {
+        *error = "Triangle mesh index count must be a positive multiple of 3";
+        return false;
+    }
+
+    for (int i = 0; i < vertexCount; i++)
+    {
+        if (!IsFinite(vertices[i]))
+        {
+            *error = "Triangle mesh vertices must be finite";
+            return false;
+        }
+    }
+
+    std::vector<Triangle> triangles;
+    triangles.reserve(indexCount / 3);
+
+    for (int i = 0; i < indexCount; i += 3)
+    {
+        int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        if (a < 0 || a >= vertexCount || b < 0 || b >= vertexCount || c < 0 || c >= vertexCount)
+        {
+            *error = "Triangle mesh index out of range";
+            return false;
+        }
+
+        Triangle triangle = { vertices[a], vertices[b], vertices[c] };
+        Vector3 cross = Vector3CrossProduct(Vector3Subtract(triangle.B, triangle.A), Vector3Subtract(triangle.C, triangle.A));
+        if (Vector3LengthSqr(cross) > 0.0f)
+        {
+            triangles.push_back(triangle);
+        }
+    }
+
+    if (triangles.empty())
+    {
+        *error = "Triangle mesh has no triangle with a non-zero area";
+        return false;
+    }
+
+    int count = (int)triangles.size();
+    std::vector<AABB> bounds(count);
+    std::vector<Vector3> centroids(count);
+    for (int i = 0; i < count; i++)
+    {
+        const Triangle& t = triangles[i];
+        bounds[i] = AABB(Vector3Min(t.A, Vector3Min(t.B, t.C)), Vector3Max(t.A, Vector3Max(t.B, t.C)));
+        centroids[i] = Vector3Scale(Vector3Add(t.A, Vector3Add(t.B, t.C)), 1.0f / 3.0f);
+    }
+
+    std::vector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+
+    // Restitution and the collision filter keep their values
+    mesh->nodes.clear();
+    mesh->nodes.reserve(2 * (count / LeafSize + 1));
+    mesh->BuildNode(order, 0, count, bounds, centroids, 0);
+
+    mesh->triangles.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        mesh->triangles[i] = triangles[order[i]];
+    }
+    return true;
+}
+
+bool TriangleMesh::FromMesh(const Mesh& mesh, Matrix transform, TriangleMesh* result, const char** error)
+{
+    *error = "";
+
+    if (mesh.vertices == nullptr || mesh.vertexCount <= 0)
+    {
+        *error = "Mesh has no vertex data on the CPU";
+        return false;
+    }
+
+    std::vector<Vector3> vertices(mesh.vertexCount);
+    for (int i = 0; i < mesh.vertexCount; i++)
+    {
+        Vector3 v = { mesh.vertices[3 * i], mesh.vertices[3 * i + 1], mesh.vertices[3 * i + 2] };
+        vertices[i] = Vector3Transform(v, transform);
+    }
+
+    // Without indices every three vertices make a triangle
+    std::vector<int> indices(mesh.triangleCount * 3);
+    for (int i = 0; i < (int)indices.size(); i++)
+    {
+        indices[i] = mesh.indices != nullptr ? (int)mesh.indices[i] : i;
+    }
+
+    return Create(vertices.data(), (int)vertices.size(), indices.data(), (int)indices.size(), result, error);
+}
+
+int TriangleMesh::BuildNode(std::vector<int>& order, int first, int count, const std::vector<AABB>& bounds,
+    const std::vector<Vector3>& centroids, int depth)
+{
+    int index = (int)this->nodes.size();
+    this->nodes.push_back(Node());
+
+    AABB box = bounds[order[first]];
+    AABB centroidBox(centroids[order[first]], centroids[order[first]]);
+    for (int i = first + 1; i < first + count; i++)
+    {
+        box.ExpandToInclude(bounds[order[i]]);
+        centroidBox.ExpandToInclude(centroids[order[i]]);
+    }
+
+    this->nodes[index].Min = box.Min;
+    this->nodes[index].Max = box.Max;
+
+    // Split along the longest axis of the centroids
+    Vector3 size = centroidBox.GetSize();
+    int axis = size.x >= size.y && size.x >= size.z ? 0 : (size.y >= size.z ? 1 : 2);
+    float low = Component(centroidBox.Min, axis);
+    float span = Component(size, axis);
+
+    if (count <= LeafSize || depth >= MaxDepth || !(span > 0.0f))
+    {
+        this->nodes[index].Offset = first;
+        this->nodes[index].Count = count;
+        return index;
+    }
+
+    // Binned surface area heuristic
+    int binCounts[BinCount] = {};
+    AABB binBounds[BinCount];
+    float scale = BinCount / span;
+    auto binOf = [&](int triangle)
+    {
+        return std::min((int)((Component(centroids[triangle], axis) - low) * scale), BinCount - 1);
+    };
+
+    for (int i = first; i < first + count; i++)
+    {
+        int bin = binOf(order[i]);
+        if (binCounts[bin]++ == 0) binBounds[bin] = bounds[order[i]];
+        else binBounds[bin].ExpandToInclude(bounds[order[i]]);
+    }
+
+    // Area * count of every prefix, then the best split against the matching suffix
+    float leftCost[BinCount];
+    AABB running;
+    int runningCount = 0;
+    for (int bin = 0; bin < BinCount - 1; bin++)
+    {
+        if (binCounts[bin] > 0)
+        {
+            if (runningCount == 0) running = binBounds[bin];
+            else running.ExpandToInclude(binBounds[bin]);
+            runningCount += binCounts[bin];
+        }
+        leftCost[bin] = runningCount > 0 ? SurfaceArea(running) * runningCount : 0.0f;
+    }
+
+    int split = -1;
+    float bestCost = INFINITY;
+    runningCount = 0;
+    for (int bin = BinCount - 1; bin > 0; bin--)
+    {
+        if (binCounts[bin] > 0)
+        {
+            if (runningCount == 0) running = binBounds[bin];
+            else running.ExpandToInclude(binBounds[bin]);
+            runningCount += binCounts[bin];
+        }
+
+        float cost = leftCost[bin - 1] + SurfaceArea(running) * runningCount;
+        if (runningCount < count && cost < bestCost)
+        {
+            bestCost = cost;
+            split = bin;
+        }
+    }
+
+    int middle = (int)(std::partition(order.begin() + first, order.begin() + first + count,
+        [&](int triangle) { return binOf(triangle) < split; }) - order.begin());
+
+    if (middle == first || middle == first + count)
+    {
+        // Every centroid in one bin: median split
+        middle = first + count / 2;
+        std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count,
+            [&](int a, int b) { return Component(centroids[a], axis) < Component(centroids[b], axis); });
+    }
+
+    this->BuildNode(order, first, middle - first, bounds, centroids, depth + 1);
+    int right = this->BuildNode(order, middle, first + count - middle, bounds, centroids, depth + 1);
+    this->nodes[index].Offset = right;
+    this->nodes[index].Count = 0;
+    return index;
+}
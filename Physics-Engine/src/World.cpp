@@ -1,302 +1,2194 @@
 #include "World.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include "MemoryAccounting.h"
+#include "ThreadPool.h"
+#include "TrajectoryRecorder.h"
 
 World::World()
 {
     this->G = 6.674e-11;
     this->broadPhase = Grid;
-    this->gridNodeSize = 400;
+    this->gridNodeSize = 0.0f;
+    this->integrator = SemiImplicitEuler;
+    this->adaptiveTolerance = 1e-4f;
+    this->adaptiveStep = 0.0f;
+    this->accelerationsValid = false;
+    this->multipole.Configure(this->gravity.Order, this->gravity.Theta, this->gravity.LeafSize, this->gravity.Softening);
+    this->SelectStep();
+
+    BodyDesc meshDesc;
+    meshDesc.IsStatic = 1;
+    const char* error;
+    Body::CreateBody(meshDesc, &this->meshBody, &error);
+}
+
+void World::SetGravity(const GravityConfig& config)
+{
+    this->gravity = config;
+    this->gravity.Softening = fmaxf(config.Softening, 0.0f);
+    this->gravity.Cutoff = fmaxf(config.Cutoff, 0.0f);
+    this->gravity.Order = std::clamp(config.Order, FastMultipole::MinOrder, FastMultipole::MaxOrder);
+    this->gravity.Theta = std::clamp(config.Theta, 0.05f, 1.0f);
+    this->gravity.LeafSize = std::max(config.LeafSize, 1);
+    this->multipole.Configure(this->gravity.Order, this->gravity.Theta, this->gravity.LeafSize, this->gravity.Softening);
+    this->accelerationsValid = false;
+}
+
+void World::SetIntegrator(Integrator integrator)
+{
+    this->integrator = integrator;
+    this->SelectStep();
+    this->accelerationsValid = false;
+    this->adaptiveStep = 0.0f;
+}
+
+void World::SetAdaptiveTolerance(float tolerance)
+{
+    this->adaptiveTolerance = Clamp(tolerance, World::MinAdaptiveTolerance, World::MaxAdaptiveTolerance);
+}
+
+void World::SetGridNodeSize(float size)
+{
+    this->gridNodeSize = fmaxf(size, 0.0f);
+    this->gridDirty = true;
+}
+
+void World::SetBroadPhase(BroadPhase broadPhase)
+{
+    this->broadPhase = broadPhase;
+    this->gridDirty = true;
+    this->SelectStep();
+}
+
+void World::SetDeterministic(bool deterministic, float quantum)
+{
+    this->deterministic = deterministic;
+    this->stateQuantum = 0.0f;
+
+    if (quantum > 0.0f)
+    {
+        // Powers of two make the snap exact: x / q and n * q are not rounded
+        int exponent;
+        frexpf(quantum, &exponent);
+        this->stateQuantum = ldexpf(1.0f, exponent - 1);
+    }
+}
+
+void World::SetSolver(const SolverConfig& config)
+{
+    this->solver = config;
+    this->solver.Solver = config.Solver == PositionBased ? PositionBased : ImpulseSolver;
+    this->solver.Iterations = Clamp(config.Iterations, 1, PositionSolver::MaxIterations);
+    this->solver.Compliance = fmaxf(config.Compliance, 0.0f);
+    this->solver.Friction = fmaxf(config.Friction, 0.0f);
+    this->solver.RollingFriction = fmaxf(config.RollingFriction, 0.0f);
+    this->solver.RestingSpeed = fmaxf(config.RestingSpeed, 0.0f);
+    this->positionSolver.ClearContacts();
+    this->SelectStep();
+}
+
+namespace
+{
+    // -0 and every NaN hash like 0 and the canonical NaN
+    uint64_t HashFloat(uint64_t hash, float value)
+    {
+        uint32_t bits;
+        if (value == 0.0f) value = 0.0f;
+        if (value != value) bits = 0x7FC00000u;
+        else memcpy(&bits, &value, sizeof(bits));
+
+        // FNV-1a over the 4 bytes
+        for (int i = 0; i < 4; i++)
+        {
+            hash ^= (bits >> (i * 8)) & 0xFF;
+            hash *= 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    float Snap(float value, float quantum)
+    {
+        return roundf(value / quantum) * quantum;
+    }
+}
+
+uint64_t World::StateHash() const
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    for (const Body& body : this->bodyList)
+    {
+        Vector3 p = body.Position();
+        Vector3 v = body.LinearVelocity();
+        Quaternion q = body.Orientation();
+        Vector3 w = body.AngularVelocity();
+        const float values[] = { p.x, p.y, p.z, v.x, v.y, v.z, q.x, q.y, q.z, q.w, w.x, w.y, w.z };
+
+        for (float value : values)
+        {
+            hash = HashFloat(hash, value);
+        }
+    }
+
+    return hash;
+}
+
+void World::SnapState()
+{
+    float q = this->stateQuantum;
+
+    for (int i = 0; i < this->bodyCount; i++)
+    {
+        Body& body = this->bodyList[i];
+        Vector3 p = body.Position();
+        Vector3 v = body.LinearVelocity();
+        Vector3 w = body.AngularVelocity();
+
+        body.MoveTo({ Snap(p.x, q), Snap(p.y, q), Snap(p.z, q) });
+        body.LinearVelocity({ Snap(v.x, q), Snap(v.y, q), Snap(v.z, q) });
+        body.AngularVelocity({ Snap(w.x, q), Snap(w.y, q), Snap(w.z, q) });
+    }
+
+    // The cached Verlet accelerations belong to the unsnapped positions
+    this->accelerationsValid = false;
+}
+
+void World::SetRecorder(TrajectoryRecorder* recorder)
+{
+    this->recorder = recorder;
+}
+
+bool World::AddBody(Body body)
+{
+    if (this->memoryLimits.MaxBodies > 0 && this->bodyCount >= this->memoryLimits.MaxBodies)
+    {
+        return false;
+    }
+
+    this->bodyList.push_back(std::move(body));
+    this->bodyCount += 1;
+    this->dirtyListStale = true;
+    this->gridDirty = true;
+    this->queryCellsDirty = true;
+    this->accelerationsValid = false;
+    return true;
+}
+
+bool World::AddBodies(const BodyDesc* descs, int count, const char** error)
+{
+    *error = "";
+    if (count <= 0)
+    {
+        return true;
+    }
+
+    if (this->memoryLimits.MaxBodies > 0 && this->bodyList.size() + count > (size_t)this->memoryLimits.MaxBodies)
+    {
+        *error = "Body limit reached";
+        return false;
+    }
+
+    size_t first = this->bodyList.size();
+    this->bodyList.reserve(first + count);
+
+    for (int i = 0; i < count; i++)
+    {
+        this->bodyList.emplace_back();
+        if (!Body::CreateBody(descs[i], &this->bodyList.back(), error))
+        {
+            this->bodyList.resize(first);
+            return false;
+        }
+    }
+
+    this->bodyCount = (float)this->bodyList.size();
+    this->accelerationsValid = false;
+    this->dirtyListStale = true;
+    this->gridDirty = true;
+    this->queryCellsDirty = true;
+    return true;
+}
+
+bool World::RemoveBody(int index)
+{
+    if (index < 0 || index >= bodyCount) {
+        return false;
+    }
+    this->MemoryUsage(); // folds the body about to be freed into the peaks
+    UnloadModel(bodyList[index].Mesh);
+    bodyList.erase(bodyList.begin() + index);
+    bodyCount--;
+
+    // Pairs of the removed body are dropped, the bodies after it move down one index
+    size_t kept = 0;
+    for (const std::pair<int, int>& pair : this->touchingPairs)
+    {
+        if (pair.first == index || pair.second == index) continue;
+        this->touchingPairs[kept++] = { pair.first - (pair.first > index), pair.second - (pair.second > index) };
+    }
+    this->touchingPairs.resize(kept);
+    this->positionSolver.ClearContacts();
+    this->dirtyListStale = true;
+    this->gridDirty = true;
+    this->queryCellsDirty = true;
+    this->accelerationsValid = false;
+    return true;
+}
+
+int World::AddStaticMesh(TriangleMesh mesh)
+{
+    if (mesh.TriangleCount() == 0)
+    {
+        return -1;
+    }
+
+    this->staticMeshes.push_back(std::move(mesh));
+    return (int)this->staticMeshes.size() - 1;
+}
+
+bool World::RemoveStaticMesh(int index)
+{
+    if (index < 0 || index >= (int)this->staticMeshes.size())
+    {
+        return false;
+    }
+
+    this->MemoryUsage(); // folds the mesh about to be freed into the peaks
+    this->staticMeshes.erase(this->staticMeshes.begin() + index);
+    return true;
+}
+
+bool World::AddParticles(const Vector3* positions, const Vector3* velocities, const float* radii, int count, const char** error)
+{
+    *error = "";
+    if (this->memoryLimits.MaxParticles > 0 && (size_t)this->particles.Count() + std::max(count, 0) > (size_t)this->memoryLimits.MaxParticles)
+    {
+        *error = "Particle limit reached";
+        return false;
+    }
+
+    return this->particles.Add(positions, velocities, radii, count, error);
+}
+
+bool World::RemoveParticle(int index)
+{
+    return this->particles.Remove(index);
+}
+
+void World::SetParticleConfig(const ParticleConfig& config)
+{
+    this->particles.SetConfig(config);
+}
+
+int World::AddForceField(const ForceField& field)
+{
+    return this->forceFields.Add(field);
+}
+
+bool World::RemoveForceField(int index)
+{
+    return this->forceFields.Remove(index);
+}
+
+const TriangleMesh* World::GetStaticMesh(int index) const
+{
+    if (index < 0 || index >= (int)this->staticMeshes.size())
+    {
+        return nullptr;
+    }
+    return &this->staticMeshes[index];
+}
+
+Body *World::GetBody(int index) {
+    if (index < 0 || index >= bodyCount) {
+        return nullptr; // O lanza una excepcin si lo prefieres
+    }
+    return &bodyList[index]; // Retorna una referencia
+}
+
+void World::SetMemoryLimits(const MemoryLimits& limits)
+{
+    this->memoryLimits = limits;
+    this->memoryLimits.MaxBodies = std::max(limits.MaxBodies, 0);
+    this->memoryLimits.MaxContacts = std::max(limits.MaxContacts, 0);
+    this->memoryLimits.MaxContactPoints = std::max(limits.MaxContactPoints, 0);
+    this->memoryLimits.MaxParticles = std::max(limits.MaxParticles, 0);
+}
+
+MemoryStats World::MemoryUsage() const
+{
+    MemoryStats stats;
+
+    stats.Bodies = VectorBytes(this->bodyList) + this->meshBody.HeapBytes();
+    for (const Body& body : this->bodyList)
+    {
+        stats.Bodies += body.HeapBytes();
+    }
+
+    stats.Contacts = VectorBytes(this->contactList) + VectorBytes(this->chunkContacts) + VectorBytes(this->corrections) +
+        VectorBytes(this->ContactPointsList) + VectorBytes(this->stepContacts) + VectorBytes(this->touchingPairs) +
+        VectorBytes(this->nextTouchingPairs) + VectorBytes(this->contactEvents) + this->positionSolver.MemoryBytes();
+
+    stats.BroadPhase = VectorBytes(this->bodyBounds) + VectorBytes(this->dirtyBodies->Indices) + this->grid.MemoryBytes() +
+        VectorBytes(this->dynamicList) + this->tree.MemoryBytes() + VectorBytes(this->treeStatic) + VectorBytes(this->pairList);
+
+    stats.Gravity = VectorBytes(this->sourceList) + VectorBytes(this->gravityCells) + this->multipole.MemoryBytes() +
+        VectorBytes(this->multipoleIndex) + VectorBytes(this->multipolePositions) + VectorBytes(this->multipoleMasses) +
+        VectorBytes(this->multipoleAccelerations);
+
+    stats.Integrator = VectorBytes(this->positionList) + VectorBytes(this->velocityList) + VectorBytes(this->accelerationList) +
+        VectorBytes(this->externalList) + VectorBytes(this->stagePositionList) + VectorBytes(this->stageVelocityList) +
+        VectorBytes(this->nextPositionList) + VectorBytes(this->nextVelocityList) + this->forceFields.MemoryBytes() +
+        VectorBytes(this->fieldAccelerations) + VectorBytes(this->invMassList) + VectorBytes(this->layerList);
+    for (int i = 0; i < 4; i++)
+    {
+        stats.Integrator += VectorBytes(this->stageDx[i]) + VectorBytes(this->stageDv[i]);
+    }
+
+    stats.Queries = VectorBytes(this->queryCells) + VectorBytes(this->queryBricks) + VectorBytes(this->queryIndices) +
+        VectorBytes(this->queryBounds) + VectorBytes(this->querySort) + VectorBytes(this->queryKeys) +
+        VectorBytes(this->querySlots) + VectorBytes(this->queryMoved) + VectorBytes(this->queryRefit);
+
+    stats.Meshes = VectorBytes(this->staticMeshes);
+    for (const TriangleMesh& mesh : this->staticMeshes)
+    {
+        stats.Meshes += mesh.MemoryBytes();
+    }
+
+    stats.Particles = this->particles.MemoryBytes() + VectorBytes(this->particleAccelerations) +
+        VectorBytes(this->particleFieldAccelerations);
+
+    stats.Total = stats.Bodies + stats.Contacts + stats.BroadPhase + stats.Gravity + stats.Integrator + stats.Queries + stats.Meshes +
+        stats.Particles;
+
+    size_t MemoryStats::* fields[] = { &MemoryStats::Bodies, &MemoryStats::Contacts, &MemoryStats::BroadPhase,
+        &MemoryStats::Gravity, &MemoryStats::Integrator, &MemoryStats::Queries, &MemoryStats::Meshes, &MemoryStats::Particles, &MemoryStats::Total };
+    for (size_t MemoryStats::* field : fields)
+    {
+        this->peakMemory.*field = std::max(this->peakMemory.*field, stats.*field);
+    }
+    return stats;
+}
+
+const MemoryStats& World::PeakMemoryUsage() const
+{
+    this->MemoryUsage();
+    return this->peakMemory;
+}
+
+void World::ResetPeakMemory()
+{
+    this->peakMemory = MemoryStats();
+    this->MemoryUsage();
+}
+
+void World::Compact()
+{
+    // Folds what is about to be freed into the peaks
+    this->MemoryUsage();
+
+    // The bodies move to a new array, detached from the dirty list until the next UpdateTransforms
+    this->bodyList.shrink_to_fit();
+    this->dirtyListStale = true;
+
+    // Contacts: scratch of the last Step; the touching pairs and events of the last Step stay
+    ReleaseVector(this->contactList);
+    ReleaseVector(this->chunkContacts);
+    ReleaseVector(this->corrections);
+    ReleaseVector(this->ContactPointsList);
+    ReleaseVector(this->stepContacts);
+    ReleaseVector(this->nextTouchingPairs);
+    this->touchingPairs.shrink_to_fit();
+    this->contactEvents.shrink_to_fit();
+    this->positionSolver.Clear();
+
+    this->bodyBounds.shrink_to_fit();
+    this->dirtyBodies->Indices.shrink_to_fit();
+    this->grid.Clear();
+    ReleaseVector(this->dynamicList);
+    this->gridDirty = true;
+    this->tree.Clear();
+    ReleaseVector(this->treeStatic);
+    ReleaseVector(this->pairList);
+
+    ReleaseVector(this->sourceList);
+    ReleaseVector(this->gravityCells);
+    this->multipole.Clear();
+    ReleaseVector(this->multipoleIndex);
+    ReleaseVector(this->multipolePositions);
+    ReleaseVector(this->multipoleMasses);
+    ReleaseVector(this->multipoleAccelerations);
+
+    // The Verlet accelerations carry over to the next Step, the other arrays are scratch
+    ShrinkVector(this->accelerationList, this->bodyList.size());
+    ReleaseVector(this->positionList);
+    ReleaseVector(this->velocityList);
+    ReleaseVector(this->externalList);
+    ReleaseVector(this->stagePositionList);
+    ReleaseVector(this->stageVelocityList);
+    ReleaseVector(this->nextPositionList);
+    ReleaseVector(this->nextVelocityList);
+    for (int i = 0; i < 4; i++)
+    {
+        ReleaseVector(this->stageDx[i]);
+        ReleaseVector(this->stageDv[i]);
+    }
+    ReleaseVector(this->fieldAccelerations);
+    ReleaseVector(this->invMassList);
+    ReleaseVector(this->layerList);
+
+    ReleaseVector(this->queryCells);
+    ReleaseVector(this->queryBricks);
+    ReleaseVector(this->queryIndices);
+    ReleaseVector(this->queryBounds);
+    ReleaseVector(this->querySort);
+    ReleaseVector(this->queryKeys);
+    ReleaseVector(this->querySlots);
+    ReleaseVector(this->queryMoved);
+    ReleaseVector(this->queryRefit);
+    this->queryCellsDirty = true;
+
+    this->staticMeshes.shrink_to_fit();
+
+    this->particles.ReleaseScratch();
+    ReleaseVector(this->particleAccelerations);
+    ReleaseVector(this->particleFieldAccelerations);
+}
+
+void World::Step(float time, int iterations)
+{
+    (this->*this->stepFunction)(time, iterations);
+}
+
+void World::SelectStep()
+{
+    static constexpr StepFunction steps[3][3][2] = {
+        {
+            { &World::StepWith<BruteForce, SemiImplicitEuler, ImpulseSolver>, &World::StepWith<BruteForce, SemiImplicitEuler, PositionBased> },
+            { &World::StepWith<BruteForce, VelocityVerlet, ImpulseSolver>, &World::StepWith<BruteForce, VelocityVerlet, PositionBased> },
+            { &World::StepWith<BruteForce, AdaptiveRK, ImpulseSolver>, &World::StepWith<BruteForce, AdaptiveRK, PositionBased> },
+        },
+        {
+            { &World::StepWith<Grid, SemiImplicitEuler, ImpulseSolver>, &World::StepWith<Grid, SemiImplicitEuler, PositionBased> },
+            { &World::StepWith<Grid, VelocityVerlet, ImpulseSolver>, &World::StepWith<Grid, VelocityVerlet, PositionBased> },
+            { &World::StepWith<Grid, AdaptiveRK, ImpulseSolver>, &World::StepWith<Grid, AdaptiveRK, PositionBased> },
+        },
+        {
+            { &World::StepWith<MortonBVH, SemiImplicitEuler, ImpulseSolver>, &World::StepWith<MortonBVH, SemiImplicitEuler, PositionBased> },
+            { &World::StepWith<MortonBVH, VelocityVerlet, ImpulseSolver>, &World::StepWith<MortonBVH, VelocityVerlet, PositionBased> },
+            { &World::StepWith<MortonBVH, AdaptiveRK, ImpulseSolver>, &World::StepWith<MortonBVH, AdaptiveRK, PositionBased> },
+        },
+    };
+    this->stepFunction = steps[this->broadPhase][this->integrator][this->solver.Solver];
+}
+
+template <BroadPhase broadPhase, Integrator integrator, ContactSolver contactSolver>
+void World::StepWith(float time, int iterations)
+{
+    iterations = Clamp(iterations, World::MinIterations, World::MaxIterations);
+    this->ContactPointsList.clear();
+    this->stepContacts.clear();
+    this->droppedContacts = 0;
+
+    if constexpr (broadPhase == Grid)
+    {
+        this->BuildNodeGrid();
+    }
+
+    this->subStepTime = time / (float)iterations;
+
+    for (int it = 0; it < iterations; it++)
+    {
+        if constexpr (contactSolver == PositionBased)
+        {
+            this->positionSolver.BeginSubStep(this->bodyList, (int)this->bodyCount);
+        }
+
+        // Movement step
+        if constexpr (integrator == VelocityVerlet)
+        {
+            this->IntegrateVerlet(time / (float)iterations);
+        }
+        else if constexpr (integrator == AdaptiveRK)
+        {
+            this->IntegrateAdaptiveRK(time / (float)iterations);
+        }
+        else
+        {
+            this->IntegrateEuler(time, iterations);
+        }
+
+        this->UpdateTransforms();
+
+        if (this->deterministic)
+        {
+            this->CollisionStepDeterministic(broadPhase);
+        }
+        else if constexpr (broadPhase == BruteForce)
+        {
+            this->CollisionStepBruteForce();
+        }
+        else if constexpr (broadPhase == Grid)
+        {
+            this->CollisionStepGrid();
+        }
+        else
+        {
+            this->CollisionStepTree();
+        }
+
+        this->RecordContacts();
+        this->CollisionStepMeshes();
+        this->StepParticles(time / (float)iterations);
+    }
+
+    this->BuildContactEvents();
+
+    if (this->deterministic && this->stateQuantum > 0.0f)
+    {
+        this->SnapState();
+    }
+
+    this->UpdateTransforms();
+    this->elapsedTime += time;
+
+    if (this->recorder != nullptr)
+    {
+        this->recorder->Capture(this->bodyList, this->elapsedTime);
+    }
+}
+
+template void World::StepWith<BruteForce, SemiImplicitEuler, ImpulseSolver>(float, int);
+template void World::StepWith<BruteForce, SemiImplicitEuler, PositionBased>(float, int);
+template void World::StepWith<BruteForce, VelocityVerlet, ImpulseSolver>(float, int);
+template void World::StepWith<BruteForce, VelocityVerlet, PositionBased>(float, int);
+template void World::StepWith<BruteForce, AdaptiveRK, ImpulseSolver>(float, int);
+template void World::StepWith<BruteForce, AdaptiveRK, PositionBased>(float, int);
+template void World::StepWith<Grid, SemiImplicitEuler, ImpulseSolver>(float, int);
+template void World::StepWith<Grid, SemiImplicitEuler, PositionBased>(float, int);
+template void World::StepWith<Grid, VelocityVerlet, ImpulseSolver>(float, int);
+template void World::StepWith<Grid, VelocityVerlet, PositionBased>(float, int);
+template void World::StepWith<Grid, AdaptiveRK, ImpulseSolver>(float, int);
+template void World::StepWith<Grid, AdaptiveRK, PositionBased>(float, int);
+template void World::StepWith<MortonBVH, SemiImplicitEuler, ImpulseSolver>(float, int);
+template void World::StepWith<MortonBVH, SemiImplicitEuler, PositionBased>(float, int);
+template void World::StepWith<MortonBVH, VelocityVerlet, ImpulseSolver>(float, int);
+template void World::StepWith<MortonBVH, VelocityVerlet, PositionBased>(float, int);
+template void World::StepWith<MortonBVH, AdaptiveRK, ImpulseSolver>(float, int);
+template void World::StepWith<MortonBVH, AdaptiveRK, PositionBased>(float, int);
+
+void World::GatherPositions()
+{
+    this->positionList.resize(this->bodyList.size());
+
+    for (int i = 0; i < this->bodyCount; i++)
+    {
+        this->positionList[i] = this->bodyList[i].Position();
+    }
+}
+
+int World::GravityCellKey(int x, int y, int z)
+{
+    // 10 bits per axis; far cells wrap onto each other, which only adds candidates
+    return (x & 0x3FF) | ((y & 0x3FF) << 10) | ((z & 0x3FF) << 20);
+}
+
+void World::BuildGravityGrid(const std::vector<Vector3>& positions)
+{
+    // Only the cells holding a source this evaluation exist, however far the sources moved before
+    this->gravityCells.clear();
+
+    float cellSize = this->gravity.Cutoff;
+
+    for (int i = 0; i < (int)this->sourceList.size(); i++)
+    {
+        int index = this->sourceList[i];
+        Vector3 p = positions[index];
+        int key = GravityCellKey((int)floorf(p.x / cellSize), (int)floorf(p.y / cellSize), (int)floorf(p.z / cellSize));
+        this->gravityCells.push_back({ key, index });
+    }
+
+    // Sources keep their order within a cell
+    std::sort(this->gravityCells.begin(), this->gravityCells.end());
+}
+
+void World::ComputeGravityMultipole(const std::vector<Vector3>& positions, std::vector<Vector3>& accelerations)
+{
+    // Sources carry their mass, receiver-only bodies take part with zero mass
+    this->multipoleIndex.clear();
+    this->multipolePositions.clear();
+    this->multipoleMasses.clear();
+
+    for (int i = 0; i < this->bodyCount; i++)
+    {
+        const Body& body = this->bodyList[i];
+        bool source = (body.Gravity & GravitySource) && body.Mass > 0.0f;
+        bool receiver = !body.IsStatic && (body.Gravity & GravityReceiver);
+        if (!source && !receiver) continue;
+
+        this->multipoleIndex.push_back(i);
+        this->multipolePositions.push_back(positions[i]);
+        this->multipoleMasses.push_back(source ? body.Mass : 0.0f);
+    }
+
+    int count = (int)this->multipoleIndex.size();
+    this->multipoleAccelerations.resize(count);
+    this->multipole.Compute(this->multipolePositions.data(), this->multipoleMasses.data(), count, this->G,
+        this->multipoleAccelerations.data(), ThreadPool::Default());
+
+    for (int k = 0; k < count; k++)
+    {
+        int i = this->multipoleIndex[k];
+        const Body& body = this->bodyList[i];
+        bool receiver = !body.IsStatic && (body.Gravity & GravityReceiver);
+        accelerations[i] = receiver ? this->multipoleAccelerations[k] : Vector3Zero();
+    }
+}
+
+void World::ComputeGravity(const std::vector<Vector3>& positions, std::vector<Vector3>& accelerations)
+{
+    accelerations.resize(this->bodyList.size());
+
+    if (this->gravity.Solver == Multipole)
+    {
+        std::fill(accelerations.begin(), accelerations.end(), Vector3Zero());
+        this->ComputeGravityMultipole(positions, accelerations);
+        return;
+    }
+
+    // Only sources are visited by the receivers, so receiver-only debris costs nothing to the others
+    this->sourceList.clear();
+    for (int i = 0; i < this->bodyCount; i++)
+    {
+        if ((this->bodyList[i].Gravity & GravitySource) && this->bodyList[i].Mass > 0.0f)
+        {
+            this->sourceList.push_back(i);
+        }
+    }
+
+    // The cutoff is chosen once per evaluation, not tested per receiver and source pair
+    if (this->gravity.Cutoff > 0.0f)
+    {
+        this->BuildGravityGrid(positions);
+        this->ComputeGravityDirect<true>(positions, accelerations);
+    }
+    else
+    {
+        this->ComputeGravityDirect<false>(positions, accelerations);
+    }
+}
+
+template <bool cutoff>
+void World::ComputeGravityDirect(const std::vector<Vector3>& positions, std::vector<Vector3>& accelerations)
+{
+    float softeningSqr = this->gravity.Softening * this->gravity.Softening;
+    float cellSize = this->gravity.Cutoff;
+    float cutoffSqr = cellSize * cellSize;
+
+    for (int i = 0; i < this->bodyCount; i++)
+    {
+        Vector3 acceleration = Vector3Zero();
+        const Body& receiver = this->bodyList[i];
+
+        if (receiver.IsStatic || !(receiver.Gravity & GravityReceiver))
+        {
+            accelerations[i] = acceleration;
+            continue;
+        }
+
+        auto accumulate = [&](int j)
+        {
+            if (i == j) return;
+            Vector3 delta = Vector3Subtract(positions[j], positions[i]);
+            float distanceSqr = Vector3LengthSqr(delta);
+            if constexpr (cutoff)
+            {
+                if (distanceSqr > cutoffSqr) return;
+            }
+
+            // a = G * m * r / (r^2 + e^2)^(3/2)
+            float softenedSqr = distanceSqr + softeningSqr;
+            if (softenedSqr == 0.0f) return;
+            float scale = G * this->bodyList[j].Mass / (softenedSqr * sqrtf(softenedSqr));
+            acceleration = Vector3Add(acceleration, Vector3Scale(delta, scale));
+        };
+
+        if constexpr (cutoff)
+        {
+            // Sources within the cutoff can only be in the 27 cells around the receiver
+            Vector3 p = positions[i];
+            int cx = (int)floorf(p.x / cellSize);
+            int cy = (int)floorf(p.y / cellSize);
+            int cz = (int)floorf(p.z / cellSize);
+
+            for (int z = cz - 1; z <= cz + 1; z++)
+            for (int y = cy - 1; y <= cy + 1; y++)
+            for (int x = cx - 1; x <= cx + 1; x++)
+            {
+                int key = GravityCellKey(x, y, z);
+                auto entry = std::lower_bound(this->gravityCells.begin(), this->gravityCells.end(), std::make_pair(key, INT_MIN));
+                for (; entry != this->gravityCells.end() && entry->first == key; ++entry)
+                {
+                    accumulate(entry->second);
+                }
+            }
+        }
+        else
+        {
+            for (int j : this->sourceList)
+            {
+                accumulate(j);
+            }
+        }
+
+        accelerations[i] = acceleration;
+    }
+}
+
+bool World::ComputeFieldAccelerations(float time)
+{
+    if (this->forceFields.Count() == 0)
+    {
+        return false;
+    }
+
+    const size_t n = this->bodyList.size();
+    this->positionList.resize(n);
+    this->velocityList.resize(n);
+    this->invMassList.resize(n);
+    this->layerList.resize(n);
+    this->fieldAccelerations.resize(n);
+
+    for (int i = 0; i < this->bodyCount; i++)
+    {
+        const Body& body = this->bodyList[i];
+        this->positionList[i] = body.Position();
+        this->velocityList[i] = body.LinearVelocity();
+        this->invMassList[i] = body.IsStatic ? 0.0f : body.InvMass;
+        this->layerList[i] = body.CollisionLayer;
+    }
+
+    this->forceFields.Apply(this->positionList.data(), this->velocityList.data(), this->invMassList.data(), this->layerList.data(), 0,
+        (int)this->bodyCount, time, this->fieldAccelerations.data(), ThreadPool::Default());
+    return true;
+}
+
+void World::IntegrateEuler(float time, int iterations)
+{
+    bool fields = this->ComputeFieldAccelerations(time / (float)iterations);
+    this->GatherPositions();
+    this->ComputeGravity(this->positionList, this->accelerationList);
+
+    for (int i = 0; i < this->bodyCount; i++)
+    {
+        Body& body = this->bodyList[i];
+        Vector3 acceleration = fields ? Vector3Add(this->accelerationList[i], this->fieldAccelerations[i]) : this->accelerationList[i];
+        body.AddForce(Vector3Scale(acceleration, body.Mass));
+        body.Step(time, iterations);
+    }
+
+    // Euler reuses accelerationList as scratch, so it no longer holds a(t) for Verlet
+    this->accelerationsValid = false;
+}
+
+void World::IntegrateVerlet(float time)
+{
+    // a(t) is carried over from the previous step, so each step costs one force evaluation
+    if (!this->accelerationsValid || this->accelerationList.size() != this->bodyList.size())
+    {
+        this->GatherPositions();
+        this->ComputeGravity(this->positionList, this->accelerationList);
+    }
+
+    bool fields = this->ComputeFieldAccelerations(time);
+    this->externalList.resize(this->bodyList.size());
+
+    for (int i = 0; i < this->bodyCount; i++)
+    {
+        Body& body = this->bodyList[i];
+        this->externalList[i] = body.ForceAcceleration();
+        if (fields) this->externalList[i] = Vector3Add(this->externalList[i], this->fieldAccelerations[i]);
+        body.KickDrift(time, Vector3Add(this->accelerationList[i], this->externalList[i]));
+    }
+
+    this->GatherPositions();
+    this->ComputeGravity(this->positionList, this->accelerationList);
+
+    for (int i = 0; i < this->bodyCount; i++)
+    {
+        this->bodyList[i].Kick(time, Vector3Add(this->accelerationList[i], this->externalList[i]));
+    }
+
+    this->accelerationsValid = true;
+}
+
+void World::EvaluateDerivative(const std::vector<Vector3>& positions, const std::vector<Vector3>& velocities,
+    std::vector<Vector3>& dx, std::vector<Vector3>& dv)
+{
+    this->ComputeGravity(positions, dv);
+    dx.resize(this->bodyList.size());
+
+    for (int i = 0; i < this->bodyCount; i++)
+    {
+        if (this->bodyList[i].IsStatic)
+        {
+            dx[i] = Vector3Zero();
+            dv[i] = Vector3Zero();
+            continue;
+        }
+
+        dx[i] = velocities[i];
+        dv[i] = Vector3Add(dv[i], this->externalList[i]);
+    }
+}
+
+void World::IntegrateAdaptiveRK(float time)
+{
+    // Bogacki-Shampine 3(2): third order solution, embedded second order error estimate, FSAL
+    const size_t n = this->bodyList.size();
+
+    bool fields = this->ComputeFieldAccelerations(time);
+    this->GatherPositions();
+    this->velocityList.resize(n);
+    this->externalList.resize(n);
+    this->stagePositionList.resize(n);
+    this->stageVelocityList.resize(n);
+    this->nextPositionList.resize(n);
+    this->nextVelocityList.resize(n);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        this->velocityList[i] = this->bodyList[i].LinearVelocity();
+        this->externalList[i] = this->bodyList[i].ForceAcceleration();
+        if (fields) this->externalList[i] = Vector3Add(this->externalList[i], this->fieldAccelerations[i]);
+    }
+
+    std::vector<Vector3>& x = this->positionList;
+    std::vector<Vector3>& v = this->velocityList;
+
+    float elapsed = 0.0f;
+    float h = this->adaptiveStep > 0.0f ? this->adaptiveStep : time;
+    int steps = 0;
+
+    this->EvaluateDerivative(x, v, this->stageDx[0], this->stageDv[0]);
+
+    while (elapsed < time)
+    {
+        // The last step is clipped to the interval without shrinking the step carried to the next call
+        bool clipped = h >= time - elapsed;
+        float step = clipped ? time - elapsed : h;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            this->stagePositionList[i] = Vector3Add(x[i], Vector3Scale(this->stageDx[0][i], 0.5f * step));
+            this->stageVelocityList[i] = Vector3Add(v[i], Vector3Scale(this->stageDv[0][i], 0.5f * step));
+        }
+        this->EvaluateDerivative(this->stagePositionList, this->stageVelocityList, this->stageDx[1], this->stageDv[1]);
+
+        for (size_t i = 0; i < n; i++)
+        {
+            this->stagePositionList[i] = Vector3Add(x[i], Vector3Scale(this->stageDx[1][i], 0.75f * step));
+            this->stageVelocityList[i] = Vector3Add(v[i], Vector3Scale(this->stageDv[1][i], 0.75f * step));
+        }
+        this->EvaluateDerivative(this->stagePositionList, this->stageVelocityList, this->stageDx[2], this->stageDv[2]);
+
+        for (size_t i = 0; i < n; i++)
+        {
+            Vector3 dx = Vector3Add(Vector3Add(Vector3Scale(this->stageDx[0][i], 2.0f / 9.0f),
+                Vector3Scale(this->stageDx[1][i], 1.0f / 3.0f)), Vector3Scale(this->stageDx[2][i], 4.0f / 9.0f));
+            Vector3 dv = Vector3Add(Vector3Add(Vector3Scale(this->stageDv[0][i], 2.0f / 9.0f),
+                Vector3Scale(this->stageDv[1][i], 1.0f / 3.0f)), Vector3Scale(this->stageDv[2][i], 4.0f / 9.0f));
+            this->nextPositionList[i] = Vector3Add(x[i], Vector3Scale(dx, step));
+            this->nextVelocityList[i] = Vector3Add(v[i], Vector3Scale(dv, step));
+        }
+        this->EvaluateDerivative(this->nextPositionList, this->nextVelocityList, this->stageDx[3], this->stageDv[3]);
+
+        // Difference between the third and second order solutions
+        float error = 0.0f;
+        for (size_t i = 0; i < n; i++)
+        {
+            Vector3 ex = Vector3Add(Vector3Add(Vector3Scale(this->stageDx[0][i], -5.0f / 72.0f), Vector3Scale(this->stageDx[1][i], 1.0f / 12.0f)),
+                Vector3Add(Vector3Scale(this->stageDx[2][i], 1.0f / 9.0f), Vector3Scale(this->stageDx[3][i], -1.0f / 8.0f)));
+            Vector3 ev = Vector3Add(Vector3Add(Vector3Scale(this->stageDv[0][i], -5.0f / 72.0f), Vector3Scale(this->stageDv[1][i], 1.0f / 12.0f)),
+                Vector3Add(Vector3Scale(this->stageDv[2][i], 1.0f / 9.0f), Vector3Scale(this->stageDv[3][i], -1.0f / 8.0f)));
+
+            float scaleX = this->adaptiveTolerance * (1.0f + Vector3Length(x[i]));
+            float scaleV = this->adaptiveTolerance * (1.0f + Vector3Length(v[i]));
+            error = fmaxf(error, step * Vector3Length(ex) / scaleX);
+            error = fmaxf(error, step * Vector3Length(ev) / scaleV);
+        }
+
+        steps++;
+        bool accepted = error <= 1.0f || steps >= World::MaxAdaptiveSteps;
+        if (accepted)
+        {
+            elapsed = clipped ? time : elapsed + step;
+            std::swap(x, this->nextPositionList);
+            std::swap(v, this->nextVelocityList);
+            std::swap(this->stageDx[0], this->stageDx[3]);
+            std::swap(this->stageDv[0], this->stageDv[3]);
+        }
+
+        float factor = error > 0.0f ? 0.9f * powf(error, -1.0f / 3.0f) : 5.0f;
+        float next = step * Clamp(factor, 0.2f, 5.0f);
+        h = (clipped && accepted) ? fmaxf(h, next) : next;
+    }
+
+    this->adaptiveStep = h;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        this->bodyList[i].StepTo(x[i], v[i], time);
+    }
+}
+
+void World::UpdateTransforms()
+{
+    BodyDirtyList& dirty = *this->dirtyBodies;
+    ThreadPool& pool = ThreadPool::Default();
+    int count = (int)this->bodyList.size();
+
+    if (this->dirtyListStale || this->bodyBounds.size() != this->bodyList.size())
+    {
+        dirty.Indices.resize(count);
+        dirty.Count.store(0, std::memory_order_relaxed);
+        this->bodyBounds.resize(count);
+
+        pool.ParallelFor(count, 1024, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                Body& body = this->bodyList[i];
+                body.dirtyHook.List = &dirty;
+                body.dirtyHook.Index = i;
+                body.dirtyHook.Queued = false;
+                body.UpdateTransform();
+                this->bodyBounds[i] = body.GetAABB();
+            }
+        });
+
+        this->dirtyListStale = false;
+        this->queryRefitAll = true;
+        this->queryMoved.clear();
+        return;
+    }
+
+    int dirtyCount = std::min(dirty.Count.load(std::memory_order_relaxed), count);
+    pool.ParallelFor(dirtyCount, 1024, [&](int begin, int end)
+    {
+        for (int k = begin; k < end; k++)
+        {
+            int i = dirty.Indices[k];
+            Body& body = this->bodyList[i];
+            body.dirtyHook.Queued = false;
+            body.UpdateTransform();
+            this->bodyBounds[i] = body.GetAABB();
+        }
+    });
+    dirty.Count.store(0, std::memory_order_relaxed);
+
+    // Handed to the query cells; past a quarter of the bodies a full refit is cheaper than the list
+    if (!this->queryRefitAll)
+    {
+        if (this->queryMoved.size() + dirtyCount > (size_t)count / 4)
+        {
+            this->queryRefitAll = true;
+            this->queryMoved.clear();
+        }
+        else
+        {
+            this->queryMoved.insert(this->queryMoved.end(), dirty.Indices.begin(), dirty.Indices.begin() + dirtyCount);
+        }
+    }
+}
+
+namespace
+{
+    // Squared distance from p to the closest and to the farthest point of the box
+    float NearestDistanceSqr(Vector3 p, const AABB& box)
+    {
+        float dx = fmaxf(fmaxf(box.Min.x - p.x, p.x - box.Max.x), 0.0f);
+        float dy = fmaxf(fmaxf(box.Min.y - p.y, p.y - box.Max.y), 0.0f);
+        float dz = fmaxf(fmaxf(box.Min.z - p.z, p.z - box.Max.z), 0.0f);
+        return dx * dx + dy * dy + dz * dz;
+    }
+
+    float FarthestDistanceSqr(Vector3 p, const AABB& box)
+    {
+        float dx = fmaxf(fabsf(box.Min.x - p.x), fabsf(box.Max.x - p.x));
+        float dy = fmaxf(fabsf(box.Min.y - p.y), fabsf(box.Max.y - p.y));
+        float dz = fmaxf(fabsf(box.Min.z - p.z), fabsf(box.Max.z - p.z));
+        return dx * dx + dy * dy + dz * dz;
+    }
+
+    // Half the surface of the box, the measure of how loose the query bricks got
+    float HalfArea(const AABB& box)
+    {
+        Vector3 size = box.GetSize();
+        return size.x * size.y + size.y * size.z + size.z * size.x;
+    }
+
+    // Frustum test combined with the distance limit (maxDistanceSqr < 0 = no limit)
+    CullResult CullBounds(const Frustum& frustum, Vector3 eye, float maxDistanceSqr, const AABB& box)
+    {
+        if (maxDistanceSqr >= 0.0f && NearestDistanceSqr(eye, box) > maxDistanceSqr)
+        {
+            return CullOutside;
+        }
+
+        CullResult result = frustum.TestAABB(box);
+        if (result == CullInside && maxDistanceSqr >= 0.0f && FarthestDistanceSqr(eye, box) > maxDistanceSqr)
+        {
+            result = CullIntersect;
+        }
+        return result;
+    }
+}
+
+int World::CullBodies(const Frustum& frustum, Vector3 eye, float maxDistance, int* indices, int capacity)
+{
+    float maxDistanceSqr = maxDistance > 0.0f ? maxDistance * maxDistance : -1.0f;
+    int count = 0;
+
+    this->PrepareQueries();
+
+    // Copies the bodies [first, first + n) of queryIndices
+    auto take = [&](int first, int n)
+    {
+        int copied = std::min(n, capacity - count);
+        if (copied > 0)
+        {
+            std::copy(this->queryIndices.begin() + first, this->queryIndices.begin() + first + copied, indices + count);
+        }
+        count += n;
+    };
+
+    for (const QueryNode& cell : this->queryCells)
+    {
+        CullResult result = CullBounds(frustum, eye, maxDistanceSqr, cell.Bounds);
+        if (result == CullOutside) continue;
+
+        if (result == CullInside)
+        {
+            const QueryNode& first = this->queryBricks[cell.First];
+            const QueryNode& last = this->queryBricks[cell.First + cell.Count - 1];
+            take(first.First, last.First + last.Count - first.First);
+            continue;
+        }
+
+        for (int b = cell.First; b < cell.First + cell.Count; b++)
+        {
+            const QueryNode& brick = this->queryBricks[b];
+            result = CullBounds(frustum, eye, maxDistanceSqr, brick.Bounds);
+            if (result == CullOutside) continue;
+
+            if (result == CullInside)
+            {
+                take(brick.First, brick.Count);
+                continue;
+            }
+
+            for (int i = brick.First; i < brick.First + brick.Count; i++)
+            {
+                if (CullBounds(frustum, eye, maxDistanceSqr, this->queryBounds[i]) == CullOutside) continue;
+                if (count < capacity) indices[count] = this->queryIndices[i];
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+void World::PrepareQueries()
+{
+    // Also picks up the bodies moved by hand since the last Step
+    this->UpdateTransforms();
+
+    if (!this->queryCellsDirty && (this->queryRefitAll || !this->queryMoved.empty()))
+    {
+        this->RefitQueryCells();
+    }
+
+    if (this->queryCellsDirty)
+    {
+        this->RefreshQueryCells();
+    }
+}
+
+void World::RefreshQueryCells()
+{
+    this->queryCells.clear();
+    this->queryBricks.clear();
+    this->queryIndices.clear();
+    this->queryBounds.clear();
+
+    // Cell bounds come from the body AABBs, so they are tight whatever the cell size
+    auto addCell = [this]()
+    {
+        if (this->querySort.empty()) return;
+
+        AABB bounds = this->bodyBounds[this->querySort[0].second];
+        for (auto& entry : this->querySort)
+        {
+            bounds.ExpandToInclude(this->bodyBounds[entry.second]);
+        }
+
+        // Bricks of QueryBrickSize bodies along the longest axis of the cell
+        Vector3 size = bounds.GetSize();
+        int axis = size.x >= size.y && size.x >= size.z ? 0 : (size.y >= size.z ? 1 : 2);
+        for (auto& entry : this->querySort)
+        {
+            Vector3 center = this->bodyList[entry.second].Position();
+            entry.first = axis == 0 ? center.x : (axis == 1 ? center.y : center.z);
+        }
+        std::sort(this->querySort.begin(), this->querySort.end());
+
+        QueryNode cell = { bounds, (int)this->queryBricks.size(), 0 };
+        for (size_t start = 0; start < this->querySort.size(); start += QueryBrickSize)
+        {
+            size_t end = std::min(start + (size_t)QueryBrickSize, this->querySort.size());
+            QueryNode brick = { this->bodyBounds[this->querySort[start].second], (int)this->queryIndices.size(), (int)(end - start) };
+
+            for (size_t i = start; i < end; i++)
+            {
+                const AABB& aabb = this->bodyBounds[this->querySort[i].second];
+                brick.Bounds.ExpandToInclude(aabb);
+                this->queryIndices.push_back(this->querySort[i].second);
+                this->queryBounds.push_back(aabb);
+            }
+            this->queryBricks.push_back(brick);
+            cell.Count++;
+        }
+
+        this->queryCells.push_back(cell);
+    };
+
+    if (this->bodyCount > 0)
+    {
+        AABB extent = this->bodyBounds[0];
+        for (int i = 1; i < this->bodyCount; i++)
+        {
+            extent.ExpandToInclude(this->bodyBounds[i]);
+        }
+
+        // Cells of about QueryCellBodies bodies over the extent, split in 3D, or in 2D / 1D when
+        // the bodies lie in a thin slab or along a line
+        Vector3 size = extent.GetSize();
+        float sides[3] = { size.x, size.y, size.z };
+        std::sort(sides, sides + 3, [](float a, float b) { return a > b; });
+        float cellCount = fmaxf(this->bodyCount / (float)QueryCellBodies, 1.0f);
+        float cellSize = cbrtf(sides[0] * sides[1] * sides[2] / cellCount);
+        if (sides[2] < cellSize) cellSize = sqrtf(sides[0] * sides[1] / cellCount);
+        if (sides[1] < cellSize) cellSize = sides[0] / cellCount;
+        float inverse = cellSize > 0.0f ? 1.0f / cellSize : 0.0f;
+
+        this->queryKeys.clear();
+        for (int i = 0; i < this->bodyCount; i++)
+        {
+            Vector3 offset = Vector3Subtract(this->bodyList[i].Position(), extent.Min);
+            uint64_t x = (uint64_t)fmaxf(offset.x * inverse, 0.0f);
+            uint64_t y = (uint64_t)fmaxf(offset.y * inverse, 0.0f);
+            uint64_t z = (uint64_t)fmaxf(offset.z * inverse, 0.0f);
+            this->queryKeys.push_back({ x | (y << 21) | (z << 42), i });
+        }
+        std::sort(this->queryKeys.begin(), this->queryKeys.end());
+
+        for (size_t start = 0; start < this->queryKeys.size();)
+        {
+            this->querySort.clear();
+            size_t end = start;
+            for (; end < this->queryKeys.size() && this->queryKeys[end].first == this->queryKeys[start].first; end++)
+            {
+                this->querySort.push_back({ 0.0f, this->queryKeys[end].second });
+            }
+            addCell();
+            start = end;
+        }
+    }
+
+    this->queryWorldBounds = AABB();
+    for (size_t i = 0; i < this->queryCells.size(); i++)
+    {
+        if (i == 0) this->queryWorldBounds = this->queryCells[i].Bounds;
+        else this->queryWorldBounds.ExpandToInclude(this->queryCells[i].Bounds);
+    }
+
+    this->querySlots.resize(this->bodyCount);
+    for (int i = 0; i < (int)this->queryIndices.size(); i++)
+    {
+        this->querySlots[this->queryIndices[i]] = i;
+    }
+
+    this->queryArea = 0.0f;
+    for (const QueryNode& brick : this->queryBricks)
+    {
+        this->queryArea += HalfArea(brick.Bounds);
+    }
+    this->queryBuiltArea = this->queryArea;
+
+    this->queryMoved.clear();
+    this->queryRefitAll = false;
+    this->queryCellsDirty = false;
+}
+
+void World::RefitQueryCells()
+{
+    this->queryRefit.clear();
+
+    if (this->queryRefitAll)
+    {
+        for (int i = 0; i < (int)this->queryIndices.size(); i++)
+        {
+            this->queryBounds[i] = this->bodyBounds[this->queryIndices[i]];
+        }
+        for (int b = 0; b < (int)this->queryBricks.size(); b++)
+        {
+            this->queryRefit.push_back(b);
+        }
+        this->queryArea = 0.0f;
+    }
+    else
+    {
+        // Bricks are in queryIndices order, the brick of a slot is the last one starting at or before it
+        for (int body : this->queryMoved)
+        {
+            int slot = this->querySlots[body];
+            this->queryBounds[slot] = this->bodyBounds[body];
+            auto brick = std::upper_bound(this->queryBricks.begin(), this->queryBricks.end(), slot,
+                [](int value, const QueryNode& node) { return value < node.First; }) - 1;
+            this->queryRefit.push_back((int)(brick - this->queryBricks.begin()));
+        }
+        std::sort(this->queryRefit.begin(), this->queryRefit.end());
+        this->queryRefit.erase(std::unique(this->queryRefit.begin(), this->queryRefit.end()), this->queryRefit.end());
+
+        for (int b : this->queryRefit)
+        {
+            this->queryArea -= HalfArea(this->queryBricks[b].Bounds);
+        }
+    }
+
+    for (int b : this->queryRefit)
+    {
+        QueryNode& brick = this->queryBricks[b];
+        brick.Bounds = this->queryBounds[brick.First];
+        for (int i = brick.First + 1; i < brick.First + brick.Count; i++)
+        {
+            brick.Bounds.ExpandToInclude(this->queryBounds[i]);
+        }
+        this->queryArea += HalfArea(brick.Bounds);
+    }
+
+    // Then the cells holding them, which are in brick order the same way
+    int lastCell = -1;
+    for (int b : this->queryRefit)
+    {
+        int cellIndex = (int)(std::upper_bound(this->queryCells.begin(), this->queryCells.end(), b,
+            [](int value, const QueryNode& node) { return value < node.First; }) - this->queryCells.begin()) - 1;
+        if (cellIndex == lastCell) continue;
+        lastCell = cellIndex;
+
+        QueryNode& cell = this->queryCells[cellIndex];
+        cell.Bounds = this->queryBricks[cell.First].Bounds;
+        for (int i = cell.First + 1; i < cell.First + cell.Count; i++)
+        {
+            cell.Bounds.ExpandToInclude(this->queryBricks[i].Bounds);
+        }
+    }
+
+    if (!this->queryRefit.empty())
+    {
+        this->queryWorldBounds = this->queryCells[0].Bounds;
+        for (const QueryNode& cell : this->queryCells)
+        {
+            this->queryWorldBounds.ExpandToInclude(cell.Bounds);
+        }
+    }
+
+    this->queryMoved.clear();
+    this->queryRefitAll = false;
+
+    // The bodies keep the cells they were sorted into, so the bricks grow as they drift apart
+    if (this->queryArea > QueryRebuildArea * this->queryBuiltArea)
+    {
+        this->queryCellsDirty = true;
+    }
+}
+
+template <typename Overlaps, typename Visit>
+void World::ForEachQueryBody(Overlaps overlaps, Visit visit) const
+{
+    for (const QueryNode& cell : this->queryCells)
+    {
+        if (!overlaps(cell.Bounds)) continue;
+
+        for (int b = cell.First; b < cell.First + cell.Count; b++)
+        {
+            const QueryNode& brick = this->queryBricks[b];
+            if (!overlaps(brick.Bounds)) continue;
+
+            for (int i = brick.First; i < brick.First + brick.Count; i++)
+            {
+                if (overlaps(this->queryBounds[i])) visit(this->queryIndices[i]);
+            }
+        }
+    }
+}
+
+namespace
+{
+    // Entry distance of a ray into a box, false when it misses or enters beyond maxDistance
+    bool RayEntersAABB(Vector3 origin, Vector3 invDirection, const AABB& box, float maxDistance)
+    {
+        float t1 = (box.Min.x - origin.x) * invDirection.x;
+        float t2 = (box.Max.x - origin.x) * invDirection.x;
+        float tMin = fminf(t1, t2);
+        float tMax = fmaxf(t1, t2);
+
+        t1 = (box.Min.y - origin.y) * invDirection.y;
+        t2 = (box.Max.y - origin.y) * invDirection.y;
+        tMin = fmaxf(tMin, fminf(t1, t2));
+        tMax = fminf(tMax, fmaxf(t1, t2));
+
+        t1 = (box.Min.z - origin.z) * invDirection.z;
+        t2 = (box.Max.z - origin.z) * invDirection.z;
+        tMin = fmaxf(tMin, fminf(t1, t2));
+        tMax = fminf(tMax, fmaxf(t1, t2));
+
+        tMin = fmaxf(tMin, 0.0f);
+        return tMax >= tMin && tMin <= maxDistance;
+    }
+
+    // Exact ray test against the shape of a body; direction is normalized.
+    // Reads the cached transform only, so it is safe to call from several threads.
+    bool RayHitsBody(const Body& body, Vector3 origin, Vector3 direction, float maxDistance, RayHit* hit)
+    {
+        Vector3 center = body.Position();
+
+        if (body.shapeType == Sphere)
+        {
+            Vector3 m = Vector3Subtract(origin, center);
+            float b = Vector3DotProduct(m, direction);
+            float radiusSqr = body.Radius * body.Radius;
+            float c = Vector3DotProduct(m, m) - radiusSqr;
+            if (c > 0.0f && b > 0.0f) return false;
+
+            // r^2 - |m - b d|^2 rather than b^2 - c, which cancels badly far from the sphere
+            // (Ericson, Real-Time Collision Detection, 5.3.2)
+            Vector3 offset = Vector3Subtract(m, Vector3Scale(direction, b));
+            float discriminant = radiusSqr - Vector3DotProduct(offset, offset);
+            if (discriminant < 0.0f) return false;
+
+            float t = fmaxf(-b - sqrtf(discriminant), 0.0f); // 0 when the ray starts inside
+            if (t > maxDistance) return false;
+
+            hit->Distance = t;
+            hit->Point = Vector3Add(origin, Vector3Scale(direction, t));
+            hit->Normal = t > 0.0f ? Vector3Normalize(Vector3Subtract(hit->Point, center)) : Vector3Negate(direction);
+            return true;
+        }
+
+        // Box: slab test in the body frame, axes are the columns of the cached transform
+        const Matrix& t = body.Transformation;
+        Vector3 axes[3] = { { t.m0, t.m1, t.m2 }, { t.m4, t.m5, t.m6 }, { t.m8, t.m9, t.m10 } };
+        float half[3] = { body.Size.x * 0.5f, body.Size.y * 0.5f, body.Size.z * 0.5f };
+        Vector3 m = Vector3Subtract(origin, center);
+
+        float tMin = 0.0f;
+        float tMax = maxDistance;
+        int axis = -1;
+        float sign = 0.0f;
+
+        for (int i = 0; i < 3; i++)
+        {
+            float o = Vector3DotProduct(axes[i], m);
+            float d = Vector3DotProduct(axes[i], direction);
+
+            if (fabsf(d) < 1e-8f)
+            {
+                if (o < -half[i] || o > half[i]) return false;
+                continue;
+            }
+
+            float t1 = (-half[i] - o) / d;
+            float t2 = (half[i] - o) / d;
+            float s = -1.0f; // face crossed at t1
+            if (t1 > t2)
+            {
+                std::swap(t1, t2);
+                s = 1.0f;
+            }
+            if (t1 > tMin)
+            {
+                tMin = t1;
+                axis = i;
+                sign = s;
+            }
+            tMax = fminf(tMax, t2);
+            if (tMin > tMax) return false;
+        }
+
+        hit->Distance = tMin;
+        hit->Point = Vector3Add(origin, Vector3Scale(direction, tMin));
+        hit->Normal = axis >= 0 ? Vector3Scale(axes[axis], sign) : Vector3Negate(direction);
+        return true;
+    }
+
+    // Distance from the sphere center to the closest point of the body shape, compared to radius
+    bool SphereOverlapsBody(const Body& body, Vector3 center, float radius)
+    {
+        Vector3 d = Vector3Subtract(center, body.Position());
+
+        if (body.shapeType == Sphere)
+        {
+            float r = radius + body.Radius;
+            return Vector3DotProduct(d, d) <= r * r;
+        }
+
+        const Matrix& t = body.Transformation;
+        Vector3 axes[3] = { { t.m0, t.m1, t.m2 }, { t.m4, t.m5, t.m6 }, { t.m8, t.m9, t.m10 } };
+        float half[3] = { body.Size.x * 0.5f, body.Size.y * 0.5f, body.Size.z * 0.5f };
+        float distanceSqr = 0.0f;
+
+        for (int i = 0; i < 3; i++)
+        {
+            float o = fabsf(Vector3DotProduct(axes[i], d)) - half[i];
+            if (o > 0.0f) distanceSqr += o * o;
+        }
+        return distanceSqr <= radius * radius;
+    }
+
+    bool OverlapsAABB(const AABB& a, const AABB& b)
+    {
+        return a.Min.x <= b.Max.x && a.Max.x >= b.Min.x &&
+            a.Min.y <= b.Max.y && a.Max.y >= b.Min.y &&
+            a.Min.z <= b.Max.z && a.Max.z >= b.Min.z;
+    }
+
+    Vector3 InverseDirection(Vector3 direction)
+    {
+        return { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+    }
+}
+
+bool World::RayCast(Ray ray, float maxDistance, RayHit* hit)
+{
+    this->PrepareQueries();
+    return this->QueryRayCast(ray, maxDistance, hit);
+}
+
+int World::RayCastAll(Ray ray, float maxDistance, RayHit* hits, int capacity)
+{
+    this->PrepareQueries();
+    return this->QueryRayCastAll(ray, maxDistance, hits, capacity);
+}
+
+int World::OverlapAABB(const AABB& box, int* indices, int capacity)
+{
+    this->PrepareQueries();
+    int count = 0;
+
+    this->ForEachQueryBody(
+        [&](const AABB& bounds) { return OverlapsAABB(bounds, box); },
+        [&](int index)
+        {
+            if (count < capacity) indices[count] = index;
+            count++;
+        });
+
+    return count;
+}
+
+int World::OverlapSphere(Vector3 center, float radius, int* indices, int capacity)
+{
+    this->PrepareQueries();
+    return this->QueryOverlapSphere(center, radius, indices, capacity);
+}
+
+int World::NearestBodies(Vector3 point, int k, int* indices, float* distances)
+{
+    this->PrepareQueries();
+    return this->QueryNearest(point, k, indices, distances);
+}
+
+void World::RayCastBatch(const Ray* rays, int count, float maxDistance, RayHit* hits)
+{
+    this->PrepareQueries();
+    ThreadPool::Default().ParallelFor(count, 64, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            this->QueryRayCast(rays[i], maxDistance, &hits[i]);
+        }
+    });
+}
+
+void World::OverlapSphereBatch(const Vector3* centers, const float* radii, int count, int* indices, int capacity, int* counts)
+{
+    this->PrepareQueries();
+    ThreadPool::Default().ParallelFor(count, 64, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            counts[i] = this->QueryOverlapSphere(centers[i], radii[i], indices + (size_t)i * capacity, capacity);
+        }
+    });
+}
+
+void World::NearestBodiesBatch(const Vector3* points, int count, int k, int* indices, float* distances)
+{
+    this->PrepareQueries();
+    ThreadPool::Default().ParallelFor(count, 64, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            int* queryIndices = indices + (size_t)i * k;
+            float* queryDistances = distances + (size_t)i * k;
+            int found = this->QueryNearest(points[i], k, queryIndices, queryDistances);
+
+            for (int j = found; j < k; j++)
+            {
+                queryIndices[j] = -1;
+                queryDistances[j] = INFINITY;
+            }
+        }
+    });
+}
+
+bool World::QueryRayCast(Ray ray, float maxDistance, RayHit* hit) const
+{
+    *hit = RayHit();
+    float length = Vector3Length(ray.direction);
+    if (length == 0.0f) return false;
+
+    Vector3 direction = Vector3Scale(ray.direction, 1.0f / length);
+    Vector3 invDirection = InverseDirection(direction);
+    float best = maxDistance > 0.0f ? maxDistance : INFINITY;
+
+    this->ForEachQueryBody(
+        [&](const AABB& bounds) { return RayEntersAABB(ray.position, invDirection, bounds, best); },
+        [&](int index)
+        {
+            RayHit candidate;
+            if (RayHitsBody(this->bodyList[index], ray.position, direction, best, &candidate))
+            {
+                candidate.Body = index;
+                *hit = candidate;
+                best = candidate.Distance;
+            }
+        });
+
+    return hit->Body >= 0;
 }
 
-int World::TransformCount = 0;  // Definicin e inicializacin
-int World::NoTransformCount = 0; // Definicin e inicializacin
+int World::QueryRayCastAll(Ray ray, float maxDistance, RayHit* hits, int capacity) const
+{
+    float length = Vector3Length(ray.direction);
+    if (length == 0.0f) return 0;
+
+    Vector3 direction = Vector3Scale(ray.direction, 1.0f / length);
+    Vector3 invDirection = InverseDirection(direction);
+    float limit = maxDistance > 0.0f ? maxDistance : INFINITY;
+    int count = 0;
 
-void World::AddBody(Body body)
+    this->ForEachQueryBody(
+        [&](const AABB& bounds) { return RayEntersAABB(ray.position, invDirection, bounds, limit); },
+        [&](int index)
+        {
+            RayHit candidate;
+            if (!RayHitsBody(this->bodyList[index], ray.position, direction, limit, &candidate)) return;
+            candidate.Body = index;
+
+            // Keeps the closest capacity hits, sorted by distance
+            int slot = std::min(count, capacity);
+            while (slot > 0 && hits[slot - 1].Distance > candidate.Distance)
+            {
+                if (slot < capacity) hits[slot] = hits[slot - 1];
+                slot--;
+            }
+            if (slot < capacity) hits[slot] = candidate;
+            count++;
+        });
+
+    return count;
+}
+
+int World::QueryOverlapSphere(Vector3 center, float radius, int* indices, int capacity) const
 {
-    this->bodyList.push_back(body);
-    this->bodyCount += 1;
+    float radiusSqr = radius * radius;
+    int count = 0;
+
+    this->ForEachQueryBody(
+        [&](const AABB& bounds) { return NearestDistanceSqr(center, bounds) <= radiusSqr; },
+        [&](int index)
+        {
+            if (!SphereOverlapsBody(this->bodyList[index], center, radius)) return;
+            if (count < capacity) indices[count] = index;
+            count++;
+        });
+
+    return count;
 }
 
-bool World::RemoveBody(int index)
+int World::QueryNearest(Vector3 point, int k, int* indices, float* distances) const
 {
-    if (index < 0 || index >= bodyCount) {
-        return false;
+    if (k <= 0 || this->queryIndices.empty()) return 0;
+    k = std::min(k, (int)this->queryIndices.size());
+
+    // Searches a growing sphere around the point. The first radius holds about k bodies if they
+    // were spread evenly over the world bounds; it doubles until k bodies are found in it.
+    Vector3 size = this->queryWorldBounds.GetSize();
+    float volume = fmaxf(size.x, 1.0f) * fmaxf(size.y, 1.0f) * fmaxf(size.z, 1.0f);
+    float radius = cbrtf(volume * k / (this->queryIndices.size() * 4.0f / 3.0f * PI));
+    float farthestSqr = FarthestDistanceSqr(point, this->queryWorldBounds);
+
+    // distances holds squared distances, sorted, until the end
+    int found = 0;
+    for (;;)
+    {
+        found = 0;
+        float limitSqr = radius * radius;
+
+        this->ForEachQueryBody(
+            [&](const AABB& bounds) { return NearestDistanceSqr(point, bounds) <= limitSqr; },
+            [&](int index)
+            {
+                float distanceSqr = Vector3DistanceSqr(point, this->bodyList[index].Position());
+                if (distanceSqr > limitSqr) return;
+
+                int slot = found < k ? found++ : k - 1;
+                while (slot > 0 && distances[slot - 1] > distanceSqr)
+                {
+                    distances[slot] = distances[slot - 1];
+                    indices[slot] = indices[slot - 1];
+                    slot--;
+                }
+                distances[slot] = distanceSqr;
+                indices[slot] = index;
+                if (found == k) limitSqr = distances[k - 1];
+            });
+
+        if (found == k || radius * radius >= farthestSqr) break;
+        radius *= 2.0f;
     }
-    UnloadModel(bodyList[index].Mesh);
-    bodyList.erase(bodyList.begin() + index);
-    bodyCount--;
-    return true;
-}
 
-Body *World::GetBody(int index) {
-    if (index < 0 || index >= bodyCount) {
-        return nullptr; // O lanza una excepcin si lo prefieres
+    for (int i = 0; i < found; i++)
+    {
+        distances[i] = sqrtf(distances[i]);
     }
-    return &bodyList[index]; // Retorna una referencia
+    return found;
 }
 
-void World::Step(float time, int iterations)
+namespace
 {
-    Vector3 dir;
-    iterations = Clamp(iterations, World::MinIterations, World::MaxIterations);
-    this->ContactPointsList.clear();
-    int columns = 0;
-
-    if (this->broadPhase == Grid)
+    // Broad-phase filter: never two static bodies, and each layer has to be in the other's mask
+    bool ShouldCollide(const Body& bodyA, const Body& bodyB)
     {
-        this->BuildNodeGrid(&columns);
+        return !(bodyA.IsStatic && bodyB.IsStatic) &&
+            (bodyA.CollisionLayer & bodyB.CollisionMask) != 0 &&
+            (bodyB.CollisionLayer & bodyA.CollisionMask) != 0;
     }
+}
 
-    for (int it = 0; it < iterations; it++)
+void World::CollisionStepBruteForce()
+{
+    this->pairList.clear();
+
+    for (int i = 0; i + 1 < this->bodyCount; i++)
     {
-        // Movement step
-        for (int i = 0; i < this->bodyCount; i++)
+        const AABB& aabb = this->bodyBounds[i];
+
+        for (int j = i + 1; j < this->bodyCount; j++)
         {
-            for (int j = 0; j < this->bodyCount; j++)
+            if (Collisions::IntersectAABBs(aabb, this->bodyBounds[j]))
             {
-                if (i == j) continue;
-                dir = Vector3Normalize(Vector3Subtract(this->bodyList[j].Position(), this->bodyList[i].Position()));
-                float distanceSqr = Vector3DistanceSqr(bodyList[i].Position(), bodyList[j].Position());
-
-                bodyList[i].AddForce(Vector3Scale(dir, G * bodyList[i].Mass * bodyList[j].Mass / distanceSqr));
+                this->pairList.push_back({ i, j });
             }
-            this->bodyList[i].Step(time, iterations);
         }
+    }
 
-        if (this->broadPhase == BruteForce)
-        {
-            this->CollisionStepBruteForce();
-        }
-        else if (this->broadPhase == Grid)
+    this->CollidePairs(this->pairList);
+}
+
+void World::BuildNodeGrid()
+{
+    if (!this->gridDirty)
+    {
+        return;
+    }
+
+    // Called before the first sub-step, so bodies added since the last Step get their bounds here
+    this->UpdateTransforms();
+    this->dynamicList.clear();
+    for (int i = 0; i < this->bodyCount; i++)
+    {
+        if (!this->bodyList[i].IsStatic)
         {
-            this->CollisionStepGrid(columns);
+            this->dynamicList.push_back(i);
         }
     }
+
+    if (this->gridNodeSize > 0.0f)
+    {
+        this->grid.SetCellSize(this->gridNodeSize);
+    }
+    else
+    {
+        this->grid.FitCellSize(this->bodyBounds.data(), (int)this->bodyBounds.size());
+    }
+
+    this->grid.Build(this->bodyBounds.data(), (int)this->bodyBounds.size(), this->dynamicList.data(), (int)this->dynamicList.size());
+    this->gridDirty = false;
 }
 
-void World::CollisionStepBruteForce()
+void World::FillNodeGrid()
 {
-    this->contactList.clear();
-    this->grid.clear();
+    this->grid.Update(this->bodyBounds.data(), this->dynamicList.data(), (int)this->dynamicList.size());
+}
 
-    // collision step
-    for (int i = 0; i < this->bodyList.size() - 1; i++)
-    {
-        Body& bodyA = this->bodyList[i];
-        AABB bodyA_aabb = bodyA.GetAABB();
+void World::CollisionStepGrid()
+{
+    this->FillNodeGrid();
+    this->CollidePairs(this->grid.Pairs());
+}
+
+void World::FillTree()
+{
+    this->treeStatic.resize(this->bodyList.size());
 
-        for (int j = i + 1; j < this->bodyList.size(); j++)
+    ThreadPool::Default().ParallelFor((int)this->bodyList.size(), 1024, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
         {
-            Body& bodyB = this->bodyList[j];
-            AABB bodyB_aabb = bodyB.GetAABB();
+            this->treeStatic[i] = this->bodyList[i].IsStatic ? 1 : 0;
+        }
+    });
 
-            if (bodyA.IsStatic && bodyB.IsStatic)
-            {
-                continue;
-            }
+    this->tree.Build(this->bodyBounds.data(), this->treeStatic.data(), (int)this->bodyBounds.size(), ThreadPool::Default());
+}
 
-            if (!Collisions::IntersectAABBs(bodyA_aabb, bodyB_aabb))
-            {
-                continue;
-            }
+void World::CollisionStepTree()
+{
+    this->FillTree();
+    this->CollidePairs(this->tree.Pairs());
+}
+
+void World::CollidePairs(const std::vector<std::pair<int, int>>& pairs)
+{
+    // Detection: transforms and AABBs are current after UpdateTransforms and nothing moves until
+    // every pair is tested, so fixed chunks of pairs run in parallel, joined in pair order
+    constexpr int DetectionChunk = 64;
+    int chunkCount = ((int)pairs.size() + DetectionChunk - 1) / DetectionChunk;
+    if ((int)this->chunkContacts.size() < chunkCount)
+    {
+        this->chunkContacts.resize(chunkCount);
+    }
 
-            Vector3 normal;
-            float depth;
+    ThreadPool::Default().ParallelFor(chunkCount, 1, [&](int begin, int end)
+    {
+        for (int c = begin; c < end; c++)
+        {
+            std::vector<Manifold>& contacts = this->chunkContacts[c];
+            contacts.clear();
 
-            if (Collisions::Collide(bodyA, bodyB, normal, depth))
+            for (int i = c * DetectionChunk; i < std::min((c + 1) * DetectionChunk, (int)pairs.size()); i++)
             {
-                if (bodyA.IsStatic)
+                Body& bodyA = this->bodyList[pairs[i].first];
+                Body& bodyB = this->bodyList[pairs[i].second];
+
+                if (!ShouldCollide(bodyA, bodyB))
                 {
-                    bodyB.Move(Vector3Scale(normal, depth));
+                    continue;
                 }
-                else if (bodyB.IsStatic)
+
+                if (!Collisions::IntersectAABBs(this->bodyBounds[pairs[i].first], this->bodyBounds[pairs[i].second]))
                 {
-                    bodyA.Move(Vector3Scale(normal, -depth));
+                    continue;
                 }
-                else
+
+                Vector3 normal;
+                float depth;
+
+                if (Collisions::Collide(bodyA, bodyB, normal, depth))
                 {
-                    bodyA.Move(Vector3Scale(normal, -depth / 2.0f));
-                    bodyB.Move(Vector3Scale(normal, depth / 2.0f));
-                }
-                Vector3 contact1, contact2;
-                int contactCount;
+                    Vector3 contact1, contact2;
+                    int contactCount;
 
-                Collisions::FindContactPoints(bodyA, bodyB, contact1, contact2, contactCount);
-                Manifold contact = Manifold(&bodyA, &bodyB, normal, depth, contact1, contact2, contactCount);
-                this->contactList.push_back(contact);
+                    Collisions::FindContactPoints(bodyA, bodyB, contact1, contact2, contactCount);
+                    contacts.push_back(Manifold(&bodyA, &bodyB, normal, depth, contact1, contact2, contactCount));
+                }
             }
         }
+    });
+
+    this->contactList.clear();
+    for (int c = 0; c < chunkCount; c++)
+    {
+        this->contactList.insert(this->contactList.end(), this->chunkContacts[c].begin(), this->chunkContacts[c].end());
     }
 
-    for (int i = 0; i < this->contactList.size(); i++)
+    // Past MaxContacts only the deepest contacts are kept, put back in pair order
+    int maxContacts = this->memoryLimits.MaxContacts;
+    if (maxContacts > 0 && (int)this->contactList.size() > maxContacts)
     {
-        Manifold *contact = &this->contactList[i];
-        this->ResolveCollision(contact);
+        auto pairOrder = [](const Manifold& x, const Manifold& y)
+        {
+            return x.BodyA != y.BodyA ? x.BodyA < y.BodyA : x.BodyB < y.BodyB;
+        };
 
-        if (contact->ContactCount > 0)
+        this->droppedContacts += (int)this->contactList.size() - maxContacts;
+        std::nth_element(this->contactList.begin(), this->contactList.begin() + maxContacts, this->contactList.end(),
+            [&](const Manifold& x, const Manifold& y) { return x.Depth != y.Depth ? x.Depth > y.Depth : pairOrder(x, y); });
+        this->contactList.erase(this->contactList.begin() + maxContacts, this->contactList.end());
+        std::sort(this->contactList.begin(), this->contactList.end(), pairOrder);
+    }
+
+    if (this->solver.Solver == PositionBased)
+    {
+        this->positionSolver.Solve(this->bodyList, this->contactList, this->subStepTime, this->solver, ThreadPool::Default());
+        for (const Manifold& contact : this->contactList)
         {
-            this->ContactPointsList.push_back(contact->Contact1);
+            this->AddContactPoints(contact);
+        }
+        return;
+    }
 
-            if (contact->ContactCount > 1)
-            {
-                this->ContactPointsList.push_back(contact->Contact2);
-            }
+    this->CorrectPositions();
+
+    for (int i = 0; i < (int)this->contactList.size(); i++)
+    {
+        this->ResolveCollision(&this->contactList[i]);
+        this->AddContactPoints(this->contactList[i]);
+    }
+}
+
+void World::AddContactPoints(const Manifold& contact)
+{
+    Vector3 points[2] = { contact.Contact1, contact.Contact2 };
+    for (int i = 0; i < contact.ContactCount; i++)
+    {
+        if (this->memoryLimits.MaxContactPoints > 0 && (int)this->ContactPointsList.size() >= this->memoryLimits.MaxContactPoints)
+        {
+            return;
         }
+        this->ContactPointsList.push_back(points[i]);
     }
 }
 
-void World::BuildNodeGrid(int* columns)
+void World::CorrectPositions()
 {
-    float minX = 1e10f;
-    //float minY = 1e10f;
-    float maxX = -1e10f;
-    //float maxY = -1e10f;
+    // Non-linear Gauss-Seidel on the detected depths: a contact only corrects what is left once
+    // the earlier contacts of its bodies moved them, so a body resting on two others is not
+    // pushed out twice. The depth left is the detected one minus the separation gained along
+    // the normal, without running detection again.
+    this->corrections.resize(this->bodyList.size(), Vector3Zero());
 
-    for (int i = 0; i < this->bodyList.size(); i++)
+    for (const Manifold& contact : this->contactList)
     {
-        Body *body = &this->bodyList[i];
-        AABB aabb = body->GetAABB();
+        int a = (int)(contact.BodyA - this->bodyList.data());
+        int b = (int)(contact.BodyB - this->bodyList.data());
+        float depth = contact.Depth -
+            Vector3DotProduct(contact.Normal, Vector3Subtract(this->corrections[b], this->corrections[a]));
 
-        if (aabb.Min.x < minX) { minX = aabb.Min.x; }
-        if (aabb.Max.x > maxX) { maxX = aabb.Max.x; }
-        //if (aabb.Min.y < minY) { minY = aabb.Min.y; }
-        //if (aabb.Max.y > maxY) { maxY = aabb.Max.y; }
-    }
+        if (depth <= 0.0f)
+        {
+            continue;
+        }
+
+        Vector3 moveA = Vector3Zero();
+        Vector3 moveB = Vector3Zero();
+        if (contact.BodyA->IsStatic)
+        {
+            moveB = Vector3Scale(contact.Normal, depth);
+        }
+        else if (contact.BodyB->IsStatic)
+        {
+            moveA = Vector3Scale(contact.Normal, -depth);
+        }
+        else
+        {
+            moveA = Vector3Scale(contact.Normal, -depth / 2.0f);
+            moveB = Vector3Scale(contact.Normal, depth / 2.0f);
+        }
+
+        if (!contact.BodyA->IsStatic)
+        {
+            contact.BodyA->Move(moveA);
+            this->corrections[a] = Vector3Add(this->corrections[a], moveA);
+        }
 
-    float width = maxX - minX;
-    //float height = maxY - minY;
+        if (!contact.BodyB->IsStatic)
+        {
+            contact.BodyB->Move(moveB);
+            this->corrections[b] = Vector3Add(this->corrections[b], moveB);
+        }
+    }
 
-    *columns = ceil(width / this->gridNodeSize);
-    //*rows = ceil(height / this->gridNodeSize);
+    for (const Manifold& contact : this->contactList)
+    {
+        this->corrections[contact.BodyA - this->bodyList.data()] = Vector3Zero();
+        this->corrections[contact.BodyB - this->bodyList.data()] = Vector3Zero();
+    }
 }
 
-void World::CollisionStepGrid(int columns)
+void World::CollisionStepDeterministic(BroadPhase broadPhase)
 {
-    this->contactList.clear();
+    // Candidate pairs, always as (lower index, higher index)
+    if (broadPhase == Grid)
+    {
+        this->FillNodeGrid();
+        this->pairList = this->grid.Pairs();
+        std::sort(this->pairList.begin(), this->pairList.end());
+    }
+    else if (broadPhase == MortonBVH)
+    {
+        this->FillTree();
+        this->pairList = this->tree.Pairs();
+        std::sort(this->pairList.begin(), this->pairList.end());
+    }
+    else
+    {
+        // Already in pair order
+        this->CollisionStepBruteForce();
+        return;
+    }
+
+    this->CollidePairs(this->pairList);
+}
 
-    for (auto& pair : this->grid)
+void World::CollisionStepMeshes()
+{
+    if (this->staticMeshes.empty())
     {
-        pair.second.clear();
+        return;
     }
 
     for (int i = 0; i < this->bodyCount; i++)
     {
-        Body* body = &this->bodyList[i];
-        AABB aabb = body->GetAABB();
+        Body& body = this->bodyList[i];
+        if (body.IsStatic) continue;
 
-        int left = (int)floor(aabb.Min.x / this->gridNodeSize);
-        int right = (int)ceil(aabb.Max.x / this->gridNodeSize);
-        int bottom = (int)floor(aabb.Min.y / this->gridNodeSize);
-        int top = (int)ceil(aabb.Max.y / this->gridNodeSize);
-
-        for (int y = bottom; y <= top; y++)
-        for (int x = left; x <= right; x++)
+        for (const TriangleMesh& mesh : this->staticMeshes)
         {
-            int key = x + y * columns;
+            if ((body.CollisionLayer & mesh.CollisionMask) == 0 || (mesh.CollisionLayer & body.CollisionMask) == 0)
+            {
+                continue;
+            }
 
-            if (grid.find(key) == grid.end())
+            const AABB& aabb = body.GetAABB();
+            if (!Collisions::IntersectAABBs(aabb, mesh.Bounds()))
             {
-                this->grid.insert({ key, std::vector<int>() });
+                continue;
             }
 
-            std::vector<int>& node = grid[key];
+            // Deepest contact over the triangles the body overlaps
+            Vector3 normal = Vector3Zero();
+            float depth = 0.0f;
+            Vector3 point = Vector3Zero();
+
+            mesh.Query(aabb, [&](int index)
+            {
+                const TriangleMesh::Triangle& triangle = mesh.GetTriangle(index);
+                Vector3 triangleNormal, trianglePoint;
+                float triangleDepth;
+
+                bool hit = body.shapeType == Sphere
+                    ? Collisions::IntersectSphereTriangle(body.Position(), body.Radius, triangle.A, triangle.B, triangle.C, triangleNormal, triangleDepth, trianglePoint)
+                    : Collisions::IntersectBoxTriangle(body, triangle.A, triangle.B, triangle.C, triangleNormal, triangleDepth, trianglePoint);
+
+                if (hit && triangleDepth > depth)
+                {
+                    normal = triangleNormal;
+                    depth = triangleDepth;
+                    point = trianglePoint;
+                }
+            });
 
-            if (std::find(node.begin(), node.end(), i) == node.end())
+            if (depth <= 0.0f)
             {
-                node.push_back(i);
+                continue;
             }
+
+            body.Move(Vector3Scale(normal, depth));
+            this->meshBody.Restitution = mesh.Restitution;
+            Manifold contact = Manifold(&this->meshBody, &body, normal, depth, point, Vector3Zero(), 1);
+            this->ResolveCollision(&contact);
+            this->AddContactPoints(contact);
         }
     }
+}
+
+void World::StepParticles(float time)
+{
+    if (this->particles.Count() == 0)
+    {
+        return;
+    }
+
+    ThreadPool& pool = ThreadPool::Default();
+    bool gravity = this->ComputeParticleGravity();
+    const Vector3* accelerations = gravity ? this->particleAccelerations.data() : nullptr;
 
-    for (auto& pair : this->grid)
+    if (this->forceFields.Count() > 0)
     {
-        std::vector<int>& node = pair.second;
-        if (node.size() < 2) continue;
+        int count = this->particles.Count();
+        this->particleFieldAccelerations.resize(count);
+        this->forceFields.Apply(this->particles.Positions(), this->particles.Velocities(), this->particles.InvMasses(), nullptr,
+            this->particles.GetConfig().CollisionLayer, count, time, this->particleFieldAccelerations.data(), pool);
 
-        for (int i = 0; i < node.size() - 1; i++)
+        if (gravity)
         {
-            Body& bodyA = this->bodyList[node[i]];
-            AABB bodyA_aabb = bodyA.GetAABB();
-
-            for (int j = i + 1; j < node.size(); j++)
+            pool.ParallelFor(count, ParticleSystem::Chunk, [&](int begin, int end)
             {
-                Body& bodyB = this->bodyList[node[j]];
-                AABB bodyB_aabb = bodyB.GetAABB();
-
-                if (bodyA.IsStatic && bodyB.IsStatic)
+                for (int i = begin; i < end; i++)
                 {
-                    continue;
+                    this->particleFieldAccelerations[i] = Vector3Add(this->particleFieldAccelerations[i], this->particleAccelerations[i]);
                 }
+            });
+        }
+        accelerations = this->particleFieldAccelerations.data();
+    }
 
-                if (!Collisions::IntersectAABBs(bodyA_aabb, bodyB_aabb))
-                {
-                    continue;
-                }
+    this->particles.Integrate(time, accelerations, pool);
+    this->particles.Collide(pool);
+    this->particles.CollideBodies(this->bodyList, this->bodyCount, pool);
+    this->particles.CollideMeshes(this->staticMeshes, pool);
+}
 
-                if (this->ContactListContainsPair(&bodyA, &bodyB))
-                {
-                    continue;
-                }
+bool World::ComputeParticleGravity()
+{
+    this->sourceList.clear();
+    for (int i = 0; i < this->bodyCount; i++)
+    {
+        if ((this->bodyList[i].Gravity & GravitySource) && this->bodyList[i].Mass > 0.0f)
+        {
+            this->sourceList.push_back(i);
+        }
+    }
 
-                Vector3 normal;
-                float depth;
+    if (this->sourceList.empty())
+    {
+        return false;
+    }
 
-                if (Collisions::Collide(bodyA, bodyB, normal, depth))
-                {
-                    if (bodyA.IsStatic)
-                    {
-                        bodyB.Move(Vector3Scale(normal, depth));
-                    }
-                    else if (bodyB.IsStatic)
-                    {
-                        bodyA.Move(Vector3Scale(normal, -depth));
-                    }
-                    else
-                    {
-                        bodyA.Move(Vector3Scale(normal, -depth / 2.0f));
-                        bodyB.Move(Vector3Scale(normal, depth / 2.0f));
-                    }
-                    Vector3 contact1, contact2;
-                    int contactCount;
+    int count = this->particles.Count();
+    const Vector3* positions = this->particles.Positions();
+    this->particleAccelerations.resize(count);
 
-                    Collisions::FindContactPoints(bodyA, bodyB, contact1, contact2, contactCount);
-                    Manifold contact = Manifold(&bodyA, &bodyB, normal, depth, contact1, contact2, contactCount);
-                    this->contactList.push_back(contact);
-                }
-            }
+    if (this->gravity.Solver == Multipole)
+    {
+        // The particles join the sources as massless receivers, so the cost stays O(N)
+        int sourceCount = (int)this->sourceList.size();
+        this->multipolePositions.resize(sourceCount + count);
+        this->multipoleMasses.resize(sourceCount + count);
+        this->multipoleAccelerations.resize(sourceCount + count);
+        for (int k = 0; k < sourceCount; k++)
+        {
+            this->multipolePositions[k] = this->bodyList[this->sourceList[k]].Position();
+            this->multipoleMasses[k] = this->bodyList[this->sourceList[k]].Mass;
         }
+        std::copy(positions, positions + count, this->multipolePositions.begin() + sourceCount);
+        std::fill(this->multipoleMasses.begin() + sourceCount, this->multipoleMasses.end(), 0.0f);
+
+        this->multipole.Compute(this->multipolePositions.data(), this->multipoleMasses.data(), sourceCount + count, this->G,
+            this->multipoleAccelerations.data(), ThreadPool::Default());
+        std::copy(this->multipoleAccelerations.begin() + sourceCount, this->multipoleAccelerations.end(), this->particleAccelerations.begin());
+        return true;
     }
 
-    for (int i = 0; i < this->contactList.size(); i++)
-    {
-        Manifold* contact = &this->contactList[i];
-        this->ResolveCollision(contact);
+    // Direct sum over the sources, which are usually few next to the particles
+    float softeningSqr = this->gravity.Softening * this->gravity.Softening;
+    float cutoffSqr = this->gravity.Cutoff > 0.0f ? this->gravity.Cutoff * this->gravity.Cutoff : INFINITY;
 
-        if (contact->ContactCount > 0)
+    ThreadPool::Default().ParallelFor(count, ParticleSystem::Chunk, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
         {
-            this->ContactPointsList.push_back(contact->Contact1);
-
-            if (contact->ContactCount > 1)
+            Vector3 acceleration = Vector3Zero();
+            for (int j : this->sourceList)
             {
-                this->ContactPointsList.push_back(contact->Contact2);
+                const Body& source = this->bodyList[j];
+                Vector3 delta = Vector3Subtract(source.Position(), positions[i]);
+                float distanceSqr = Vector3LengthSqr(delta);
+                if (distanceSqr > cutoffSqr) continue;
+
+                float softenedSqr = distanceSqr + softeningSqr;
+                if (softenedSqr == 0.0f) continue;
+                acceleration = Vector3Add(acceleration, Vector3Scale(delta, this->G * source.Mass / (softenedSqr * sqrtf(softenedSqr))));
             }
+            this->particleAccelerations[i] = acceleration;
+        }
+    });
+    return true;
+}
+
+void World::RecordContacts()
+{
+    for (const Manifold& contact : this->contactList)
+    {
+        int a = (int)(contact.BodyA - this->bodyList.data());
+        int b = (int)(contact.BodyB - this->bodyList.data());
+        Vector3 normal = contact.Normal;
+
+        if (a > b)
+        {
+            std::swap(a, b);
+            normal = Vector3Negate(normal);
         }
+
+        this->stepContacts.push_back({ ContactPersist, a, b, normal, contact.Depth, contact.Contact1 });
     }
 }
 
-bool World::ContactListContainsPair(Body* bodyA, Body* bodyB)
+void World::BuildContactEvents()
 {
-    for (int i = 0; i < this->contactList.size(); i++)
+    this->contactEvents.clear();
+    this->nextTouchingPairs.clear();
+
+    // One entry per pair, the deepest of the sub-steps
+    std::sort(this->stepContacts.begin(), this->stepContacts.end(), [](const ContactEvent& x, const ContactEvent& y)
+    {
+        return x.BodyA != y.BodyA ? x.BodyA < y.BodyA : (x.BodyB != y.BodyB ? x.BodyB < y.BodyB : x.Depth > y.Depth);
+    });
+
+    // Merge with the sorted pairs of the previous Step
+    size_t previous = 0;
+    const size_t previousCount = this->touchingPairs.size();
+
+    for (size_t i = 0; i < this->stepContacts.size(); i++)
     {
-        Manifold* manifold = &this->contactList[i];
+        const ContactEvent& contact = this->stepContacts[i];
+        std::pair<int, int> pair = { contact.BodyA, contact.BodyB };
+        if (i > 0 && this->stepContacts[i - 1].BodyA == pair.first && this->stepContacts[i - 1].BodyB == pair.second) continue;
 
-        if ((manifold->BodyA == bodyA && manifold->BodyB == bodyB) ||
-            (manifold->BodyB == bodyA && manifold->BodyA == bodyB))
+        while (previous < previousCount && this->touchingPairs[previous] < pair)
         {
-            return true;
+            const std::pair<int, int>& ended = this->touchingPairs[previous++];
+            this->contactEvents.push_back({ ContactEnd, ended.first, ended.second, Vector3Zero(), 0.0f, Vector3Zero() });
+        }
+
+        ContactEvent event = contact;
+        event.Type = ContactBegin;
+        if (previous < previousCount && this->touchingPairs[previous] == pair)
+        {
+            event.Type = ContactPersist;
+            previous++;
         }
+
+        this->contactEvents.push_back(event);
+        this->nextTouchingPairs.push_back(pair);
+    }
+
+    while (previous < previousCount)
+    {
+        const std::pair<int, int>& ended = this->touchingPairs[previous++];
+        this->contactEvents.push_back({ ContactEnd, ended.first, ended.second, Vector3Zero(), 0.0f, Vector3Zero() });
     }
 
-    return false;
+    std::swap(this->touchingPairs, this->nextTouchingPairs);
 }
 
 void World::ResolveCollision(Manifold* contact)
@@ -304,22 +2196,58 @@ void World::ResolveCollision(Manifold* contact)
     Body* bodyA = contact->BodyA;
     Body* bodyB = contact->BodyB;
     Vector3 normal = contact->Normal;
-    float depth = contact->Depth;
 
-    Vector3 relativeVelocity = Vector3Subtract(bodyB->LinearVelocity(), bodyA->LinearVelocity());
+    float e = fminf(bodyA->Restitution, bodyB->Restitution);
+
+    // Without contact points the impulse goes through both centers (linear only)
+    bool hasContacts = contact->ContactCount > 0;
+    int contactCount = hasContacts ? contact->ContactCount : 1;
+    Vector3 contactList[2] = { contact->Contact1, contact->Contact2 };
 
-    if (Vector3DotProduct(relativeVelocity, normal) > 0.0f)
+    Vector3 impulseList[2] = { Vector3Zero(), Vector3Zero() };
+    Vector3 raList[2];
+    Vector3 rbList[2];
+
+    // Impulses are computed from the pre-contact velocities and applied together
+    for (int i = 0; i < contactCount; i++)
     {
-        return;
-    }
+        Vector3 ra = hasContacts ? Vector3Subtract(contactList[i], bodyA->Position()) : Vector3Zero();
+        Vector3 rb = hasContacts ? Vector3Subtract(contactList[i], bodyB->Position()) : Vector3Zero();
+        raList[i] = ra;
+        rbList[i] = rb;
 
-    float e = fminf(bodyA->Restitution, bodyB->Restitution);
+        Vector3 velocityA = Vector3Add(bodyA->LinearVelocity(), Vector3CrossProduct(bodyA->AngularVelocity(), ra));
+        Vector3 velocityB = Vector3Add(bodyB->LinearVelocity(), Vector3CrossProduct(bodyB->AngularVelocity(), rb));
+        Vector3 relativeVelocity = Vector3Subtract(velocityB, velocityA);
+
+        float contactVelocityMag = Vector3DotProduct(relativeVelocity, normal);
+
+        if (contactVelocityMag > 0.0f)
+        {
+            continue;
+        }
+
+        Vector3 raCrossN = Vector3CrossProduct(ra, normal);
+        Vector3 rbCrossN = Vector3CrossProduct(rb, normal);
+
+        float denom = bodyA->InvMass + bodyB->InvMass +
+            Vector3DotProduct(raCrossN, bodyA->ApplyInvInertia(raCrossN)) +
+            Vector3DotProduct(rbCrossN, bodyB->ApplyInvInertia(rbCrossN));
 
-    float j = -(1.0f + e) * Vector3DotProduct(relativeVelocity, normal);
-    j /= bodyA->InvMass + bodyB->InvMass;
+        float j = -(1.0f + e) * contactVelocityMag;
+        j /= denom;
+        j /= (float)contactCount;
 
-    Vector3 impulse = Vector3Scale(normal, j);
+        impulseList[i] = Vector3Scale(normal, j);
+    }
+
+    for (int i = 0; i < contactCount; i++)
+    {
+        Vector3 impulse = impulseList[i];
 
-    bodyA->LinearVelocity(Vector3Subtract(bodyA->LinearVelocity(), Vector3Scale(impulse, bodyA->InvMass)));
-    bodyB->LinearVelocity(Vector3Add(bodyB->LinearVelocity(), Vector3Scale(impulse, bodyB->InvMass)));
+        bodyA->LinearVelocity(Vector3Subtract(bodyA->LinearVelocity(), Vector3Scale(impulse, bodyA->InvMass)));
+        bodyA->AngularVelocity(Vector3Subtract(bodyA->AngularVelocity(), bodyA->ApplyInvInertia(Vector3CrossProduct(raList[i], impulse))));
+        bodyB->LinearVelocity(Vector3Add(bodyB->LinearVelocity(), Vector3Scale(impulse, bodyB->InvMass)));
+        bodyB->AngularVelocity(Vector3Add(bodyB->AngularVelocity(), bodyB->ApplyInvInertia(Vector3CrossProduct(rbList[i], impulse))));
+    }
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+#include "WorldBatch.h"
+#include <chrono>
+
+uint64_t WorldBatch::WorldSeed(uint64_t baseSeed, int index)
+{
+    uint64_t z = baseSeed + 0x9E3779B97F4A7C15ull * (uint64_t)(index + 1);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+bool WorldBatch::Create(int count, uint64_t baseSeed, const SceneBuilder& build, ThreadPool& pool, const char** error)
+{
+    *error = "";
+    this->worlds.clear();
+    this->stats = Stats();
+
+    if (count <= 0)
+    {
+        return true;
+    }
+
+    std::vector<std::unique_ptr<World>> created(count);
+    std::vector<const char*> errors(count, nullptr);
+
+    pool.ParallelFor(count, 1, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            created[i] = std::make_unique<World>();
+            const char* worldError = "";
+            if (!build(created[i].get(), WorldSeed(baseSeed, i), i, &worldError))
+            {
+                errors[i] = worldError;
+            }
+        }
+    });
+
+    for (int i = 0; i < count; i++)
+    {
+        if (errors[i] != nullptr)
+        {
+            *error = errors[i];
+            return false;
+        }
+    }
+
+    this->worlds = std::move(created);
+    return true;
+}
+
+void WorldBatch::Step(float time, int iterations, int steps, ThreadPool& pool)
+{
+    if (steps <= 0 || this->worlds.empty())
+    {
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    pool.ParallelFor((int)this->worlds.size(), 1, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            for (int s = 0; s < steps; s++)
+            {
+                this->worlds[i]->Step(time, iterations);
+            }
+        }
+    });
+
+    this->stats.Seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    this->stats.Steps += (long long)steps * (long long)this->worlds.size();
+    for (const std::unique_ptr<World>& world : this->worlds)
+    {
+        this->stats.BodySteps += (long long)steps * world->BodyCount();
+    }
+}
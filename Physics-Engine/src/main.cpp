@@ -1,10 +1,17 @@
 // External Includes
 #include <raylib.h>
 #include <raymath.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
 
 // Local Includes
 #include "World.h"
+#include "Benchmark.h"
+#include "Scene.h"
+#include "InstancedRenderer.h"
+#include <rlgl.h>
 #define RLIGHTS_IMPLEMENTATION
 #include "RLights.h"
 
@@ -14,8 +21,170 @@
 #define GLSL_VERSION            100
 #endif
 
-int main()
+// Loads the lighting shader and sets the locations and uniforms the demo uses
+static Shader LoadLightingShader()
 {
+    Shader shader = LoadShader(TextFormat("resources/shaders/glsl%i/lighting.vert", GLSL_VERSION),
+        TextFormat("resources/shaders/glsl%i/lighting.frag", GLSL_VERSION));
+    // Get some required shader locations
+    shader.locs[SHADER_LOC_VECTOR_VIEW] = GetShaderLocation(shader, "viewPos");
+    // NOTE: "matModel" location name is automatically assigned on shader loading, 
+    // no need to get the location again if using that uniform name
+    //shader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocation(shader, "matModel");
+
+    // Ambient light level (some basic lighting)
+    int ambientLoc = GetShaderLocation(shader, "ambient");
+    float ambient[4] = { 0.1f, 0.1f, 0.1f, 1.0f };
+    SetShaderValue(shader, ambientLoc, ambient, SHADER_UNIFORM_VEC4);
+    return shader;
+}
+
+// bodyCount - 1 random small spheres plus the big one the camera follows, in one AddBodies call
+static void CreateDemoBodies(World* world, int bodyCount)
+{
+    const char* error;
+    std::vector<BodyDesc> descs(bodyCount);
+
+    for (int i = 0; i < bodyCount - 1; i++)
+    {
+        BodyDesc& desc = descs[i];
+        desc.Radius = (float)GetRandomValue(1, 5);
+        desc.Position = { (float)GetRandomValue(-1000, 1000), (float)GetRandomValue(-1000, 1000), (float)GetRandomValue(-1000, 1000) };
+        desc.Density = 15.0f;
+        desc.color = { (unsigned char)GetRandomValue(0, 255), (unsigned char)GetRandomValue(0, 255), (unsigned char)GetRandomValue(0, 255), 255 };
+    }
+
+    // Big sphere followed by the camera
+    BodyDesc& planet = descs[bodyCount - 1];
+    planet.Position = { 0, -102, 0 };
+    planet.Radius = 150.0f;
+    planet.Density = 1e10f;
+    planet.color = GREEN;
+
+    if (!world->AddBodies(descs.data(), bodyCount, &error))
+        TraceLog(LOG_ERROR, error);
+}
+
+// Renders one frame of bodyCount bodies into an offscreen target and saves it as an image.
+// Runs with a hidden window, so it also works on a software GL context (e.g. Mesa llvmpipe under xvfb).
+static int RenderTest(const char* path, int bodyCount)
+{
+    const int width = 800;
+    const int height = 600;
+    SetConfigFlags(FLAG_WINDOW_HIDDEN);
+    InitWindow(width, height, "Physics Engine render test");
+
+    Camera camera = { 0 };
+    camera.position = { 0.0f, 600.0f, -2400.0f };
+    camera.target = { 0.0f, 0.0f, 0.0f };
+    camera.up = { 0.0f, 1.0f, 0.0f };
+    camera.fovy = 60.0f;
+    camera.projection = CAMERA_PERSPECTIVE;
+
+    Shader shader = LoadLightingShader();
+    Light light = CreateLight(LIGHT_POINT, { 0, 1500, -1500 }, Vector3Zero(), WHITE, shader);
+    float cameraPos[3] = { camera.position.x, camera.position.y, camera.position.z };
+    SetShaderValue(shader, shader.locs[SHADER_LOC_VECTOR_VIEW], cameraPos, SHADER_UNIFORM_VEC3);
+
+    World world;
+    CreateDemoBodies(&world, bodyCount);
+    world.UpdateTransforms();
+
+    InstancedRenderer renderer;
+    renderer.Load(shader);
+    RenderTexture2D target = LoadRenderTexture(width, height);
+
+    double start = GetTime();
+    renderer.Build(*world.BodyList());
+    BeginTextureMode(target);
+    ClearBackground(BLACK);
+    BeginMode3D(camera);
+    renderer.Draw();
+    EndMode3D();
+    EndTextureMode();
+    double elapsed = GetTime() - start;
+
+    Image image = LoadImageFromTexture(target.texture);
+    ImageFlipVertical(&image);
+    bool saved = ExportImage(image, path);
+
+    printf("Rendered %d spheres and %d boxes in %d draw calls, %.2f ms, %s %s\n",
+        renderer.InstanceCount(Sphere), renderer.InstanceCount(Box), renderer.DrawCallCount(), elapsed * 1000.0,
+        saved ? "saved" : "could not save", path);
+
+    UnloadImage(image);
+    UnloadRenderTexture(target);
+    renderer.Unload();
+    UnloadModel(light.model);
+    UnloadShader(shader);
+    CloseWindow();
+    return saved ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    // Headless runs: --bench-gravity [bodies] [samples]
+    if (argc > 1 && strcmp(argv[1], "--bench-gravity") == 0)
+    {
+        int bodies = argc > 2 ? atoi(argv[2]) : 100000;
+        int samples = argc > 3 ? atoi(argv[3]) : 1000;
+        Benchmark::GravityAccuracy(bodies, samples);
+        return 0;
+    }
+
+    // --bench-queries [bodies] [queries]
+    if (argc > 1 && strcmp(argv[1], "--bench-queries") == 0)
+    {
+        int bodies = argc > 2 ? atoi(argv[2]) : 100000;
+        int queries = argc > 3 ? atoi(argv[3]) : 10000;
+        Benchmark::SpatialQueries(bodies, queries);
+        return 0;
+    }
+
+    // --bench-batch [worlds] [bodies] [steps]
+    if (argc > 1 && strcmp(argv[1], "--bench-batch") == 0)
+    {
+        int worlds = argc > 2 ? atoi(argv[2]) : 256;
+        int bodies = argc > 3 ? atoi(argv[3]) : 200;
+        int steps = argc > 4 ? atoi(argv[4]) : 120;
+        Benchmark::WorldBatchThroughput(worlds, bodies, steps);
+        return 0;
+    }
+
+    // --bench-particles [particles] [steps]
+    if (argc > 1 && strcmp(argv[1], "--bench-particles") == 0)
+    {
+        int particles = argc > 2 ? atoi(argv[2]) : 100000;
+        int steps = argc > 3 ? atoi(argv[3]) : 120;
+        Benchmark::Particles(particles, steps);
+        return 0;
+    }
+
+    // --bench-stacking [side] [layers] [steps]
+    if (argc > 1 && strcmp(argv[1], "--bench-stacking") == 0)
+    {
+        int side = argc > 2 ? atoi(argv[2]) : 8;
+        int layers = argc > 3 ? atoi(argv[3]) : 6;
+        int steps = argc > 4 ? atoi(argv[4]) : 600;
+        Benchmark::Stacking(side, layers, steps);
+        return 0;
+    }
+
+    // --bench-fields [bodies] [steps]
+    if (argc > 1 && strcmp(argv[1], "--bench-fields") == 0)
+    {
+        int bodies = argc > 2 ? atoi(argv[2]) : 100000;
+        int steps = argc > 3 ? atoi(argv[3]) : 120;
+        Benchmark::ForceFields(bodies, steps);
+        return 0;
+    }
+
+    // Offscreen frame: --render-test <image> [bodies]
+    if (argc > 2 && strcmp(argv[1], "--render-test") == 0)
+    {
+        return RenderTest(argv[2], argc > 3 ? atoi(argv[3]) : 10000);
+    }
+
     const int screenWidth = 800;
     const int screenHeight = 600;
     SetConfigFlags(FLAG_MSAA_4X_HINT);  // Enable Multi Sampling Anti Aliasing 4x (if available)
@@ -30,18 +199,7 @@ int main()
     camera.projection = CAMERA_PERSPECTIVE;
 
     // Load basic lighting shader
-    Shader shader = LoadShader(TextFormat("resources/shaders/glsl%i/lighting.vert", GLSL_VERSION),
-        TextFormat("resources/shaders/glsl%i/lighting.frag", GLSL_VERSION));
-    // Get some required shader locations
-    shader.locs[SHADER_LOC_VECTOR_VIEW] = GetShaderLocation(shader, "viewPos");
-    // NOTE: "matModel" location name is automatically assigned on shader loading, 
-    // no need to get the location again if using that uniform name
-    //shader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocation(shader, "matModel");
-
-    // Ambient light level (some basic lighting)
-    int ambientLoc = GetShaderLocation(shader, "ambient");
-    float ambient[4] = { 0.1f, 0.1f, 0.1f, 1.0f };
-    SetShaderValue(shader, ambientLoc, ambient, SHADER_UNIFORM_VEC4);
+    Shader shader = LoadLightingShader();
 
     // Create lights
     Light lights[MAX_LIGHTS] = { 0 };
@@ -53,33 +211,25 @@ int main()
     const int bodyCount = 1000;
 
     World world;
-    Body body;
     const char* error;
-    Vector3 pos;
-    float rad;
-    unsigned char R, G, B;
 
-    for (int i = 0; i < bodyCount - 1; i++)
+    // Shared meshes and instanced draws for the bodies that do not own a mesh
+    InstancedRenderer renderer;
+    renderer.Load(shader);
+
+    if (argc > 2 && strcmp(argv[1], "--scene") == 0)
     {
-        //Body body;
-        rad = (float)GetRandomValue(1, 5);
-        pos = { (float)GetRandomValue(-1000, 1000), (float)GetRandomValue(-1000, 1000), (float)GetRandomValue(-1000, 1000) };
-        R = GetRandomValue(0, 255);
-        G = GetRandomValue(0, 255);
-        B = GetRandomValue(0, 255);
-        if (!Body::CreateSphereBody(pos, rad, 15.0f, false, 0.5f, { R, G, B, 255 }, &body, &error))
+        if (!Scene::Load(&world, argv[2], &error))
             TraceLog(LOG_ERROR, error);
-
-        body.Mesh.materials[0].shader = shader;
-        world.AddBody(body);
+    }
+    else
+    {
+        CreateDemoBodies(&world, bodyCount);
     }
 
-    //Body body;
-    if (!Body::CreateSphereBody({ 0, -102, 0 }, 150.0f, 1e10f, false, 0.5f, GREEN, &body, &error))
-        TraceLog(LOG_ERROR, error);
-
-    body.Mesh.materials[0].shader = shader;
-    world.AddBody(body);
+    // Bodies farther than this from the camera are removed from the world
+    const float maxDistance = 5000.0f;
+    std::vector<int> visible;
 
     bool showCursor = false;
     DisableCursor();
@@ -106,7 +256,6 @@ int main()
         // Update camera
         camera.target = world.GetBody(world.BodyCount() - 1)->Position();
         UpdateCamera(&camera, CAMERA_THIRD_PERSON);
-        Vector3 dir = Vector3Normalize(Vector3Subtract(camera.position, camera.target));
 
         // Update the shader with the camera view vector (points towards { 0.0f, 0.0f, 0.0f })
         float cameraPos[3] = { camera.position.x, camera.position.y, camera.position.z };
@@ -121,46 +270,63 @@ int main()
         // Update light values (actually, only enable/disable them)
         for (int i = 0; i < MAX_LIGHTS; i++) UpdateLightValues(shader, lights[i]);
 
+        // Backwards, since RemoveBody shifts the bodies that follow
+        for (int i = world.BodyCount() - 1; i >= 0; i--)
+            if (Vector3Distance(camera.position, world.GetBody(i)->Position()) > maxDistance)
+                world.RemoveBody(i);
+
         world.Step(GetFrameTime(), 2);
 
-        for (int i = 0; i < world.BodyCount(); i++)
-            if (Vector3Distance(camera.position, world.GetBody(i)->Position()) > 5000)
-            world.RemoveBody(i);
+        // Visible bodies, from the same frustum BeginMode3D uses
+        Frustum frustum = Frustum::FromCamera(camera, (float)GetScreenWidth() / (float)GetScreenHeight(),
+            RL_CULL_DISTANCE_NEAR, RL_CULL_DISTANCE_FAR);
+        if ((int)visible.size() < world.BodyCount()) visible.resize(world.BodyCount());
+        int visibleCount = world.CullBodies(frustum, camera.position, maxDistance, visible.data(), (int)visible.size());
 
         // Draw everything
         BeginDrawing();
         ClearBackground(BLACK);
         BeginMode3D(camera);
-        for (int i = 0; i < world.BodyCount(); i++)
+
+        renderer.Build(*world.BodyList(), visible.data(), visibleCount, camera.position);
+        renderer.Draw();
+
+        // Bodies created with their own mesh (CreateSphereBody / CreateBoxBody) are drawn one by one
+        for (int i = 0; i < visibleCount; i++)
         {
-            Body *body = world.GetBody(i);
-            if (body == nullptr) continue;
+            Body *body = world.GetBody(visible[i]);
+            if (body == nullptr || !body->DrawMesh || body->Mesh.meshCount == 0) continue;
+
+            float scale = 1.0f;
 
             if (body->shapeType == Sphere)
-            {
-                if (Vector3DotProduct(dir, Vector3Normalize(Vector3Subtract(camera.position, body->Position()))) < -0.2) continue;
-                DrawModel(body->Mesh, body->Position(), body->Radius, body->color);
-            }
+                scale = body->Radius;
             else if (body->shapeType == Box)
-                DrawModel(body->Mesh, body->Position(), Vector3Length(body->Size), body->color);
+                scale = Vector3Length(body->Size);
 
-            // Draw spheres to show where the lights are
-            for (int i = 0; i < MAX_LIGHTS; i++)
-            {
-                if (Vector3DotProduct(dir, Vector3Normalize(Vector3Subtract(camera.position, lights[i].position))) < -0.2) continue;
-                if (lights[i].enabled) DrawModel(lights[i].model, lights[i].position, 1, lights[i].color);
-                else DrawModelWires(lights[i].model, lights[i].position, 1, lights[i].color);
-            }
+            // Reuse the transform cached by the physics step instead of rebuilding it from the position
+            body->Mesh.transform = MatrixMultiply(MatrixScale(scale, scale, scale), body->GetWorldTransform());
+            DrawModel(body->Mesh, Vector3Zero(), 1.0f, body->color);
+        }
+
+        // Draw spheres to show where the lights are
+        for (int i = 0; i < MAX_LIGHTS; i++)
+        {
+            if (!frustum.ContainsSphere(lights[i].position, 2.0f)) continue;
+            if (lights[i].enabled) DrawModel(lights[i].model, lights[i].position, 1, lights[i].color);
+            else DrawModelWires(lights[i].model, lights[i].position, 1, lights[i].color);
         }
         EndMode3D();
         DrawFPS(10, 10);
+        DrawText(TextFormat("%i / %i bodies in view", visibleCount, world.BodyCount()), 10, 35, 20, WHITE);
         EndDrawing();
     }
 
     // Close window and OpenGL context
+    while (world.BodyCount() > 0)
+        world.RemoveBody(world.BodyCount() - 1);
+    renderer.Unload();
     CloseWindow();
-    for (int i = 0; i < world.BodyCount(); i++)
-        world.RemoveBody(i);
 
     return 0;
 }